@@ -29,11 +29,19 @@ namespace mango
     // - the mac_length must be 4, 6, 8, 10, 12, 14, or 16
     // - output.size must be input.size + mac_length
     //
+    // gcm_encrypt() and gcm_decrypt():
+    // - the iv can be any length but 12 bytes (96 bits) is recommended
+    // - the tag is 16 bytes
+    // - gcm_decrypt() returns false and clears the output when the tag does not match
+    //
     // Hardware acceleration support:
     // ECB: Intel AES-NI
     // CBC: Intel AES-NI
-    // CTR: none
+    // CTR: Intel AES-NI, VAES (AVX2 and AVX-512 builds)
+    // GCM: Intel AES-NI, PCLMULQDQ
     // CCM: none
+    //
+    // The CTR buffers larger than 4 MB are processed in parallel using the ThreadPool.
 
     class AES
     {
@@ -64,6 +72,15 @@ namespace mango
     
         void ecb_encrypt(u8* output, const u8* input, size_t length);
         void ecb_decrypt(u8* output, const u8* input, size_t length);
+
+        // input can be any size and output is same size as input; the iv is
+        // a 128 bit big-endian counter which is incremented for each block
+        void ctr_encrypt(u8* output, const u8* input, size_t length, const u8* iv);
+        void ctr_decrypt(u8* output, const u8* input, size_t length, const u8* iv);
+
+        // authenticated encryption; input can be any size and output is same size as input
+        void gcm_encrypt(u8* output, u8* tag, const u8* input, size_t length, Memory associated, Memory iv);
+        bool gcm_decrypt(u8* output, const u8* input, size_t length, Memory associated, Memory iv, const u8* tag);
     };
 
 } // namespace mango
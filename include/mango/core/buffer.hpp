@@ -5,6 +5,8 @@
 #pragma once
 
 #include <cstddef>
+#include <vector>
+#include <memory>
 #include "configure.hpp"
 #include "memory.hpp"
 #include "stream.hpp"
@@ -64,6 +66,77 @@ namespace mango
         void seek(u64 distance, SeekMode mode);
         void read(void* dest, size_t bytes);
         void write(const void* source, size_t bytes);
+        Memory map(u64 offset, size_t size);
+    };
+
+    // ConstMemoryStream is a read-only stream interface to existing memory; the
+    // memory is not copied so it must remain valid while the stream is used.
+
+    class ConstMemoryStream : public Stream
+    {
+    private:
+        Memory m_memory;
+        size_t m_offset;
+
+    public:
+        ConstMemoryStream(Memory memory);
+        ~ConstMemoryStream();
+
+        u64 size() const;
+        u64 offset() const;
+        void seek(u64 distance, SeekMode mode);
+        void read(void* dest, size_t bytes);
+        void write(const void* source, size_t bytes);
+        Memory map(u64 offset, size_t size);
+    };
+
+    // StreamView maps a range of a stream into memory. The stream's backing store
+    // is accessed directly when possible; otherwise the range is read into a pooled buffer.
+
+    class StreamView : public NonCopyable
+    {
+    private:
+        Memory m_memory;
+        std::unique_ptr<VirtualMemory> m_mapping;
+        u8* m_buffer;
+        size_t m_capacity;
+
+    public:
+        StreamView(Stream& stream);
+        StreamView(Stream& stream, u64 offset, size_t size);
+        ~StreamView();
+
+        operator Memory () const;
+        bool isDirect() const;
+    };
+
+    // ChunkedMemoryStream stores the data in a list of fixed-size chunks so that
+    // growing the stream never copies previously written data. The chunks can be
+    // written out with a single gather write; example: file.writev(stream.chunks())
+
+    class ChunkedMemoryStream : public Stream
+    {
+    private:
+        std::vector<u8*> m_chunks;
+        size_t m_chunk_size;
+        size_t m_size;
+        size_t m_offset;
+
+    public:
+        ChunkedMemoryStream(size_t chunk_size = 64 * 1024);
+        ~ChunkedMemoryStream();
+
+        // iovec-style list of the stored data; the last chunk is trimmed to size
+        std::vector<Memory> chunks() const;
+        size_t chunkSize() const;
+        void reset();
+
+        u64 size() const;
+        u64 offset() const;
+        void seek(u64 distance, SeekMode mode);
+        void read(void* dest, size_t bytes);
+        void write(const void* source, size_t bytes);
+        Memory map(u64 offset, size_t size);
     };
 
 } // namespace mango
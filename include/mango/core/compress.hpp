@@ -12,6 +12,9 @@
 namespace mango
 {
 
+    class Stream;
+    class Histogram;
+
     // -----------------------------------------------------------------------
     // stream compression
     // -----------------------------------------------------------------------
@@ -185,10 +188,19 @@ namespace mango
         size_t (*bound)(size_t size);
         size_t (*compress)(Memory dest, Memory source, int level);
         void (*decompress)(Memory dest, Memory source);
+
+        // optional; the Stream variants record their time (ns) into the histogram
+        Histogram* histogram = nullptr;
     };
 
     std::vector<Compressor> getCompressors();
     Compressor getCompressor(Compressor::Method method);
     Compressor getCompressor(const std::string& name);
 
+    // Stream source variants; the source is mapped directly when the stream
+    // supports it and read into a temporary buffer otherwise.
+
+    size_t compress(const Compressor& compressor, Memory dest, Stream& source, int level = 6);
+    void decompress(const Compressor& compressor, Memory dest, Stream& source);
+
 } // namespace mango
@@ -481,6 +481,16 @@
         #include <wmmintrin.h>
     #endif
 
+    #ifdef __PCLMUL__
+        #define MANGO_ENABLE_PCLMUL
+        #include <wmmintrin.h>
+    #endif
+
+    #ifdef __VAES__
+        #define MANGO_ENABLE_VAES
+        #include <immintrin.h>
+    #endif
+
     #ifdef __SHA__
         #define MANGO_ENABLE_SHA
         #include <immintrin.h>
@@ -653,6 +663,14 @@
     #define MANGO_ENABLE_ARCHIVE_MGX
 #endif
 
+#ifndef MANGO_DISABLE_ARCHIVE_7Z
+    #define MANGO_ENABLE_ARCHIVE_7Z
+#endif
+
+#ifndef MANGO_DISABLE_ARCHIVE_TAR
+    #define MANGO_ENABLE_ARCHIVE_TAR
+#endif
+
 // -----------------------------------------------------------------------
 // image codecs
 // -----------------------------------------------------------------------
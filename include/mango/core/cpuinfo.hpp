@@ -52,6 +52,8 @@ namespace mango
         CPU_AVX512DQ   = 0x0000000200000000,
         CPU_AVX512IFMA = 0x0000000400000000,
         CPU_AVX512VBMI = 0x0000000800000000,
+        CPU_VAES       = 0x0000001000000000,
+        CPU_VPCLMULQDQ = 0x0000002000000000,
         // ARM
         CPU_NEON       = 0x0001000000000000,
         CPU_ARM_AES    = 0x0002000000000000,
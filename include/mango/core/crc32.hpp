@@ -13,4 +13,9 @@ namespace mango
     u32 crc32(u32 crc, Memory memory);
     u32 crc32c(u32 crc, Memory memory);
 
+    // combine checksums of two consecutive buffers; length1 is the size of the
+    // second buffer. This allows to compute the checksum in parallel.
+    u32 crc32_combine(u32 crc0, u32 crc1, u64 length1);
+    u32 crc32c_combine(u32 crc0, u32 crc1, u64 length1);
+
 } // namespace mango
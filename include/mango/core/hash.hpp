@@ -65,6 +65,10 @@ namespace mango
     SHA1 sha1(Memory memory);
     SHA2 sha2(Memory memory);
 
+    // keyed hashing (RFC 2104) and password based key derivation (RFC 8018)
+    SHA1 hmac_sha1(Memory key, Memory message);
+    void pbkdf2_sha1(Memory output, Memory password, Memory salt, int iterations);
+
     u32 xxhash32(u32 seed, Memory memory);
     u64 xxhash64(u64 seed, Memory memory);
 
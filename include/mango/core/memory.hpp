@@ -77,6 +77,20 @@ namespace mango {
         }
     };
 
+    // Access pattern hints for the memory mapped files. The hints are advisory;
+    // memory which is not backed by a file mapping ignores them.
+
+    enum class MemoryAccess
+    {
+        NORMAL,     // default read-ahead
+        SEQUENTIAL, // aggressive read-ahead, pages can be freed soon after access
+        RANDOM,     // no read-ahead
+        WILLNEED,   // start reading the range in the background
+        DONTNEED,   // the range will not be accessed in the near future
+        HUGEPAGE,   // back the range with huge pages when possible
+        POPULATE,   // read the range and map the pages before returning
+    };
+
     class VirtualMemory : private NonCopyable
     {
     protected:
@@ -86,6 +100,14 @@ namespace mango {
         VirtualMemory() = default;
         virtual ~VirtualMemory() {}
 
+        // range is relative to the memory; size of zero means the rest of the memory
+        virtual void advise(MemoryAccess access, size_t offset = 0, size_t size = 0)
+        {
+            MANGO_UNREFERENCED(access);
+            MANGO_UNREFERENCED(offset);
+            MANGO_UNREFERENCED(size);
+        }
+
         const Memory* operator -> () const
         {
             return &m_memory;
@@ -4,6 +4,7 @@
 */
 #pragma once
 
+#include <vector>
 #include "configure.hpp"
 #include "endian.hpp"
 #include "memory.hpp"
@@ -42,6 +43,37 @@ namespace mango
         {
             write(memory.address, memory.size);
         }
+
+        // gather write; the default implementation writes the buffers one at a time
+        // but streams with scatter-gather capable backing store can override it.
+        virtual void writev(const Memory* buffers, size_t count)
+        {
+            for (size_t i = 0; i < count; ++i)
+            {
+                write(buffers[i].address, buffers[i].size);
+            }
+        }
+
+        void writev(const std::vector<Memory>& buffers)
+        {
+            writev(buffers.data(), buffers.size());
+        }
+
+        // direct access to the backing store; returns empty Memory when the stream
+        // cannot be mapped. The mapping is valid until the stream is modified or destroyed;
+        // streams which create the mapping on demand keep only the latest one.
+        // Use StreamView (buffer.hpp) for mapping with automatic read fallback.
+        virtual Memory map(u64 offset, size_t size)
+        {
+            MANGO_UNREFERENCED(offset);
+            MANGO_UNREFERENCED(size);
+            return Memory();
+        }
+
+        // direct access to the backing store with ownership; the mapping is released when
+        // the returned object is deleted. Returns nullptr when the stream cannot be mapped.
+        // The default implementation wraps map().
+        virtual VirtualMemory* mmap(u64 offset, size_t size);
     };
 
     // --------------------------------------------------------------
@@ -142,6 +174,11 @@ namespace mango
             s.write(memory);
         }
 
+        void writev(const std::vector<Memory>& buffers)
+        {
+            s.writev(buffers);
+        }
+
         void write8(u8 value)
         {
             s.write(&value, sizeof(u8));
@@ -280,6 +317,11 @@ namespace mango
             s.write(memory);
         }
 
+        void writev(const std::vector<Memory>& buffers)
+        {
+            s.writev(buffers);
+        }
+
         void write8(u8 value)
         {
             s.write(&value, 1);
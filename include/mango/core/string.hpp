@@ -19,6 +19,15 @@ namespace mango
     std::string utf8_from_utf16(const std::u16string& str);
     std::string utf8_from_utf32(const std::u32string& str);
 
+    // non-allocating unicode conversions; the functions return number of characters
+    // written into dest, which must have capacity for the worst case:
+    // utf32_from_utf8(), utf16_from_utf8(): length characters
+    // utf8_from_utf16(): 3 * length characters
+    bool is_utf8(const char* source, size_t length);
+    size_t utf32_from_utf8(char32_t* dest, const char* source, size_t length);
+    size_t utf16_from_utf8(char16_t* dest, const char* source, size_t length);
+    size_t utf8_from_utf16(char* dest, const char16_t* source, size_t length);
+
     // microsoft specific unicode conversions
     std::string u16_toBytes(const std::wstring& source);
     std::wstring u16_fromBytes(const std::string& source);
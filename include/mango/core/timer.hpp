@@ -5,7 +5,21 @@
 #pragma once
 
 #include <chrono>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <vector>
 #include "configure.hpp"
+#include "object.hpp"
+
+#if defined(MANGO_CPU_INTEL) && !defined(__ia64__) && !defined(_M_IA64)
+    #if defined(MANGO_COMPILER_MICROSOFT)
+        #include <intrin.h>
+    #else
+        #include <x86intrin.h>
+    #endif
+    #define MANGO_ENABLE_TSC
+#endif
 
 namespace mango
 {
@@ -76,4 +90,98 @@ namespace mango
 
     LocalTime getLocalTime();
 
+    // -----------------------------------------------------------------------
+    // Cycles
+    // -----------------------------------------------------------------------
+
+    // Low overhead timestamp source. Reads the time stamp counter when it is
+    // available and falls back to steady_clock nanoseconds. The counter
+    // frequency is calibrated against steady_clock on first use.
+
+    struct Cycles
+    {
+        static inline u64 now()
+        {
+#if defined(MANGO_ENABLE_TSC)
+            return __rdtsc();
+#else
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+        }
+
+        static double frequency(); // ticks per second
+        static u64 ns(u64 cycles); // convert ticks to nanoseconds
+    };
+
+    // -----------------------------------------------------------------------
+    // Histogram
+    // -----------------------------------------------------------------------
+
+    // Fixed memory HDR-style histogram with 32 linear sub-buckets in each power
+    // of two range; recorded values are accurate to ~3% over the full 64 bit range.
+    // Each recording thread gets it's own set of buckets which only that thread
+    // writes, so record() is a few plain loads and stores without atomic
+    // read-modify-write operations. The queries merge the per-thread buckets.
+    // reset() must not be called while other threads are recording.
+
+    class Histogram : protected NonCopyable
+    {
+    protected:
+        struct Shard;
+
+        u64 m_id;
+        mutable std::mutex m_mutex;
+        std::vector<std::unique_ptr<Shard>> m_shards;
+
+        Shard* getShard();
+        void snapshot(u64* counts, u64& total, u64& sum, u64& min, u64& max) const;
+
+        static int getIndex(u64 value);
+        static u64 getValue(int index);
+
+    public:
+        Histogram();
+        ~Histogram();
+
+        void record(u64 value, u64 count = 1);
+        void merge(const Histogram& histogram);
+        void reset();
+
+        u64 count() const;
+        u64 min() const;
+        u64 max() const;
+        double mean() const;
+        u64 percentile(double percent) const; // percent in range [0, 100]
+    };
+
+    // -----------------------------------------------------------------------
+    // ScopedTimer
+    // -----------------------------------------------------------------------
+
+    // Records the lifetime of the scope in nanoseconds; nothing is recorded
+    // when the histogram is nullptr.
+
+    class ScopedTimer : protected NonCopyable
+    {
+    protected:
+        Histogram* m_histogram;
+        u64 m_start;
+
+    public:
+        ScopedTimer(Histogram* histogram)
+            : m_histogram(histogram)
+            , m_start(histogram ? Cycles::now() : 0)
+        {
+        }
+
+        ~ScopedTimer()
+        {
+            if (m_histogram)
+            {
+                m_histogram->record(Cycles::ns(Cycles::now() - m_start));
+            }
+        }
+    };
+
 } // namespace mango
@@ -7,8 +7,11 @@
 #include <cstdio>
 #include <string>
 #include <vector>
+#include <functional>
+#include <future>
 #include "../core/configure.hpp"
 #include "../core/stream.hpp"
+#include "../core/thread.hpp"
 #include "mapper.hpp"
 #include "path.hpp"
 
@@ -21,12 +24,21 @@ namespace filesystem {
         std::string m_filename;
         std::unique_ptr<Path> m_path;
         std::unique_ptr<VirtualMemory> m_memory;
+        std::unique_ptr<ConcurrentQueue> m_prefetch;
 
         Memory getMemory() const;
+        void configure(u32 flags);
 
     public:
-        File(const std::string& filename);
-        File(const Path& path, const std::string& filename);
+        enum Flags : u32
+        {
+            SEQUENTIAL = 0x01, // the file is read from start to end
+            RANDOM     = 0x02, // the file is accessed in random order
+            POPULATE   = 0x04, // read the file and map the pages when the file is opened
+        };
+
+        File(const std::string& filename, u32 flags = 0);
+        File(const Path& path, const std::string& filename, u32 flags = 0);
         File(const Memory& memory, const std::string& extension, const std::string& filename);
         ~File();
 
@@ -38,6 +50,20 @@ namespace filesystem {
         operator const u8* () const;
         const u8* data() const;
         size_t size() const;
+
+        // access pattern hint for a range of the file; size of zero means the rest of the file
+        void advise(MemoryAccess access, size_t offset = 0, size_t size = 0) const;
+
+        // read the range in the background; returns immediately
+        void prefetch(size_t offset = 0, size_t size = 0);
+
+        // Open the file in the ThreadPool. The file is mapped, the compressed container
+        // entries are decompressed and the pages are populated in the background; errors
+        // are delivered through the future. The future is deferred: get() and wait() run
+        // the ThreadPool tasks until the file is opened so they can be called from a
+        // ThreadPool task, and wait_for() reports std::future_status::deferred.
+        static std::future<std::unique_ptr<File>> openAsync(const std::string& filename, u32 flags = 0);
+        static std::future<std::unique_ptr<File>> openAsync(const Path& path, const std::string& filename, u32 flags = 0);
     };
 
     class FileStream : public Stream
@@ -56,6 +82,139 @@ namespace filesystem {
         void seek(u64 distance, SeekMode mode);
         void read(void* dest, size_t size);
         void write(const void* data, size_t size);
+
+        using Stream::writev;
+        void writev(const Memory* buffers, size_t count);
+
+        // map() keeps only the latest mapping; mmap() returns an owned mapping
+        Memory map(u64 offset, size_t size);
+        VirtualMemory* mmap(u64 offset, size_t size);
+    };
+
+    // MappedFileStream writes into a shared writable mapping of the file; the writes are
+    // copied directly into the page cache without stdio buffering. The mapping grows
+    // geometrically when written past the end. memory() gives the current contents for
+    // producing the output in-place; it is invalidated by anything that grows the file.
+    // finish() truncates the file to size() and closes it; it is called on destruction.
+    // The file must be a regular file which can be memory mapped; pipes and devices are
+    // written with FileStream. The capacity is allocated from the file system when the
+    // mapping grows so that running out of space throws instead of faulting.
+
+    class MappedFileStream : public Stream
+    {
+    protected:
+        struct MappedFileHandle* m_handle;
+
+    public:
+        MappedFileStream(const std::string& filename, u64 size = 0);
+        ~MappedFileStream();
+
+        const std::string& filename() const;
+
+        // writable view to the first size() bytes
+        Memory memory() const;
+
+        // capacity of the mapping; does not change size()
+        void reserve(u64 capacity);
+
+        // set size() and grow the mapping when required
+        void resize(u64 size);
+
+        // write the modified pages to the file
+        void flush();
+
+        void finish();
+
+        u64 size() const;
+        u64 offset() const;
+        void seek(u64 distance, SeekMode mode);
+        void read(void* dest, size_t size);
+        void write(const void* data, size_t size);
+    };
+
+    // InputFileStream reads a file through the container mappers like File but does not
+    // map the whole file on open; large compressed container entries are decompressed
+    // on demand. The mapping returned by map() is valid until the next read() or map().
+
+    class InputFileStream : public Stream
+    {
+    protected:
+        std::string m_filename;
+        std::unique_ptr<Path> m_path;
+        std::unique_ptr<Stream> m_stream;
+
+        InputFileStream(std::shared_ptr<Mapper> mapper, const std::string& filename);
+
+    public:
+        InputFileStream(const std::string& filename);
+        InputFileStream(const Path& path, const std::string& filename);
+        ~InputFileStream();
+
+        const std::string& filename() const;
+        const std::string& pathname() const;
+
+        u64 size() const;
+        u64 offset() const;
+        void seek(u64 distance, SeekMode mode);
+        void read(void* dest, size_t size);
+        void write(const void* data, size_t size);
+        Memory map(u64 offset, size_t size);
+        VirtualMemory* mmap(u64 offset, size_t size);
+    };
+
+    // AsyncFile is positional, thread-safe file I/O with asynchronous requests. On Linux
+    // the requests are submitted with io_uring when the kernel supports it and otherwise
+    // executed with pread() / pwrite() in the ThreadPool. The asynchronous requests are
+    // batched until submit() so that many reads cost one system call. When a request
+    // completes its callback is enqueued into the ConcurrentQueue given with the request;
+    // the memory passed to the callback is the request memory truncated to the number
+    // of bytes transferred and the status is false if the request failed.
+    //
+    // DIRECT mode bypasses the page cache (O_DIRECT); the offsets, sizes and memory
+    // addresses must be aligned to getDirectAlignment().
+
+    class AsyncFile : protected NonCopyable
+    {
+    protected:
+        struct AsyncFileHandle* m_handle;
+
+    public:
+        enum Flags : u32
+        {
+            READ   = 0x01,
+            WRITE  = 0x02,
+            DIRECT = 0x04,
+        };
+
+        using Callback = std::function<void(Memory memory, bool status)>;
+
+        AsyncFile(const std::string& filename, u32 flags = READ);
+        ~AsyncFile(); // waits for the pending requests
+
+        const std::string& filename() const;
+        u64 size() const;
+        void resize(u64 size);
+
+        // kernel read-ahead window for the synchronous reads; 0 disables the read-ahead
+        void setReadAhead(size_t bytes);
+
+        // synchronous I/O; returns the number of bytes transferred
+        size_t read(u64 offset, void* dest, size_t size);
+        size_t write(u64 offset, const void* data, size_t size);
+
+        // asynchronous I/O; the memory must remain valid until the callback is called
+        void read(u64 offset, Memory dest, ConcurrentQueue& queue, Callback callback);
+        void write(u64 offset, Memory source, ConcurrentQueue& queue, Callback callback);
+
+        // submit the batched requests
+        void submit();
+
+        // submit and wait until all requests of this file are completed; the callbacks
+        // have been enqueued but might not have been executed
+        void wait();
+
+        static bool isAsyncSupported(); // io_uring is available
+        static size_t getDirectAlignment();
     };
 
 } // namespace filesystem
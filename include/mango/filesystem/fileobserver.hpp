@@ -5,16 +5,27 @@
 #pragma once
 
 #include <string>
+#include <vector>
+#include <functional>
 #include "../core/configure.hpp"
 #include "../core/object.hpp"
+#include "../core/thread.hpp"
 
 namespace mango {
 namespace filesystem {
 
+    struct FileEvent
+    {
+        u32 flags;
+        std::string filename; // relative to the observed path
+    };
+
     class FileObserver : protected NonCopyable
     {
     protected:
         struct FileObserverState* m_state;
+        u32 m_debounce;
+        std::function<void(std::function<void()>&&)> m_dispatch;
 
     public:
         enum Flags
@@ -26,22 +37,46 @@ namespace filesystem {
             DIRECTORY   = 0x0200
         };
 
+        enum Options
+        {
+            RECURSIVE   = 0x0001  // observe the subdirectories, including the ones created later
+        };
+
         FileObserver();
         virtual ~FileObserver();
 
-        void start(const std::string& pathname);
+        // The configuration is applied on the next start().
+        //
+        // Events are coalesced until no new events have arrived for the debounce period;
+        // a burst of writes to a file becomes a single MODIFIED event, a file which is created
+        // and deleted within the period is not reported at all.
+        //
+        // The batches are delivered from the observer thread unless a queue is given.
+        // The queue must outlive the observer.
+        void setDebounce(u32 milliseconds);
+        void setQueue(ConcurrentQueue& queue);
+        void setQueue(SerialQueue& queue);
+
+        void start(const std::string& pathname, u32 options = 0);
+
+        // stop() waits for the batches which are already in the queue; it must not
+        // be called from inside onEvents().
         void stop();
 
         // Two kinds of events will be generated:
         //
         // 1: Change Notifications:
         //    Flags will be 0 and the filename empty; these are generated by systems
-        //    which are unable to reliably track filesystem changes.
+        //    which are unable to reliably track filesystem changes, or when the
+        //    events overflowed and the changes must be rescanned.
         //
         // 2: Extended Notifications:
         //    Flags will indicate what happened and the filename will indicate the affected file.
         //    Currently only Linux and Windows platforms are able to generate extended notifications.
-        virtual void onEvent(u32 flags, const std::string& filename) = 0;
+        virtual void onEvent(u32 flags, const std::string& filename);
+
+        // Receives the coalesced events; the default implementation calls onEvent() for each.
+        virtual void onEvents(const std::vector<FileEvent>& events);
     };
 
 } // namespace filesystem
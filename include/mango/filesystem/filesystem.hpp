@@ -7,4 +7,6 @@
 #include "mapper.hpp"
 #include "path.hpp"
 #include "file.hpp"
+#include "overlay.hpp"
 #include "fileobserver.hpp"
+#include "writer.hpp"
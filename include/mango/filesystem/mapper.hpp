@@ -8,6 +8,7 @@
 #include <vector>
 #include "../core/configure.hpp"
 #include "../core/memory.hpp"
+#include "../core/stream.hpp"
 
 namespace mango {
 namespace filesystem {
@@ -97,6 +98,10 @@ namespace filesystem {
         virtual bool isFile(const std::string& filename) const = 0;
         virtual void getIndex(FileIndex& index, const std::string& pathname) = 0;
         virtual VirtualMemory* mmap(const std::string& filename) = 0;
+
+        // read-only stream to a file; the default implementation streams from mmap()
+        // but mappers can override it to decompress large files on demand.
+        virtual Stream* open(const std::string& filename);
     };
 
     class Mapper : protected NonCopyable
@@ -105,9 +110,12 @@ namespace filesystem {
         friend class File;
 
         AbstractMapper* m_mapper { nullptr };
+        std::shared_ptr<AbstractMapper> m_shared_mapper;
         std::shared_ptr<Mapper> m_parent_mapper;
-        VirtualMemory* m_parent_memory { nullptr };
+        std::shared_ptr<struct ContainerHandle> m_container;
         std::vector<std::unique_ptr<AbstractMapper>> m_mappers;
+        AbstractMapper* m_file_mapper { nullptr };
+        std::string m_file_basepath;
         std::string m_basepath;
         std::string m_pathname;
 
@@ -120,6 +128,7 @@ namespace filesystem {
         Mapper(const std::string& pathname, const std::string& password);
         Mapper(std::shared_ptr<Mapper> mapper, const std::string& filename, const std::string& password);
         Mapper(const Memory& memory, const std::string& extension, const std::string& password);
+        explicit Mapper(std::shared_ptr<AbstractMapper> mapper);
         ~Mapper();
 
         const std::string& basepath() const;
@@ -129,5 +138,24 @@ namespace filesystem {
         static bool isCustomMapper(const std::string& filename);
     };
 
+    // The decompressed container entries are cached and shared by all mappers;
+    // budget is the upper limit of cached memory in bytes (0 disables caching).
+    void setMemoryCacheBudget(size_t bytes);
+    void clearMemoryCache();
+
+    // The opened containers are cached and shared by all mappers so that opening
+    // files from the same container does not parse it again. The cache is validated
+    // with the modification time and size of the container file. Closing removes
+    // the container and the containers nested in it from the cache; the mappers
+    // which are using them are not affected.
+    void closeContainer(const std::string& filename);
+    void closeContainers();
+
+    // Compressed containers which need decoding to build their index (tar.gz, tar.zst)
+    // store the index next to the container file as "<container>.idx" when enabled.
+    // A stored index is used when it records the current modification time and size
+    // of the container and its checksum matches.
+    void setPersistentIndex(bool enable);
+
 } // namespace filesystem
 } // namespace mango
@@ -0,0 +1,105 @@
+/*
+    MANGO Multimedia Development Platform
+    Copyright (C) 2012-2019 Twilight Finland 3D Oy Ltd. All rights reserved.
+*/
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <set>
+#include "../core/configure.hpp"
+#include "mapper.hpp"
+
+namespace mango {
+namespace filesystem {
+
+    /*
+        OverlayMapper merges directories and containers into one view. The layers
+        are indexed when they are mounted and the files are resolved from a single
+        hash table, so isFile() and mmap() cost one lookup regardless of the number
+        of layers. A file in a layer with higher priority shadows the same file in
+        the layers below; layers with equal priority are ordered by mount time and
+        the latest one wins. Folders are merged.
+
+        Mounting, unmounting and remounting only update the entries of that layer.
+        A remount indexes the layer again, for example after a mod folder has
+        changed or a patch container has been replaced.
+
+        The overlay is used through a Path:
+
+        auto overlay = std::make_shared<OverlayMapper>();
+        overlay->mount("data/base.mgx/", 0);
+        overlay->mount("data/patch1.zip/", 1);
+        overlay->mount("mods/", 2);
+
+        Path path(overlay);
+        File file(path, "textures/wall.png");
+    */
+
+    class OverlayMapper : public AbstractMapper
+    {
+    protected:
+        struct Layer;
+
+        struct Candidate
+        {
+            std::shared_ptr<Layer> layer;
+            u64 size;
+            u32 flags;
+        };
+
+        struct NameLess
+        {
+            bool operator () (const std::string* a, const std::string* b) const
+            {
+                return *a < *b;
+            }
+        };
+
+        // The names are stored once as the keys of m_entries; the layers and the
+        // folders refer to the keys, which do not move when the table is rehashed.
+        using Names = std::set<const std::string*, NameLess>;
+
+        struct Entry
+        {
+            std::vector<Candidate> candidates; // sorted so that the visible one is first
+            Names children; // folders: the names in the folder
+        };
+
+        mutable std::mutex m_mutex;
+        std::vector<std::shared_ptr<Layer>> m_layers;
+        std::unordered_map<std::string, Entry> m_entries;
+        Names m_root;
+        u32 m_sequence { 0 };
+
+        Names* getChildren(const std::string& folder);
+        void insert(const std::shared_ptr<Layer>& layer);
+        void remove(const std::shared_ptr<Layer>& layer);
+        std::shared_ptr<Layer> resolve(const std::string& filename) const;
+
+    public:
+        OverlayMapper();
+        ~OverlayMapper();
+
+        // pathname is a directory or a container ("data/base.zip/"); mounting the same
+        // pathname again replaces the previous layer
+        void mount(const std::string& pathname, int priority = 0, const std::string& password = "");
+        void unmount(const std::string& pathname);
+        void remount(const std::string& pathname);
+
+        bool isMounted(const std::string& pathname) const;
+
+        // pathname of the layer which provides the file; empty if there is no such file
+        std::string getLayer(const std::string& filename) const;
+
+        bool isFile(const std::string& filename) const override;
+        void getIndex(FileIndex& index, const std::string& pathname) override;
+        VirtualMemory* mmap(const std::string& filename) override;
+        Stream* open(const std::string& filename) override;
+    };
+
+} // namespace filesystem
+} // namespace mango
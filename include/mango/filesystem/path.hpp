@@ -6,24 +6,35 @@
 
 #include <string>
 #include <vector>
+#include <functional>
+#include <future>
 #include "../core/configure.hpp"
+#include "../core/timer.hpp"
 #include "mapper.hpp"
 
 namespace mango {
 namespace filesystem {
 
+    class File;
+
     class Path : protected NonCopyable
     {
     protected:
         friend class File;
+        friend class InputFileStream;
 
         std::shared_ptr<Mapper> m_mapper;
         FileIndex m_files;
+        Histogram* m_histogram = nullptr;
+
+        // the files only need the mapper; the folder is not indexed
+        explicit Path(std::shared_ptr<Mapper> mapper);
 
     public:
         Path(const std::string& pathname, const std::string& password = "");
         Path(const Path& path, const std::string& filename, const std::string& password = "");
         Path(const Memory& memory, const std::string& extension, const std::string& password = "");
+        Path(std::shared_ptr<AbstractMapper> mapper, const std::string& pathname = "");
         ~Path();
 
         const std::string& pathname() const
@@ -55,8 +66,50 @@ namespace filesystem {
         {
             return m_files[index];
         }
+
+        // Record the time (ns) of mapping the files opened from this path; the
+        // histogram must outlive the path and the files which are being opened.
+        void setHistogram(Histogram* histogram)
+        {
+            m_histogram = histogram;
+        }
+
+        // Open the files in the ThreadPool with File::openAsync(); the futures are in
+        // the same order as the filenames. The path does not have to outlive the futures.
+        std::vector<std::future<std::unique_ptr<File>>> prefetch(const std::vector<std::string>& filenames, u32 flags = 0) const;
+    };
+
+    // -----------------------------------------------------------------
+    // walk
+    // -----------------------------------------------------------------
+
+    /*
+        Recursive walk of a native directory tree. The directories are scanned in
+        parallel in the ThreadPool and the contents of each directory are delivered
+        as a batch. The names are relative to the pathname and directories end with '/'.
+
+        The filter is a list of glob patterns separated with ';' ("*.png;*.jpg") which
+        the file names are matched against; empty filter accepts all files. All of the
+        directories are walked and reported. The symbolic links to directories are
+        reported but not followed.
+
+        The callback is called from the worker threads but never concurrently.
+    */
+
+    enum WalkFlags : u32
+    {
+        // query the file sizes; without this flag the files are not stat'd when
+        // the directory entry tells the file type and the sizes are zero.
+        WALK_SIZE = 0x01,
     };
 
+    using WalkCallback = std::function<void(const FileInfo& info)>;
+
+    void walk(const std::string& pathname, WalkCallback callback, const std::string& filter = "", u32 flags = WALK_SIZE);
+
+    // the index is sorted by name
+    void walk(FileIndex& index, const std::string& pathname, const std::string& filter = "", u32 flags = WALK_SIZE);
+
     // filename manipulation functions (example: "foo/bar/readme.txt")
     std::string getPath(const std::string& filename);           // "foo/bar/"
     std::string removePath(const std::string& filename);        // "readme.txt"
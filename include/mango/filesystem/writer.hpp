@@ -0,0 +1,107 @@
+/*
+    MANGO Multimedia Development Platform
+    Copyright (C) 2012-2019 Twilight Finland 3D Oy Ltd. All rights reserved.
+*/
+#pragma once
+
+#include <string>
+#include "../core/configure.hpp"
+#include "../core/compress.hpp"
+#include "../core/stream.hpp"
+
+namespace mango {
+namespace filesystem {
+
+    // -----------------------------------------------------------------
+    // WriterMGX
+    // -----------------------------------------------------------------
+
+    /*
+        Container writer for .mgx files.
+
+        Small files are packed together into shared blocks and large files are
+        split into block sized segments. The blocks are compressed in parallel
+        in the ThreadPool. Blocks which are stored (Compressor::NONE or data did
+        not compress) are page-aligned so that MapperMGX can map them directly.
+
+        The blocks have crc32c checksum which is verified when they are decoded
+        and they can be encrypted with AES-256 in CTR mode; the password is given
+        to the Path or File which opens the container.
+
+        The memory passed to addFile() must remain valid until finish().
+    */
+
+    class WriterMGX : protected NonCopyable
+    {
+    protected:
+        std::unique_ptr<struct ContextMGX> m_context;
+
+    public:
+        WriterMGX(const std::string& filename, Compressor::Method method = Compressor::ZSTD, int level = 6);
+        WriterMGX(Stream& stream, Compressor::Method method = Compressor::ZSTD, int level = 6);
+        ~WriterMGX();
+
+        // configuration must be done before files are added
+        void setBlockSize(size_t bytes); // default: 4 MB
+        void setChecksum(bool enable); // default: enabled
+        void setPassword(const std::string& password); // default: no encryption
+
+        void addFile(const std::string& filename, Memory memory);
+        void addFile(const std::string& filename, const std::string& source);
+        void addDirectory(const std::string& pathname, const std::string& source);
+
+        // write the file and block tables; called automatically by the destructor
+        // which discards the errors so call finish() explicitly to see them
+        void finish();
+    };
+
+    // -----------------------------------------------------------------
+    // WriterZIP
+    // -----------------------------------------------------------------
+
+    /*
+        ZIP archive writer.
+
+        The files are compressed in parallel in the ThreadPool; large files are split
+        into chunks which are compressed independently and concatenated into a single
+        entry. The CRC32 of the chunks are computed in parallel and combined.
+
+        Stored entries of at least page size are page-aligned so that MapperZIP can
+        map them directly. The ZIP64 extensions are written when the sizes, offsets
+        or entry count require them.
+
+        The memory passed to addFile() must remain valid until finish().
+    */
+
+    class WriterZIP : protected NonCopyable
+    {
+    protected:
+        std::unique_ptr<struct ContextZIP> m_context;
+
+    public:
+        enum Method
+        {
+            STORE   = 0,
+            DEFLATE = 8,
+            ZSTD    = 93,
+            XZ      = 95,
+        };
+
+        WriterZIP(const std::string& filename, Method method = DEFLATE, int level = 6);
+        WriterZIP(Stream& stream, Method method = DEFLATE, int level = 6);
+        ~WriterZIP();
+
+        // compression of the files added after the call
+        void setMethod(Method method, int level = 6);
+
+        void addFile(const std::string& filename, Memory memory);
+        void addFile(const std::string& filename, const std::string& source);
+        void addDirectory(const std::string& pathname, const std::string& source);
+
+        // write the central directory; called automatically by the destructor
+        // which discards the errors so call finish() explicitly to see them
+        void finish();
+    };
+
+} // namespace filesystem
+} // namespace mango
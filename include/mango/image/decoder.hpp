@@ -13,6 +13,9 @@
 namespace mango
 {
     class Surface;
+    class Stream;
+    class StreamView;
+    class Histogram;
 
     struct ImageHeader : image::Status
     {
@@ -48,6 +51,8 @@ namespace mango
         // - palette is resolved into the provided palette object
         // - decode() destination surface must be indexed
         Palette* palette = nullptr; // enable indexed decoding by pointing to a palette
+
+        Histogram* histogram = nullptr; // record the decoding time (ns)
     };
 
     class ImageDecoderInterface : protected NonCopyable
@@ -68,6 +73,7 @@ namespace mango
     {
     public:
         ImageDecoder(Memory memory, const std::string& extension);
+        ImageDecoder(Stream& stream, const std::string& extension);
         ~ImageDecoder();
 
         bool isDecoder() const;
@@ -80,6 +86,7 @@ namespace mango
         typedef ImageDecoderInterface* (*CreateDecoderFunc)(Memory memory);
 
     protected:
+        std::unique_ptr<StreamView> m_view;
         std::unique_ptr<ImageDecoderInterface> m_interface;
     };
 
@@ -14,6 +14,7 @@
 namespace mango
 {
     class Surface;
+    class Histogram;
 
     struct ImageEncodeStatus : image::Status
     {
@@ -26,6 +27,7 @@ namespace mango
         float quality = 0.90f;
         bool dithering = true;
         bool lossless = false;
+        Histogram* histogram = nullptr; // record the encoding time (ns)
     };
 
     class ImageEncoder : protected NonCopyable
@@ -46,6 +46,7 @@ namespace mango
         }
 
         void save(const std::string& filename, const ImageEncodeOptions& options = ImageEncodeOptions()) const;
+        void save(Stream& stream, const std::string& extension, const ImageEncodeOptions& options = ImageEncodeOptions()) const;
         void clear(float red, float green, float blue, float alpha) const;
         void blit(int x, int y, const Surface& source) const;
         void xflip() const;
@@ -62,6 +63,9 @@ namespace mango
         Bitmap(const std::string& filename, const Format& format);
         Bitmap(Memory memory, const std::string& extension, Palette& palette);
         Bitmap(const std::string& filename, Palette& palette);
+        Bitmap(Stream& stream, const std::string& extension);
+        Bitmap(Stream& stream, const std::string& extension, const Format& format);
+        Bitmap(Stream& stream, const std::string& extension, Palette& palette);
         Bitmap(Bitmap&& bitmap);
         ~Bitmap();
 
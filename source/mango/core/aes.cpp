@@ -2,15 +2,47 @@
     MANGO Multimedia Development Platform
     Copyright (C) 2012-2018 Twilight Finland 3D Oy Ltd. All rights reserved.
 */
+#include <algorithm>
+#include <cstring>
 #include <mango/core/aes.hpp>
 #include <mango/core/cpuinfo.hpp>
 #include <mango/core/exception.hpp>
+#include <mango/core/bits.hpp>
+#include <mango/core/endian.hpp>
+#include <mango/core/thread.hpp>
 #include "../../external/aes/bc_aes.h"
 
 namespace
 {
     using namespace mango;
 
+// 128 bit big-endian counter
+
+struct CounterAES
+{
+    u64 high;
+    u64 low;
+
+    CounterAES(const u8* iv)
+    {
+        high = uload64be(iv + 0);
+        low = uload64be(iv + 8);
+    }
+
+    void add(u64 count)
+    {
+        u64 x = low + count;
+        high += x < low;
+        low = x;
+    }
+
+    void store(u8* dest) const
+    {
+        ustore64be(dest + 0, high);
+        ustore64be(dest + 8, low);
+    }
+};
+
 #if defined(MANGO_ENABLE_AES)
 
 // ----------------------------------------------------------------------------------------
@@ -284,6 +316,35 @@ inline __m128i aesni_ecb_decrypt_block<14>(__m128i data, const __m128i* schedule
 template <int NR>
 void aesni_ecb_encrypt(u8* output, const u8* input, size_t blocks, const __m128i* schedule)
 {
+    // eight independent blocks are in flight to hide the aesenc latency
+    for ( ; blocks >= 8; blocks -= 8)
+    {
+        __m128i data[8];
+
+        for (int i = 0; i < 8; ++i)
+        {
+            data[i] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(input) + i);
+            data[i] = _mm_xor_si128(data[i], schedule[0]);
+        }
+
+        for (int j = 1; j < NR; ++j)
+        {
+            for (int i = 0; i < 8; ++i)
+            {
+                data[i] = _mm_aesenc_si128(data[i], schedule[j]);
+            }
+        }
+
+        for (int i = 0; i < 8; ++i)
+        {
+            data[i] = _mm_aesenclast_si128(data[i], schedule[NR]);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(output) + i, data[i]);
+        }
+
+        input += 128;
+        output += 128;
+    }
+
     for (size_t i = 0; i < blocks; ++i)
     {
         __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i *>(input) + i);
@@ -330,6 +391,184 @@ void aesni_cbc_decrypt(u8* output, const u8* input, size_t blocks, __m128i iv, c
     }
 }
 
+// CTR buffer
+
+inline __m128i aesni_ctr_block(CounterAES& counter)
+{
+    __m128i block = _mm_set_epi64x(byteswap(counter.low), byteswap(counter.high));
+    counter.add(1);
+    return block;
+}
+
+template <int NR>
+void aesni_ctr_encrypt(u8* output, const u8* input, size_t length, CounterAES& counter, const __m128i* schedule)
+{
+    // eight independent blocks are in flight to hide the aesenc latency
+    while (length >= 128)
+    {
+        __m128i data[8];
+
+        for (int i = 0; i < 8; ++i)
+        {
+            data[i] = _mm_xor_si128(aesni_ctr_block(counter), schedule[0]);
+        }
+
+        for (int j = 1; j < NR; ++j)
+        {
+            for (int i = 0; i < 8; ++i)
+            {
+                data[i] = _mm_aesenc_si128(data[i], schedule[j]);
+            }
+        }
+
+        for (int i = 0; i < 8; ++i)
+        {
+            data[i] = _mm_aesenclast_si128(data[i], schedule[NR]);
+            __m128i source = _mm_loadu_si128(reinterpret_cast<const __m128i *>(input) + i);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(output) + i, _mm_xor_si128(data[i], source));
+        }
+
+        input += 128;
+        output += 128;
+        length -= 128;
+    }
+
+    while (length >= 16)
+    {
+        __m128i data = aesni_ecb_encrypt_block<NR>(aesni_ctr_block(counter), schedule);
+        __m128i source = _mm_loadu_si128(reinterpret_cast<const __m128i *>(input));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(output), _mm_xor_si128(data, source));
+
+        input += 16;
+        output += 16;
+        length -= 16;
+    }
+
+    if (length > 0)
+    {
+        u8 temp[16];
+        __m128i data = aesni_ecb_encrypt_block<NR>(aesni_ctr_block(counter), schedule);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(temp), data);
+
+        for (size_t i = 0; i < length; ++i)
+        {
+            output[i] = input[i] ^ temp[i];
+        }
+    }
+}
+
+#if defined(MANGO_ENABLE_VAES) && defined(MANGO_ENABLE_AVX512)
+
+// VAES with 512 bit registers: four blocks per instruction, sixteen blocks in flight
+
+template <int NR>
+size_t vaes_ctr_encrypt(u8* output, const u8* input, size_t length, CounterAES& counter, const __m128i* schedule)
+{
+    __m512i keys[NR + 1];
+    for (int j = 0; j <= NR; ++j)
+    {
+        keys[j] = _mm512_broadcast_i32x4(schedule[j]);
+    }
+
+    const size_t bytes = length & ~size_t(255);
+
+    for (size_t offset = 0; offset < bytes; offset += 256)
+    {
+        __m512i data[4];
+
+        for (int i = 0; i < 4; ++i)
+        {
+            __m512i temp = _mm512_castsi128_si512(aesni_ctr_block(counter));
+            temp = _mm512_inserti32x4(temp, aesni_ctr_block(counter), 1);
+            temp = _mm512_inserti32x4(temp, aesni_ctr_block(counter), 2);
+            temp = _mm512_inserti32x4(temp, aesni_ctr_block(counter), 3);
+            data[i] = _mm512_xor_si512(temp, keys[0]);
+        }
+
+        for (int j = 1; j < NR; ++j)
+        {
+            for (int i = 0; i < 4; ++i)
+            {
+                data[i] = _mm512_aesenc_epi128(data[i], keys[j]);
+            }
+        }
+
+        for (int i = 0; i < 4; ++i)
+        {
+            data[i] = _mm512_aesenclast_epi128(data[i], keys[NR]);
+            __m512i source = _mm512_loadu_si512(input + offset + i * 64);
+            _mm512_storeu_si512(output + offset + i * 64, _mm512_xor_si512(data[i], source));
+        }
+    }
+
+    return bytes;
+}
+
+#elif defined(MANGO_ENABLE_VAES) && defined(MANGO_ENABLE_AVX2)
+
+// VAES with 256 bit registers: two blocks per instruction, eight blocks in flight
+
+template <int NR>
+size_t vaes_ctr_encrypt(u8* output, const u8* input, size_t length, CounterAES& counter, const __m128i* schedule)
+{
+    __m256i keys[NR + 1];
+    for (int j = 0; j <= NR; ++j)
+    {
+        keys[j] = _mm256_broadcastsi128_si256(schedule[j]);
+    }
+
+    const size_t bytes = length & ~size_t(127);
+
+    for (size_t offset = 0; offset < bytes; offset += 128)
+    {
+        __m256i data[4];
+
+        for (int i = 0; i < 4; ++i)
+        {
+            __m256i temp = _mm256_castsi128_si256(aesni_ctr_block(counter));
+            temp = _mm256_inserti128_si256(temp, aesni_ctr_block(counter), 1);
+            data[i] = _mm256_xor_si256(temp, keys[0]);
+        }
+
+        for (int j = 1; j < NR; ++j)
+        {
+            for (int i = 0; i < 4; ++i)
+            {
+                data[i] = _mm256_aesenc_epi128(data[i], keys[j]);
+            }
+        }
+
+        for (int i = 0; i < 4; ++i)
+        {
+            data[i] = _mm256_aesenclast_epi128(data[i], keys[NR]);
+            __m256i source = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(input + offset) + i);
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(output + offset) + i, _mm256_xor_si256(data[i], source));
+        }
+    }
+
+    return bytes;
+}
+
+#endif
+
+template <int NR>
+void aesni_ctr_encrypt(u8* output, const u8* input, size_t length, CounterAES counter, const __m128i* schedule, bool vaes)
+{
+#if defined(MANGO_ENABLE_VAES) && (defined(MANGO_ENABLE_AVX512) || defined(MANGO_ENABLE_AVX2))
+    if (vaes)
+    {
+        size_t bytes = vaes_ctr_encrypt<NR>(output, input, length, counter, schedule);
+        output += bytes;
+        input += bytes;
+        length -= bytes;
+    }
+#else
+    MANGO_UNREFERENCED(vaes);
+#endif
+
+    aesni_ctr_encrypt<NR>(output, input, length, counter, schedule);
+}
+
 // EBC selector
 
 void aesni_ecb_encrypt(u8* output, const u8* input, size_t length, const __m128i* schedule, int keybits)
@@ -412,6 +651,26 @@ void aesni_cbc_decrypt(u8* output, const u8* input, size_t length, const u8* ive
     }
 }
 
+// CTR selector
+
+void aesni_ctr_encrypt(u8* output, const u8* input, size_t length, CounterAES counter, const __m128i* schedule, int keybits, bool vaes)
+{
+    switch (keybits)
+    {
+        case 128:
+            aesni_ctr_encrypt<10>(output, input, length, counter, schedule, vaes);
+            break;
+        case 192:
+            aesni_ctr_encrypt<12>(output, input, length, counter, schedule, vaes);
+            break;
+        case 256:
+            aesni_ctr_encrypt<14>(output, input, length, counter, schedule, vaes);
+            break;
+        default:
+            break;
+    }
+}
+
 void aesni_key_expand(__m128i* schedule, const u8* key, int bits)
 {
     switch (bits)
@@ -439,18 +698,284 @@ namespace mango
 
 struct KeyScheduleAES
 {
-    union
-    {
-#if defined(MANGO_ENABLE_AES)
-        __m128i schedule[28];
-#endif
-        u32 w[60];
-    };
+    // the software key schedule is always generated; CCM is implemented in software
 #if defined(MANGO_ENABLE_AES)
+    __m128i schedule[28];
     bool aes_supported;
+    bool vaes_supported;
 #endif
+    u32 w[60];
 };
 
+namespace
+{
+
+    // buffers larger than the threshold are processed in parallel chunks
+    constexpr size_t aes_parallel_threshold = 4 * 1024 * 1024;
+    constexpr size_t aes_parallel_chunk = 1024 * 1024;
+
+    void ctr_process(const KeyScheduleAES& schedule, int bits, u8* output, const u8* input, size_t length, CounterAES counter)
+    {
+#if defined(MANGO_ENABLE_AES)
+        if (schedule.aes_supported)
+        {
+            aesni_ctr_encrypt(output, input, length, counter, schedule.schedule, bits, schedule.vaes_supported);
+            return;
+        }
+#endif
+
+        u8 iv[16];
+        counter.store(iv);
+        aes_encrypt_ctr(input, length, output, schedule.w, bits, iv);
+    }
+
+    void ctr_parallel(const KeyScheduleAES& schedule, int bits, u8* output, const u8* input, size_t length, const u8* iv)
+    {
+        CounterAES counter(iv);
+
+        if (length < aes_parallel_threshold)
+        {
+            ctr_process(schedule, bits, output, input, length, counter);
+            return;
+        }
+
+        ConcurrentQueue q("aes.ctr", Priority::HIGH);
+
+        for (size_t offset = 0; offset < length; offset += aes_parallel_chunk)
+        {
+            const size_t bytes = std::min(aes_parallel_chunk, length - offset);
+
+            CounterAES chunk_counter = counter;
+            chunk_counter.add(offset / 16);
+
+            q.enqueue([=, &schedule] {
+                ctr_process(schedule, bits, output + offset, input + offset, bytes, chunk_counter);
+            });
+        }
+
+        q.wait();
+    }
+
+    // GCM uses a 32 bit counter in the last four bytes of the counter block;
+    // the counter wraps without carry into the rest of the block
+    void gcm_ctr(const KeyScheduleAES& schedule, int bits, u8* output, const u8* input, size_t length, CounterAES& counter)
+    {
+        while (length > 0)
+        {
+            const u64 available = (u64(1) << 32) - (counter.low & 0xffffffff);
+            const size_t bytes = size_t(std::min(u64(length), available * 16));
+
+            ctr_process(schedule, bits, output, input, bytes, counter);
+
+            const u64 blocks = (bytes + 15) / 16;
+            counter.low = (counter.low & 0xffffffff00000000ull) | ((counter.low + blocks) & 0xffffffff);
+
+            output += bytes;
+            input += bytes;
+            length -= bytes;
+        }
+    }
+
+    // ----------------------------------------------------------------------------------------
+    // GHASH
+    // ----------------------------------------------------------------------------------------
+
+#if defined(MANGO_ENABLE_PCLMUL)
+
+    inline __m128i ghash_bswap(__m128i value)
+    {
+        const __m128i mask = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+        return _mm_shuffle_epi8(value, mask);
+    }
+
+    // carry-less multiplication and reduction of byte reflected operands
+    // (Intel: Carry-Less Multiplication Instruction and its Usage for Computing the GCM Mode)
+    inline __m128i ghash_multiply(__m128i a, __m128i b)
+    {
+        __m128i tmp3 = _mm_clmulepi64_si128(a, b, 0x00);
+        __m128i tmp4 = _mm_clmulepi64_si128(a, b, 0x10);
+        __m128i tmp5 = _mm_clmulepi64_si128(a, b, 0x01);
+        __m128i tmp6 = _mm_clmulepi64_si128(a, b, 0x11);
+
+        tmp4 = _mm_xor_si128(tmp4, tmp5);
+        tmp5 = _mm_slli_si128(tmp4, 8);
+        tmp4 = _mm_srli_si128(tmp4, 8);
+        tmp3 = _mm_xor_si128(tmp3, tmp5);
+        tmp6 = _mm_xor_si128(tmp6, tmp4);
+
+        // shift the 256 bit product left by one
+        __m128i tmp7 = _mm_srli_epi32(tmp3, 31);
+        __m128i tmp8 = _mm_srli_epi32(tmp6, 31);
+        tmp3 = _mm_slli_epi32(tmp3, 1);
+        tmp6 = _mm_slli_epi32(tmp6, 1);
+
+        __m128i tmp9 = _mm_srli_si128(tmp7, 12);
+        tmp8 = _mm_slli_si128(tmp8, 4);
+        tmp7 = _mm_slli_si128(tmp7, 4);
+        tmp3 = _mm_or_si128(tmp3, tmp7);
+        tmp6 = _mm_or_si128(tmp6, tmp8);
+        tmp6 = _mm_or_si128(tmp6, tmp9);
+
+        // reduction modulo x^128 + x^7 + x^2 + x + 1
+        tmp7 = _mm_slli_epi32(tmp3, 31);
+        tmp8 = _mm_slli_epi32(tmp3, 30);
+        tmp9 = _mm_slli_epi32(tmp3, 25);
+
+        tmp7 = _mm_xor_si128(tmp7, tmp8);
+        tmp7 = _mm_xor_si128(tmp7, tmp9);
+        tmp8 = _mm_srli_si128(tmp7, 4);
+        tmp7 = _mm_slli_si128(tmp7, 12);
+        tmp3 = _mm_xor_si128(tmp3, tmp7);
+
+        __m128i tmp2 = _mm_srli_epi32(tmp3, 1);
+        tmp4 = _mm_srli_epi32(tmp3, 2);
+        tmp5 = _mm_srli_epi32(tmp3, 7);
+        tmp2 = _mm_xor_si128(tmp2, tmp4);
+        tmp2 = _mm_xor_si128(tmp2, tmp5);
+        tmp2 = _mm_xor_si128(tmp2, tmp8);
+        tmp3 = _mm_xor_si128(tmp3, tmp2);
+        tmp6 = _mm_xor_si128(tmp6, tmp3);
+
+        return tmp6;
+    }
+
+#endif
+
+    class GHASH
+    {
+    protected:
+        u64 m_h[2];
+        u64 m_x[2];
+#if defined(MANGO_ENABLE_PCLMUL)
+        __m128i m_hv;
+        __m128i m_xv;
+        bool m_clmul;
+#endif
+
+        void multiply()
+        {
+            // X = X * H in GF(2^128); software fallback (NIST SP 800-38D, algorithm 1)
+            u64 zh = 0;
+            u64 zl = 0;
+            u64 vh = m_h[0];
+            u64 vl = m_h[1];
+
+            for (int i = 0; i < 128; ++i)
+            {
+                const u64 word = m_x[i >> 6];
+                if ((word >> (63 - (i & 63))) & 1)
+                {
+                    zh ^= vh;
+                    zl ^= vl;
+                }
+
+                const u64 lsb = vl & 1;
+                vl = (vl >> 1) | (vh << 63);
+                vh = (vh >> 1) ^ (lsb ? 0xe100000000000000ull : 0);
+            }
+
+            m_x[0] = zh;
+            m_x[1] = zl;
+        }
+
+        void block(const u8* data)
+        {
+#if defined(MANGO_ENABLE_PCLMUL)
+            if (m_clmul)
+            {
+                __m128i value = ghash_bswap(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data)));
+                m_xv = ghash_multiply(_mm_xor_si128(m_xv, value), m_hv);
+                return;
+            }
+#endif
+            m_x[0] ^= uload64be(data + 0);
+            m_x[1] ^= uload64be(data + 8);
+            multiply();
+        }
+
+    public:
+        GHASH(const u8* h)
+        {
+            m_h[0] = uload64be(h + 0);
+            m_h[1] = uload64be(h + 8);
+            m_x[0] = 0;
+            m_x[1] = 0;
+#if defined(MANGO_ENABLE_PCLMUL)
+            m_clmul = (getCPUFlags() & CPU_CLMUL) != 0;
+            m_hv = ghash_bswap(_mm_loadu_si128(reinterpret_cast<const __m128i *>(h)));
+            m_xv = _mm_setzero_si128();
+#endif
+        }
+
+        // the last partial block is padded with zeros
+        void update(const u8* data, size_t length)
+        {
+            for ( ; length >= 16; length -= 16)
+            {
+                block(data);
+                data += 16;
+            }
+
+            if (length > 0)
+            {
+                u8 temp[16] = { 0 };
+                std::memcpy(temp, data, length);
+                block(temp);
+            }
+        }
+
+        void final(u8* output) const
+        {
+#if defined(MANGO_ENABLE_PCLMUL)
+            if (m_clmul)
+            {
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(output), ghash_bswap(m_xv));
+                return;
+            }
+#endif
+            ustore64be(output + 0, m_x[0]);
+            ustore64be(output + 8, m_x[1]);
+        }
+    };
+
+    constexpr size_t gcm_chunk_size = 64 * 1024;
+
+    void gcm_initial_counter(u8* j0, const u8* h, Memory iv)
+    {
+        if (iv.size == 12)
+        {
+            std::memcpy(j0, iv.address, 12);
+            ustore32be(j0 + 12, 1);
+        }
+        else
+        {
+            GHASH ghash(h);
+            ghash.update(iv.address, iv.size);
+
+            u8 lengths[16];
+            ustore64be(lengths + 0, 0);
+            ustore64be(lengths + 8, u64(iv.size) * 8);
+            ghash.update(lengths, 16);
+            ghash.final(j0);
+        }
+    }
+
+    void gcm_tag(const KeyScheduleAES& schedule, int bits, u8* tag, GHASH& ghash, const u8* j0, size_t associated, size_t length)
+    {
+        u8 lengths[16];
+        ustore64be(lengths + 0, u64(associated) * 8);
+        ustore64be(lengths + 8, u64(length) * 8);
+        ghash.update(lengths, 16);
+
+        u8 s[16];
+        ghash.final(s);
+
+        // tag = E(K, J0) ^ S
+        ctr_process(schedule, bits, tag, s, 16, CounterAES(j0));
+    }
+
+} // namespace
+
 AES::AES(const u8* key, int bits)
     : m_schedule(new KeyScheduleAES())
     , m_bits(bits)
@@ -468,16 +993,16 @@ AES::AES(const u8* key, int bits)
     }
 
 #if defined(MANGO_ENABLE_AES)
-    m_schedule->aes_supported = (getCPUFlags() & CPU_AES) != 0;
+    const u64 flags = getCPUFlags();
+    m_schedule->aes_supported = (flags & CPU_AES) != 0;
+    m_schedule->vaes_supported = (flags & CPU_VAES) != 0;
     if (m_schedule->aes_supported)
     {
         aesni_key_expand(m_schedule->schedule, key, bits);
     }
-    else
 #endif
-    {
-        aes_key_setup(key, m_schedule->w, bits);
-    }
+
+    aes_key_setup(key, m_schedule->w, bits);
 }
 
 AES::~AES()
@@ -573,7 +1098,7 @@ void AES::ctr_block_encrypt(u8* output, const u8* input, size_t length, const u8
     {
         MANGO_EXCEPTION("[AES] The length must be multiple of 16 bytes.");
     }
-    aes_encrypt_ctr(input, length, output, m_schedule->w, m_bits, iv);
+    ctr_parallel(*m_schedule, m_bits, output, input, length, iv);
 }
 
 void AES::ctr_block_decrypt(u8* output, const u8* input, size_t length, const u8* iv)
@@ -582,7 +1107,7 @@ void AES::ctr_block_decrypt(u8* output, const u8* input, size_t length, const u8
     {
         MANGO_EXCEPTION("[AES] The length must be multiple of 16 bytes.");
     }
-    aes_decrypt_ctr(input, length, output, m_schedule->w, m_bits, iv);
+    ctr_parallel(*m_schedule, m_bits, output, input, length, iv);
 }
 
 void AES::ccm_block_encrypt(Memory output, Memory input, Memory associated, Memory nonce, int mac_length)
@@ -643,4 +1168,80 @@ void AES::ecb_decrypt(u8* output, const u8* input, size_t length)
     }
 }
 
+void AES::ctr_encrypt(u8* output, const u8* input, size_t length, const u8* iv)
+{
+    // CTR is a stream cipher mode; the last partial block does not need padding
+    ctr_parallel(*m_schedule, m_bits, output, input, length, iv);
+}
+
+void AES::ctr_decrypt(u8* output, const u8* input, size_t length, const u8* iv)
+{
+    ctr_parallel(*m_schedule, m_bits, output, input, length, iv);
+}
+
+void AES::gcm_encrypt(u8* output, u8* tag, const u8* input, size_t length, Memory associated, Memory iv)
+{
+    u8 h[16] = { 0 };
+    ecb_block_encrypt(h, h, 16);
+
+    u8 j0[16];
+    gcm_initial_counter(j0, h, iv);
+
+    GHASH ghash(h);
+    ghash.update(associated.address, associated.size);
+
+    CounterAES counter(j0);
+    counter.low = (counter.low & 0xffffffff00000000ull) | ((counter.low + 1) & 0xffffffff);
+
+    // the chunks are hashed while they are still in the cache
+    for (size_t offset = 0; offset < length; offset += gcm_chunk_size)
+    {
+        const size_t bytes = std::min(gcm_chunk_size, length - offset);
+        gcm_ctr(*m_schedule, m_bits, output + offset, input + offset, bytes, counter);
+        ghash.update(output + offset, bytes);
+    }
+
+    gcm_tag(*m_schedule, m_bits, tag, ghash, j0, associated.size, length);
+}
+
+bool AES::gcm_decrypt(u8* output, const u8* input, size_t length, Memory associated, Memory iv, const u8* tag)
+{
+    u8 h[16] = { 0 };
+    ecb_block_encrypt(h, h, 16);
+
+    u8 j0[16];
+    gcm_initial_counter(j0, h, iv);
+
+    GHASH ghash(h);
+    ghash.update(associated.address, associated.size);
+
+    CounterAES counter(j0);
+    counter.low = (counter.low & 0xffffffff00000000ull) | ((counter.low + 1) & 0xffffffff);
+
+    for (size_t offset = 0; offset < length; offset += gcm_chunk_size)
+    {
+        const size_t bytes = std::min(gcm_chunk_size, length - offset);
+        ghash.update(input + offset, bytes);
+        gcm_ctr(*m_schedule, m_bits, output + offset, input + offset, bytes, counter);
+    }
+
+    u8 computed[16];
+    gcm_tag(*m_schedule, m_bits, computed, ghash, j0, associated.size, length);
+
+    u8 difference = 0;
+    for (int i = 0; i < 16; ++i)
+    {
+        difference |= computed[i] ^ tag[i];
+    }
+
+    if (difference)
+    {
+        // never release unauthenticated plaintext
+        std::memset(output, 0, length);
+        return false;
+    }
+
+    return true;
+}
+
 } // namespace mango
@@ -2,9 +2,85 @@
     MANGO Multimedia Development Platform
     Copyright (C) 2012-2019 Twilight Finland 3D Oy Ltd. All rights reserved.
 */
+#include <mutex>
 #include <mango/core/buffer.hpp>
 #include <mango/core/exception.hpp>
 
+namespace {
+
+    using namespace mango;
+
+    // ----------------------------------------------------------------------------
+    // BufferPool
+    // ----------------------------------------------------------------------------
+
+    // Recycles the temporary buffers used by StreamView so that repeatedly
+    // reading streams into memory doesn't hit the allocator every time.
+
+    class BufferPool
+    {
+    protected:
+        struct Block
+        {
+            u8* address;
+            size_t capacity;
+        };
+
+        static constexpr size_t max_blocks = 8;
+
+        std::mutex m_mutex;
+        std::vector<Block> m_blocks;
+
+    public:
+        ~BufferPool()
+        {
+            for (auto& block : m_blocks)
+            {
+                aligned_free(block.address);
+            }
+        }
+
+        u8* acquire(size_t size, size_t& capacity)
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+
+                for (size_t i = 0; i < m_blocks.size(); ++i)
+                {
+                    if (m_blocks[i].capacity >= size)
+                    {
+                        Block block = m_blocks[i];
+                        m_blocks.erase(m_blocks.begin() + i);
+                        capacity = block.capacity;
+                        return block.address;
+                    }
+                }
+            }
+
+            capacity = size;
+            return reinterpret_cast<u8*>(aligned_malloc(size));
+        }
+
+        void release(u8* address, size_t capacity)
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+
+                if (m_blocks.size() < max_blocks)
+                {
+                    m_blocks.push_back({ address, capacity });
+                    return;
+                }
+            }
+
+            aligned_free(address);
+        }
+    };
+
+    BufferPool g_buffer_pool;
+
+} // namespace
+
 namespace mango {
 
     // ----------------------------------------------------------------------------
@@ -218,4 +294,313 @@ namespace mango {
         m_offset += bytes;
     }
 
+    Memory MemoryStream::map(u64 offset, size_t size)
+    {
+        const u64 total = u64(m_buffer.size());
+        if (offset > total)
+        {
+            return Memory();
+        }
+
+        size = size_t(std::min(u64(size), total - offset));
+        return Memory(m_buffer.data() + offset, size);
+    }
+
+    // ----------------------------------------------------------------------------
+    // ConstMemoryStream
+    // ----------------------------------------------------------------------------
+
+    ConstMemoryStream::ConstMemoryStream(Memory memory)
+        : m_memory(memory)
+        , m_offset(0)
+    {
+    }
+
+    ConstMemoryStream::~ConstMemoryStream()
+    {
+    }
+
+    u64 ConstMemoryStream::size() const
+    {
+        return u64(m_memory.size);
+    }
+
+    u64 ConstMemoryStream::offset() const
+    {
+        return u64(m_offset);
+    }
+
+    void ConstMemoryStream::seek(u64 distance, SeekMode mode)
+    {
+        const u64 size = u64(m_memory.size);
+        switch (mode)
+        {
+            case BEGIN:
+                m_offset = size_t(std::min(size, distance));
+                break;
+
+            case CURRENT:
+                m_offset = size_t(std::min(size, m_offset + distance));
+                break;
+
+            case END:
+                m_offset = size_t(distance > size ? 0 : size - distance);
+                break;
+        }
+    }
+
+    void ConstMemoryStream::read(void* dest, size_t bytes)
+    {
+        const size_t left = m_memory.size - m_offset;
+        if (left < bytes)
+        {
+            MANGO_EXCEPTION("[ConstMemoryStream] Reading past end of memory.");
+        }
+
+        std::memcpy(dest, m_memory.address + m_offset, bytes);
+        m_offset += bytes;
+    }
+
+    void ConstMemoryStream::write(const void* source, size_t bytes)
+    {
+        MANGO_UNREFERENCED(source);
+        MANGO_UNREFERENCED(bytes);
+        MANGO_EXCEPTION("[ConstMemoryStream] Stream is read-only.");
+    }
+
+    Memory ConstMemoryStream::map(u64 offset, size_t size)
+    {
+        const u64 total = u64(m_memory.size);
+        if (offset > total)
+        {
+            return Memory();
+        }
+
+        size = size_t(std::min(u64(size), total - offset));
+        return Memory(m_memory.address + offset, size);
+    }
+
+    // ----------------------------------------------------------------------------
+    // Stream
+    // ----------------------------------------------------------------------------
+
+    VirtualMemory* Stream::mmap(u64 offset, size_t size)
+    {
+        // the memory is owned by the stream
+        class StreamMemory : public VirtualMemory
+        {
+        public:
+            StreamMemory(Memory memory)
+            {
+                m_memory = memory;
+            }
+        };
+
+        Memory memory = map(offset, size);
+        return memory.address ? new StreamMemory(memory) : nullptr;
+    }
+
+    // ----------------------------------------------------------------------------
+    // StreamView
+    // ----------------------------------------------------------------------------
+
+    StreamView::StreamView(Stream& stream)
+        : StreamView(stream, 0, size_t(stream.size()))
+    {
+    }
+
+    StreamView::StreamView(Stream& stream, u64 offset, size_t size)
+        : m_buffer(nullptr)
+        , m_capacity(0)
+    {
+        const u64 total = stream.size();
+        if (offset > total)
+        {
+            MANGO_EXCEPTION("[StreamView] Offset is past end of stream.");
+        }
+
+        size = size_t(std::min(u64(size), total - offset));
+
+        m_mapping.reset(size > 0 ? stream.mmap(offset, size) : nullptr);
+        if (m_mapping)
+        {
+            m_memory = *m_mapping;
+        }
+        else if (size > 0)
+        {
+            // the stream cannot be mapped; read the range into a pooled buffer
+            m_buffer = g_buffer_pool.acquire(size, m_capacity);
+
+            const u64 current = stream.offset();
+            stream.seek(offset, Stream::BEGIN);
+            stream.read(m_buffer, size);
+            stream.seek(current, Stream::BEGIN);
+
+            m_memory = Memory(m_buffer, size);
+        }
+    }
+
+    StreamView::~StreamView()
+    {
+        if (m_buffer)
+        {
+            g_buffer_pool.release(m_buffer, m_capacity);
+        }
+    }
+
+    StreamView::operator Memory () const
+    {
+        return m_memory;
+    }
+
+    bool StreamView::isDirect() const
+    {
+        return m_buffer == nullptr;
+    }
+
+    // ----------------------------------------------------------------------------
+    // ChunkedMemoryStream
+    // ----------------------------------------------------------------------------
+
+    ChunkedMemoryStream::ChunkedMemoryStream(size_t chunk_size)
+        : m_chunk_size(std::max(chunk_size, size_t(256)))
+        , m_size(0)
+        , m_offset(0)
+    {
+    }
+
+    ChunkedMemoryStream::~ChunkedMemoryStream()
+    {
+        reset();
+    }
+
+    std::vector<Memory> ChunkedMemoryStream::chunks() const
+    {
+        std::vector<Memory> result;
+
+        size_t left = m_size;
+        for (size_t i = 0; left > 0; ++i)
+        {
+            const size_t bytes = std::min(left, m_chunk_size);
+            result.emplace_back(m_chunks[i], bytes);
+            left -= bytes;
+        }
+
+        return result;
+    }
+
+    size_t ChunkedMemoryStream::chunkSize() const
+    {
+        return m_chunk_size;
+    }
+
+    void ChunkedMemoryStream::reset()
+    {
+        for (u8* chunk : m_chunks)
+        {
+            aligned_free(chunk);
+        }
+
+        m_chunks.clear();
+        m_size = 0;
+        m_offset = 0;
+    }
+
+    u64 ChunkedMemoryStream::size() const
+    {
+        return u64(m_size);
+    }
+
+    u64 ChunkedMemoryStream::offset() const
+    {
+        return u64(m_offset);
+    }
+
+    void ChunkedMemoryStream::seek(u64 distance, SeekMode mode)
+    {
+        const u64 size = u64(m_size);
+        switch (mode)
+        {
+            case BEGIN:
+                m_offset = size_t(std::min(size, distance));
+                break;
+
+            case CURRENT:
+                m_offset = size_t(std::min(size, m_offset + distance));
+                break;
+
+            case END:
+                m_offset = size_t(distance > size ? 0 : size - distance);
+                break;
+        }
+    }
+
+    void ChunkedMemoryStream::read(void* dest, size_t bytes)
+    {
+        const size_t left = m_size - m_offset;
+        if (left < bytes)
+        {
+            MANGO_EXCEPTION("[ChunkedMemoryStream] Reading past end of buffer.");
+        }
+
+        u8* output = reinterpret_cast<u8*>(dest);
+
+        while (bytes > 0)
+        {
+            const size_t index = m_offset / m_chunk_size;
+            const size_t position = m_offset % m_chunk_size;
+            const size_t n = std::min(bytes, m_chunk_size - position);
+
+            std::memcpy(output, m_chunks[index] + position, n);
+            output += n;
+            bytes -= n;
+            m_offset += n;
+        }
+    }
+
+    void ChunkedMemoryStream::write(const void* source, size_t bytes)
+    {
+        const u8* input = reinterpret_cast<const u8*>(source);
+
+        while (bytes > 0)
+        {
+            const size_t index = m_offset / m_chunk_size;
+            const size_t position = m_offset % m_chunk_size;
+            const size_t n = std::min(bytes, m_chunk_size - position);
+
+            if (index == m_chunks.size())
+            {
+                // append a new chunk; the existing chunks are never moved
+                void* ptr = aligned_malloc(m_chunk_size);
+                m_chunks.push_back(reinterpret_cast<u8*>(ptr));
+            }
+
+            std::memcpy(m_chunks[index] + position, input, n);
+            input += n;
+            bytes -= n;
+            m_offset += n;
+        }
+
+        m_size = std::max(m_size, m_offset);
+    }
+
+    Memory ChunkedMemoryStream::map(u64 offset, size_t size)
+    {
+        // an empty range has no chunk; offset == size() would index past the chunk table
+        if (!size || offset >= u64(m_size) || offset + size > u64(m_size))
+        {
+            return Memory();
+        }
+
+        // only ranges which do not cross chunk boundary can be mapped directly
+        const size_t index = size_t(offset / m_chunk_size);
+        const size_t position = size_t(offset % m_chunk_size);
+        if (position + size > m_chunk_size)
+        {
+            return Memory();
+        }
+
+        return Memory(m_chunks[index] + position, size);
+    }
+
 } // namespace mango
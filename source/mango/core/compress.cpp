@@ -11,6 +11,7 @@
 #include <mango/core/bits.hpp>
 #include <mango/core/endian.hpp>
 #include <mango/core/pointer.hpp>
+#include <mango/core/timer.hpp>
 #include <mango/math/math.hpp>
 
 #define MINIZ_NO_ZLIB_COMPATIBLE_NAMES
@@ -985,4 +986,18 @@ namespace ppmd8
         return compressor;
     }
 
+    size_t compress(const Compressor& compressor, Memory dest, Stream& source, int level)
+    {
+        StreamView view(source);
+        ScopedTimer timer(compressor.histogram);
+        return compressor.compress(dest, view, level);
+    }
+
+    void decompress(const Compressor& compressor, Memory dest, Stream& source)
+    {
+        StreamView view(source);
+        ScopedTimer timer(compressor.histogram);
+        compressor.decompress(dest, view);
+    }
+
 } // namespace mango
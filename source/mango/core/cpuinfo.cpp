@@ -101,6 +101,9 @@ namespace
                     if ((cpuInfo[1] & 0x20000000) != 0) flags |= CPU_SHA;
                     if ((cpuInfo[1] & 0x40000000) != 0) flags |= CPU_AVX512BW;
                     if ((cpuInfo[1] & 0x80000000) != 0) flags |= CPU_AVX512VL;
+                    // ecx
+                    if ((cpuInfo[2] & 0x00000200) != 0) flags |= CPU_VAES;
+                    if ((cpuInfo[2] & 0x00000400) != 0) flags |= CPU_VPCLMULQDQ;
                     break;
 			}
 		}
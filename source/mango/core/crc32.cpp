@@ -761,6 +761,76 @@ namespace
         return ~crc;
     }
 
+    // -----------------------------------------------------------------
+    // combine
+    // -----------------------------------------------------------------
+
+    // The checksum of concatenated buffers is computed by applying the effect of
+    // length1 zero bytes to crc0 (multiplication with powers of x in GF(2)) and
+    // xoring the result with crc1. Adapted from zlib crc32_combine().
+
+    u32 gf2_matrix_times(const u32* matrix, u32 vec)
+    {
+        u32 sum = 0;
+        while (vec)
+        {
+            if (vec & 1)
+                sum ^= *matrix;
+            vec >>= 1;
+            ++matrix;
+        }
+        return sum;
+    }
+
+    void gf2_matrix_square(u32* square, const u32* matrix)
+    {
+        for (int n = 0; n < 32; ++n)
+        {
+            square[n] = gf2_matrix_times(matrix, matrix[n]);
+        }
+    }
+
+    u32 crc_combine(u32 polynomial, u32 crc0, u32 crc1, u64 length1)
+    {
+        if (!length1)
+            return crc0;
+
+        u32 even[32]; // even-power-of-two zeros operator
+        u32 odd[32];  // odd-power-of-two zeros operator
+
+        // operator for one zero bit
+        odd[0] = polynomial;
+        u32 row = 1;
+        for (int n = 1; n < 32; ++n)
+        {
+            odd[n] = row;
+            row <<= 1;
+        }
+
+        gf2_matrix_square(even, odd); // two zero bits
+        gf2_matrix_square(odd, even); // four zero bits
+
+        // apply length1 zero bytes to crc0; first square puts the operator
+        // for one zero byte (eight zero bits) in even
+        do
+        {
+            gf2_matrix_square(even, odd);
+            if (length1 & 1)
+                crc0 = gf2_matrix_times(even, crc0);
+            length1 >>= 1;
+
+            if (!length1)
+                break;
+
+            gf2_matrix_square(odd, even);
+            if (length1 & 1)
+                crc0 = gf2_matrix_times(odd, crc0);
+            length1 >>= 1;
+        } while (length1);
+
+        return crc0 ^ crc1;
+    }
+
 } // namespace
 
 namespace mango
@@ -776,4 +846,14 @@ namespace mango
         return crc_template(crc, memory, u8_crc32c, u64_crc32c);
     }
 
+    u32 crc32_combine(u32 crc0, u32 crc1, u64 length1)
+    {
+        return crc_combine(0xedb88320, crc0, crc1, length1);
+    }
+
+    u32 crc32c_combine(u32 crc0, u32 crc1, u64 length1)
+    {
+        return crc_combine(0x82f63b78, crc0, crc1, length1);
+    }
+
 } // namespace mango
@@ -2,6 +2,9 @@
     MANGO Multimedia Development Platform
     Copyright (C) 2012-2019 Twilight Finland 3D Oy Ltd. All rights reserved.
 */
+#include <vector>
+#include <algorithm>
+#include <cstring>
 #include <mango/core/hash.hpp>
 #include <mango/core/exception.hpp>
 #include <mango/core/bits.hpp>
@@ -360,7 +363,7 @@ namespace
         }
 
         abcd = _mm_shuffle_epi32(abcd, 0x1B);
-        _mm_store_si128((__m128i*) digest, abcd);
+        _mm_storeu_si128((__m128i*) digest, abcd);
         *(digest+4) = _mm_extract_epi32(e0, 3);
     }
 
@@ -506,24 +509,16 @@ namespace
             state[2] += c;
             state[3] += d;
             state[4] += e;
+
+            block += 64;
         }
     }
 
-} // namespace
-
-namespace mango
-{
+    using SHA1Transform = void (*)(u32 state[5], const u8* block, int count);
 
-    SHA1 sha1(Memory memory)
+    SHA1Transform getTransform()
     {
-        SHA1 hash;
-        hash.data[0] = 0x67452301;
-        hash.data[1] = 0xEFCDAB89;
-        hash.data[2] = 0x98BADCFE;
-        hash.data[3] = 0x10325476;
-        hash.data[4] = 0xC3D2E1F0;
-
-        auto transform = generic_sha1_update;
+        SHA1Transform transform = generic_sha1_update;
 #if defined(__ARM_FEATURE_CRYPTO)
         if ((getCPUFlags() & CPU_ARM_SHA1) != 0)
         {
@@ -535,32 +530,50 @@ namespace mango
             transform = intel_sha1_update;
         }
 #endif
+        return transform;
+    }
+
+    void sha1_init(u32 state[5])
+    {
+        state[0] = 0x67452301;
+        state[1] = 0xEFCDAB89;
+        state[2] = 0x98BADCFE;
+        state[3] = 0x10325476;
+        state[4] = 0xC3D2E1F0;
+    }
 
-        const u32 len = u32(memory.size);
-        const u8* message = memory.address;
+    // hash the message into a state which has already consumed prefix bytes (multiple of 64)
+    SHA1 sha1_final(SHA1Transform transform, const u32 state[5], u64 prefix, const u8* message, size_t length)
+    {
+        SHA1 hash;
+        std::memcpy(hash.data, state, 20);
 
-        int block_count = len / 64;
-        transform(hash.data, message, block_count);
-        message += block_count * 64;
-        u32 i = block_count * 64;
+        size_t block_count = length / 64;
+        for (size_t i = 0; i < block_count; )
+        {
+            // the transform block count is an int
+            int count = int(std::min(block_count - i, size_t(1) << 24));
+            transform(hash.data, message + i * 64, count);
+            i += count;
+        }
 
         u8 block[64];
-        u32 rem = len - i;
-        memcpy(block, message + i, rem);
+        size_t rem = length - block_count * 64;
+        std::memcpy(block, message + block_count * 64, rem);
 
         block[rem++] = 0x80;
         if (64 - rem >= 8)
         {
-            memset(block + rem, 0, 56 - rem);
+            std::memset(block + rem, 0, 56 - rem);
         }
         else
         {
-            memset(block + rem, 0, 64 - rem);
+            std::memset(block + rem, 0, 64 - rem);
             transform(hash.data, block, 1);
-            memset(block, 0, 56);
+            std::memset(block, 0, 56);
         }
 
-        ustore64be(block + 56, memory.size * 8);
+        ustore64be(block + 56, (prefix + length) * 8);
         transform(hash.data, block, 1);
 
 #ifdef MANGO_LITTLE_ENDIAN
@@ -574,4 +587,106 @@ namespace mango
         return hash;
     }
 
+    struct HMAC_SHA1
+    {
+        SHA1Transform transform;
+        u32 inner[5];
+        u32 outer[5];
+
+        HMAC_SHA1(Memory key)
+        {
+            transform = getTransform();
+
+            u8 block[64] = { 0 };
+            if (key.size > 64)
+            {
+                sha1_init(inner);
+                SHA1 hash = sha1_final(transform, inner, 0, key.address, key.size);
+                std::memcpy(block, hash.data, 20);
+            }
+            else
+            {
+                std::memcpy(block, key.address, key.size);
+            }
+
+            // the padded keys are hashed once and the states are reused for every message
+            u8 pad[64];
+
+            for (int i = 0; i < 64; ++i)
+            {
+                pad[i] = block[i] ^ 0x36;
+            }
+
+            sha1_init(inner);
+            transform(inner, pad, 1);
+
+            for (int i = 0; i < 64; ++i)
+            {
+                pad[i] = block[i] ^ 0x5c;
+            }
+
+            sha1_init(outer);
+            transform(outer, pad, 1);
+        }
+
+        SHA1 operator () (const u8* message, size_t length) const
+        {
+            SHA1 hash = sha1_final(transform, inner, 64, message, length);
+            return sha1_final(transform, outer, 64, reinterpret_cast<const u8*>(hash.data), 20);
+        }
+    };
+
+} // namespace
+
+namespace mango
+{
+
+    SHA1 sha1(Memory memory)
+    {
+        u32 state[5];
+        sha1_init(state);
+        return sha1_final(getTransform(), state, 0, memory.address, memory.size);
+    }
+
+    SHA1 hmac_sha1(Memory key, Memory message)
+    {
+        HMAC_SHA1 hmac(key);
+        return hmac(message.address, message.size);
+    }
+
+    void pbkdf2_sha1(Memory output, Memory password, Memory salt, int iterations)
+    {
+        HMAC_SHA1 hmac(password);
+
+        std::vector<u8> buffer(salt.size + 4);
+        std::memcpy(buffer.data(), salt.address, salt.size);
+
+        for (u32 index = 1; output.size > 0; ++index)
+        {
+            // U1 = PRF(password, salt || INT(index))
+            ustore32be(buffer.data() + salt.size, index);
+            SHA1 u = hmac(buffer.data(), buffer.size());
+
+            u8 result[20];
+            std::memcpy(result, u.data, 20);
+
+            for (int i = 1; i < iterations; ++i)
+            {
+                // Un = PRF(password, Un-1)
+                u = hmac(reinterpret_cast<const u8*>(u.data), 20);
+
+                const u8* p = reinterpret_cast<const u8*>(u.data);
+                for (int j = 0; j < 20; ++j)
+                {
+                    result[j] ^= p[j];
+                }
+            }
+
+            size_t bytes = std::min(output.size, size_t(20));
+            std::memcpy(output.address, result, bytes);
+            output.address += bytes;
+            output.size -= bytes;
+        }
+    }
+
 } // namespace mango
@@ -3,14 +3,15 @@
     Copyright (C) 2012-2016 Twilight Finland 3D Oy Ltd. All rights reserved.
 */
 #include <cctype>
+#include <cstring>
 #include <algorithm>
-#include <locale>
 #include <mango/core/string.hpp>
+#include <mango/core/bits.hpp>
+#include <mango/core/endian.hpp>
 
 namespace
 {
-    using mango::u8;
-    using mango::u32;
+    using namespace mango;
 
     /*
         WARNING!
@@ -82,9 +83,11 @@ namespace
     // See http://bjoern.hoehrmann.de/utf-8/decoder/dfa/ for details.
     // -----------------------------------------------------------------
 
+    // NOTE: the transition table below uses the compact state numbering
+    // where the reject state is 1 (the original paper uses 12)
     enum {
         UTF8_ACCEPT = 0,
-        UTF8_REJECT = 12
+        UTF8_REJECT = 1
     };
 
     inline u32 utf8_decode(u32& state, u32& code, u32 byte)
@@ -146,155 +149,576 @@ namespace
         return ptr;
     }
 
-} // namespace
+    // -----------------------------------------------------------------
+    // ASCII fast path
+    // -----------------------------------------------------------------
 
-namespace mango
-{
+#if defined(MANGO_ENABLE_SSE2)
+
+    inline void store_ascii(char16_t* dest, __m128i v)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + 0), _mm_unpacklo_epi8(v, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + 8), _mm_unpackhi_epi8(v, zero));
+    }
+
+    inline void store_ascii(char32_t* dest, __m128i v)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i lo = _mm_unpacklo_epi8(v, zero);
+        const __m128i hi = _mm_unpackhi_epi8(v, zero);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dest +  0), _mm_unpacklo_epi16(lo, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dest +  4), _mm_unpackhi_epi16(lo, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dest +  8), _mm_unpacklo_epi16(hi, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + 12), _mm_unpackhi_epi16(hi, zero));
+    }
+
+#endif
+
+    // Widen the leading ASCII characters of source into dest; returns the number
+    // of characters converted. Stops at the first byte which is not ASCII.
+    template <typename T>
+    inline size_t ascii_widen(T* dest, const u8* source, size_t length)
+    {
+        size_t i = 0;
+
+#if defined(MANGO_ENABLE_SSE2)
+        for ( ; i + 16 <= length; i += 16)
+        {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+            if (_mm_movemask_epi8(v))
+                break;
+            store_ascii(dest + i, v);
+        }
+#endif
+
+        for ( ; i < length && source[i] < 0x80; ++i)
+        {
+            dest[i] = source[i];
+        }
+
+        return i;
+    }
+
+    // Narrow the leading ASCII characters of UTF-16 source into dest; returns
+    // the number of characters converted.
+    inline size_t ascii_narrow(char* dest, const char16_t* source, size_t length)
+    {
+        size_t i = 0;
+
+#if defined(MANGO_ENABLE_SSE2)
+        const __m128i mask = _mm_set1_epi16(s16(0xff80));
+        const __m128i zero = _mm_setzero_si128();
+
+        for ( ; i + 8 <= length; i += 8)
+        {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+            __m128i ascii = _mm_cmpeq_epi16(_mm_and_si128(v, mask), zero);
+            if (_mm_movemask_epi8(ascii) != 0xffff)
+                break;
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(dest + i), _mm_packus_epi16(v, v));
+        }
+#endif
+
+        for ( ; i < length && source[i] < 0x80; ++i)
+        {
+            dest[i] = char(source[i]);
+        }
+
+        return i;
+    }
+
+    // Count the leading ASCII bytes
+    inline size_t ascii_prefix(const u8* source, size_t length)
+    {
+        size_t i = 0;
+
+#if defined(MANGO_ENABLE_AVX2)
+        for ( ; i + 32 <= length; i += 32)
+        {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + i));
+            u32 mask = u32(_mm256_movemask_epi8(v));
+            if (mask)
+                return i + u32_tzcnt(mask);
+        }
+#endif
+
+#if defined(MANGO_ENABLE_SSE2)
+        for ( ; i + 16 <= length; i += 16)
+        {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+            u32 mask = u32(_mm_movemask_epi8(v));
+            if (mask)
+                return i + u32_tzcnt(mask);
+        }
+#endif
+
+        for ( ; i + 8 <= length; i += 8)
+        {
+            if (uload64(source + i) & 0x8080808080808080ull)
+                break;
+        }
+
+        for ( ; i < length && source[i] < 0x80; ++i)
+        {
+        }
+
+        return i;
+    }
 
     // -----------------------------------------------------------------
-    // unicode conversions
+    // UTF-8 validation
     // -----------------------------------------------------------------
 
-    bool is_utf8(const std::string& source)
+#if !defined(MANGO_ENABLE_AVX2) && !defined(MANGO_ENABLE_SSE4_1)
+
+    bool utf8_validate_scalar(const u8* source, size_t length)
     {
+        u32 state = UTF8_ACCEPT;
         u32 code = 0;
-        u32 state = 0;
 
-        for (u8 c : source)
-            utf8_decode(state, code, c);
+        for (size_t i = 0; i < length; )
+        {
+            if (state == UTF8_ACCEPT)
+            {
+                i += ascii_prefix(source + i, length - i);
+                if (i == length)
+                    break;
+            }
+
+            if (utf8_decode(state, code, source[i++]) == UTF8_REJECT)
+                return false;
+        }
 
         return state == UTF8_ACCEPT;
     }
 
-    std::u32string utf32_from_utf8(const std::string& source)
+#endif
+
+#if defined(MANGO_ENABLE_SSE4_1)
+
+    /*
+        Lookup validation algorithm by John Keiser and Daniel Lemire:
+        "Validating UTF-8 In Less Than One Instruction Per Byte"
+        https://arxiv.org/abs/2010.03090
+
+        Each byte is classified together with the previous byte using three
+        nibble lookup tables; the remaining multi-byte length errors are found
+        by checking that the 2nd and 3rd continuation bytes are expected.
+    */
+
+    enum : u8
     {
-        std::u32string s;
-        StringBuilder<char32_t, 256, 1> sb(s);
+        TOO_SHORT   = 1 << 0, // 11______ 0_______ or 11______ 11______
+        TOO_LONG    = 1 << 1, // 0_______ 10______
+        OVERLONG_3  = 1 << 2, // 11100000 100_____
+        TOO_LARGE   = 1 << 3, // 11110100 1001____ or 11110100 101_____ or 11110101..11111111
+        SURROGATE   = 1 << 4, // 11101101 101_____
+        OVERLONG_2  = 1 << 5, // 1100000_ 10______
+        TOO_LARGE_1000 = 1 << 6, // 11110101..11111111 1000____
+        OVERLONG_4  = 1 << 6, // 11110000 1000____
+        TWO_CONTS   = 1 << 7, // 10______ 10______
+        CARRY = TOO_SHORT | TOO_LONG | TWO_CONTS
+    };
 
-        u32 state = 0;
-        u32 code = 0;
+    inline __m128i lookup_table(u8 x0, u8 x1, u8 x2, u8 x3, u8 x4, u8 x5, u8 x6, u8 x7,
+                                u8 x8, u8 x9, u8 x10, u8 x11, u8 x12, u8 x13, u8 x14, u8 x15)
+    {
+        return _mm_setr_epi8(x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15);
+    }
 
-        for (u8 c : source)
+    struct UTF8ValidatorSSE4
+    {
+        __m128i byte_1_high;
+        __m128i byte_1_low;
+        __m128i byte_2_high;
+        __m128i nibble;
+
+        __m128i error;
+        __m128i prev_input;
+        __m128i prev_incomplete;
+
+        UTF8ValidatorSSE4()
         {
-            if (!utf8_decode(state, code, c))
+            byte_1_high = lookup_table(
+                TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+                TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+                TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+                TOO_SHORT | OVERLONG_2,
+                TOO_SHORT,
+                TOO_SHORT | OVERLONG_3 | SURROGATE,
+                TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4);
+
+            byte_1_low = lookup_table(
+                CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+                CARRY | OVERLONG_2,
+                CARRY,
+                CARRY,
+                CARRY | TOO_LARGE,
+                CARRY | TOO_LARGE | TOO_LARGE_1000,
+                CARRY | TOO_LARGE | TOO_LARGE_1000,
+                CARRY | TOO_LARGE | TOO_LARGE_1000,
+                CARRY | TOO_LARGE | TOO_LARGE_1000,
+                CARRY | TOO_LARGE | TOO_LARGE_1000,
+                CARRY | TOO_LARGE | TOO_LARGE_1000,
+                CARRY | TOO_LARGE | TOO_LARGE_1000,
+                CARRY | TOO_LARGE | TOO_LARGE_1000,
+                CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+                CARRY | TOO_LARGE | TOO_LARGE_1000,
+                CARRY | TOO_LARGE | TOO_LARGE_1000);
+
+            byte_2_high = lookup_table(
+                TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+                TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+                TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+                TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+                TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+                TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+                TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT);
+
+            nibble = _mm_set1_epi8(0x0f);
+
+            error = _mm_setzero_si128();
+            prev_input = _mm_setzero_si128();
+            prev_incomplete = _mm_setzero_si128();
+        }
+
+        __m128i high_nibble(__m128i v) const
+        {
+            return _mm_and_si128(_mm_srli_epi16(v, 4), nibble);
+        }
+
+        void process(__m128i input)
+        {
+            if (!_mm_movemask_epi8(input))
             {
-                sb.ensure();
-                *sb.ptr++ = code;
+                // ASCII block; only need to check that the previous block was complete
+                error = _mm_or_si128(error, prev_incomplete);
             }
+            else
+            {
+                __m128i prev1 = _mm_alignr_epi8(input, prev_input, 15);
+                __m128i prev2 = _mm_alignr_epi8(input, prev_input, 14);
+                __m128i prev3 = _mm_alignr_epi8(input, prev_input, 13);
+
+                __m128i special = _mm_shuffle_epi8(byte_1_high, high_nibble(prev1));
+                special = _mm_and_si128(special, _mm_shuffle_epi8(byte_1_low, _mm_and_si128(prev1, nibble)));
+                special = _mm_and_si128(special, _mm_shuffle_epi8(byte_2_high, high_nibble(input)));
+
+                // 3rd and 4th bytes of a sequence must be continuation bytes
+                __m128i is_third = _mm_subs_epu8(prev2, _mm_set1_epi8(u8(0xe0 - 0x80)));
+                __m128i is_fourth = _mm_subs_epu8(prev3, _mm_set1_epi8(u8(0xf0 - 0x80)));
+                __m128i must23 = _mm_and_si128(_mm_or_si128(is_third, is_fourth), _mm_set1_epi8(u8(0x80)));
+
+                error = _mm_or_si128(error, _mm_xor_si128(must23, special));
+
+                // the last bytes must not start a sequence which continues into the next block
+                const __m128i max = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1,
+                                                  -1, -1, -1, -1, -1, u8(0xf0 - 1), u8(0xe0 - 1), u8(0xc0 - 1));
+                prev_incomplete = _mm_subs_epu8(input, max);
+            }
+
+            prev_input = input;
         }
 
-        sb.flush();
-        return s;
-    }
+        bool validate(const u8* source, size_t length)
+        {
+            size_t i = 0;
 
-    std::string utf8_from_utf32(const std::u32string& source)
+            for ( ; i + 16 <= length; i += 16)
+            {
+                process(_mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i)));
+            }
+
+            // process the remaining bytes padded with zeros; the padding also
+            // terminates any sequences which are incomplete at the end of input
+            alignas(16) u8 temp[16] = { 0 };
+            std::memcpy(temp, source + i, length - i);
+            process(_mm_load_si128(reinterpret_cast<const __m128i*>(temp)));
+            error = _mm_or_si128(error, prev_incomplete);
+
+            return _mm_testz_si128(error, error) != 0;
+        }
+    };
+
+#endif // MANGO_ENABLE_SSE4_1
+
+#if defined(MANGO_ENABLE_AVX2)
+
+    struct UTF8ValidatorAVX2
     {
-        std::string s;
-        StringBuilder<char, 128, 16> sb(s);
+        __m256i byte_1_high;
+        __m256i byte_1_low;
+        __m256i byte_2_high;
+        __m256i nibble;
 
-        const size_t length4 = source.length() & ~3;
-        size_t i = 0;
+        __m256i error;
+        __m256i prev_input;
+        __m256i prev_incomplete;
 
-        for (; i < length4; i += 4)
+        UTF8ValidatorAVX2()
         {
-            sb.ensure();
-            sb.ptr = utf8_encode(sb.ptr, source[i + 0]);
-            sb.ptr = utf8_encode(sb.ptr, source[i + 1]);
-            sb.ptr = utf8_encode(sb.ptr, source[i + 2]);
-            sb.ptr = utf8_encode(sb.ptr, source[i + 3]);
+            UTF8ValidatorSSE4 sse;
+
+            // the same tables are used in both 128 bit lanes
+            byte_1_high = _mm256_broadcastsi128_si256(sse.byte_1_high);
+            byte_1_low = _mm256_broadcastsi128_si256(sse.byte_1_low);
+            byte_2_high = _mm256_broadcastsi128_si256(sse.byte_2_high);
+            nibble = _mm256_set1_epi8(0x0f);
+
+            error = _mm256_setzero_si256();
+            prev_input = _mm256_setzero_si256();
+            prev_incomplete = _mm256_setzero_si256();
         }
 
-        sb.ensure();
-        for (; i < source.length(); ++i)
+        __m256i high_nibble(__m256i v) const
         {
-            sb.ptr = utf8_encode(sb.ptr, source[i]);
+            return _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble);
         }
 
-        sb.flush();
-        return s;
+        void process(__m256i input)
+        {
+            if (!_mm256_movemask_epi8(input))
+            {
+                error = _mm256_or_si256(error, prev_incomplete);
+            }
+            else
+            {
+                // previous bytes across the 128 bit lane boundary
+                __m256i shifted = _mm256_permute2x128_si256(prev_input, input, 0x21);
+                __m256i prev1 = _mm256_alignr_epi8(input, shifted, 15);
+                __m256i prev2 = _mm256_alignr_epi8(input, shifted, 14);
+                __m256i prev3 = _mm256_alignr_epi8(input, shifted, 13);
+
+                __m256i special = _mm256_shuffle_epi8(byte_1_high, high_nibble(prev1));
+                special = _mm256_and_si256(special, _mm256_shuffle_epi8(byte_1_low, _mm256_and_si256(prev1, nibble)));
+                special = _mm256_and_si256(special, _mm256_shuffle_epi8(byte_2_high, high_nibble(input)));
+
+                __m256i is_third = _mm256_subs_epu8(prev2, _mm256_set1_epi8(u8(0xe0 - 0x80)));
+                __m256i is_fourth = _mm256_subs_epu8(prev3, _mm256_set1_epi8(u8(0xf0 - 0x80)));
+                __m256i must23 = _mm256_and_si256(_mm256_or_si256(is_third, is_fourth), _mm256_set1_epi8(u8(0x80)));
+
+                error = _mm256_or_si256(error, _mm256_xor_si256(must23, special));
+
+                const __m256i max = _mm256_setr_epi8(
+                    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, u8(0xf0 - 1), u8(0xe0 - 1), u8(0xc0 - 1));
+                prev_incomplete = _mm256_subs_epu8(input, max);
+            }
+
+            prev_input = input;
+        }
+
+        bool validate(const u8* source, size_t length)
+        {
+            size_t i = 0;
+
+            for ( ; i + 32 <= length; i += 32)
+            {
+                process(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + i)));
+            }
+
+            alignas(32) u8 temp[32] = { 0 };
+            std::memcpy(temp, source + i, length - i);
+            process(_mm256_load_si256(reinterpret_cast<const __m256i*>(temp)));
+            error = _mm256_or_si256(error, prev_incomplete);
+
+            return _mm256_testz_si256(error, error) != 0;
+        }
+    };
+
+#endif // MANGO_ENABLE_AVX2
+
+} // namespace
+
+namespace mango
+{
+
+    // -----------------------------------------------------------------
+    // unicode conversions
+    // -----------------------------------------------------------------
+
+    bool is_utf8(const char* source, size_t length)
+    {
+        const u8* s = reinterpret_cast<const u8*>(source);
+#if defined(MANGO_ENABLE_AVX2)
+        UTF8ValidatorAVX2 validator;
+        return validator.validate(s, length);
+#elif defined(MANGO_ENABLE_SSE4_1)
+        UTF8ValidatorSSE4 validator;
+        return validator.validate(s, length);
+#else
+        return utf8_validate_scalar(s, length);
+#endif
     }
 
-#if 1
+    size_t utf32_from_utf8(char32_t* dest, const char* source, size_t length)
+    {
+        const u8* s = reinterpret_cast<const u8*>(source);
+        char32_t* d = dest;
 
-    std::u16string utf16_from_utf8(const std::string& source)
+        u32 state = UTF8_ACCEPT;
+        u32 code = 0;
+
+        for (size_t i = 0; i < length; )
+        {
+            if (state == UTF8_ACCEPT)
+            {
+                const size_t n = ascii_widen(d, s + i, length - i);
+                d += n;
+                i += n;
+                if (i == length)
+                    break;
+            }
+
+            if (!utf8_decode(state, code, s[i++]))
+            {
+                *d++ = code;
+            }
+            else if (state == UTF8_REJECT)
+            {
+                // invalid sequence terminates the conversion
+                break;
+            }
+        }
+
+        return d - dest;
+    }
+
+    size_t utf16_from_utf8(char16_t* dest, const char* source, size_t length)
     {
-        std::u16string s;
-        StringBuilder<char16_t, 256, 2> sb(s);
+        const u8* s = reinterpret_cast<const u8*>(source);
+        char16_t* d = dest;
 
-        u32 state = 0;
+        u32 state = UTF8_ACCEPT;
         u32 code = 0;
 
-        for (u8 c : source)
+        for (size_t i = 0; i < length; )
         {
-            if (!utf8_decode(state, code, c))
+            if (state == UTF8_ACCEPT)
             {
-                sb.ensure();
+                const size_t n = ascii_widen(d, s + i, length - i);
+                d += n;
+                i += n;
+                if (i == length)
+                    break;
+            }
 
-                // encode into temporary buffer
+            if (!utf8_decode(state, code, s[i++]))
+            {
                 if (code <= 0xffff)
                 {
-                    *sb.ptr++ = code;
+                    *d++ = code;
                 }
                 else
                 {
                     // encode code points above U+FFFF as surrogate pair
-                    sb.ptr[0] = 0xd7c0 + (code >> 10);
-                    sb.ptr[1] = 0xdc00 + (code & 0x3ff);
-                    sb.ptr += 2;
+                    d[0] = 0xd7c0 + (code >> 10);
+                    d[1] = 0xdc00 + (code & 0x3ff);
+                    d += 2;
                 }
             }
+            else if (state == UTF8_REJECT)
+            {
+                // invalid sequence terminates the conversion
+                break;
+            }
         }
 
-        sb.flush();
-        return s;
+        return d - dest;
     }
 
-    std::string utf8_from_utf16(const std::u16string& source)
+    size_t utf8_from_utf16(char* dest, const char16_t* source, size_t length)
     {
-        std::string s;
-        StringBuilder<char, 256, 4> sb(s);
-
-        const size_t length = source.length();
+        char* d = dest;
 
-        for (size_t i = 0; i < length; ++i)
+        for (size_t i = 0; i < length; )
         {
-            u32 code = source[i];
+            const size_t n = ascii_narrow(d, source + i, length - i);
+            d += n;
+            i += n;
+            if (i == length)
+                break;
+
+            u32 code = source[i++];
 
             // decode surrogate pair
-            if ((code - 0xd800) < 0x400)
+            if ((code - 0xd800) < 0x400 && i < length)
             {
-                const u32 low = source[++i];
+                const u32 low = source[i];
 
                 if ((low - 0xdc00) < 0x400)
                 {
                     code = ((code - 0xd800) << 10) + (low - 0xdc00) + 0x10000;
+                    ++i;
                 }
             }
 
+            d = utf8_encode(d, code);
+        }
+
+        return d - dest;
+    }
+
+    bool is_utf8(const std::string& source)
+    {
+        return is_utf8(source.data(), source.length());
+    }
+
+    std::u32string utf32_from_utf8(const std::string& source)
+    {
+        // each input byte produces at most one output character
+        std::u32string s(source.length(), 0);
+        size_t length = utf32_from_utf8(&s[0], source.data(), source.length());
+        s.resize(length);
+        return s;
+    }
+
+    std::string utf8_from_utf32(const std::u32string& source)
+    {
+        std::string s;
+        StringBuilder<char, 128, 16> sb(s);
+
+        const size_t length4 = source.length() & ~3;
+        size_t i = 0;
+
+        for (; i < length4; i += 4)
+        {
             sb.ensure();
-            sb.ptr = utf8_encode(sb.ptr, code);
+            sb.ptr = utf8_encode(sb.ptr, source[i + 0]);
+            sb.ptr = utf8_encode(sb.ptr, source[i + 1]);
+            sb.ptr = utf8_encode(sb.ptr, source[i + 2]);
+            sb.ptr = utf8_encode(sb.ptr, source[i + 3]);
+        }
+
+        sb.ensure();
+        for (; i < source.length(); ++i)
+        {
+            sb.ptr = utf8_encode(sb.ptr, source[i]);
         }
 
         sb.flush();
         return s;
     }
 
-#else
-
     std::u16string utf16_from_utf8(const std::string& source)
     {
-        std::wstring_convert<std::codecvt_utf8_utf16<char16_t>, char16_t> convert;
-        return convert.from_bytes(source);
+        // each input byte produces at most one output code unit
+        std::u16string s(source.length(), 0);
+        size_t length = utf16_from_utf8(&s[0], source.data(), source.length());
+        s.resize(length);
+        return s;
     }
 
     std::string utf8_from_utf16(const std::u16string& source)
     {
-        std::wstring_convert<std::codecvt_utf8_utf16<char16_t>, char16_t> convert;
-        return convert.to_bytes(source);
+        // each input code unit produces at most three output bytes
+        std::string s(source.length() * 3, 0);
+        size_t length = utf8_from_utf16(&s[0], source.data(), source.length());
+        s.resize(length);
+        return s;
     }
 
-#endif
-
     std::string u16_toBytes(const std::wstring& source)
     {
         // TODO: validate against reference implementation
@@ -3,11 +3,75 @@
     Copyright (C) 2012-2019 Twilight Finland 3D Oy Ltd. All rights reserved.
 */
 #include <ctime>
+#include <cmath>
+#include <algorithm>
+#include <unordered_set>
 #include <mango/core/timer.hpp>
+#include <mango/core/bits.hpp>
 
 namespace
 {
-    mango::Timer g_timer;
+    using namespace mango;
+
+    Timer g_timer;
+
+    constexpr int SUB_BUCKET_BITS = 5;
+    constexpr int SUB_BUCKET_COUNT = 1 << SUB_BUCKET_BITS;
+    constexpr int BUCKET_COUNT = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT;
+
+    // The histograms are identified by a serial number which is never reused so that
+    // the per-thread shard lists can not confuse a new histogram with a destroyed one.
+    std::atomic<u64> g_histogram_serial { 0 };
+
+    std::mutex g_histogram_mutex;
+    std::unordered_set<u64> g_histogram_live;
+
+    // prune the destroyed histograms from a thread's shard list at this size
+    constexpr size_t thread_shard_prune_size = 64;
+
+    // Only the owning thread writes a counter so plain load + store is sufficient;
+    // the counters are atomic so that the queries can read them concurrently.
+    inline void shard_add(std::atomic<u64>& counter, u64 value)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    struct CycleCalibration
+    {
+        double frequency; // ticks per second
+        double scale;     // nanoseconds per tick
+
+        CycleCalibration()
+        {
+#if defined(MANGO_ENABLE_TSC)
+            // measure the counter against steady_clock for a few milliseconds
+            using clock = std::chrono::steady_clock;
+
+            const clock::time_point t0 = clock::now();
+            const u64 c0 = Cycles::now();
+
+            clock::time_point t1;
+            do
+            {
+                t1 = clock::now();
+            } while (t1 - t0 < std::chrono::milliseconds(5));
+
+            const u64 c1 = Cycles::now();
+
+            const double seconds = std::chrono::duration<double>(t1 - t0).count();
+            frequency = double(c1 - c0) / seconds;
+#else
+            frequency = 1000000000.0;
+#endif
+            scale = 1000000000.0 / frequency;
+        }
+    };
+
+    const CycleCalibration& getCycleCalibration()
+    {
+        static CycleCalibration calibration;
+        return calibration;
+    }
 
 } // namespace
 
@@ -29,6 +93,256 @@ namespace mango
         return g_timer.ns();
     }
 
+    // -----------------------------------------------------------------------
+    // Cycles
+    // -----------------------------------------------------------------------
+
+    double Cycles::frequency()
+    {
+        return getCycleCalibration().frequency;
+    }
+
+    u64 Cycles::ns(u64 cycles)
+    {
+        return u64(double(cycles) * getCycleCalibration().scale);
+    }
+
+    // -----------------------------------------------------------------------
+    // Histogram
+    // -----------------------------------------------------------------------
+
+    struct Histogram::Shard
+    {
+        std::atomic<u64> counts[BUCKET_COUNT];
+        std::atomic<u64> total;
+        std::atomic<u64> sum;
+        std::atomic<u64> min;
+        std::atomic<u64> max;
+
+        Shard()
+        {
+            clear();
+        }
+
+        void clear()
+        {
+            for (auto& count : counts)
+            {
+                count.store(0, std::memory_order_relaxed);
+            }
+
+            total.store(0, std::memory_order_relaxed);
+            sum.store(0, std::memory_order_relaxed);
+            min.store(~0ull, std::memory_order_relaxed);
+            max.store(0, std::memory_order_relaxed);
+        }
+    };
+
+    Histogram::Histogram()
+        : m_id(++g_histogram_serial)
+    {
+        std::lock_guard<std::mutex> lock(g_histogram_mutex);
+        g_histogram_live.insert(m_id);
+    }
+
+    Histogram::~Histogram()
+    {
+        std::lock_guard<std::mutex> lock(g_histogram_mutex);
+        g_histogram_live.erase(m_id);
+    }
+
+    Histogram::Shard* Histogram::getShard()
+    {
+        thread_local std::vector<std::pair<u64, Shard*>> t_shards;
+
+        for (auto& shard : t_shards)
+        {
+            if (shard.first == m_id)
+                return shard.second;
+        }
+
+        if (t_shards.size() >= thread_shard_prune_size)
+        {
+            // the shards are owned by the histograms; only the list entries are dropped
+            std::lock_guard<std::mutex> lock(g_histogram_mutex);
+            t_shards.erase(std::remove_if(t_shards.begin(), t_shards.end(), [] (const std::pair<u64, Shard*>& shard)
+            {
+                return !g_histogram_live.count(shard.first);
+            }), t_shards.end());
+        }
+
+        Shard* shard = new Shard();
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_shards.emplace_back(shard);
+        t_shards.emplace_back(m_id, shard);
+
+        return shard;
+    }
+
+    void Histogram::snapshot(u64* counts, u64& total, u64& sum, u64& min, u64& max) const
+    {
+        total = 0;
+        sum = 0;
+        min = ~0ull;
+        max = 0;
+
+        if (counts)
+        {
+            std::fill(counts, counts + BUCKET_COUNT, 0);
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        for (auto& shard : m_shards)
+        {
+            if (counts)
+            {
+                for (int i = 0; i < BUCKET_COUNT; ++i)
+                {
+                    counts[i] += shard->counts[i].load(std::memory_order_relaxed);
+                }
+            }
+
+            total += shard->total.load(std::memory_order_relaxed);
+            sum += shard->sum.load(std::memory_order_relaxed);
+            min = std::min(min, shard->min.load(std::memory_order_relaxed));
+            max = std::max(max, shard->max.load(std::memory_order_relaxed));
+        }
+    }
+
+    int Histogram::getIndex(u64 value)
+    {
+        if (value < SUB_BUCKET_COUNT)
+            return int(value);
+
+        // msb selects the power of two range, the following bits the linear sub-bucket
+        const int msb = u64_log2(value);
+        const int sub = int(value >> (msb - SUB_BUCKET_BITS)) & (SUB_BUCKET_COUNT - 1);
+        return (msb - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT + sub;
+    }
+
+    u64 Histogram::getValue(int index)
+    {
+        if (index < SUB_BUCKET_COUNT)
+            return u64(index);
+
+        // highest value which maps into the bucket
+        const int shift = index / SUB_BUCKET_COUNT - 1;
+        const u64 sub = index & (SUB_BUCKET_COUNT - 1);
+        const u64 lower = (SUB_BUCKET_COUNT + sub) << shift;
+        return lower + ((1ull << shift) - 1);
+    }
+
+    void Histogram::record(u64 value, u64 count)
+    {
+        Shard* shard = getShard();
+
+        shard_add(shard->counts[getIndex(value)], count);
+        shard_add(shard->total, count);
+        shard_add(shard->sum, value * count);
+
+        if (value < shard->min.load(std::memory_order_relaxed))
+            shard->min.store(value, std::memory_order_relaxed);
+
+        if (value > shard->max.load(std::memory_order_relaxed))
+            shard->max.store(value, std::memory_order_relaxed);
+    }
+
+    void Histogram::merge(const Histogram& histogram)
+    {
+        std::vector<u64> counts(BUCKET_COUNT);
+        u64 total, sum, min, max;
+        histogram.snapshot(counts.data(), total, sum, min, max);
+
+        if (!total)
+            return;
+
+        // the merged data is written into the calling thread's shard
+        Shard* shard = getShard();
+
+        for (int i = 0; i < BUCKET_COUNT; ++i)
+        {
+            if (counts[i])
+            {
+                shard_add(shard->counts[i], counts[i]);
+            }
+        }
+
+        shard_add(shard->total, total);
+        shard_add(shard->sum, sum);
+
+        if (min < shard->min.load(std::memory_order_relaxed))
+            shard->min.store(min, std::memory_order_relaxed);
+
+        if (max > shard->max.load(std::memory_order_relaxed))
+            shard->max.store(max, std::memory_order_relaxed);
+    }
+
+    void Histogram::reset()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        for (auto& shard : m_shards)
+        {
+            shard->clear();
+        }
+    }
+
+    u64 Histogram::count() const
+    {
+        u64 total, sum, min, max;
+        snapshot(nullptr, total, sum, min, max);
+        return total;
+    }
+
+    u64 Histogram::min() const
+    {
+        u64 total, sum, min, max;
+        snapshot(nullptr, total, sum, min, max);
+        return total ? min : 0;
+    }
+
+    u64 Histogram::max() const
+    {
+        u64 total, sum, min, max;
+        snapshot(nullptr, total, sum, min, max);
+        return max;
+    }
+
+    double Histogram::mean() const
+    {
+        u64 total, sum, min, max;
+        snapshot(nullptr, total, sum, min, max);
+        return total ? double(sum) / double(total) : 0.0;
+    }
+
+    u64 Histogram::percentile(double percent) const
+    {
+        std::vector<u64> counts(BUCKET_COUNT);
+        u64 total, sum, min, max;
+        snapshot(counts.data(), total, sum, min, max);
+
+        if (!total)
+            return 0;
+
+        percent = std::max(0.0, std::min(100.0, percent));
+        const u64 target = std::max(u64(1), u64(std::ceil(percent * total / 100.0)));
+
+        u64 accumulated = 0;
+
+        for (int i = 0; i < BUCKET_COUNT; ++i)
+        {
+            accumulated += counts[i];
+            if (accumulated >= target)
+            {
+                return std::min(getValue(i), max);
+            }
+        }
+
+        return max;
+    }
+
     LocalTime getLocalTime()
     {
         std::time_t t = std::time(nullptr);
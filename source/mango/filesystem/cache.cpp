@@ -0,0 +1,423 @@
+/*
+    MANGO Multimedia Development Platform
+    Copyright (C) 2012-2019 Twilight Finland 3D Oy Ltd. All rights reserved.
+*/
+#include <atomic>
+#include <mango/core/thread.hpp>
+#include <mango/filesystem/mapper.hpp>
+#include "cache.hpp"
+
+namespace
+{
+    using namespace mango;
+    using namespace mango::filesystem;
+
+    std::atomic<bool> g_persistent_index { false };
+
+    constexpr size_t default_cache_budget = 64 * 1024 * 1024;
+    constexpr size_t large_solid_capacity = 2;
+    constexpr size_t default_container_capacity = 64;
+
+    class VirtualMemoryCache : public VirtualMemory
+    {
+    protected:
+        MemoryCache::Entry m_entry;
+
+    public:
+        VirtualMemoryCache(MemoryCache::Entry entry, Memory memory)
+            : m_entry(entry)
+        {
+            m_memory = memory;
+        }
+
+        ~VirtualMemoryCache()
+        {
+        }
+    };
+
+} // namespace
+
+namespace mango {
+namespace filesystem {
+
+    // -----------------------------------------------------------------
+    // MemoryCache
+    // -----------------------------------------------------------------
+
+    MemoryCache::MemoryCache(size_t budget)
+        : m_budget(budget)
+    {
+    }
+
+    MemoryCache::~MemoryCache()
+    {
+    }
+
+    void MemoryCache::evict(size_t budget)
+    {
+        while (m_size > budget && !m_lru.empty())
+        {
+            Node& node = m_lru.back();
+            m_size -= (*node.entry)->size;
+            m_map.erase(node.key);
+            m_lru.pop_back();
+        }
+    }
+
+    void MemoryCache::evictLarge(size_t capacity)
+    {
+        while (m_large.size() > capacity)
+        {
+            m_map.erase(m_large.back().key);
+            m_large.pop_back();
+        }
+    }
+
+    void MemoryCache::setBudget(size_t bytes)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_budget = bytes;
+        evict(m_budget);
+        evictLarge(m_budget ? large_solid_capacity : 0);
+    }
+
+    size_t MemoryCache::getBudget() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_budget;
+    }
+
+    void MemoryCache::clear()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        evict(0);
+        evictLarge(0);
+    }
+
+    MemoryCache::Entry MemoryCache::find(const std::string& key)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto i = m_map.find(key);
+        if (i == m_map.end())
+        {
+            return Entry();
+        }
+
+        // move to front of the LRU list
+        std::list<Node>& list = i->second->large ? m_large : m_lru;
+        list.splice(list.begin(), list, i->second);
+        return i->second->entry;
+    }
+
+    MemoryCache::Entry MemoryCache::insert(const std::string& key, Entry entry, bool solid)
+    {
+        const size_t size = (*entry)->size;
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto i = m_map.find(key);
+        if (i != m_map.end())
+        {
+            // another thread inserted the same key first
+            std::list<Node>& list = i->second->large ? m_large : m_lru;
+            list.splice(list.begin(), list, i->second);
+            return i->second->entry;
+        }
+
+        if (size <= m_budget / 4)
+        {
+            evict(m_budget - size);
+            m_lru.push_front({ key, entry, false });
+            m_map[key] = m_lru.begin();
+            m_size += size;
+        }
+        else if (solid && m_budget)
+        {
+            // the number of large solid blocks is limited for all mappers together
+            m_large.push_front({ key, entry, true });
+            m_map[key] = m_large.begin();
+            evictLarge(large_solid_capacity);
+        }
+
+        // the other large entries would flush the cache; they are only reference counted
+        return entry;
+    }
+
+    void MemoryCache::erase(const std::string& prefix)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto match = [&] (const Node& node)
+        {
+            return !node.key.compare(0, prefix.length(), prefix);
+        };
+
+        for (auto i = m_lru.begin(); i != m_lru.end(); )
+        {
+            if (match(*i))
+            {
+                m_size -= (*i->entry)->size;
+                m_map.erase(i->key);
+                i = m_lru.erase(i);
+            }
+            else
+            {
+                ++i;
+            }
+        }
+
+        for (auto i = m_large.begin(); i != m_large.end(); )
+        {
+            if (match(*i))
+            {
+                m_map.erase(i->key);
+                i = m_large.erase(i);
+            }
+            else
+            {
+                ++i;
+            }
+        }
+    }
+
+    MemoryCache::Entry MemoryCache::reserve(const std::string& key, std::promise<Entry>& promise, std::shared_future<Entry>& future)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto i = m_map.find(key);
+        if (i != m_map.end())
+        {
+            // the entry was inserted after find()
+            std::list<Node>& list = i->second->large ? m_large : m_lru;
+            list.splice(list.begin(), list, i->second);
+            return i->second->entry;
+        }
+
+        auto p = m_pending.find(key);
+        if (p != m_pending.end())
+        {
+            future = p->second;
+        }
+        else
+        {
+            m_pending[key] = promise.get_future().share();
+        }
+
+        return Entry();
+    }
+
+    MemoryCache::Entry MemoryCache::complete(const std::string& key, Entry entry)
+    {
+        // the pending key is removed when the entry is in the cache so that the
+        // threads arriving after this find the entry instead of creating it again
+        entry = insert(key, entry);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_pending.erase(key);
+        return entry;
+    }
+
+    void MemoryCache::abandon(const std::string& key)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_pending.erase(key);
+    }
+
+    MemoryCache& getMemoryCache()
+    {
+        static MemoryCache cache(default_cache_budget);
+        return cache;
+    }
+
+    std::string createContainerKey()
+    {
+        // the key has a fixed length so that it is never a prefix of another key;
+        // each mapper has its own key so the decrypted content is only visible to
+        // the mapper which has been able to decrypt it
+        static std::atomic<u64> counter { 0 };
+        const u64 id = ++counter;
+        return std::string(reinterpret_cast<const char*>(&id), sizeof(id));
+    }
+
+    std::string getBlockKey(const std::string& container, u64 index)
+    {
+        std::string key = container;
+        key += '\0';
+        key += std::to_string(index);
+        return key;
+    }
+
+    VirtualMemory* createCacheView(MemoryCache::Entry entry)
+    {
+        return new VirtualMemoryCache(entry, *entry);
+    }
+
+    VirtualMemory* createCacheView(MemoryCache::Entry entry, size_t offset, size_t size)
+    {
+        Memory memory = *entry;
+        return new VirtualMemoryCache(entry, Memory(memory.address + offset, size));
+    }
+
+    // -----------------------------------------------------------------
+    // ContainerCache
+    // -----------------------------------------------------------------
+
+    ContainerCache::ContainerCache(size_t capacity)
+        : m_capacity(capacity)
+    {
+    }
+
+    ContainerCache::~ContainerCache()
+    {
+    }
+
+    void ContainerCache::evict(size_t capacity)
+    {
+        while (m_map.size() > capacity && !m_lru.empty())
+        {
+            Node& node = m_lru.back();
+            m_map.erase(node.key);
+            m_lru.pop_back();
+        }
+    }
+
+    void ContainerCache::clear()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        evict(0);
+    }
+
+    void ContainerCache::invalidate(const std::string& key)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        for (auto i = m_lru.begin(); i != m_lru.end(); )
+        {
+            // the cache keys are the container key followed by '\0' and the password,
+            // the nested containers continue the key with '/'
+            const std::string& k = i->key;
+            if (k.length() > key.length() && !k.compare(0, key.length(), key) &&
+                (k[key.length()] == '\0' || k[key.length()] == '/'))
+            {
+                m_map.erase(k);
+                i = m_lru.erase(i);
+            }
+            else
+            {
+                ++i;
+            }
+        }
+    }
+
+    ContainerCache::Entry ContainerCache::find(const std::string& key, u64 time, u64 size, const Entry& parent)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto i = m_map.find(key);
+        if (i == m_map.end())
+        {
+            return Entry();
+        }
+
+        const Entry& entry = i->second->entry;
+        if (entry->time != time || entry->size != size || entry->parent != parent)
+        {
+            // stale
+            m_lru.erase(i->second);
+            m_map.erase(i);
+            return Entry();
+        }
+
+        // move to front of the LRU list
+        m_lru.splice(m_lru.begin(), m_lru, i->second);
+        return i->second->entry;
+    }
+
+    ContainerCache::Entry ContainerCache::insert(const std::string& key, Entry entry)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto i = m_map.find(key);
+        if (i != m_map.end())
+        {
+            const Entry& current = i->second->entry;
+            if (current->time == entry->time && current->size == entry->size && current->parent == entry->parent)
+            {
+                // another thread inserted the same container first
+                m_lru.splice(m_lru.begin(), m_lru, i->second);
+                return current;
+            }
+
+            m_lru.erase(i->second);
+            m_map.erase(i);
+        }
+
+        evict(m_capacity - 1);
+        m_lru.push_front({ key, entry });
+        m_map[key] = m_lru.begin();
+
+        return entry;
+    }
+
+    ContainerCache& getContainerCache()
+    {
+        struct Instance
+        {
+            ContainerCache cache;
+
+            Instance()
+                : cache(default_container_capacity)
+            {
+                // the mappers wait for their ThreadPool queues and remove their MemoryCache
+                // entries when they are destroyed; the pool and the memory cache are
+                // created first so that they are destroyed after the container cache
+                ThreadPool::getInstance();
+                getMemoryCache();
+            }
+        };
+
+        static Instance instance;
+        return instance.cache;
+    }
+
+    // -----------------------------------------------------------------
+    // functions
+    // -----------------------------------------------------------------
+
+    void setMemoryCacheBudget(size_t bytes)
+    {
+        getMemoryCache().setBudget(bytes);
+    }
+
+    void clearMemoryCache()
+    {
+        getMemoryCache().clear();
+    }
+
+    void closeContainer(const std::string& filename)
+    {
+        std::string key = filename;
+        u64 time;
+        u64 size;
+        getContainerStatus(filename, key, time, size);
+        getContainerCache().invalidate(key);
+    }
+
+    void closeContainers()
+    {
+        getContainerCache().clear();
+    }
+
+    void setPersistentIndex(bool enable)
+    {
+        g_persistent_index = enable;
+    }
+
+    bool isPersistentIndex()
+    {
+        return g_persistent_index;
+    }
+
+} // namespace filesystem
+} // namespace mango
@@ -0,0 +1,211 @@
+/*
+    MANGO Multimedia Development Platform
+    Copyright (C) 2012-2019 Twilight Finland 3D Oy Ltd. All rights reserved.
+*/
+#pragma once
+
+#include <list>
+#include <mutex>
+#include <future>
+#include <string>
+#include <memory>
+#include <unordered_map>
+#include <mango/core/memory.hpp>
+#include <mango/filesystem/mapper.hpp>
+
+namespace mango {
+namespace filesystem {
+
+    // -----------------------------------------------------------------
+    // MemoryCache
+    // -----------------------------------------------------------------
+
+    // Byte budgeted LRU cache of decompressed container entries and blocks
+    // shared by all mappers. The entries are reference counted so evicting an
+    // entry does not invalidate the views which are still in use.
+    //
+    // The entries larger than a quarter of the budget would flush the cache; they
+    // are not kept unless they are solid blocks, which many files are viewed from.
+    // A few of the most recently used solid blocks are kept outside of the budget.
+
+    class MemoryCache : protected NonCopyable
+    {
+    public:
+        using Entry = std::shared_ptr<VirtualMemory>;
+
+    protected:
+        struct Node
+        {
+            std::string key;
+            Entry entry;
+            bool large;
+        };
+
+        mutable std::mutex m_mutex;
+        std::list<Node> m_lru; // front is the most recently used
+        std::list<Node> m_large; // solid blocks larger than a quarter of the budget
+        std::unordered_map<std::string, std::list<Node>::iterator> m_map;
+        std::unordered_map<std::string, std::shared_future<Entry>> m_pending; // keys being created
+        size_t m_budget;
+        size_t m_size { 0 };
+
+        void evict(size_t budget);
+        void evictLarge(size_t capacity);
+
+        // find the entry or the pending creation of it; when neither exists the
+        // promise is registered as the pending creation and future is left invalid
+        Entry reserve(const std::string& key, std::promise<Entry>& promise, std::shared_future<Entry>& future);
+        Entry complete(const std::string& key, Entry entry);
+        void abandon(const std::string& key);
+
+    public:
+        MemoryCache(size_t budget);
+        ~MemoryCache();
+
+        void setBudget(size_t bytes);
+        size_t getBudget() const;
+        void clear();
+
+        Entry find(const std::string& key);
+        Entry insert(const std::string& key, Entry entry, bool solid = false);
+
+        // remove the entries whose key starts with the prefix; the mappers remove
+        // their entries with the container key when they are destroyed
+        void erase(const std::string& prefix);
+
+        // find the entry or create it with func() which returns VirtualMemory*
+        template <typename Func>
+        Entry acquire(const std::string& key, Func func)
+        {
+            Entry entry = find(key);
+            if (entry)
+            {
+                return entry;
+            }
+
+            // only one thread creates the entry; the others wait for it
+            std::promise<Entry> promise;
+            std::shared_future<Entry> future;
+
+            entry = reserve(key, promise, future);
+            if (entry)
+            {
+                return entry;
+            }
+
+            if (future.valid())
+            {
+                return future.get();
+            }
+
+            try
+            {
+                // decompress outside of the lock
+                entry = complete(key, Entry(func()));
+            }
+            catch (...)
+            {
+                abandon(key);
+                promise.set_exception(std::current_exception());
+                throw;
+            }
+
+            promise.set_value(entry);
+            return entry;
+        }
+    };
+
+    MemoryCache& getMemoryCache();
+
+    // Unique key prefix for the entries of one opened container. The containers are
+    // shared through the ContainerCache which identifies the files by canonical path,
+    // modification time and size, so a changed file is opened again with a new key
+    // and the entries cached from its previous contents are never returned.
+    std::string createContainerKey();
+
+    // keys of the files are the container key followed by the filename; the block
+    // keys are separated with a zero which cannot appear in a filename
+    std::string getBlockKey(const std::string& container, u64 index);
+
+    // reference counted view into a cached entry
+    VirtualMemory* createCacheView(MemoryCache::Entry entry);
+    VirtualMemory* createCacheView(MemoryCache::Entry entry, size_t offset, size_t size);
+
+    // -----------------------------------------------------------------
+    // ContainerCache
+    // -----------------------------------------------------------------
+
+    // An opened container: the parent memory and the mapper with the parsed index.
+    // Nested containers keep their parent alive.
+
+    struct ContainerHandle
+    {
+        std::string key; // canonical path of the file; nested containers are appended with '/'
+        u64 time = 0;    // modification time and size of the file; zero for nested containers
+        u64 size = 0;
+        std::shared_ptr<ContainerHandle> parent;
+        std::unique_ptr<VirtualMemory> memory;
+        std::unique_ptr<AbstractMapper> mapper;
+    };
+
+    // Count limited LRU cache of the opened containers shared by all mappers. The
+    // handles are reference counted so evicting or invalidating a container does not
+    // affect the mappers which are still using it.
+
+    class ContainerCache : protected NonCopyable
+    {
+    public:
+        using Entry = std::shared_ptr<ContainerHandle>;
+
+    protected:
+        struct Node
+        {
+            std::string key;
+            Entry entry;
+        };
+
+        mutable std::mutex m_mutex;
+        std::list<Node> m_lru; // front is the most recently used
+        std::unordered_map<std::string, std::list<Node>::iterator> m_map;
+        size_t m_capacity;
+
+        void evict(size_t capacity);
+
+    public:
+        ContainerCache(size_t capacity);
+        ~ContainerCache();
+
+        void clear();
+
+        // remove the container and the containers nested in it
+        void invalidate(const std::string& key);
+
+        // the entry is discarded when the file or the parent has changed
+        Entry find(const std::string& key, u64 time, u64 size, const Entry& parent);
+        Entry insert(const std::string& key, Entry entry);
+
+        // find the entry or create it with func() which returns ContainerHandle*
+        template <typename Func>
+        Entry acquire(const std::string& key, u64 time, u64 size, const Entry& parent, Func func)
+        {
+            Entry entry = find(key, time, size, parent);
+            if (!entry)
+            {
+                // parse outside of the lock; if another thread finishes
+                // first the older entry is kept and ours is released
+                entry = insert(key, Entry(func()));
+            }
+            return entry;
+        }
+    };
+
+    ContainerCache& getContainerCache();
+
+    // Platform specific: canonical path, modification time and size of a file.
+    bool getContainerStatus(const std::string& filename, std::string& canonical, u64& time, u64& size);
+
+    // see setPersistentIndex()
+    bool isPersistentIndex();
+
+} // namespace filesystem
+} // namespace mango
@@ -4,8 +4,42 @@
 */
 #include <mango/core/string.hpp>
 #include <mango/core/exception.hpp>
+#include <mango/core/timer.hpp>
 #include <mango/filesystem/file.hpp>
 
+namespace
+{
+    using namespace mango;
+    using namespace mango::filesystem;
+
+    template <typename Func>
+    std::future<std::unique_ptr<File>> openInPool(Func func)
+    {
+        auto queue = std::make_shared<ConcurrentQueue>("file.open");
+        auto promise = std::make_shared<std::promise<std::unique_ptr<File>>>();
+        auto result = std::make_shared<std::future<std::unique_ptr<File>>>(promise->get_future());
+
+        queue->enqueue([promise, func] {
+            try
+            {
+                promise->set_value(func());
+            }
+            catch (...)
+            {
+                promise->set_exception(std::current_exception());
+            }
+        });
+
+        // The waiting thread runs the pool tasks until the file is opened; a task which
+        // waits for the file can not deadlock the pool by occupying all of the workers.
+        return std::async(std::launch::deferred, [queue, result] {
+            queue->wait();
+            return result->get();
+        });
+    }
+
+} // namespace
+
 namespace mango {
 namespace filesystem {
 
@@ -13,7 +47,7 @@ namespace filesystem {
     // File
     // -----------------------------------------------------------------
 
-    File::File(const std::string& s)
+    File::File(const std::string& s, u32 flags)
     {
         // split s into pathname + filename
         size_t n = s.find_last_of("/\\:");
@@ -23,7 +57,7 @@ namespace filesystem {
         m_filename = filename;
 
         // create a internal path
-        m_path.reset(new Path(filepath));
+        m_path.reset(new Path(std::make_shared<Mapper>(filepath, "")));
 
         Mapper* path_mapper = m_path->m_mapper.get();
         if (!path_mapper)
@@ -37,9 +71,11 @@ namespace filesystem {
             VirtualMemory* vmemory = mapper->mmap(path_mapper->basepath() + m_filename);
             m_memory = UniqueObject<VirtualMemory>(vmemory);
         }
+
+        configure(flags);
     }
 
-    File::File(const Path& path, const std::string& s)
+    File::File(const Path& path, const std::string& s, u32 flags)
     {
         // split s into pathname + filename
         size_t n = s.find_last_of("/\\:");
@@ -49,7 +85,7 @@ namespace filesystem {
         m_filename = filename;
 
         // create a internal path
-        m_path.reset(new Path(path, filepath));
+        m_path.reset(new Path(std::make_shared<Mapper>(path.m_mapper, filepath, "")));
 
         Mapper* path_mapper = m_path->m_mapper.get();
         if (!path_mapper)
@@ -60,9 +96,12 @@ namespace filesystem {
         AbstractMapper* mapper = *path_mapper;
         if (mapper)
         {
+            ScopedTimer timer(path.m_histogram);
             VirtualMemory* vmemory = mapper->mmap(path_mapper->basepath() + m_filename);
             m_memory = UniqueObject<VirtualMemory>(vmemory);
         }
+
+        configure(flags);
     }
 
     File::File(const Memory& memory, const std::string& extension, const std::string& filename)
@@ -93,6 +132,35 @@ namespace filesystem {
 
     File::~File()
     {
+        if (m_prefetch)
+        {
+            // the prefetch tasks must not touch the memory after it is unmapped
+            m_prefetch->cancel();
+            m_prefetch.reset();
+        }
+    }
+
+    void File::configure(u32 flags)
+    {
+        if (!m_memory)
+        {
+            return;
+        }
+
+        if (flags & SEQUENTIAL)
+        {
+            m_memory->advise(MemoryAccess::SEQUENTIAL);
+        }
+
+        if (flags & RANDOM)
+        {
+            m_memory->advise(MemoryAccess::RANDOM);
+        }
+
+        if (flags & POPULATE)
+        {
+            m_memory->advise(MemoryAccess::POPULATE);
+        }
     }
 
     const std::string& File::filename() const
@@ -130,5 +198,152 @@ namespace filesystem {
         return m_memory ? *m_memory : Memory();
     }
 
+    void File::advise(MemoryAccess access, size_t offset, size_t size) const
+    {
+        if (m_memory)
+        {
+            m_memory->advise(access, offset, size);
+        }
+    }
+
+    void File::prefetch(size_t offset, size_t size)
+    {
+        Memory memory = getMemory();
+        if (offset >= memory.size)
+        {
+            return;
+        }
+
+        size_t available = memory.size - offset;
+        size = size ? std::min(size, available) : available;
+
+        // the kernel starts reading the range asynchronously
+        m_memory->advise(MemoryAccess::WILLNEED, offset, size);
+
+        if (!m_prefetch)
+        {
+            m_prefetch.reset(new ConcurrentQueue("file.prefetch", Priority::LOW));
+        }
+
+        // map the pages in the background in blocks so that the prefetch can be cancelled
+        const size_t block_size = 1024 * 1024;
+
+        for (size_t block = offset; block < offset + size; block += block_size)
+        {
+            const size_t bytes = std::min(block_size, offset + size - block);
+            VirtualMemory* vmemory = m_memory.get();
+
+            m_prefetch->enqueue([vmemory, block, bytes] {
+                vmemory->advise(MemoryAccess::POPULATE, block, bytes);
+            });
+        }
+    }
+
+    std::future<std::unique_ptr<File>> File::openAsync(const std::string& filename, u32 flags)
+    {
+        return openInPool([filename, flags] {
+            return std::unique_ptr<File>(new File(filename, flags | POPULATE));
+        });
+    }
+
+    std::future<std::unique_ptr<File>> File::openAsync(const Path& path, const std::string& filename, u32 flags)
+    {
+        // the task holds a reference to the mapper so that the path can be released
+        std::shared_ptr<Mapper> mapper = path.m_mapper;
+        Histogram* histogram = path.m_histogram;
+
+        return openInPool([mapper, histogram, filename, flags] {
+            Path parent(mapper);
+            parent.setHistogram(histogram);
+            return std::unique_ptr<File>(new File(parent, filename, flags | POPULATE));
+        });
+    }
+
+    // -----------------------------------------------------------------
+    // InputFileStream
+    // -----------------------------------------------------------------
+
+    InputFileStream::InputFileStream(const std::string& s)
+        : InputFileStream(std::make_shared<Mapper>(getPath(s), ""), removePath(s))
+    {
+    }
+
+    InputFileStream::InputFileStream(const Path& path, const std::string& s)
+        : InputFileStream(std::make_shared<Mapper>(path.m_mapper, getPath(s), ""), removePath(s))
+    {
+    }
+
+    InputFileStream::InputFileStream(std::shared_ptr<Mapper> mapper, const std::string& filename)
+        : m_filename(filename)
+    {
+        // create a internal path
+        m_path.reset(new Path(mapper));
+
+        Mapper* path_mapper = m_path->m_mapper.get();
+        if (!path_mapper)
+        {
+            MANGO_EXCEPTION("[InputFileStream] Mapper interface missing.");
+        }
+
+        AbstractMapper* abstract = *path_mapper;
+        if (!abstract)
+        {
+            MANGO_EXCEPTION("[InputFileStream] Mapper interface missing.");
+        }
+
+        m_stream.reset(abstract->open(path_mapper->basepath() + m_filename));
+    }
+
+    InputFileStream::~InputFileStream()
+    {
+    }
+
+    const std::string& InputFileStream::filename() const
+    {
+        return m_filename;
+    }
+
+    const std::string& InputFileStream::pathname() const
+    {
+        return m_path->m_mapper->pathname();
+    }
+
+    u64 InputFileStream::size() const
+    {
+        return m_stream->size();
+    }
+
+    u64 InputFileStream::offset() const
+    {
+        return m_stream->offset();
+    }
+
+    void InputFileStream::seek(u64 distance, SeekMode mode)
+    {
+        m_stream->seek(distance, mode);
+    }
+
+    void InputFileStream::read(void* dest, size_t size)
+    {
+        m_stream->read(dest, size);
+    }
+
+    void InputFileStream::write(const void* data, size_t size)
+    {
+        MANGO_UNREFERENCED(data);
+        MANGO_UNREFERENCED(size);
+        MANGO_EXCEPTION("[InputFileStream] Stream is read-only.");
+    }
+
+    Memory InputFileStream::map(u64 offset, size_t size)
+    {
+        return m_stream->map(offset, size);
+    }
+
+    VirtualMemory* InputFileStream::mmap(u64 offset, size_t size)
+    {
+        return m_stream->mmap(offset, size);
+    }
+
 } // namespace filesystem
 } // namespace mango
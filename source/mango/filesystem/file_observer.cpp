@@ -0,0 +1,229 @@
+/*
+    MANGO Multimedia Development Platform
+    Copyright (C) 2012-2019 Twilight Finland 3D Oy Ltd. All rights reserved.
+*/
+#include <mutex>
+#include <condition_variable>
+#include "file_observer.hpp"
+
+namespace
+{
+    using namespace mango;
+    using namespace mango::filesystem;
+
+    // Merge a new event into the earlier event of the same file. Zero means that
+    // the file was created and deleted inside the window and is not reported.
+    u32 mergeEvent(u32 previous, u32 current)
+    {
+        const u32 mask = FileObserver::CREATED | FileObserver::DELETED | FileObserver::MODIFIED;
+        const u32 type = current & ~mask;
+        const u32 prev = previous & mask;
+        const u32 next = current & mask;
+
+        if (!prev)
+        {
+            return current;
+        }
+
+        if (prev & FileObserver::CREATED)
+        {
+            // still a new file unless it is gone already
+            return (next & FileObserver::DELETED) ? 0 : FileObserver::CREATED | type;
+        }
+
+        if (prev & FileObserver::DELETED)
+        {
+            // replaced, for example saved with a rename over the old file
+            return (next & FileObserver::CREATED) ? FileObserver::MODIFIED | type : previous;
+        }
+
+        // modified
+        return (next & FileObserver::DELETED) ? FileObserver::DELETED | type : FileObserver::MODIFIED | type;
+    }
+
+} // namespace
+
+namespace mango {
+namespace filesystem {
+
+    // -----------------------------------------------------------------
+    // FileEventBatch
+    // -----------------------------------------------------------------
+
+    struct FileEventBatch::Pending
+    {
+        std::mutex mutex;
+        std::condition_variable condition;
+        int count = 0;
+    };
+
+    FileEventBatch::FileEventBatch(FileObserver* observer, u32 debounce,
+                                   const std::function<void(std::function<void()>&&)>& dispatch)
+        : m_observer(observer)
+        , m_dispatch(dispatch)
+        , m_debounce(debounce)
+        , m_pending(std::make_shared<Pending>())
+    {
+    }
+
+    FileEventBatch::~FileEventBatch()
+    {
+        // the observer must not be called after it has been stopped
+        std::unique_lock<std::mutex> lock(m_pending->mutex);
+        m_pending->condition.wait(lock, [this] {
+            return m_pending->count == 0;
+        });
+    }
+
+    void FileEventBatch::add(u32 flags, const std::string& filename)
+    {
+        const Clock::time_point now = Clock::now();
+        if (m_events.empty())
+        {
+            m_first = now;
+        }
+        m_last = now;
+
+        auto i = m_lookup.find(filename);
+        if (i != m_lookup.end())
+        {
+            FileEvent& event = m_events[i->second];
+            event.flags = mergeEvent(event.flags, flags);
+
+            if (!event.flags && !filename.empty())
+            {
+                // the event is skipped on delivery; a later event starts a new entry
+                m_lookup.erase(i);
+            }
+        }
+        else
+        {
+            m_lookup[filename] = m_events.size();
+            m_events.push_back({ flags, filename });
+        }
+    }
+
+    int FileEventBatch::timeout() const
+    {
+        if (m_events.empty())
+        {
+            return -1;
+        }
+
+        // wait for a quiet period but do not hold the events forever under constant load
+        const Clock::time_point now = Clock::now();
+        const Clock::time_point deadline = std::min(m_last + m_debounce, m_first + m_debounce * 8);
+        if (deadline <= now)
+        {
+            return 0;
+        }
+
+        auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now);
+        return int(remaining.count()) + 1;
+    }
+
+    void FileEventBatch::update(bool force)
+    {
+        if (m_events.empty() || (!force && timeout() > 0))
+        {
+            return;
+        }
+
+        std::vector<FileEvent> events;
+        events.reserve(m_events.size());
+
+        for (FileEvent& event : m_events)
+        {
+            if (event.flags || event.filename.empty())
+            {
+                events.push_back(std::move(event));
+            }
+        }
+
+        m_events.clear();
+        m_lookup.clear();
+
+        if (events.empty())
+        {
+            return;
+        }
+
+        if (!m_dispatch)
+        {
+            m_observer->onEvents(events);
+            return;
+        }
+
+        std::shared_ptr<Pending> pending = m_pending;
+        FileObserver* observer = m_observer;
+
+        {
+            std::lock_guard<std::mutex> lock(pending->mutex);
+            ++pending->count;
+        }
+
+        auto batch = std::make_shared<std::vector<FileEvent>>(std::move(events));
+
+        m_dispatch([pending, observer, batch] {
+            observer->onEvents(*batch);
+
+            std::lock_guard<std::mutex> lock(pending->mutex);
+            if (--pending->count == 0)
+            {
+                pending->condition.notify_all();
+            }
+        });
+    }
+
+    // -----------------------------------------------------------------
+    // FileObserver
+    // -----------------------------------------------------------------
+
+    FileObserver::FileObserver()
+        : m_state(nullptr)
+        , m_debounce(0)
+    {
+    }
+
+    FileObserver::~FileObserver()
+    {
+        stop();
+    }
+
+    void FileObserver::setDebounce(u32 milliseconds)
+    {
+        m_debounce = milliseconds;
+    }
+
+    void FileObserver::setQueue(ConcurrentQueue& queue)
+    {
+        m_dispatch = [&queue] (std::function<void()>&& task)
+        {
+            queue.enqueue(std::move(task));
+        };
+    }
+
+    void FileObserver::setQueue(SerialQueue& queue)
+    {
+        m_dispatch = [&queue] (std::function<void()>&& task)
+        {
+            queue.enqueue(std::move(task));
+        };
+    }
+
+    void FileObserver::onEvent(u32 flags, const std::string& filename)
+    {
+        MANGO_UNREFERENCED(flags);
+        MANGO_UNREFERENCED(filename);
+    }
+
+    void FileObserver::onEvents(const std::vector<FileEvent>& events)
+    {
+        for (const FileEvent& event : events)
+        {
+            onEvent(event.flags, event.filename);
+        }
+    }
+
+} // namespace filesystem
+} // namespace mango
@@ -0,0 +1,57 @@
+/*
+    MANGO Multimedia Development Platform
+    Copyright (C) 2012-2019 Twilight Finland 3D Oy Ltd. All rights reserved.
+*/
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <unordered_map>
+#include <mango/filesystem/fileobserver.hpp>
+
+namespace mango {
+namespace filesystem {
+
+    // -----------------------------------------------------------------
+    // FileEventBatch
+    // -----------------------------------------------------------------
+
+    // Platform independent coalescing of the raw events. The platform thread adds
+    // the raw events, sleeps for timeout() milliseconds and calls update().
+
+    class FileEventBatch
+    {
+    protected:
+        using Clock = std::chrono::steady_clock;
+
+        struct Pending;
+
+        FileObserver* m_observer;
+        std::function<void(std::function<void()>&&)> m_dispatch;
+        std::chrono::milliseconds m_debounce;
+
+        std::vector<FileEvent> m_events;
+        std::unordered_map<std::string, size_t> m_lookup;
+        Clock::time_point m_first;
+        Clock::time_point m_last;
+
+        std::shared_ptr<Pending> m_pending;
+
+    public:
+        FileEventBatch(FileObserver* observer, u32 debounce,
+                       const std::function<void(std::function<void()>&&)>& dispatch);
+        ~FileEventBatch();
+
+        void add(u32 flags, const std::string& filename);
+
+        // milliseconds until the batch is due; -1 when there are no events
+        int timeout() const;
+
+        // deliver the batch when it is due
+        void update(bool force = false);
+    };
+
+} // namespace filesystem
+} // namespace mango
@@ -5,57 +5,390 @@
 #pragma once
 
 #include <string>
-#include <map>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+#include <mango/core/configure.hpp>
+#include <mango/core/hash.hpp>
+#include <mango/core/thread.hpp>
 
 namespace mango {
 namespace filesystem {
 
+    /*
+        Index of the files in a container.
+
+        The paths are stored once in a string pool; the folders are not stored at all
+        as their paths are prefixes of the paths already in the pool. The files and
+        folders are nodes in a flat array and the contents of a folder are a range of
+        the sorted children array. The lookups are done with an open addressing hash
+        table over the full paths.
+
+        Paths which end with '/' are folders. The index is immutable after build();
+        the parent folders of the files are created automatically.
+    */
+
     template <typename Header>
     class Indexer
     {
-    public:
-        struct Folder
+    protected:
+        static constexpr u32 npos = 0xffffffff;
+
+        // the index is built in parallel when it has more entries than this
+        static constexpr size_t parallel_threshold = 16384;
+
+        struct Node
         {
-            std::map<std::string, Header *> headers;
+            u32 path;   // offset of the full path in the string pool
+            u32 length; // length of the full path
+            u32 name;   // length of the parent path; the name follows it
+            u32 parent; // parent folder node
+            u32 header; // header index; npos for folders
+            u32 begin;  // children range (folders only)
+            u32 end;
         };
 
-    protected:
-        std::map<std::string, Folder> folders;
-        std::map<std::string, Header> headers;
+        std::vector<char> m_pool;
+        std::vector<Node> m_nodes;
+        std::vector<Header> m_headers;
+        std::vector<u32> m_children;
+        std::vector<u32> m_table; // node index + 1; zero is empty slot
+        u64 m_mask { 0 };
+
+        const char* getPath(const Node& node) const
+        {
+            return m_pool.data() + node.path;
+        }
+
+        static u64 hash(const char* path, size_t length)
+        {
+            return xxhash64(0, Memory(reinterpret_cast<const u8*>(path), length));
+        }
+
+        static bool isFolder(const char* path, size_t length)
+        {
+            return !length || path[length - 1] == '/';
+        }
+
+        u32 find(const char* path, size_t length, u64 h) const
+        {
+            if (m_table.empty())
+            {
+                return npos;
+            }
+
+            for (u64 i = h & m_mask; m_table[i]; i = (i + 1) & m_mask)
+            {
+                const u32 index = m_table[i] - 1;
+                const Node& node = m_nodes[index];
+                if (node.length == length && !std::memcmp(getPath(node), path, length))
+                {
+                    return index;
+                }
+            }
+
+            return npos;
+        }
+
+        void insertTable(u32 index, u64 h)
+        {
+            u64 i = h & m_mask;
+            while (m_table[i])
+            {
+                i = (i + 1) & m_mask;
+            }
+            m_table[i] = index + 1;
+        }
+
+        void resizeTable(size_t count, const std::vector<u64>& hashes)
+        {
+            size_t size = 64;
+            while (size < count * 2)
+            {
+                size *= 2;
+            }
+
+            m_table.assign(size, 0);
+            m_mask = size - 1;
+
+            for (size_t i = 0; i < m_nodes.size(); ++i)
+            {
+                insertTable(u32(i), hashes[i]);
+            }
+        }
+
+        static size_t getParentLength(const char* path, size_t length)
+        {
+            // the parent path includes the trailing '/'
+            size_t n = length - 1;
+            while (n > 0 && path[n - 1] != '/')
+            {
+                --n;
+            }
+            return n;
+        }
+
+        template <typename Func>
+        void parallel(size_t count, Func func)
+        {
+            const size_t step = parallel_threshold;
+
+            if (count < parallel_threshold)
+            {
+                func(0, count);
+                return;
+            }
+
+            ConcurrentQueue q("indexer", Priority::HIGH);
+
+            for (size_t i = 0; i < count; i += step)
+            {
+                const size_t end = std::min(count, i + step);
+                q.enqueue([&func, i, end] {
+                    func(i, end);
+                });
+            }
+
+            q.wait();
+        }
+
+        void sortFolder(Node& folder)
+        {
+            const std::vector<Node>& nodes = m_nodes;
+            const char* pool = m_pool.data();
+
+            std::sort(m_children.begin() + folder.begin, m_children.begin() + folder.end, [&] (u32 a, u32 b) {
+                const Node& na = nodes[a];
+                const Node& nb = nodes[b];
+                const size_t la = na.length - na.name;
+                const size_t lb = nb.length - nb.name;
+                int x = std::memcmp(pool + na.path + na.name, pool + nb.path + nb.name, std::min(la, lb));
+                return x ? x < 0 : la < lb;
+            });
+        }
 
     public:
-        void insert(const std::string& foldername, const std::string& filename, const Header& header)
+        Indexer()
         {
-            Header* ptr = &headers[filename];
-            *ptr = header;
-            folders[foldername].headers.emplace(filename, ptr);
         }
 
-        const Folder* getFolder(const std::string& pathname) const
+        ~Indexer()
         {
-            const Folder* result = nullptr; // default: not found
+        }
 
-            auto i = folders.find(pathname);
-            if (i != folders.end())
+        void reserve(size_t count, size_t pool)
+        {
+            m_nodes.reserve(count + 1);
+            m_headers.reserve(count);
+            m_pool.reserve(pool);
+        }
+
+        void insert(const char* filename, size_t length, const Header& header)
+        {
+            Node node;
+
+            node.path = u32(m_pool.size());
+            node.length = u32(length);
+            node.name = 0;
+            node.parent = npos;
+            node.header = npos;
+            node.begin = 0;
+            node.end = 0;
+
+            if (!isFolder(filename, length))
             {
-                result = &i->second;
+                node.header = u32(m_headers.size());
+                m_headers.push_back(header);
             }
 
-            return result;
+            m_pool.insert(m_pool.end(), filename, filename + length);
+            m_nodes.push_back(node);
+        }
+
+        void insert(const std::string& filename, const Header& header)
+        {
+            insert(filename.data(), filename.length(), header);
+        }
+
+        void build()
+        {
+            // root folder
+            m_nodes.push_back({ 0, 0, 0, npos, npos, 0, 0 });
+
+            std::vector<u64> hashes(m_nodes.size());
+
+            parallel(m_nodes.size(), [&] (size_t begin, size_t end) {
+                for (size_t i = begin; i < end; ++i)
+                {
+                    hashes[i] = hash(getPath(m_nodes[i]), m_nodes[i].length);
+                }
+            });
+
+            m_table.assign(64, 0);
+            m_mask = 63;
+
+            std::vector<Node> nodes;
+            std::vector<u64> node_hashes;
+            nodes.reserve(m_nodes.size());
+            node_hashes.reserve(m_nodes.size());
+
+            std::swap(nodes, m_nodes);
+
+            auto add = [&] (const Node& node, u64 h) -> u32
+            {
+                const u32 index = u32(m_nodes.size());
+                m_nodes.push_back(node);
+                node_hashes.push_back(h);
+
+                if (m_nodes.size() * 2 > m_table.size())
+                {
+                    resizeTable(m_nodes.size(), node_hashes);
+                }
+                else
+                {
+                    insertTable(index, h);
+                }
+
+                return index;
+            };
+
+            // root is the first node
+            add(nodes.back(), hashes.back());
+            nodes.pop_back();
+
+            // the entries which are inserted later replace the earlier ones with the same path
+            for (size_t i = 0; i < nodes.size(); ++i)
+            {
+                const Node& node = nodes[i];
+                u32 index = find(getPath(node), node.length, hashes[i]);
+                if (index == npos)
+                {
+                    add(node, hashes[i]);
+                }
+                else if (node.header != npos)
+                {
+                    m_nodes[index].header = node.header;
+                }
+            }
+
+            nodes.clear();
+            nodes.shrink_to_fit();
+
+            // create the parent folders; they point to the path of the first child
+            for (size_t i = 1; i < m_nodes.size(); ++i)
+            {
+                u32 child = u32(i);
+
+                while (m_nodes[child].parent == npos)
+                {
+                    const Node& node = m_nodes[child];
+                    const char* path = getPath(node);
+                    const u32 parent_length = u32(getParentLength(path, node.length));
+                    const u64 h = hash(path, parent_length);
+
+                    u32 parent = find(path, parent_length, h);
+                    if (parent == npos)
+                    {
+                        Node folder = { node.path, parent_length, 0, npos, npos, 0, 0 };
+                        parent = add(folder, h);
+                    }
+
+                    m_nodes[child].name = parent_length;
+                    m_nodes[child].parent = parent;
+
+                    if (!parent_length)
+                    {
+                        // the root folder
+                        break;
+                    }
+
+                    child = parent;
+                }
+            }
+
+            node_hashes.clear();
+            node_hashes.shrink_to_fit();
+
+            // the children of each folder are a contiguous range
+            for (size_t i = 1; i < m_nodes.size(); ++i)
+            {
+                ++m_nodes[m_nodes[i].parent].end;
+            }
+
+            u32 offset = 0;
+            for (Node& node : m_nodes)
+            {
+                const u32 count = node.end;
+                node.begin = offset;
+                node.end = offset;
+                offset += count;
+            }
+
+            m_children.resize(m_nodes.size() - 1);
+
+            for (size_t i = 1; i < m_nodes.size(); ++i)
+            {
+                Node& parent = m_nodes[m_nodes[i].parent];
+                m_children[parent.end++] = u32(i);
+            }
+
+            // sort the folders by name
+            std::vector<u32> folders;
+            for (size_t i = 0; i < m_nodes.size(); ++i)
+            {
+                if (m_nodes[i].end - m_nodes[i].begin > 1)
+                {
+                    folders.push_back(u32(i));
+                }
+            }
+
+            parallel(folders.size(), [&] (size_t begin, size_t end) {
+                for (size_t i = begin; i < end; ++i)
+                {
+                    sortFolder(m_nodes[folders[i]]);
+                }
+            });
         }
 
         const Header* getHeader(const std::string& filename) const
         {
             const Header* result = nullptr; // default: not found
 
-            auto i = headers.find(filename);
-            if (i != headers.end())
+            const u32 index = find(filename.data(), filename.length(), hash(filename.data(), filename.length()));
+            if (index != npos && m_nodes[index].header != npos)
             {
-                result = &i->second;
+                result = &m_headers[m_nodes[index].header];
             }
 
             return result;
         }
+
+        bool isFolder(const std::string& pathname) const
+        {
+            const u32 index = find(pathname.data(), pathname.length(), hash(pathname.data(), pathname.length()));
+            return index != npos && m_nodes[index].header == npos;
+        }
+
+        // func(const std::string& name, const Header* header) is called for the contents
+        // of the folder in sorted order; the header is nullptr for the folders.
+        template <typename Func>
+        void getFolder(const std::string& pathname, Func func) const
+        {
+            const u32 index = find(pathname.data(), pathname.length(), hash(pathname.data(), pathname.length()));
+            if (index == npos || m_nodes[index].header != npos)
+            {
+                return;
+            }
+
+            const Node& folder = m_nodes[index];
+
+            for (u32 i = folder.begin; i < folder.end; ++i)
+            {
+                const Node& node = m_nodes[m_children[i]];
+                const Header* header = node.header != npos ? &m_headers[node.header] : nullptr;
+                func(std::string(getPath(node) + node.name, node.length - node.name), header);
+            }
+        }
     };
 
 } // namespace filesystem
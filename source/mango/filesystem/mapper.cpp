@@ -7,6 +7,8 @@
 #include <mango/core/string.hpp>
 #include <mango/filesystem/mapper.hpp>
 #include <mango/filesystem/path.hpp>
+#include "seekable.hpp"
+#include "cache.hpp"
 
 namespace mango {
 namespace filesystem {
@@ -17,6 +19,7 @@ namespace filesystem {
 
 #ifdef MANGO_ENABLE_ARCHIVE_ZIP
     AbstractMapper* createMapperZIP(Memory parent, const std::string& password);
+    AbstractMapper* createStreamMapperZIP(Stream* parent, const std::string& password);
 #endif
 #ifdef MANGO_ENABLE_ARCHIVE_RAR
     AbstractMapper* createMapperRAR(Memory parent, const std::string& password);
@@ -24,20 +27,44 @@ namespace filesystem {
 #ifdef MANGO_ENABLE_ARCHIVE_MGX
     AbstractMapper* createMapperMGX(Memory parent, const std::string& password);
 #endif
+#ifdef MANGO_ENABLE_ARCHIVE_7Z
+    AbstractMapper* createMapperSevenZip(Memory parent, const std::string& password);
+#endif
+#ifdef MANGO_ENABLE_ARCHIVE_TAR
+    AbstractMapper* createMapperTAR(Memory parent, const std::string& filename, const std::string& password);
+#endif
 
     typedef AbstractMapper* (*CreateMapperFunc)(Memory, const std::string&);
+    typedef AbstractMapper* (*CreateStreamMapperFunc)(Stream*, const std::string&);
+
+    // the filename of the container in the native filesystem, or empty when it is
+    // nested, is given to the mappers which store an index next to the container
+    typedef AbstractMapper* (*CreateIndexedMapperFunc)(Memory, const std::string&, const std::string&);
 
     struct MapperExtension
     {
         std::string extension;
         std::string decorated_extension;
         CreateMapperFunc createMapperFunc;
+        CreateStreamMapperFunc createStreamMapperFunc;
+        CreateIndexedMapperFunc createIndexedMapperFunc;
 
-        MapperExtension(const std::string& extension, CreateMapperFunc func)
+        MapperExtension(const std::string& extension, CreateMapperFunc func, CreateStreamMapperFunc stream_func = nullptr)
             : extension(extension)
         {
             decorated_extension = extension + "/";
             createMapperFunc = func;
+            createStreamMapperFunc = stream_func;
+            createIndexedMapperFunc = nullptr;
+        }
+
+        MapperExtension(const std::string& extension, CreateIndexedMapperFunc func)
+            : extension(extension)
+        {
+            decorated_extension = extension + "/";
+            createMapperFunc = nullptr;
+            createStreamMapperFunc = nullptr;
+            createIndexedMapperFunc = func;
         }
 
         ~MapperExtension()
@@ -46,18 +73,35 @@ namespace filesystem {
 
         AbstractMapper* createMapper(Memory memory, const std::string& password) const
         {
+            return createMapper(memory, std::string(), password);
+        }
+
+        AbstractMapper* createMapper(Memory memory, const std::string& filename, const std::string& password) const
+        {
+            if (createIndexedMapperFunc)
+            {
+                return createIndexedMapperFunc(memory, filename, password);
+            }
+
             AbstractMapper* mapper = createMapperFunc(memory, password);
             return mapper;
         }
+
+        // the mapper takes the ownership of the stream
+        AbstractMapper* createMapper(Stream* stream, const std::string& password) const
+        {
+            AbstractMapper* mapper = createStreamMapperFunc(stream, password);
+            return mapper;
+        }
     };
 
     static std::vector<MapperExtension> g_extensions =
     {
 #ifdef MANGO_ENABLE_ARCHIVE_ZIP
-        MapperExtension(".zip", createMapperZIP),
-        MapperExtension(".cbz", createMapperZIP),
-        MapperExtension(".apk", createMapperZIP),
-        MapperExtension(".zipx", createMapperZIP),
+        MapperExtension(".zip", createMapperZIP, createStreamMapperZIP),
+        MapperExtension(".cbz", createMapperZIP, createStreamMapperZIP),
+        MapperExtension(".apk", createMapperZIP, createStreamMapperZIP),
+        MapperExtension(".zipx", createMapperZIP, createStreamMapperZIP),
 #endif
 
 #ifdef MANGO_ENABLE_ARCHIVE_MGX
@@ -69,6 +113,20 @@ namespace filesystem {
         MapperExtension(".rar", createMapperRAR),
         MapperExtension(".cbr", createMapperRAR),
 #endif
+
+#ifdef MANGO_ENABLE_ARCHIVE_7Z
+        MapperExtension(".7z", createMapperSevenZip),
+        MapperExtension(".cb7", createMapperSevenZip),
+#endif
+
+#ifdef MANGO_ENABLE_ARCHIVE_TAR
+        MapperExtension(".tar", createMapperTAR),
+        MapperExtension(".tar.gz", createMapperTAR),
+        MapperExtension(".tgz", createMapperTAR),
+        MapperExtension(".tar.zst", createMapperTAR),
+        MapperExtension(".tzst", createMapperTAR),
+        MapperExtension(".cbt", createMapperTAR),
+#endif
     };
 
     // -----------------------------------------------------------------
@@ -128,6 +186,16 @@ namespace filesystem {
         }
     }
 
+    // -----------------------------------------------------------------
+    // AbstractMapper
+    // -----------------------------------------------------------------
+
+    Stream* AbstractMapper::open(const std::string& filename)
+    {
+        VirtualMemory* memory = mmap(filename);
+        return createVirtualMemoryStream(memory);
+    }
+
     // -----------------------------------------------------------------
     // Mapper
     // -----------------------------------------------------------------
@@ -152,6 +220,9 @@ namespace filesystem {
         // use parent's mapper
         m_parent_mapper = mapper;
         m_mapper = *mapper;
+        m_container = mapper->m_container;
+        m_file_mapper = mapper->m_file_mapper;
+        m_file_basepath = mapper->m_file_basepath;
 
 		// parse and create mappers
         std::string temp = mapper->m_basepath + pathname;
@@ -171,9 +242,14 @@ namespace filesystem {
         m_mapper = createMemoryMapper(memory, extension, password);
     }
 
+    Mapper::Mapper(std::shared_ptr<AbstractMapper> mapper)
+        : m_mapper(mapper.get())
+        , m_shared_mapper(mapper)
+    {
+    }
+
     Mapper::~Mapper()
     {
-		delete m_parent_memory;
     }
 
     std::string Mapper::parse(std::string& pathname, const std::string& password)
@@ -216,13 +292,82 @@ namespace filesystem {
                     std::string head = container.substr(0, n + 1);
                     container = container.substr(n + 1, std::string::npos);
                     m_mapper = createFileMapper(head);
+                    m_file_mapper = m_mapper;
+                    m_file_basepath = head;
                 }
 
                 if (m_mapper->isFile(container))
                 {
-                    m_parent_memory = m_mapper->mmap(container);
-                    mapper = extension.createMapper(*m_parent_memory, password);
-                    m_mappers.emplace_back(mapper);
+                    // containers in the filesystem and inside cached containers can be cached
+                    std::string key;
+                    u64 time = 0;
+                    u64 size = 0;
+                    bool cacheable = false;
+
+                    if (m_container && m_mapper == m_container->mapper.get())
+                    {
+                        key = m_container->key + "/" + container;
+                        cacheable = true;
+                    }
+                    else if (m_mapper == m_file_mapper)
+                    {
+                        cacheable = getContainerStatus(m_file_basepath + container, key, time, size);
+                    }
+
+                    auto create = [&] () -> ContainerHandle*
+                    {
+                        std::unique_ptr<ContainerHandle> handle(new ContainerHandle());
+                        handle->key = key;
+                        handle->time = time;
+                        handle->size = size;
+                        handle->parent = m_container;
+
+                        if (extension.createStreamMapperFunc)
+                        {
+                            // Large compressed containers are opened as seekable streams; the
+                            // nested mapper reads only the central directory and the entries
+                            // which are mapped instead of the whole decompressed container.
+                            Stream* stream = m_mapper->open(container);
+
+                            VirtualMemory* memory = releaseVirtualMemory(stream);
+                            if (memory)
+                            {
+                                handle->memory.reset(memory);
+                                handle->mapper.reset(extension.createMapper(*memory, password));
+                            }
+                            else
+                            {
+                                handle->mapper.reset(extension.createMapper(stream, password));
+                            }
+                        }
+                        else
+                        {
+                            std::string filename;
+                            if (m_mapper == m_file_mapper)
+                            {
+                                filename = m_file_basepath + container;
+                            }
+
+                            handle->memory.reset(m_mapper->mmap(container));
+                            handle->mapper.reset(extension.createMapper(*handle->memory, filename, password));
+                        }
+
+                        return handle.release();
+                    };
+
+                    if (cacheable)
+                    {
+                        std::string cache_key = key;
+                        cache_key += '\0';
+                        cache_key += password;
+                        m_container = getContainerCache().acquire(cache_key, time, size, m_container, create);
+                    }
+                    else
+                    {
+                        m_container.reset(create());
+                    }
+
+                    mapper = m_container->mapper.get();
                     m_mapper = mapper;
 
                     filename = postfix;
@@ -236,6 +381,8 @@ namespace filesystem {
         if (!m_mapper)
         {
             m_mapper = createFileMapper(pathname);
+            m_file_mapper = m_mapper;
+            m_file_basepath = pathname;
             pathname = "";
         }
 
@@ -284,11 +431,15 @@ namespace filesystem {
 
     bool Mapper::isCustomMapper(const std::string& filename)
     {
-        const std::string extension = toLower(getExtension(filename));
+        // match the end of the name like parse() does so that the compound
+        // extensions (example: ".tar.gz") are recognized
+        const std::string name = toLower(filename) + "/";
 
         for (auto &node : g_extensions)
         {
-            if (extension == node.extension)
+            const std::string& extension = node.decorated_extension;
+            if (name.length() >= extension.length() &&
+                !name.compare(name.length() - extension.length(), extension.length(), extension))
             {
                 return true;
             }
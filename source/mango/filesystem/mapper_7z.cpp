@@ -0,0 +1,610 @@
+/*
+    MANGO Multimedia Development Platform
+    Copyright (C) 2012-2019 Twilight Finland 3D Oy Ltd. All rights reserved.
+*/
+/*
+    7z decompression code: Igor Pavlov / LZMA SDK.
+*/
+#include <map>
+#include <mutex>
+#include <future>
+#include <memory>
+#include <algorithm>
+#include <mango/core/string.hpp>
+#include <mango/core/exception.hpp>
+#include <mango/core/thread.hpp>
+#include <mango/filesystem/mapper.hpp>
+#include <mango/filesystem/path.hpp>
+#include "indexer.hpp"
+#include "cache.hpp"
+
+#if defined(MANGO_ENABLE_ARCHIVE_7Z)
+
+#include "../../external/lzma/7z.h"
+#include "../../external/lzma/7zCrc.h"
+#include "../../external/lzma/Alloc.h"
+
+namespace
+{
+    using namespace mango;
+    using mango::filesystem::Indexer;
+
+    constexpr u32 method_copy = 0x00000000;
+    constexpr u32 method_aes  = 0x06f10701;
+
+    constexpr u32 no_folder = 0xffffffff;
+
+    // -----------------------------------------------------------------
+    // ILookInStream interface to the archive memory
+    // -----------------------------------------------------------------
+
+    // The SDK reads the archive through this interface; the "look" buffer is
+    // the archive memory itself so nothing is copied. Each decoder has it's own
+    // stream so the folders can be decoded concurrently.
+
+    struct LookInStream
+    {
+        ILookInStream vt; // must be first
+        Memory memory;
+        size_t offset;
+
+        LookInStream(Memory memory)
+            : memory(memory)
+            , offset(0)
+        {
+            vt.Look = look;
+            vt.Skip = skip;
+            vt.Read = read;
+            vt.Seek = seek;
+        }
+
+        static LookInStream* get(const ILookInStream* p)
+        {
+            return reinterpret_cast<LookInStream*>(const_cast<ILookInStream*>(p));
+        }
+
+        static SRes look(const ILookInStream* p, const void** buf, size_t* size)
+        {
+            LookInStream* s = get(p);
+            *size = std::min(*size, s->memory.size - s->offset);
+            *buf = s->memory.address + s->offset;
+            return SZ_OK;
+        }
+
+        static SRes skip(const ILookInStream* p, size_t offset)
+        {
+            LookInStream* s = get(p);
+            s->offset = std::min(s->offset + offset, s->memory.size);
+            return SZ_OK;
+        }
+
+        static SRes read(const ILookInStream* p, void* buf, size_t* size)
+        {
+            LookInStream* s = get(p);
+            *size = std::min(*size, s->memory.size - s->offset);
+            std::memcpy(buf, s->memory.address + s->offset, *size);
+            s->offset += *size;
+            return SZ_OK;
+        }
+
+        static SRes seek(const ILookInStream* p, Int64* pos, ESzSeek origin)
+        {
+            LookInStream* s = get(p);
+
+            Int64 base = 0;
+            switch (origin)
+            {
+                case SZ_SEEK_SET: base = 0; break;
+                case SZ_SEEK_CUR: base = Int64(s->offset); break;
+                case SZ_SEEK_END: base = Int64(s->memory.size); break;
+            }
+
+            Int64 position = base + *pos;
+            if (position < 0 || position > Int64(s->memory.size))
+            {
+                return SZ_ERROR_READ;
+            }
+
+            s->offset = size_t(position);
+            *pos = position;
+            return SZ_OK;
+        }
+    };
+
+    const char* getErrorString(SRes result)
+    {
+        switch (result)
+        {
+            case SZ_ERROR_DATA: return "Corrupted data";
+            case SZ_ERROR_MEM: return "Out of memory";
+            case SZ_ERROR_CRC: return "Checksum mismatch";
+            case SZ_ERROR_UNSUPPORTED: return "Unsupported method";
+            case SZ_ERROR_INPUT_EOF: return "Unexpected end of data";
+            case SZ_ERROR_NO_ARCHIVE: return "Incorrect signature";
+            case SZ_ERROR_ARCHIVE: return "Corrupted archive";
+            default: return "Decoding failed";
+        }
+    }
+
+    // -----------------------------------------------------------------
+    // VirtualMemory7Z
+    // -----------------------------------------------------------------
+
+    class VirtualMemory7Z : public mango::VirtualMemory
+    {
+    protected:
+        const u8* m_delete_address;
+
+    public:
+        VirtualMemory7Z(const u8* address, const u8* delete_address, size_t size)
+            : m_delete_address(delete_address)
+        {
+            m_memory = Memory(address, size);
+        }
+
+        ~VirtualMemory7Z()
+        {
+            delete [] m_delete_address;
+        }
+    };
+
+    // -----------------------------------------------------------------
+    // 7z headers
+    // -----------------------------------------------------------------
+
+    struct FolderHeader
+    {
+        u64 offset;          // packed data offset in the archive
+        u64 packed_size;
+        u64 unpacked_size;
+        bool is_stored;      // single copy coder; the files can be mapped directly
+        bool is_encrypted;
+    };
+
+    struct FileHeader
+    {
+        u64 size;
+        u64 offset;          // offset in the unpacked folder
+        u32 folder;          // no_folder for empty files
+        u32 index;           // file in the archive database
+    };
+
+} // namespace
+
+namespace mango {
+namespace filesystem {
+
+    // -----------------------------------------------------------------
+    // MapperSevenZip
+    // -----------------------------------------------------------------
+
+    /*
+        The files in a 7z archive are compressed in folders (solid blocks). A folder
+        is always decoded as a whole into the MemoryCache and the files are views into
+        it, so the files from one solid block are decompressed only once.
+
+        The folders are inserted into the MemoryCache as solid blocks; the large ones
+        are kept outside of its budget so that the files in a large solid folder do not
+        decode it again. The checksum of a file is verified when it is first mapped.
+
+        When a file is mapped the following folders are decoded ahead in the ThreadPool,
+        up to a fraction of the cache budget; the typical access pattern is to iterate
+        the archive in order which then decodes the folders in parallel.
+    */
+
+    class MapperSevenZip : public AbstractMapper
+    {
+    protected:
+        Memory m_parent;
+        std::string m_cache_key;
+        std::vector<FolderHeader> m_blocks;
+        Indexer<FileHeader> m_folders;
+
+        CSzArEx m_db;
+
+        // folders which are being decoded; the other threads wait for the result
+        std::mutex m_decode_mutex;
+        std::map<u32, std::shared_future<MemoryCache::Entry>> m_decoding;
+        std::vector<bool> m_scheduled;
+        std::vector<bool> m_verified;
+
+        ConcurrentQueue m_queue;
+
+    public:
+        MapperSevenZip(Memory parent, const std::string& password)
+            : m_parent(parent)
+            , m_cache_key(createContainerKey())
+            , m_queue("7z.decoder", Priority::LOW)
+        {
+            if (!parent.address)
+            {
+                MANGO_EXCEPTION("[mapper.7z] Parent container doesn't have memory");
+            }
+
+            static const bool table = (CrcGenerateTable(), true);
+            MANGO_UNREFERENCED(table);
+
+            SzArEx_Init(&m_db);
+
+            LookInStream stream(parent);
+            SRes result = SzArEx_Open(&m_db, &stream.vt, &g_Alloc, &g_Alloc);
+            if (result != SZ_OK)
+            {
+                SzArEx_Free(&m_db, &g_Alloc);
+                MANGO_EXCEPTION("[mapper.7z] %s.", getErrorString(result));
+            }
+
+            try
+            {
+                parse();
+            }
+            catch (...)
+            {
+                SzArEx_Free(&m_db, &g_Alloc);
+                throw;
+            }
+        }
+
+        ~MapperSevenZip()
+        {
+            // the read-ahead tasks refer to the mapper
+            m_queue.cancel();
+            m_queue.wait();
+
+            SzArEx_Free(&m_db, &g_Alloc);
+            getMemoryCache().erase(m_cache_key);
+        }
+
+        void parse()
+        {
+            const CSzAr& ar = m_db.db;
+
+            for (u32 i = 0; i < ar.NumFolders; ++i)
+            {
+                CSzFolder folder;
+                CSzData sd;
+                sd.Data = ar.CodersData + ar.FoCodersOffsets[i];
+                sd.Size = ar.FoCodersOffsets[i + 1] - ar.FoCodersOffsets[i];
+
+                if (SzGetNextFolderItem(&folder, &sd) != SZ_OK)
+                {
+                    MANGO_EXCEPTION("[mapper.7z] Incorrect folder %d.", i);
+                }
+
+                u64 packed_size = 0;
+                for (u32 j = 0; j < folder.NumPackStreams; ++j)
+                {
+                    const u32 stream = ar.FoStartPackStreamIndex[i] + j;
+                    packed_size += ar.PackPositions[stream + 1] - ar.PackPositions[stream];
+                }
+
+                FolderHeader header;
+
+                header.offset = m_db.dataPos + ar.PackPositions[ar.FoStartPackStreamIndex[i]];
+                header.packed_size = packed_size;
+                header.unpacked_size = SzAr_GetFolderUnpackSize(&ar, i);
+                header.is_stored = folder.NumCoders == 1 && folder.NumPackStreams == 1 &&
+                                   folder.Coders[0].MethodID == method_copy;
+                header.is_encrypted = false;
+
+                for (u32 j = 0; j < folder.NumCoders; ++j)
+                {
+                    if (folder.Coders[j].MethodID == method_aes)
+                    {
+                        header.is_encrypted = true;
+                    }
+                }
+
+                if (header.offset + header.packed_size > m_parent.size)
+                {
+                    MANGO_EXCEPTION("[mapper.7z] Folder %d is outside of parent memory.", i);
+                }
+
+                m_blocks.push_back(header);
+            }
+
+            m_scheduled.resize(m_blocks.size(), false);
+            m_verified.resize(m_db.NumFiles, false);
+
+            std::u16string name;
+
+            for (u32 i = 0; i < m_db.NumFiles; ++i)
+            {
+                size_t length = SzArEx_GetFileNameUtf16(&m_db, i, nullptr);
+                name.resize(length);
+                SzArEx_GetFileNameUtf16(&m_db, i, reinterpret_cast<UInt16*>(&name[0]));
+                name.resize(length ? length - 1 : 0); // terminator
+
+                std::string filename = utf8_from_utf16(name);
+                std::replace(filename.begin(), filename.end(), '\\', '/');
+
+                if (SzArEx_IsDir(&m_db, i))
+                {
+                    m_folders.insert(filename + "/", FileHeader());
+                    continue;
+                }
+
+                FileHeader header;
+
+                header.size = SzArEx_GetFileSize(&m_db, i);
+                header.folder = m_db.FileToFolder[i];
+                header.offset = 0;
+                header.index = i;
+
+                if (header.folder != no_folder)
+                {
+                    const u32 first = m_db.FolderToFile[header.folder];
+                    header.offset = m_db.UnpackPositions[i] - m_db.UnpackPositions[first];
+                }
+
+                m_folders.insert(filename, header);
+            }
+
+            m_folders.build();
+        }
+
+        VirtualMemory* decode(u32 index)
+        {
+            const FolderHeader& block = m_blocks[index];
+            const size_t size = size_t(block.unpacked_size);
+
+            u8* buffer = new u8[size];
+            std::unique_ptr<VirtualMemory7Z> memory(new VirtualMemory7Z(buffer, buffer, size));
+
+            LookInStream stream(m_parent);
+            SRes result = SzAr_DecodeFolder(&m_db.db, index, &stream.vt, m_db.dataPos,
+                buffer, size, &g_Alloc);
+            if (result != SZ_OK)
+            {
+                MANGO_EXCEPTION("[mapper.7z] Folder %d: %s.", index, getErrorString(result));
+            }
+
+            return memory.release();
+        }
+
+        std::string getBlockKey(u32 index) const
+        {
+            return filesystem::getBlockKey(m_cache_key, index);
+        }
+
+        MemoryCache::Entry getBlock(u32 index)
+        {
+            MemoryCache& cache = getMemoryCache();
+            const std::string key = getBlockKey(index);
+
+            MemoryCache::Entry entry = cache.find(key);
+            if (entry)
+            {
+                return entry;
+            }
+
+            // only one thread decodes the folder; the others wait for it
+            std::promise<MemoryCache::Entry> promise;
+            std::shared_future<MemoryCache::Entry> future;
+            bool owner = false;
+
+            {
+                std::lock_guard<std::mutex> lock(m_decode_mutex);
+
+                auto i = m_decoding.find(index);
+                if (i != m_decoding.end())
+                {
+                    future = i->second;
+                }
+                else
+                {
+                    // the decoding might have completed while we were waiting for the lock
+                    entry = cache.find(key);
+                    if (entry)
+                    {
+                        return entry;
+                    }
+
+                    future = promise.get_future().share();
+                    m_decoding[index] = future;
+                    owner = true;
+                }
+            }
+
+            if (!owner)
+            {
+                return future.get();
+            }
+
+            try
+            {
+                entry = cache.insert(key, MemoryCache::Entry(decode(index)), true);
+                promise.set_value(entry);
+            }
+            catch (...)
+            {
+                promise.set_exception(std::current_exception());
+
+                std::lock_guard<std::mutex> lock(m_decode_mutex);
+                m_decoding.erase(index);
+                throw;
+            }
+
+            std::lock_guard<std::mutex> lock(m_decode_mutex);
+            m_decoding.erase(index);
+
+            return entry;
+        }
+
+        void prefetch(u32 index)
+        {
+            MemoryCache& cache = getMemoryCache();
+
+            const size_t budget = cache.getBudget() / 4;
+            const size_t count = std::max(1, ThreadPool::getInstanceSize());
+
+            size_t bytes = 0;
+            size_t ahead = 0;
+
+            for (u32 next = index + 1; next < u32(m_blocks.size()) && ahead < count; ++next)
+            {
+                const FolderHeader& block = m_blocks[next];
+                const size_t size = size_t(block.unpacked_size);
+
+                // the folders which are not decoded or cached do not end the prefetch
+                if (block.is_stored || block.is_encrypted || size > budget)
+                {
+                    continue;
+                }
+
+                bytes += size;
+                if (bytes > budget)
+                {
+                    break;
+                }
+
+                ++ahead;
+
+                {
+                    std::lock_guard<std::mutex> lock(m_decode_mutex);
+                    if (m_scheduled[next] || m_decoding.count(next))
+                    {
+                        continue;
+                    }
+                    m_scheduled[next] = true;
+                }
+
+                if (cache.find(getBlockKey(next)))
+                {
+                    std::lock_guard<std::mutex> lock(m_decode_mutex);
+                    m_scheduled[next] = false;
+                    continue;
+                }
+
+                m_queue.enqueue([this, next] {
+                    try
+                    {
+                        getBlock(next);
+                    }
+                    catch (...)
+                    {
+                        // the error is reported when the file is mapped
+                    }
+
+                    std::lock_guard<std::mutex> lock(m_decode_mutex);
+                    m_scheduled[next] = false;
+                });
+            }
+        }
+
+        void verify(const std::string& filename, const FileHeader& file, Memory folder)
+        {
+            // the folder checksum is verified by the decoder; the archives usually
+            // have a checksum for each file instead
+            if (!SzBitWithVals_Check(&m_db.CRCs, file.index))
+            {
+                return;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(m_decode_mutex);
+                if (m_verified[file.index])
+                {
+                    return;
+                }
+            }
+
+            const u32 crc = CrcCalc(folder.address + file.offset, size_t(file.size));
+            if (crc != m_db.CRCs.Vals[file.index])
+            {
+                MANGO_EXCEPTION("[mapper.7z] File \"%s\" checksum mismatch.", filename.c_str());
+            }
+
+            std::lock_guard<std::mutex> lock(m_decode_mutex);
+            m_verified[file.index] = true;
+        }
+
+        bool isFile(const std::string& filename) const override
+        {
+            return m_folders.getHeader(filename) != nullptr;
+        }
+
+        void getIndex(FileIndex& index, const std::string& pathname) override
+        {
+            m_folders.getFolder(pathname, [&] (const std::string& name, const FileHeader* header)
+            {
+                if (!header)
+                {
+                    index.emplace(name, 0, FileInfo::DIRECTORY);
+                    return;
+                }
+
+                u32 flags = 0;
+
+                if (header->folder != no_folder)
+                {
+                    const FolderHeader& block = m_blocks[header->folder];
+
+                    if (!block.is_stored)
+                    {
+                        flags |= FileInfo::COMPRESSED;
+                    }
+
+                    if (block.is_encrypted)
+                    {
+                        flags |= FileInfo::ENCRYPTED;
+                    }
+                }
+
+                index.emplace(name, header->size, flags);
+            });
+        }
+
+        VirtualMemory* mmap(const std::string& filename) override
+        {
+            const FileHeader* ptrHeader = m_folders.getHeader(filename);
+            if (!ptrHeader)
+            {
+                MANGO_EXCEPTION("[mapper.7z] File \"%s\" not found.", filename.c_str());
+            }
+
+            const FileHeader& file = *ptrHeader;
+
+            if (file.folder == no_folder)
+            {
+                // empty file
+                return new VirtualMemory7Z(nullptr, nullptr, 0);
+            }
+
+            const FolderHeader& block = m_blocks[file.folder];
+
+            if (block.is_encrypted)
+            {
+                MANGO_EXCEPTION("[mapper.7z] Encrypted file \"%s\" is not supported.", filename.c_str());
+            }
+
+            if (block.is_stored)
+            {
+                // NOTE: the directly mapped files are not verified as that would touch all of the pages
+                const u8* address = m_parent.address + block.offset + file.offset;
+                return new VirtualMemory7Z(address, nullptr, size_t(file.size));
+            }
+
+            MemoryCache::Entry entry = getBlock(file.folder);
+            prefetch(file.folder);
+
+            verify(filename, file, *entry);
+
+            return createCacheView(entry, size_t(file.offset), size_t(file.size));
+        }
+    };
+
+    // -----------------------------------------------------------------
+    // functions
+    // -----------------------------------------------------------------
+
+    AbstractMapper* createMapperSevenZip(Memory parent, const std::string& password)
+    {
+        AbstractMapper* mapper = new MapperSevenZip(parent, password);
+        return mapper;
+    }
+
+} // namespace filesystem
+} // namespace mango
+
+#endif // MANGO_ENABLE_ARCHIVE_7Z
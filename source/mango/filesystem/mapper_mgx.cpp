@@ -2,10 +2,15 @@
     MANGO Multimedia Development Platform
     Copyright (C) 2012-2018 Twilight Finland 3D Oy Ltd. All rights reserved.
 */
+#include <mutex>
+#include <atomic>
+#include <exception>
 #include <mango/core/core.hpp>
 #include <mango/filesystem/filesystem.hpp>
 #include <mango/image/fourcc.hpp>
 #include "indexer.hpp"
+#include "cache.hpp"
+#include "mgx.hpp"
 
 #ifdef MANGO_ENABLE_ARCHIVE_MGX
 
@@ -15,16 +20,12 @@ namespace
     namespace fs = mango::filesystem;
 
     using mango::filesystem::Indexer;
+    using mango::filesystem::BlockMGX;
 
     constexpr u64 mgx_header_size = 24;
+    constexpr size_t mgx_chunk_size = 64 * 1024;
 
-    struct Block
-    {
-        u64 offset;
-        u64 compressed;
-        u64 uncompressed;
-        u32 method;
-    };
+    using Block = BlockMGX;
 
     struct FileHeader
     {
@@ -37,9 +38,9 @@ namespace
 
         u64 size;
         u32 checksum;
+        u32 index;
         bool is_compressed;
         std::vector<Segment> segments;
-        std::string filename;
 
         bool isCompressed() const
         {
@@ -57,11 +58,30 @@ namespace
         }
     };
 
+    // small file which is stored in a block with other small files
+    struct PackedFile
+    {
+        u32 offset;
+        u32 size;
+        u32 checksum;
+        u32 index;
+    };
+
     struct HeaderMGX
     {
         Memory m_memory;
         Indexer<FileHeader> m_folders;
         std::vector<Block> m_blocks;
+        std::vector<std::vector<PackedFile>> m_packed; // small files in each block
+        u32 m_num_files = 0;
+        u32 m_features = 0;
+        u8 m_salt[fs::mgx_salt_size];
+        u64 m_key_check = 0;
+
+        bool isEncrypted() const
+        {
+            return (m_features & fs::MGX_FEATURE_ENCRYPTED) != 0;
+        }
 
         HeaderMGX(Memory memory)
             : m_memory(memory)
@@ -91,13 +111,11 @@ namespace
             u64 block_offset = p.read64();
             u64 file_offset = p.read64();
 
-            read_blocks(memory.address + block_offset);
+            read_blocks(memory.address + block_offset, version);
             read_files(memory.address + file_offset);
-
-            MANGO_UNREFERENCED(version);
         }
 
-        void read_blocks(LittleEndianConstPointer p)
+        void read_blocks(LittleEndianConstPointer p, u32 version)
         {
             u32 magic1 = p.read32();
             if (magic1 != u32_mask('m', 'g', 'x', '1'))
@@ -106,6 +124,18 @@ namespace
             }
 
             u32 num_blocks = p.read32();
+
+            if (version >= 2)
+            {
+                m_features = p.read32();
+                if (isEncrypted())
+                {
+                    std::memcpy(m_salt, p, fs::mgx_salt_size);
+                    p += fs::mgx_salt_size;
+                    m_key_check = p.read64();
+                }
+            }
+
             for (u32 i = 0; i < num_blocks; ++i)
             {
                 Block block;
@@ -113,6 +143,7 @@ namespace
                 block.compressed = p.read64();
                 block.uncompressed = p.read64();
                 block.method = p.read32();
+                block.checksum = version >= 2 ? p.read32() : 0;
                 m_blocks.push_back(block);
             }
 
@@ -131,6 +162,8 @@ namespace
                 MANGO_EXCEPTION("[mapper.mgx] Incorrect block identifier (%x)", magic2);
             }
 
+            m_packed.resize(m_blocks.size());
+
             u32 num_files = p.read32();
             for (u32 i = 0; i < num_files; ++i)
             {
@@ -138,11 +171,12 @@ namespace
 
                 u32 length = p.read32();
                 const u8* ptr = p;
-                std::string filename(reinterpret_cast<const char *>(ptr), length);
+                const char* filename = reinterpret_cast<const char *>(ptr);
                 p += length;
 
                 header.size = p.read64();
                 header.checksum = p.read32();
+                header.index = i;
                 header.is_compressed = false;
 
                 u32 num_segment = p.read32();
@@ -155,7 +189,7 @@ namespace
 
                     // inspect block
                     Block& block = m_blocks[block_idx];
-                    if (block.method > 0)
+                    if (block.method > 0 || isEncrypted())
                     {
                         // if ANY of the blocks in the file segments is compressed
                         // the whole file is considered compressed (= cannot be mapped directly)
@@ -163,19 +197,27 @@ namespace
                     }
                 }
 
-                std::string folder = header.isFolder() ?
-                    fs::getPath(filename.substr(0, length - 1)) :
-                    fs::getPath(filename);
+                if (header.is_compressed && num_segment == 1)
+                {
+                    const auto& segment = header.segments[0];
+                    if (segment.size != m_blocks[segment.block].uncompressed)
+                    {
+                        m_packed[segment.block].push_back({ segment.offset, segment.size, header.checksum, i });
+                    }
+                }
 
-                header.filename = filename.substr(folder.length());
-                m_folders.insert(folder, filename, header);
+                m_folders.insert(filename, length, header);
             }
 
+            m_num_files = num_files;
+
             u32 magic3 = p.read32();
             if (magic3 != u32_mask('m', 'g', 'x', '3'))
             {
                 MANGO_EXCEPTION("[mapper.mgx] Incorrect block terminator (%x)", magic3);
             }
+
+            m_folders.build();
         }
     };
 
@@ -215,50 +257,220 @@ namespace filesystem {
     public:
         HeaderMGX m_header;
         std::string m_password;
+        std::string m_cache_key;
+        std::unique_ptr<CipherMGX> m_cipher;
+
+        // blocks which have passed the checksum; each block is verified only once
+        std::unique_ptr<std::atomic<bool>[]> m_verified;
+
+        // checksum state of the small files; they are verified when their block is decoded
+        enum : u8 { FILE_UNKNOWN, FILE_VERIFIED, FILE_CORRUPTED };
+        std::unique_ptr<std::atomic<u8>[]> m_packed_state;
 
     public:
         MapperMGX(Memory parent, const std::string& password)
             : m_header(parent)
             , m_password(password)
+            , m_cache_key(createContainerKey())
+            , m_verified(new std::atomic<bool>[m_header.m_blocks.size()])
+            , m_packed_state(new std::atomic<u8>[m_header.m_num_files])
+        {
+            for (size_t i = 0; i < m_header.m_blocks.size(); ++i)
+            {
+                m_verified[i] = false;
+            }
+
+            for (u32 i = 0; i < m_header.m_num_files; ++i)
+            {
+                m_packed_state[i] = FILE_UNKNOWN;
+            }
+
+            if (m_header.isEncrypted())
+            {
+                m_cipher.reset(new CipherMGX(password, m_header.m_salt));
+                if (m_cipher->check() != m_header.m_key_check)
+                {
+                    MANGO_EXCEPTION("[mapper.mgx] Incorrect password.");
+                }
+            }
+        }
+
+        ~MapperMGX()
         {
+            getMemoryCache().erase(m_cache_key);
         }
 
-        bool isFile(const std::string& filename) const override
+        bool isChecksum() const
         {
-            const FileHeader* ptrHeader = m_header.m_folders.getHeader(filename);
-            if (ptrHeader)
+            return (m_header.m_features & MGX_FEATURE_CHECKSUM) != 0;
+        }
+
+        const u8* getAddress(u32 index) const
+        {
+            const Block& block = m_header.m_blocks[index];
+
+            if (block.offset + block.compressed > m_header.m_memory.size)
             {
-                return !ptrHeader->isFolder();
+                MANGO_EXCEPTION("[mapper.mgx] Block %d is outside of parent memory.", index);
             }
-            return false;
+
+            return m_header.m_memory.address + block.offset;
         }
 
-        void getIndex(FileIndex& index, const std::string& pathname) override
+        void verify(u32 index, u32 checksum) const
+        {
+            if (checksum != m_header.m_blocks[index].checksum)
+            {
+                MANGO_EXCEPTION("[mapper.mgx] Block %d checksum mismatch.", index);
+            }
+
+            m_verified[index] = true;
+        }
+
+        void verify(u32 index) const
+        {
+            const u8* src = getAddress(index);
+
+            if (isChecksum() && !m_verified[index])
+            {
+                const Block& block = m_header.m_blocks[index];
+                verify(index, crc32c(0, Memory(src, size_t(block.compressed))));
+            }
+        }
+
+        // copy or decrypt the stored data of a block; the checksum is computed
+        // in the same pass while the data is in the cache
+        void read(u8* dest, u32 index) const
         {
-            const Indexer<FileHeader>::Folder* ptrFolder = m_header.m_folders.getFolder(pathname);
-            if (ptrFolder)
+            const Block& block = m_header.m_blocks[index];
+            const u8* src = getAddress(index);
+            const size_t size = size_t(block.compressed);
+
+            const bool checksum = isChecksum() && !m_verified[index];
+            u32 crc = 0;
+
+            for (size_t offset = 0; offset < size; offset += mgx_chunk_size)
             {
-                for (auto i : ptrFolder->headers)
+                const size_t bytes = std::min(mgx_chunk_size, size - offset);
+
+                if (checksum)
                 {
-                    const FileHeader& header = *i.second;
+                    crc = crc32c(crc, Memory(src + offset, bytes));
+                }
 
-                    u32 flags = 0;
+                if (m_cipher)
+                {
+                    m_cipher->process(dest + offset, src + offset, bytes, index, offset);
+                }
+                else
+                {
+                    std::memcpy(dest + offset, src + offset, bytes);
+                }
+            }
 
-                    if (header.isFolder())
-                    {
-                        flags |= FileInfo::DIRECTORY;
-                    }
+            if (checksum)
+            {
+                verify(index, crc);
+            }
+        }
 
-                    if (header.isCompressed())
-                    {
-                        flags |= FileInfo::COMPRESSED;
-                    }
+        void decode(Memory dest, u32 index) const
+        {
+            const Block& block = m_header.m_blocks[index];
+
+            if (!block.method)
+            {
+                read(dest.address, index);
+                return;
+            }
+
+            Compressor compressor = getCompressor(Compressor::Method(block.method));
 
-                    index.emplace(header.filename, header.size, flags);
+            if (m_cipher || (isChecksum() && !m_verified[index]))
+            {
+                // the compressed data is decrypted or copied and verified in one pass
+                // before it is given to the decompressor
+                Buffer temp(size_t(block.compressed));
+                read(temp.data(), index);
+                compressor.decompress(dest, temp);
+            }
+            else
+            {
+                compressor.decompress(dest, Memory(getAddress(index), size_t(block.compressed)));
+            }
+        }
+
+        void verify(const FileHeader& file, u32 checksum, const std::string& filename) const
+        {
+            if (isChecksum() && checksum != file.checksum)
+            {
+                MANGO_EXCEPTION("[mapper.mgx] File \"%s\" checksum mismatch.", filename.c_str());
+            }
+        }
+
+        // small files share blocks so their checksum is computed from the file data
+        // while the decoded block is in the cache
+        void verifyPacked(u32 index, Memory memory) const
+        {
+            for (const PackedFile& file : m_header.m_packed[index])
+            {
+                if (m_packed_state[file.index] == FILE_UNKNOWN)
+                {
+                    const u32 checksum = crc32c(0, Memory(memory.address + file.offset, file.size));
+                    m_packed_state[file.index] = checksum == file.checksum ? FILE_VERIFIED : FILE_CORRUPTED;
                 }
             }
         }
 
+        MemoryCache::Entry getBlock(u32 index)
+        {
+            // decompressed blocks are shared by all small files stored in them
+            std::string key = getBlockKey(m_cache_key, index);
+
+            return getMemoryCache().acquire(key, [&] {
+                const Block& block = m_header.m_blocks[index];
+                u8* ptr = new u8[size_t(block.uncompressed)];
+                std::unique_ptr<VirtualMemoryMGX> vm(new VirtualMemoryMGX(ptr, ptr, size_t(block.uncompressed)));
+                decode(*vm, index);
+                if (isChecksum())
+                {
+                    verifyPacked(index, *vm);
+                }
+                return vm.release();
+            });
+        }
+
+        bool isFile(const std::string& filename) const override
+        {
+            return m_header.m_folders.getHeader(filename) != nullptr;
+        }
+
+        void getIndex(FileIndex& index, const std::string& pathname) override
+        {
+            m_header.m_folders.getFolder(pathname, [&] (const std::string& name, const FileHeader* header)
+            {
+                if (!header)
+                {
+                    index.emplace(name, 0, FileInfo::DIRECTORY);
+                    return;
+                }
+
+                u32 flags = 0;
+
+                if (header->isCompressed())
+                {
+                    flags |= FileInfo::COMPRESSED;
+                }
+
+                if (m_header.isEncrypted())
+                {
+                    flags |= FileInfo::ENCRYPTED;
+                }
+
+                index.emplace(name, header->size, flags);
+            });
+        }
+
         VirtualMemory* mmap(const std::string& filename) override
         {
             const FileHeader* ptrHeader = m_header.m_folders.getHeader(filename);
@@ -269,9 +481,12 @@ namespace filesystem {
 
             const FileHeader& file = *ptrHeader;
 
+            if (file.isFolder())
+            {
+                MANGO_EXCEPTION("[mapper.mgx] \"%s\" is a folder.", filename.c_str());
+            }
+
             // TODO: compute segment.size instead of storing it in .mgx container
-            // TODO: checksum
-            // TODO: encryption
 
             if (!file.isMultiSegment())
             {
@@ -280,19 +495,24 @@ namespace filesystem {
 
                 if (file.isCompressed())
                 {
-                    if (segment.size != block.uncompressed && !file.isMultiSegment())
+                    if (segment.size != block.uncompressed)
                     {
-                        // a small file stored in one block with other small files
-                        // cache the decompressed buffers
-
-                        // TODO: decompression cache for small-file blocks
-#if 0
-                        // simulate almost-zero-cost (AZC) decompression
-                        u8* ptr = new u8[file.size];
-                        std::memset(ptr, 0, file.size);
-                        VirtualMemoryMGX* vm = new VirtualMemoryMGX(ptr, ptr, file.size);
-                        return vm;
-#endif
+                        // a small file stored in one block with other small files;
+                        // map it from the cached decompressed block
+                        MemoryCache::Entry entry = getBlock(segment.block);
+                        if (isChecksum())
+                        {
+                            if (m_packed_state[file.index] == FILE_UNKNOWN)
+                            {
+                                verifyPacked(segment.block, *entry);
+                            }
+
+                            if (m_packed_state[file.index] != FILE_VERIFIED)
+                            {
+                                MANGO_EXCEPTION("[mapper.mgx] File \"%s\" checksum mismatch.", filename.c_str());
+                            }
+                        }
+                        return createCacheView(entry, segment.offset, segment.size);
                     }
                 }
                 else
@@ -307,6 +527,9 @@ namespace filesystem {
                         MANGO_EXCEPTION("[mapper.mgx] File \"%s\" has mapped region outside of parent memory.", filename.c_str());
                     }
 
+                    // the mapped block is read once to verify it's checksum
+                    verify(segment.block);
+
                     VirtualMemoryMGX* vm = new VirtualMemoryMGX(ptr, nullptr, size_t(file.size));
                     return vm;
                 }
@@ -314,46 +537,106 @@ namespace filesystem {
 
             // generic compression case
 
+            MemoryCache::Entry entry = getMemoryCache().acquire(m_cache_key + filename, [&] {
+                return decompress(file, filename);
+            });
+
+            return createCacheView(entry);
+        }
+
+        VirtualMemory* decompress(const FileHeader& file, const std::string& filename)
+        {
             u8* ptr = new u8[size_t(file.size)];
             u8* x = ptr;
 
             ConcurrentQueue q("mgx.decompessor", Priority::HIGH);
 
-            for (auto &segment : file.segments)
+            // exceptions are forwarded from the tasks to the caller
+            std::mutex error_mutex;
+            std::exception_ptr error;
+
+            auto enqueue = [&] (std::function<void()> func)
+            {
+                q.enqueue([&error_mutex, &error, func] {
+                    try
+                    {
+                        func();
+                    }
+                    catch (...)
+                    {
+                        std::lock_guard<std::mutex> lock(error_mutex);
+                        error = std::current_exception();
+                    }
+                });
+            };
+
+            // checksums of the segments are computed while the data is in the cache
+            const bool checksum = isChecksum();
+            std::vector<u32> checksums(file.segments.size(), 0);
+
+            for (size_t i = 0; i < file.segments.size(); ++i)
             {
+                const auto& segment = file.segments[i];
                 const Block& block = m_header.m_blocks[segment.block];
+                const u32 index = segment.block;
+                u32* crc = &checksums[i];
 
-                if (block.method)
+                if (block.uncompressed == segment.size && segment.offset == 0)
                 {
-                    Compressor compressor = getCompressor(Compressor::Method(block.method));
-                    Memory src(m_header.m_memory.address + block.offset, size_t(block.compressed));
-
-                    q.enqueue([=, &block, &segment] {
-                        if (block.uncompressed == segment.size && segment.offset == 0)
-                        {
-                            // segment is full-block so we can decode directly w/o intermediate buffer
-                            Memory dest(x, size_t(block.uncompressed));
-                            compressor.decompress(dest, src);
-                        }
-                        else
-                        {
-                            Buffer dest(size_t(block.uncompressed));
-                            compressor.decompress(dest, src);
-                            std::memcpy(x, Memory(dest).address + segment.offset, segment.size);
-                        }
+                    enqueue([=] {
+                        // segment is full-block so we can decode directly w/o intermediate buffer
+                        decode(Memory(x, size_t(block.uncompressed)), index);
+                        *crc = checksum ? crc32c(0, Memory(x, segment.size)) : 0;
+                    });
+                }
+                else if (block.method || m_cipher)
+                {
+                    enqueue([=, &segment] {
+                        // partial block is shared with other files so it goes through the cache
+                        MemoryCache::Entry entry = getBlock(index);
+                        std::memcpy(x, Memory(*entry).address + segment.offset, segment.size);
+                        *crc = checksum ? crc32c(0, Memory(x, segment.size)) : 0;
                     });
-
-                    x += segment.size;
                 }
                 else
                 {
-                    std::memcpy(x, m_header.m_memory.address + block.offset + segment.offset, segment.size);
-                    x += segment.size;
+                    enqueue([=, &segment] {
+                        // the checksum is for the whole block
+                        verify(index);
+                        std::memcpy(x, getAddress(index) + segment.offset, segment.size);
+                        *crc = checksum ? crc32c(0, Memory(x, segment.size)) : 0;
+                    });
                 }
+
+                x += segment.size;
             }
 
             q.wait();
 
+            if (!error && checksum)
+            {
+                u32 crc = 0;
+                for (size_t i = 0; i < file.segments.size(); ++i)
+                {
+                    crc = crc32c_combine(crc, checksums[i], file.segments[i].size);
+                }
+
+                try
+                {
+                    verify(file, crc, filename);
+                }
+                catch (...)
+                {
+                    error = std::current_exception();
+                }
+            }
+
+            if (error)
+            {
+                delete[] ptr;
+                std::rethrow_exception(error);
+            }
+
             VirtualMemoryMGX* vm = new VirtualMemoryMGX(ptr, ptr, size_t(file.size));
             return vm;
         }
@@ -6,13 +6,18 @@
     RAR decompression code: Alexander L. Roshal / unRAR library.
 */
 #include <map>
+#include <vector>
+#include <mutex>
+#include <memory>
 #include <algorithm>
 #include <mango/core/string.hpp>
 #include <mango/core/exception.hpp>
+#include <mango/core/compress.hpp>
 #include <mango/core/pointer.hpp>
 #include <mango/filesystem/mapper.hpp>
 #include <mango/filesystem/path.hpp>
 #include "indexer.hpp"
+#include "cache.hpp"
 
 #if defined(MANGO_ENABLE_ARCHIVE_RAR)
 
@@ -76,6 +81,46 @@ namespace
         return true;
     }
 
+    // Solid archives compress the files as one continuous stream; the decoder state
+    // is carried from one file to the next so the files must be decoded in order.
+    class SolidDecoder
+    {
+    protected:
+        ComprDataIO m_io;
+        Unpack m_unpack;
+        bool m_solid { false };
+
+    public:
+        SolidDecoder()
+            : m_unpack(&m_io)
+        {
+            m_io.Init();
+            m_unpack.Init();
+        }
+
+        ~SolidDecoder()
+        {
+        }
+
+        void decompress(u8* output, const u8* input, u64 unpacked_size, u64 packed_size, u8 version)
+        {
+            m_io.UnpackToMemory = true;
+            m_io.UnpackToMemorySize = static_cast<size_t>(unpacked_size);
+            m_io.UnpackToMemoryAddr = output;
+
+            m_io.UnpackFromMemory = true;
+            m_io.UnpackFromMemorySize = static_cast<size_t>(packed_size);
+            m_io.UnpackFromMemoryAddr = const_cast<byte*>(input);
+
+            m_io.UnpPackedSize = packed_size;
+            m_unpack.SetDestSize(unpacked_size);
+
+            // the first file initializes the stream and the rest continue it
+            m_unpack.DoUnpack(version, m_solid);
+            m_solid = true;
+        }
+    };
+
     // -----------------------------------------------------------------
     // RAR unicode filename conversion code
     // -----------------------------------------------------------------
@@ -359,6 +404,8 @@ namespace
         std::string filename;
 
         bool folder;
+        bool solid;  // continues the compressed stream of the previous file
+        u32  index;  // order in the archive
         const u8* data;
 
         bool compressed() const
@@ -379,6 +426,10 @@ namespace
                 // no compression
                 memory = new VirtualMemoryRAR(data, nullptr, size_t(unpacked_size));
             }
+            else if (solid)
+            {
+                MANGO_EXCEPTION("[mapper.rar] Solid file requires the previous files to be decoded.");
+            }
             else
             {
                 size_t size = size_t(unpacked_size);
@@ -411,12 +462,20 @@ namespace filesystem {
     {
     public:
         std::string m_password;
+        std::string m_cache_key;
         std::vector<FileHeader> m_files;
-        Indexer<FileHeader> m_folders;
+        Indexer<u32> m_folders;
         bool is_encrypted { false };
 
+        // solid stream decoder positioned before file m_solid_next
+        std::mutex m_solid_mutex;
+        std::unique_ptr<SolidDecoder> m_solid_decoder;
+        u32 m_solid_start { 0 };
+        u32 m_solid_next { 0 };
+
         MapperRAR(Memory parent, const std::string& password)
             : m_password(password)
+            , m_cache_key(createContainerKey())
         {
             const u8* start = parent.address;
             const u8* end = parent.address + parent.size;
@@ -429,6 +488,7 @@ namespace filesystem {
 
         ~MapperRAR()
         {
+            getMemoryCache().erase(m_cache_key);
         }
 
         void parse(const u8* start, const u8* end)
@@ -453,19 +513,19 @@ namespace filesystem {
                 MANGO_EXCEPTION("[mapper.rar] Incorrect signature.");
             }
 
-            for (auto& header : m_files)
+            // the index refers to the headers by their position in m_files
+            for (const FileHeader& file : m_files)
             {
-                std::string filename = header.filename;
-                while (!filename.empty())
-                {
-                    std::string folder = getPath(filename.substr(0, filename.length() - 1));
-
-                    header.filename = filename.substr(folder.length());
-                    m_folders.insert(folder, filename, header);
-                    header.folder = true;
-                    filename = folder;
-                }
+                m_folders.insert(file.filename, file.index);
             }
+
+            m_folders.build();
+        }
+
+        const FileHeader* getHeader(const std::string& filename) const
+        {
+            const u32* index = m_folders.getHeader(filename);
+            return index ? &m_files[*index] : nullptr;
         }
 
         void parse_rar4(const u8* start, const u8* end)
@@ -494,6 +554,8 @@ namespace filesystem {
                             file.version = header.version;
                             file.method  = header.method;
                             file.is_rar5 = false;
+                            file.solid = (header.flags & LHD_SOLID) != 0;
+                            file.index = u32(m_files.size());
 
                             int dict_flags = (header.flags >> 5) & 7;
                             file.folder = (dict_flags == 7);
@@ -584,7 +646,7 @@ namespace filesystem {
 
             if (is_solid)
             {
-                // solid archives are unsupported at this time
+                // RAR 5.0 decompression is not supported so neither are its solid streams
                 return;
             }
 
@@ -610,6 +672,8 @@ namespace filesystem {
             file.version = algorithm;
             file.method  = method;
             file.is_rar5 = true;
+            file.solid = false;
+            file.index = u32(m_files.size());
 
             file.folder = is_directory;
             file.data = compressed_data.address;
@@ -687,57 +751,207 @@ namespace filesystem {
 
         bool isFile(const std::string& filename) const override
         {
-            const FileHeader* ptrHeader = m_folders.getHeader(filename);
-            if (ptrHeader)
-            {
-                return !ptrHeader->folder;
-            }
-            return false;
+            return getHeader(filename) != nullptr;
         }
 
         void getIndex(FileIndex& index, const std::string& pathname) override
         {
-            const Indexer<FileHeader>::Folder* ptrFolder = m_folders.getFolder(pathname);
-            if (ptrFolder)
+            m_folders.getFolder(pathname, [&] (const std::string& name, const u32* file)
             {
-                for (auto i : ptrFolder->headers)
+                if (!file)
                 {
-                    const FileHeader& header = *i.second;
-
-                    u32 flags = 0;
-                    u64 size = header.unpacked_size;
+                    index.emplace(name, 0, FileInfo::DIRECTORY);
+                    return;
+                }
 
-                    if (header.folder)
-                    {
-                        flags |= FileInfo::DIRECTORY;
-                        size = 0;
-                    }
+                const FileHeader& header = m_files[*file];
 
-                    if (header.compressed())
-                    {
-                        flags |= FileInfo::COMPRESSED;
-                    }
+                u32 flags = 0;
 
-                    if (is_encrypted)
-                    {
-                        flags |= FileInfo::ENCRYPTED;
-                    }
+                if (header.compressed())
+                {
+                    flags |= FileInfo::COMPRESSED;
+                }
 
-                    index.emplace(header.filename, size, flags);
+                if (is_encrypted)
+                {
+                    flags |= FileInfo::ENCRYPTED;
                 }
-            }
+
+                index.emplace(name, header.unpacked_size, flags);
+            });
         }
 
         VirtualMemory* mmap(const std::string& filename) override
         {
-            const FileHeader* ptrHeader = m_folders.getHeader(filename);
+            const FileHeader* ptrHeader = getHeader(filename);
             if (!ptrHeader)
             {
                 MANGO_EXCEPTION("[mapper.rar] File \"%s\" not found.", filename.c_str());
             }
 
             const FileHeader& header = *ptrHeader;
-            return header.mmap();
+
+            if (!header.compressed())
+            {
+                return header.mmap();
+            }
+
+            MemoryCache::Entry entry;
+
+            if (header.solid)
+            {
+                entry = getMemoryCache().find(m_cache_key + filename);
+                if (!entry)
+                {
+                    entry = decodeSolid(header.index);
+                }
+            }
+            else
+            {
+                entry = getMemoryCache().acquire(m_cache_key + filename, [&] {
+                    return header.mmap();
+                });
+            }
+
+            return createCacheView(entry);
+        }
+
+        bool isSolidMember(const FileHeader& file) const
+        {
+            return !file.folder && file.compressed();
+        }
+
+        // The decoder state cannot be copied (the window and the PPM model use internal
+        // pointers) so the decoded files are checkpointed instead: an LZ4 copy of each
+        // solid file is kept in the MemoryCache as a block of the container. It restores
+        // the file after the decoded file has been evicted without decoding the stream
+        // again from the start.
+
+        void storeSolid(u32 index, Memory memory)
+        {
+            // caller holds the solid mutex; lz4 is limited to int sizes
+            MemoryCache& cache = getMemoryCache();
+            const std::string key = getBlockKey(m_cache_key, index);
+
+            if (memory.size > 0x40000000 || memory.size > cache.getBudget() / 4 || cache.find(key))
+            {
+                return;
+            }
+
+            std::vector<u8> temp(lz4::bound(memory.size));
+            const size_t bytes = memory.size ? lz4::compress(Memory(temp.data(), temp.size()), memory) : 0;
+
+            u8* copy = new u8[bytes];
+            std::memcpy(copy, temp.data(), bytes);
+
+            cache.insert(key, MemoryCache::Entry(new VirtualMemoryRAR(copy, copy, bytes)));
+        }
+
+        MemoryCache::Entry restoreSolid(u32 index)
+        {
+            // caller holds the solid mutex
+            MemoryCache& cache = getMemoryCache();
+
+            MemoryCache::Entry copy = cache.find(getBlockKey(m_cache_key, index));
+            if (!copy)
+            {
+                return MemoryCache::Entry();
+            }
+
+            const FileHeader& file = m_files[index];
+            const Memory compressed = *copy;
+
+            const size_t size = size_t(file.unpacked_size);
+            u8* buffer = new u8[size];
+
+            if (size > 0)
+            {
+                try
+                {
+                    lz4::decompress(Memory(buffer, size), compressed);
+                }
+                catch (...)
+                {
+                    delete[] buffer;
+                    throw;
+                }
+            }
+
+            MemoryCache::Entry entry(new VirtualMemoryRAR(buffer, buffer, size));
+            return cache.insert(m_cache_key + file.filename, entry);
+        }
+
+        MemoryCache::Entry decodeSolid(u32 index)
+        {
+            std::lock_guard<std::mutex> lock(m_solid_mutex);
+
+            MemoryCache& cache = getMemoryCache();
+
+            // another thread may have decoded the file while we were waiting for the lock
+            MemoryCache::Entry result = cache.find(m_cache_key + m_files[index].filename);
+            if (result)
+            {
+                return result;
+            }
+
+            result = restoreSolid(index);
+            if (result)
+            {
+                return result;
+            }
+
+            // find the file which starts the solid stream
+            u32 start = index;
+            while (start > 0 && !(isSolidMember(m_files[start]) && !m_files[start].solid))
+            {
+                --start;
+            }
+
+            // the decoder can continue when it is in the same stream before the file;
+            // otherwise the stream is decoded again from the start
+            if (!m_solid_decoder || m_solid_start != start || m_solid_next > index)
+            {
+                m_solid_decoder.reset(new SolidDecoder());
+                m_solid_start = start;
+                m_solid_next = start;
+            }
+
+            // decode the files in order; the decoder stays after the file so that sequential
+            // iteration over the archive decodes the stream only once. Only the requested
+            // file is cached, the files before it are checkpointed.
+            for ( ; m_solid_next <= index; ++m_solid_next)
+            {
+                const FileHeader& file = m_files[m_solid_next];
+                if (!isSolidMember(file))
+                {
+                    continue;
+                }
+
+                const size_t size = size_t(file.unpacked_size);
+                u8* buffer = new u8[size];
+
+                try
+                {
+                    m_solid_decoder->decompress(buffer, file.data, file.unpacked_size, file.packed_size, file.version);
+                }
+                catch (...)
+                {
+                    delete[] buffer;
+                    m_solid_decoder.reset();
+                    throw;
+                }
+
+                MemoryCache::Entry entry(new VirtualMemoryRAR(buffer, buffer, size));
+                storeSolid(m_solid_next, *entry);
+
+                if (m_solid_next == index)
+                {
+                    result = cache.insert(m_cache_key + file.filename, entry);
+                }
+            }
+
+            return result;
         }
     };
 
@@ -0,0 +1,687 @@
+/*
+    MANGO Multimedia Development Platform
+    Copyright (C) 2012-2019 Twilight Finland 3D Oy Ltd. All rights reserved.
+*/
+#include <mutex>
+#include <memory>
+#include <algorithm>
+#include <mango/core/string.hpp>
+#include <mango/core/exception.hpp>
+#include <mango/core/pointer.hpp>
+#include <mango/core/crc32.hpp>
+#include <mango/filesystem/mapper.hpp>
+#include <mango/filesystem/file.hpp>
+#include "indexer.hpp"
+#include "cache.hpp"
+#include "seekable.hpp"
+
+#if defined(MANGO_ENABLE_ARCHIVE_TAR)
+
+namespace
+{
+    using namespace mango;
+    using mango::filesystem::Indexer;
+
+    constexpr u64 tar_block_size = 512;
+    constexpr u64 no_size = ~u64(0);
+
+    constexpr u32 tar_index_magic = u32_mask('t', 'a', 'r', 'i');
+    constexpr u32 tar_index_version = 3;
+
+    // -----------------------------------------------------------------
+    // tar headers
+    // -----------------------------------------------------------------
+
+    struct FileHeader
+    {
+        u64 offset; // offset of the data in the uncompressed archive
+        u64 size;
+    };
+
+    struct Entry
+    {
+        std::string filename;
+        FileHeader header;
+    };
+
+    enum class Compression
+    {
+        NONE,
+        GZIP,
+        ZSTD
+    };
+
+    Compression getCompression(Memory memory)
+    {
+        const u8* p = memory.address;
+
+        if (memory.size >= 2 && p[0] == 0x1f && p[1] == 0x8b)
+        {
+            return Compression::GZIP;
+        }
+
+        if (memory.size >= 4)
+        {
+            u32 magic = uload32le(p);
+            if (magic == 0xfd2fb528 || (magic & 0xfffffff0) == 0x184d2a50)
+            {
+                // zstd frame or skippable frame
+                return Compression::ZSTD;
+            }
+        }
+
+        return Compression::NONE;
+    }
+
+    u64 getNumber(const u8* p, size_t size)
+    {
+        u64 value = 0;
+
+        if (p[0] & 0x80)
+        {
+            // GNU base-256 encoding for large values
+            value = p[0] & 0x3f;
+            for (size_t i = 1; i < size; ++i)
+            {
+                value = (value << 8) | p[i];
+            }
+            return value;
+        }
+
+        // octal, terminated with space or zero
+        for (size_t i = 0; i < size; ++i)
+        {
+            const u8 c = p[i];
+            if (c >= '0' && c <= '7')
+            {
+                value = (value << 3) | (c - '0');
+            }
+            else if (c != ' ' || value)
+            {
+                break;
+            }
+        }
+
+        return value;
+    }
+
+    std::string getString(const u8* p, size_t size)
+    {
+        const char* s = reinterpret_cast<const char*>(p);
+        return std::string(s, std::find(s, s + size, 0));
+    }
+
+    bool isZeroBlock(const u8* p)
+    {
+        return std::all_of(p, p + tar_block_size, [] (u8 c) { return c == 0; });
+    }
+
+    bool isValidChecksum(const u8* p)
+    {
+        // the checksum field is summed as if it contained spaces
+        u32 sum = 8 * ' ';
+        for (size_t i = 0; i < tar_block_size; ++i)
+        {
+            if (i < 148 || i >= 156)
+            {
+                sum += p[i];
+            }
+        }
+        return sum == getNumber(p + 148, 8);
+    }
+
+    // pax extended header records: "<length> <key>=<value>\n"
+    void parsePax(const std::string& records, std::string& path, u64& size)
+    {
+        size_t offset = 0;
+
+        while (offset < records.size())
+        {
+            size_t space = records.find(' ', offset);
+            if (space == std::string::npos)
+            {
+                break;
+            }
+
+            size_t length = std::strtoull(records.c_str() + offset, nullptr, 10);
+            if (length <= space - offset || offset + length > records.size())
+            {
+                break;
+            }
+
+            std::string record = records.substr(space + 1, offset + length - space - 2);
+            size_t equal = record.find('=');
+            if (equal != std::string::npos)
+            {
+                std::string key = record.substr(0, equal);
+                std::string value = record.substr(equal + 1);
+
+                if (key == "path")
+                {
+                    path = value;
+                }
+                else if (key == "size")
+                {
+                    size = std::strtoull(value.c_str(), nullptr, 10);
+                }
+            }
+
+            offset += length;
+        }
+    }
+
+    std::string getIndexFilename(const std::string& filename)
+    {
+        return filename + ".idx";
+    }
+
+    // -----------------------------------------------------------------
+    // VirtualMemoryTAR
+    // -----------------------------------------------------------------
+
+    class VirtualMemoryTAR : public mango::VirtualMemory
+    {
+    protected:
+        const u8* m_delete_address;
+
+    public:
+        VirtualMemoryTAR(const u8* address, const u8* delete_address, size_t size)
+            : m_delete_address(delete_address)
+        {
+            m_memory = Memory(address, size);
+        }
+
+        ~VirtualMemoryTAR()
+        {
+            delete [] m_delete_address;
+        }
+    };
+
+} // namespace
+
+namespace mango {
+namespace filesystem {
+
+    // -----------------------------------------------------------------
+    // MapperTAR
+    // -----------------------------------------------------------------
+
+    /*
+        The entries of an uncompressed tar archive are mapped directly from the parent
+        memory. The gzip and zstd compressed archives are accessed through a seekable
+        stream which keeps decoder checkpoints so that an entry is decoded starting
+        from the nearest checkpoint instead of the start of the archive.
+
+        Building the index of a compressed archive requires decoding it; the index with
+        the checkpoints can be stored next to the archive as "<archive>.idx" so that
+        the archive can be opened again without decoding it (see setPersistentIndex).
+    */
+
+    class MapperTAR : public AbstractMapper
+    {
+    protected:
+        Memory m_parent;
+        std::string m_cache_key;
+        Indexer<FileHeader> m_folders;
+
+        std::unique_ptr<IndexedStream> m_stream;
+        std::mutex m_stream_mutex;
+
+    public:
+        MapperTAR(Memory parent, const std::string& filename, const std::string& password)
+            : m_parent(parent)
+            , m_cache_key(createContainerKey())
+        {
+            if (!parent.address)
+            {
+                MANGO_EXCEPTION("[mapper.tar] Parent container doesn't have memory");
+            }
+
+            std::vector<Entry> entries;
+            Buffer index;
+
+            Compression compression = getCompression(parent);
+            if (compression != Compression::NONE)
+            {
+                // the stored index is only used when it was built from this archive
+                if (!filename.empty())
+                {
+                    loadIndex(filename, entries, index);
+                }
+
+                Memory checkpoints = entries.empty() ? Memory() : Memory(index.data(), index.size());
+
+                if (compression == Compression::GZIP)
+                {
+                    m_stream.reset(createGzipStream(parent, checkpoints));
+                }
+                else
+                {
+                    m_stream.reset(createZstdStream(parent, checkpoints));
+                }
+            }
+
+            if (entries.empty())
+            {
+                parse(entries);
+
+                if (m_stream && !filename.empty() && isPersistentIndex())
+                {
+                    saveIndex(filename, entries);
+                }
+            }
+
+            for (const Entry& entry : entries)
+            {
+                m_folders.insert(entry.filename, entry.header);
+            }
+
+            m_folders.build();
+        }
+
+        ~MapperTAR()
+        {
+            getMemoryCache().erase(m_cache_key);
+        }
+
+        void read(u64 offset, void* dest, size_t size)
+        {
+            if (m_stream)
+            {
+                std::lock_guard<std::mutex> lock(m_stream_mutex);
+                m_stream->seek(offset, Stream::BEGIN);
+                m_stream->read(dest, size);
+            }
+            else
+            {
+                if (offset + size > m_parent.size)
+                {
+                    MANGO_EXCEPTION("[mapper.tar] Reading past end of archive.");
+                }
+
+                std::memcpy(dest, m_parent.address + offset, size);
+            }
+        }
+
+        // returns false when the data ends at the header; archives written without
+        // the terminating zero blocks end like this
+        bool readHeader(u64 offset, u8* block)
+        {
+            u64 available = tar_block_size;
+
+            if (m_stream)
+            {
+                std::lock_guard<std::mutex> lock(m_stream_mutex);
+                Memory memory = m_stream->map(offset, tar_block_size);
+                std::memcpy(block, memory.address, memory.size);
+                available = memory.size;
+            }
+            else
+            {
+                available = std::min(tar_block_size, m_parent.size - std::min(offset, u64(m_parent.size)));
+                std::memcpy(block, m_parent.address + offset, size_t(available));
+            }
+
+            if (!available)
+            {
+                return false;
+            }
+
+            if (available < tar_block_size)
+            {
+                MANGO_EXCEPTION("[mapper.tar] Archive is truncated (offset: %llu).", (unsigned long long)offset);
+            }
+
+            return true;
+        }
+
+        std::string readString(u64 offset, u64 size)
+        {
+            std::string s(size_t(size), 0);
+            read(offset, &s[0], size_t(size));
+            return std::string(s.c_str()); // up to the terminator
+        }
+
+        void parse(std::vector<Entry>& entries)
+        {
+            u8 block[tar_block_size];
+            u64 offset = 0;
+
+            // extended information for the next entry
+            std::string extended_name;
+            u64 extended_size = no_size;
+
+            for (;;)
+            {
+                if (!readHeader(offset, block) || isZeroBlock(block))
+                {
+                    // end of archive
+                    break;
+                }
+
+                if (!isValidChecksum(block))
+                {
+                    MANGO_EXCEPTION("[mapper.tar] Incorrect header checksum (offset: %llu).", (unsigned long long)offset);
+                }
+
+                const u8 type = block[156];
+                const u64 data = offset + tar_block_size;
+
+                u64 size = getNumber(block + 124, 12);
+
+                switch (type)
+                {
+                    case 'L':
+                        // GNU long filename for the next entry
+                        extended_name = readString(data, size);
+                        offset = data + align(size);
+                        continue;
+
+                    case 'x':
+                        // pax extended header for the next entry
+                        parsePax(readString(data, size), extended_name, extended_size);
+                        offset = data + align(size);
+                        continue;
+
+                    case 'g':
+                    case 'K':
+                        // global pax header, GNU long link name
+                        offset = data + align(size);
+                        continue;
+                }
+
+                if (extended_size != no_size)
+                {
+                    size = extended_size;
+                }
+
+                std::string filename = extended_name;
+                if (filename.empty())
+                {
+                    filename = getString(block, 100);
+
+                    // ustar stores long names in two parts
+                    if (!std::memcmp(block + 257, "ustar", 5) && block[345])
+                    {
+                        filename = getString(block + 345, 155) + "/" + filename;
+                    }
+                }
+
+                extended_name.clear();
+                extended_size = no_size;
+                offset = data + align(size);
+
+                // remove leading "./" and "/"
+                while (!filename.compare(0, 2, "./"))
+                {
+                    filename.erase(0, 2);
+                }
+
+                while (!filename.empty() && filename[0] == '/')
+                {
+                    filename.erase(0, 1);
+                }
+
+                if (filename.empty() || filename == ".")
+                {
+                    continue;
+                }
+
+                switch (type)
+                {
+                    case '0':
+                    case '7':
+                    case 0:
+                        if (filename.back() == '/')
+                        {
+                            // old archives mark directories with the trailing slash
+                            entries.push_back({ filename, { data, 0 } });
+                        }
+                        else
+                        {
+                            entries.push_back({ filename, { data, size } });
+                        }
+                        break;
+
+                    case '5':
+                        if (filename.back() != '/')
+                        {
+                            filename += '/';
+                        }
+                        entries.push_back({ filename, { data, 0 } });
+                        break;
+
+                    default:
+                        // links, devices and fifos are not mapped
+                        break;
+                }
+            }
+        }
+
+        static u64 align(u64 size)
+        {
+            return (size + tar_block_size - 1) & ~(tar_block_size - 1);
+        }
+
+        void loadIndex(const std::string& filename, std::vector<Entry>& entries, Buffer& index)
+        {
+            std::string canonical;
+            u64 time;
+            u64 size;
+
+            // the index must have been built from the archive as it is now
+            if (!getContainerStatus(filename, canonical, time, size) || size != m_parent.size)
+            {
+                return;
+            }
+
+            try
+            {
+                File file(getIndexFilename(filename));
+                Memory memory = file;
+
+                // the index ends with a checksum of everything before it
+                if (memory.size < 4)
+                {
+                    return;
+                }
+
+                memory.size -= 4;
+                if (crc32c(0, memory) != uload32le(memory.address + memory.size))
+                {
+                    return;
+                }
+
+                const u8* end = memory.address + memory.size;
+                LittleEndianConstPointer p = memory.address;
+
+                auto available = [&] (u64 bytes) -> bool
+                {
+                    const u8* ptr = p;
+                    return u64(end - ptr) >= bytes;
+                };
+
+                if (!available(24) || p.read32() != tar_index_magic || p.read32() != tar_index_version)
+                {
+                    return;
+                }
+
+                if (p.read64() != time || p.read64() != size)
+                {
+                    return;
+                }
+
+                if (!available(4))
+                {
+                    return;
+                }
+
+                std::vector<Entry> temp;
+                u32 count = p.read32();
+                u32 length;
+
+                for (u32 i = 0; i < count; ++i)
+                {
+                    if (!available(4))
+                    {
+                        return;
+                    }
+
+                    length = p.read32();
+                    if (!available(length + 16))
+                    {
+                        return;
+                    }
+
+                    const u8* s = p;
+                    p += length;
+
+                    Entry entry;
+                    entry.filename = std::string(reinterpret_cast<const char*>(s), length);
+                    entry.header.offset = p.read64();
+                    entry.header.size = p.read64();
+                    temp.push_back(entry);
+                }
+
+                if (!available(4))
+                {
+                    return;
+                }
+
+                length = p.read32();
+                if (!available(length))
+                {
+                    return;
+                }
+
+                index.reset();
+                index.append(p, length);
+                entries = std::move(temp);
+            }
+            catch (Exception&)
+            {
+                // the index is rebuilt
+            }
+        }
+
+        void saveIndex(const std::string& filename, const std::vector<Entry>& entries)
+        {
+            std::string canonical;
+            u64 time;
+            u64 size;
+
+            if (!getContainerStatus(filename, canonical, time, size) || size != m_parent.size)
+            {
+                return;
+            }
+
+            Buffer checkpoints;
+            m_stream->saveIndex(checkpoints);
+
+            MemoryStream stream;
+            LittleEndianStream s = stream;
+
+            s.write32(tar_index_magic);
+            s.write32(tar_index_version);
+            s.write64(time);
+            s.write64(size);
+
+            s.write32(u32(entries.size()));
+            for (const Entry& entry : entries)
+            {
+                s.write32(u32(entry.filename.length()));
+                s.write(entry.filename.data(), entry.filename.length());
+                s.write64(entry.header.offset);
+                s.write64(entry.header.size);
+            }
+
+            s.write32(u32(checkpoints.size()));
+            s.write(checkpoints.data(), checkpoints.size());
+
+            // a truncated or modified index is ignored
+            s.write32(crc32c(0, Memory(stream.data(), size_t(stream.size()))));
+
+            try
+            {
+                // the index is an optimization; failing to store it is not an error
+                FileStream file(getIndexFilename(filename), Stream::WRITE);
+                file.write(stream.data(), size_t(stream.size()));
+            }
+            catch (Exception&)
+            {
+            }
+        }
+
+        bool isFile(const std::string& filename) const override
+        {
+            return m_folders.getHeader(filename) != nullptr;
+        }
+
+        void getIndex(FileIndex& index, const std::string& pathname) override
+        {
+            m_folders.getFolder(pathname, [&] (const std::string& name, const FileHeader* header)
+            {
+                if (!header)
+                {
+                    index.emplace(name, 0, FileInfo::DIRECTORY);
+                    return;
+                }
+
+                u32 flags = 0;
+
+                if (m_stream)
+                {
+                    flags |= FileInfo::COMPRESSED;
+                }
+
+                index.emplace(name, header->size, flags);
+            });
+        }
+
+        VirtualMemory* mmap(const std::string& filename) override
+        {
+            const FileHeader* ptrHeader = m_folders.getHeader(filename);
+            if (!ptrHeader)
+            {
+                MANGO_EXCEPTION("[mapper.tar] File \"%s\" not found.", filename.c_str());
+            }
+
+            const FileHeader& header = *ptrHeader;
+
+            if (!m_stream)
+            {
+                if (header.offset + header.size > m_parent.size)
+                {
+                    MANGO_EXCEPTION("[mapper.tar] File \"%s\" has mapped region outside of parent memory.", filename.c_str());
+                }
+
+                const u8* address = m_parent.address + header.offset;
+                return new VirtualMemoryTAR(address, nullptr, size_t(header.size));
+            }
+
+            MemoryCache::Entry entry = getMemoryCache().acquire(m_cache_key + filename, [&] {
+                const size_t size = size_t(header.size);
+                u8* buffer = new u8[size];
+                std::unique_ptr<VirtualMemoryTAR> memory(new VirtualMemoryTAR(buffer, buffer, size));
+                read(header.offset, buffer, size);
+                return memory.release();
+            });
+
+            return createCacheView(entry);
+        }
+    };
+
+    // -----------------------------------------------------------------
+    // functions
+    // -----------------------------------------------------------------
+
+    AbstractMapper* createMapperTAR(Memory parent, const std::string& filename, const std::string& password)
+    {
+        AbstractMapper* mapper = new MapperTAR(parent, filename, password);
+        return mapper;
+    }
+
+} // namespace filesystem
+} // namespace mango
+
+#endif // MANGO_ENABLE_ARCHIVE_TAR
@@ -3,16 +3,27 @@
     Copyright (C) 2012-2018 Twilight Finland 3D Oy Ltd. All rights reserved.
 */
 #include <mango/core/pointer.hpp>
+#include <mango/core/buffer.hpp>
 #include <mango/core/string.hpp>
 #include <mango/core/exception.hpp>
 #include <mango/core/compress.hpp>
+#include <mango/core/aes.hpp>
+#include <mango/core/hash.hpp>
+#include <mango/core/thread.hpp>
 #include <mango/filesystem/mapper.hpp>
 #include <mango/filesystem/path.hpp>
 #include "indexer.hpp"
+#include "cache.hpp"
+#include "seekable.hpp"
 
 #ifdef MANGO_ENABLE_ARCHIVE_ZIP
 
 #include "../../external/miniz/miniz.h"
+#include "../../external/zstd/zstd.h"
+#include "../../external/lzma/Xz.h"
+#include "../../external/lzma/XzCrc64.h"
+#include "../../external/lzma/7zCrc.h"
+#include "../../external/lzma/Alloc.h"
 
 /*
 https://courses.cs.ut.ee/MTAT.07.022/2015_fall/uploads/Main/dmitri-report-f15-16.pdf
@@ -37,6 +48,10 @@ namespace
     using mango::filesystem::Indexer;
 
     enum { DCKEYSIZE = 12 };
+    enum { AES_PWVERIFYSIZE = 2, HMAC_LENGTH = 10 };
+
+    // entries larger than this are streamed instead of decompressed completely on open
+    constexpr u64 zip_stream_threshold = 4 * 1024 * 1024;
 
     enum Encryption : u8
     {
@@ -58,7 +73,8 @@ namespace
         COMPRESSION_LZMA = 14,
         COMPRESSION_JPEG = 96,
         COMPRESSION_AES = 99,
-        COMPRESSION_XZ = 95
+        COMPRESSION_XZ = 95,
+        COMPRESSION_ZSTD = 93
     };
 
     u32 getSaltLength(Encryption encryption)
@@ -176,9 +192,9 @@ namespace
 		u32	external;          // external file attributes
 		u64	localOffset;       // relative offset of the local file header, ZIP64: 0xffffffff
 
-        std::string filename;      // filename is stored after the header
-        bool        is_folder;     // if the last character of filename is "/", it is a folder
+        const char* filename;      // filename is stored after the header; folders end with "/"
         Encryption  encryption;
+        u16         aesVersion;    // WinZip AES: 1 (AE-1) stores the CRC, 2 (AE-2) does not; 0 without AES
 
 		bool read(LittleEndianConstPointer& p)
 		{
@@ -207,20 +223,11 @@ namespace
 
             // read filename
             const u8* us = p;
-            const char* s = reinterpret_cast<const char*>(us);
+            filename = reinterpret_cast<const char*>(us);
             p += filenameLen;
 
-            if (s[filenameLen - 1] == '/')
-            {
-                is_folder = true;
-            }
-            else
-            {
-                is_folder = false;
-            }
-
-            filename = std::string(s, filenameLen);
             encryption = flags & 1 ? ENCRYPTION_CLASSIC : ENCRYPTION_NONE;
+            aesVersion = 0;
 
             // read extra fields
             const u8* ext = p;
@@ -268,6 +275,8 @@ namespace
                             MANGO_EXCEPTION("[mapper.zip] Incorrect AES header.");
                         }
 
+                        aesVersion = version;
+
                         // select encryption mode
                         switch (mode)
                         {
@@ -308,7 +317,8 @@ namespace
 		u64	dirStartOffset;    // offset of the start of central directory on the disk
 		u16	commentLen;        // zip file comment length
 
-		DirEndRecord(Memory memory)
+		// memory is the tail of the archive starting at offset base
+		DirEndRecord(Memory memory, u64 base = 0)
 		{
             std::memset(this, 0, sizeof(DirEndRecord));
 
@@ -351,8 +361,12 @@ namespace
                             p += 4;
                             u64 offset = p.read64();
 
-                            p = start + offset;
-                            magic = p.read32();
+                            magic = 0;
+                            if (offset >= base && offset - base + 56 <= memory.size)
+                            {
+                                p = start + (offset - base);
+                                magic = p.read32();
+                            }
                             if (magic == 0x06064b50)
                             {
                                 // ZIP64 End of Central Directory
@@ -488,6 +502,148 @@ namespace
 		return true;
 	}
 
+    // --------------------------------------------------------------------
+    // WinZip AES
+    // --------------------------------------------------------------------
+
+    enum AESStatus
+    {
+        AES_OK,
+        AES_INCORRECT_PASSWORD,
+        AES_AUTHENTICATION_FAILED,
+    };
+
+    // WinZip AES (AE-1 and AE-2) uses CTR mode with a little-endian counter starting from one
+    void zip_aes_ctr(AES& aes, u8* out, const u8* in, size_t size, u64 counter)
+    {
+        u8 keystream[4096];
+
+        while (size > 0)
+        {
+            const size_t bytes = std::min(size, sizeof(keystream));
+            const size_t blocks = (bytes + 15) / 16;
+
+            for (size_t i = 0; i < blocks; ++i)
+            {
+                ustore64le(keystream + i * 16 + 0, counter + i);
+                ustore64le(keystream + i * 16 + 8, 0);
+            }
+
+            aes.ecb_block_encrypt(keystream, keystream, blocks * 16);
+
+            for (size_t i = 0; i < bytes; ++i)
+            {
+                out[i] = in[i] ^ keystream[i];
+            }
+
+            counter += blocks;
+            out += bytes;
+            in += bytes;
+            size -= bytes;
+        }
+    }
+
+    // PBKDF2 generates the encryption key, the authentication key and the password verification value;
+    // keys must have room for 32 * 2 + AES_PWVERIFYSIZE bytes
+    AESStatus zip_aes_keys(u8* keys, u32 key_length, const u8* salt, u32 salt_length,
+                           const u8* verify, const std::string& password)
+    {
+        if (password.empty())
+        {
+            return AES_INCORRECT_PASSWORD;
+        }
+
+        Memory key_memory(keys, key_length * 2 + AES_PWVERIFYSIZE);
+        Memory password_memory(reinterpret_cast<const u8*>(password.data()), password.length());
+        pbkdf2_sha1(key_memory, password_memory, Memory(salt, salt_length), 1000);
+
+        if (std::memcmp(keys + key_length * 2, verify, AES_PWVERIFYSIZE))
+        {
+            return AES_INCORRECT_PASSWORD;
+        }
+
+        return AES_OK;
+    }
+
+    // the chunks are multiple of the AES block size so that each starts at a counter boundary
+    constexpr size_t zip_aes_chunk_size = 1024 * 1024;
+    constexpr size_t zip_aes_inflate_chunk_size = 256 * 1024;
+
+    void zip_aes_decrypt(ConcurrentQueue& q, AES& aes, u8* out, const u8* in, size_t size)
+    {
+        for (size_t offset = 0; offset < size; offset += zip_aes_chunk_size)
+        {
+            const size_t bytes = std::min(zip_aes_chunk_size, size - offset);
+            q.enqueue([=, &aes] {
+                zip_aes_ctr(aes, out + offset, in + offset, bytes, 1 + offset / 16);
+            });
+        }
+    }
+
+    const char* getInflateError(int zcode)
+    {
+        const char* msg = "[mapper.zip] Internal error.";
+        switch (zcode)
+        {
+            case Z_MEM_ERROR:
+                msg = "[mapper.zip] Memory error.";
+                break;
+
+            case Z_BUF_ERROR:
+                msg = "[mapper.zip] Buffer error.";
+                break;
+
+            case Z_DATA_ERROR:
+                msg = "[mapper.zip] Data error.";
+                break;
+        }
+        return msg;
+    }
+
+    // inflate the encrypted deflate stream; the input is decrypted in chunks as the
+    // inflater consumes it so the decrypted compressed data is never stored whole
+    u64 zip_aes_inflate(AES& aes, u8* uncompressed, u64 uncompressedLen, const u8* compressed, u64 compressedLen)
+    {
+        z_stream zstream;
+        std::memset(&zstream, 0, sizeof(zstream));
+
+        if (inflateInit2(&zstream, -MAX_WBITS) != Z_OK)
+        {
+            MANGO_EXCEPTION("[mapper.zip] InflateInit failed.");
+        }
+
+        std::vector<u8> chunk(zip_aes_inflate_chunk_size);
+        u64 offset = 0;
+
+        zstream.next_out  = uncompressed;
+        zstream.avail_out = uInt(uncompressedLen); // TODO: upgrade to support 64 bit files
+
+        int zcode = Z_OK;
+        while (zcode == Z_OK)
+        {
+            if (!zstream.avail_in && offset < compressedLen)
+            {
+                const size_t bytes = size_t(std::min(u64(chunk.size()), compressedLen - offset));
+                zip_aes_ctr(aes, chunk.data(), compressed + offset, bytes, 1 + offset / 16);
+
+                zstream.next_in  = chunk.data();
+                zstream.avail_in = uInt(bytes);
+                offset += bytes;
+            }
+
+            zcode = inflate(&zstream, offset < compressedLen ? Z_NO_FLUSH : Z_FINISH);
+        }
+
+        inflateEnd(&zstream);
+
+        if (zcode != Z_STREAM_END)
+        {
+            MANGO_EXCEPTION(getInflateError(zcode));
+        }
+
+        return zstream.total_out;
+    }
+
 	u64 zip_decompress(const u8* compressed, u8* uncompressed, u64 compressedLen, u64 uncompressedLen)
 	{
 		z_stream zstream;
@@ -508,22 +664,7 @@ namespace
     	int zcode = inflate(&zstream, Z_FINISH);
 		if (zcode != Z_STREAM_END)
         {
-            const char* msg = "[mapper.zip] Internal error.";
-            switch (zcode)
-            {
-                case Z_MEM_ERROR:
-                    msg = "[mapper.zip] Memory error.";
-                    break;
-
-                case Z_BUF_ERROR:
-                    msg = "[mapper.zip] Buffer error.";
-                    break;
-
-                case Z_DATA_ERROR:
-                    msg = "[mapper.zip] Data error.";
-                    break;
-            }
-            MANGO_EXCEPTION(msg);
+            MANGO_EXCEPTION(getInflateError(zcode));
         }
 
 		if (inflateEnd(&zstream) != Z_OK)
@@ -534,6 +675,49 @@ namespace
 		return zstream.total_out;
     }
 
+    void zstd_decompress(Memory dest, Memory source)
+    {
+        size_t x = ZSTD_decompress(dest.address, dest.size, source.address, source.size);
+        if (ZSTD_isError(x))
+        {
+            MANGO_EXCEPTION("[mapper.zip] %s", ZSTD_getErrorName(x));
+        }
+
+        if (x != dest.size)
+        {
+            MANGO_EXCEPTION("[mapper.zip] Incorrect decompressed size.");
+        }
+    }
+
+    void xz_decompress(Memory dest, Memory source)
+    {
+        static const bool table = (CrcGenerateTable(), Crc64GenerateTable(), true);
+        MANGO_UNREFERENCED(table);
+
+        CXzUnpacker state;
+        XzUnpacker_Construct(&state, &g_Alloc);
+
+        SizeT dest_size = dest.size;
+        SizeT source_size = source.size;
+        ECoderStatus status;
+
+        SRes result = XzUnpacker_CodeFull(&state, dest.address, &dest_size,
+            source.address, &source_size, CODER_FINISH_END, &status);
+        bool finished = XzUnpacker_IsStreamWasFinished(&state) != 0;
+
+        XzUnpacker_Free(&state);
+
+        if (result != SZ_OK)
+        {
+            MANGO_EXCEPTION("[mapper.zip] XZ decompression failed (%d).", result);
+        }
+
+        if (!finished || dest_size != dest.size)
+        {
+            MANGO_EXCEPTION("[mapper.zip] Incorrect decompressed size.");
+        }
+    }
+
 } // namespace
 
 namespace mango {
@@ -569,51 +753,151 @@ namespace filesystem {
     {
     public:
         Memory m_parent_memory;
+        std::unique_ptr<Stream> m_parent_stream;
+        std::mutex m_stream_mutex;
+        Buffer m_directory;
         std::string m_password;
+        std::string m_cache_key;
         Indexer<FileHeader> m_folders;
 
         MapperZIP(Memory parent, const std::string& password)
             : m_parent_memory(parent)
             , m_password(password)
+            , m_cache_key(createContainerKey())
         {
             if (parent.address)
             {
                 DirEndRecord record(parent);
-                if (record.status())
+                if (record.status() && record.dirStartOffset <= parent.size)
                 {
-                    const int numFiles = int(record.numEntriesTotal);
+                    const u8* start = parent.address + record.dirStartOffset;
+                    const u8* end = parent.address + parent.size;
+                    index(record, start, end);
+                }
+            }
 
-                    // read file headers
-                    LittleEndianConstPointer p = parent.address + record.dirStartOffset;
+            m_folders.build();
+        }
 
-                    for (int i = 0; i < numFiles; ++i)
-                    {
-                        FileHeader header;
-                        if (header.read(p))
-                        {
-                            std::string filename = header.filename;
-                            while (!filename.empty())
-                            {
-                                std::string folder = getPath(filename.substr(0, filename.length() - 1));
+        MapperZIP(Stream* parent, const std::string& password)
+            : m_parent_stream(parent)
+            , m_password(password)
+            , m_cache_key(createContainerKey())
+        {
+            // the end record is in the tail; the largest comment is 64 KB
+            const u64 parent_size = parent->size();
+            const u64 tail_size = std::min(parent_size, u64(65536 + 22 + 20 + 56));
+            const u64 tail_offset = parent_size - tail_size;
 
-                                header.filename = filename.substr(folder.length());
-                                m_folders.insert(folder, filename, header);
-                                header.is_folder = true;
-                                filename = folder;
-                            }
+            Buffer tail(static_cast<size_t>(tail_size));
+            parent->seek(tail_offset, Stream::BEGIN);
+            parent->read(tail, tail.size());
+
+            DirEndRecord record(tail, tail_offset);
+            if (record.status() && record.dirStartOffset + record.dirSize <= parent_size)
+            {
+                // only the central directory is read; the entries are read when they are mapped
+                m_directory.resize(size_t(record.dirSize));
+                parent->seek(record.dirStartOffset, Stream::BEGIN);
+                parent->read(m_directory, m_directory.size());
+
+                index(record, m_directory.data(), m_directory.data() + m_directory.size());
+            }
+
+            m_folders.build();
+        }
+
+        void index(const DirEndRecord& record, const u8* start, const u8* end)
+        {
+            // locate the headers; the records have variable size
+            std::vector<const u8*> records;
+            records.reserve(size_t(record.numEntriesTotal));
+
+            LittleEndianConstPointer p = start;
+
+            for (u64 i = 0; i < record.numEntriesTotal && p + 46 <= end; ++i)
+            {
+                LittleEndianConstPointer h = p;
+                if (h.read32() != 0x02014b50)
+                {
+                    break;
+                }
+
+                h += 24;
+                u16 filenameLen = h.read16();
+                u16 extraFieldLen = h.read16();
+                u16 commentLen = h.read16();
+
+                records.push_back(p);
+                p += 46 + filenameLen + extraFieldLen + commentLen;
+            }
+
+            // decode the headers in parallel
+            std::vector<FileHeader> headers(records.size());
+
+            auto decode = [&] (size_t first, size_t last)
+            {
+                for (size_t i = first; i < last; ++i)
+                {
+                    LittleEndianConstPointer h = records[i];
+                    headers[i].read(h);
+                }
+            };
+
+            const size_t step = 8192;
+            std::vector<u8> failed((records.size() + step - 1) / step, 0);
+
+            if (records.size() > step)
+            {
+                ConcurrentQueue q("zip.index", Priority::HIGH);
+
+                for (size_t i = 0; i < records.size(); i += step)
+                {
+                    q.enqueue([&, i] {
+                        try
+                        {
+                            decode(i, std::min(records.size(), i + step));
                         }
-                    }
+                        catch (Exception&)
+                        {
+                            failed[i / step] = 1;
+                        }
+                    });
+                }
+
+                q.wait();
+            }
+            else
+            {
+                decode(0, records.size());
+            }
+
+            for (size_t i = 0; i < failed.size(); ++i)
+            {
+                if (failed[i])
+                {
+                    // decode again in this thread so that the exception propagates
+                    decode(i * step, std::min(records.size(), i * step + step));
                 }
             }
+
+            m_folders.reserve(headers.size(), size_t(record.dirSize));
+
+            for (const FileHeader& header : headers)
+            {
+                m_folders.insert(header.filename, header.filenameLen, header);
+            }
         }
 
         ~MapperZIP()
         {
+            getMemoryCache().erase(m_cache_key);
         }
 
-        VirtualMemory* mmap(const FileHeader& header, const u8* start, const std::string& password)
+        // local points to the local file header of the entry
+        VirtualMemory* mmap(const FileHeader& header, const u8* local, const std::string& password)
         {
-            LittleEndianConstPointer p = start + header.localOffset;
+            LittleEndianConstPointer p = local;
 
             LocalFileHeader localHeader(p);
             if (!localHeader.status())
@@ -621,12 +905,14 @@ namespace filesystem {
                 MANGO_EXCEPTION("[mapper.zip] Invalid local header.");
             }
 
-            u64 offset = header.localOffset + 30 + localHeader.filenameLen + localHeader.extraFieldLen;
+            u64 offset = 30 + localHeader.filenameLen + localHeader.extraFieldLen;
 
-            const u8* address = start + offset;
+            const u8* address = local + offset;
             u64 size = 0;
+            u64 compressed_size = header.compressedSize;
 
             u8* buffer = nullptr; // remember allocated memory
+            bool inflated = false; // the encrypted deflate stream is decrypted and inflated together
 
             //printf("[ZIP] compression: %d, encryption: %d \n", header.compression, header.encryption);
 
@@ -640,12 +926,12 @@ namespace filesystem {
                     // decryption header
                     const u8* dcheader = address;
                     address += DCKEYSIZE;
+                    compressed_size -= DCKEYSIZE;
 
                     // NOTE: decryption capability reduced on 32 bit platforms
-                    const size_t compressed_size = size_t(header.compressedSize);
-                    buffer = new u8[compressed_size];
+                    buffer = new u8[size_t(compressed_size)];
 
-                    bool status = zip_decrypt(buffer, address, header.compressedSize, dcheader,
+                    bool status = zip_decrypt(buffer, address, compressed_size, dcheader,
                                             header.versionUsed & 0xff, header.crc, password);
                     if (!status)
                     {
@@ -661,26 +947,84 @@ namespace filesystem {
                 case ENCRYPTION_AES192:
                 case ENCRYPTION_AES256:
                 {
-                    u32 salt_length = getSaltLength(header.encryption);
-                    MANGO_UNREFERENCED(salt_length);
-                    MANGO_EXCEPTION("[mapper.zip] AES encryption is not yet supported.");
-#if 0                
-                    u8* saltvalue = address;
+                    const u32 salt_length = getSaltLength(header.encryption);
+                    if (compressed_size < salt_length + AES_PWVERIFYSIZE + HMAC_LENGTH)
+                    {
+                        MANGO_EXCEPTION("[mapper.zip] Incorrect AES encrypted file size.");
+                    }
+
+                    const u8* salt = address;
                     address += salt_length;
 
-                    u8* passverify = address;
+                    const u8* verify = address;
                     address += AES_PWVERIFYSIZE;
 
-                    address += HMAC_LENGTH;
+                    compressed_size -= salt_length + AES_PWVERIFYSIZE + HMAC_LENGTH;
+                    const u8* mac = address + compressed_size;
+
+                    const u32 key_length = salt_length * 2;
+                    u8 keys[32 * 2 + AES_PWVERIFYSIZE];
+
+                    if (zip_aes_keys(keys, key_length, salt, salt_length, verify, password) != AES_OK)
+                    {
+                        MANGO_EXCEPTION("[mapper.zip] Decryption failed (incorrect password).");
+                    }
+
+                    AES aes(keys, key_length * 8);
+
+                    // the authentication code is computed from the encrypted data so it runs
+                    // concurrently with the decryption and decompression
+                    ConcurrentQueue q("zip.aes", Priority::HIGH);
+
+                    SHA1 authentication;
+                    const Memory encrypted(address, size_t(compressed_size));
+                    q.enqueue([&] {
+                        authentication = hmac_sha1(Memory(keys + key_length, key_length), encrypted);
+                    });
+
+                    std::exception_ptr exception;
+
+                    try
+                    {
+                        if (header.compression == COMPRESSION_DEFLATE)
+                        {
+                            buffer = new u8[size_t(header.uncompressedSize)];
+                            u64 outsize = zip_aes_inflate(aes, buffer, header.uncompressedSize, address, compressed_size);
+                            if (outsize != header.uncompressedSize)
+                            {
+                                MANGO_EXCEPTION("[mapper.zip] Incorrect decompressed size.");
+                            }
 
-                    size_t compressed_size = size_t(header.compressedSize);
-                    compressed_size -= salt_length;
-                    compressed_size -= AES_PWVERIFYSIZE;
-                    compressed_size -= HMAC_LENGTH;
+                            inflated = true;
+                        }
+                        else
+                        {
+                            // the other decompressors need the whole input
+                            buffer = new u8[size_t(compressed_size)];
+                            zip_aes_decrypt(q, aes, buffer, address, size_t(compressed_size));
+                        }
+                    }
+                    catch (...)
+                    {
+                        exception = std::current_exception();
+                    }
+
+                    q.wait();
+
+                    // a decoding error in unauthentic data is reported as authentication failure
+                    if (std::memcmp(authentication.data, mac, HMAC_LENGTH))
+                    {
+                        delete[] buffer;
+                        MANGO_EXCEPTION("[mapper.zip] Decryption failed (authentication code mismatch).");
+                    }
+
+                    if (exception)
+                    {
+                        delete[] buffer;
+                        std::rethrow_exception(exception);
+                    }
 
-                    // TODO: password + salt --> key
-                    // TODO: decrypt using the generated key
-#endif                
+                    address = buffer;
                     break;
                 }
             }
@@ -693,10 +1037,16 @@ namespace filesystem {
 
                 case COMPRESSION_DEFLATE:
                 {
+                    if (inflated)
+                    {
+                        size = header.uncompressedSize;
+                        break;
+                    }
+
                     const size_t uncompressed_size = size_t(header.uncompressedSize);
                     u8* uncompressed_buffer = new u8[uncompressed_size];
 
-                    u64 outsize = zip_decompress(address, uncompressed_buffer, header.compressedSize, header.uncompressedSize);
+                    u64 outsize = zip_decompress(address, uncompressed_buffer, compressed_size, header.uncompressedSize);
 
                     delete[] buffer;
                     buffer = uncompressed_buffer;
@@ -729,7 +1079,7 @@ namespace filesystem {
                         MANGO_EXCEPTION("[mapper.zip] Incorrect LZMA header.");
                     }
                     address = p;
-                    u64 compressed_size = header.compressedSize - 4;
+                    compressed_size -= 4;
 
                     lzma::decompress(Memory(uncompressed_buffer, size_t(header.uncompressedSize)), Memory(address, size_t(compressed_size)));
 
@@ -747,7 +1097,7 @@ namespace filesystem {
                     const std::size_t uncompressed_size = static_cast<std::size_t>(header.uncompressedSize);
                     u8* uncompressed_buffer = new u8[uncompressed_size];
 
-                    ppmd8::decompress(Memory(uncompressed_buffer, size_t(header.uncompressedSize)), Memory(address, size_t(header.compressedSize)));
+                    ppmd8::decompress(Memory(uncompressed_buffer, size_t(header.uncompressedSize)), Memory(address, size_t(compressed_size)));
 
                     delete[] buffer;
                     buffer = uncompressed_buffer;
@@ -763,7 +1113,39 @@ namespace filesystem {
                     const std::size_t uncompressed_size = static_cast<std::size_t>(header.uncompressedSize);
                     u8* uncompressed_buffer = new u8[uncompressed_size];
 
-                    bzip2::decompress(Memory(uncompressed_buffer, size_t(header.uncompressedSize)), Memory(address, size_t(header.compressedSize)));
+                    bzip2::decompress(Memory(uncompressed_buffer, size_t(header.uncompressedSize)), Memory(address, size_t(compressed_size)));
+
+                    delete[] buffer;
+                    buffer = uncompressed_buffer;
+
+                    // use decode_buffer as memory map
+                    address = buffer;
+                    size = header.uncompressedSize;
+                    break;
+                }
+
+                case COMPRESSION_ZSTD:
+                case COMPRESSION_XZ:
+                {
+                    const size_t uncompressed_size = size_t(header.uncompressedSize);
+                    u8* uncompressed_buffer = new u8[uncompressed_size];
+
+                    Memory dest(uncompressed_buffer, uncompressed_size);
+                    Memory source(address, size_t(compressed_size));
+
+                    try
+                    {
+                        if (header.compression == COMPRESSION_ZSTD)
+                            zstd_decompress(dest, source);
+                        else
+                            xz_decompress(dest, source);
+                    }
+                    catch (...)
+                    {
+                        delete[] uncompressed_buffer;
+                        delete[] buffer;
+                        throw;
+                    }
 
                     delete[] buffer;
                     buffer = uncompressed_buffer;
@@ -778,11 +1160,20 @@ namespace filesystem {
                 case COMPRESSION_WAVPACK:
                 case COMPRESSION_JPEG:
                 case COMPRESSION_AES:
-                case COMPRESSION_XZ:
                     MANGO_EXCEPTION("[mapper.zip] Unsupported compression algorithm (%d).", header.compression);
                     break;
             }
 
+            if (header.aesVersion == 1)
+            {
+                // AE-1 keeps the CRC of the data; AE-2 relies on the authentication code only
+                if (mz_crc32(MZ_CRC32_INIT, address, size_t(size)) != header.crc)
+                {
+                    delete[] buffer;
+                    MANGO_EXCEPTION("[mapper.zip] CRC mismatch.");
+                }
+            }
+
             VirtualMemory* memory;
             if (buffer)
             {
@@ -797,58 +1188,177 @@ namespace filesystem {
         }
 
         bool isFile(const std::string& filename) const override
+        {
+            return m_folders.getHeader(filename) != nullptr;
+        }
+
+        void getIndex(FileIndex& index, const std::string& pathname) override
+        {
+            m_folders.getFolder(pathname, [&] (const std::string& name, const FileHeader* header)
+            {
+                if (!header)
+                {
+                    index.emplace(name, 0, FileInfo::DIRECTORY);
+                    return;
+                }
+
+                u32 flags = 0;
+
+                if (header->compression > 0)
+                {
+                    flags |= FileInfo::COMPRESSED;
+                }
+
+                if (header->encryption != ENCRYPTION_NONE)
+                {
+                    flags |= FileInfo::ENCRYPTED;
+                }
+
+                index.emplace(name, header->uncompressedSize, flags);
+            });
+        }
+
+        VirtualMemory* mmap(const std::string& filename) override
         {
             const FileHeader* ptrHeader = m_folders.getHeader(filename);
-            if (ptrHeader)
+            if (!ptrHeader)
+            {
+                MANGO_EXCEPTION("[mapper.zip] File \"%s\" not found.", filename.c_str());
+            }
+
+            const FileHeader& header = *ptrHeader;
+
+            if (m_parent_stream)
+            {
+                MemoryCache::Entry entry = getMemoryCache().acquire(m_cache_key + filename, [&] {
+                    return mmapStream(header);
+                });
+
+                return createCacheView(entry);
+            }
+
+            const u8* local = m_parent_memory.address + header.localOffset;
+
+            if (header.compression == COMPRESSION_NONE && header.encryption == ENCRYPTION_NONE)
             {
-                return !ptrHeader->is_folder;
+                // stored files are mapped directly from the parent memory
+                return mmap(header, local, m_password);
             }
-            return false;
+
+            MemoryCache::Entry entry = getMemoryCache().acquire(m_cache_key + filename, [&] {
+                return mmap(header, local, m_password);
+            });
+
+            return createCacheView(entry);
         }
 
-        void getIndex(FileIndex& index, const std::string& pathname) override
+        VirtualMemory* mmapStream(const FileHeader& header)
         {
-            const Indexer<FileHeader>::Folder* ptrFolder = m_folders.getFolder(pathname);
-            if (ptrFolder)
+            u8* buffer = nullptr;
+            size_t offset = 0;
+
             {
-                for (auto i : ptrFolder->headers)
-                {
-                    const FileHeader& header = *i.second;
+                // read the local header and the compressed data of the entry from the parent;
+                // the stream is only locked for the reading, not for the decompression
+                std::lock_guard<std::mutex> lock(m_stream_mutex);
 
-                    u32 flags = 0;
-                    u64 size = header.uncompressedSize;
+                u8 fixed[30];
+                m_parent_stream->seek(header.localOffset, Stream::BEGIN);
+                m_parent_stream->read(fixed, 30);
 
-                    if (header.is_folder)
-                    {
-                        flags |= FileInfo::DIRECTORY;
-                        size = 0;
-                    }
+                LittleEndianConstPointer p = fixed + 26;
+                u16 filenameLen = p.read16();
+                u16 extraFieldLen = p.read16();
 
-                    if (header.compression > 0)
-                    {
-                        flags |= FileInfo::COMPRESSED;
-                    }
+                offset = 30 + filenameLen + extraFieldLen;
+                const size_t bytes = offset + size_t(header.compressedSize);
+
+                buffer = new u8[bytes];
+                std::memcpy(buffer, fixed, 30);
+
+                try
+                {
+                    m_parent_stream->read(buffer + 30, bytes - 30);
+                }
+                catch (...)
+                {
+                    delete[] buffer;
+                    throw;
+                }
+            }
 
-                    if (header.encryption != ENCRYPTION_NONE)
+            try
+            {
+                if (header.compression == COMPRESSION_NONE && header.encryption == ENCRYPTION_NONE)
+                {
+                    LittleEndianConstPointer h = buffer;
+                    LocalFileHeader localHeader(h);
+                    if (!localHeader.status())
                     {
-                        flags |= FileInfo::ENCRYPTED;
+                        MANGO_EXCEPTION("[mapper.zip] Invalid local header.");
                     }
 
-                    index.emplace(header.filename, size, flags);
+                    // the buffer is the memory
+                    return new VirtualMemoryZIP(buffer + offset, buffer, size_t(header.uncompressedSize));
                 }
+
+                VirtualMemory* memory = mmap(header, buffer, m_password);
+                delete[] buffer;
+                return memory;
+            }
+            catch (...)
+            {
+                delete[] buffer;
+                throw;
             }
         }
 
-        VirtualMemory* mmap(const std::string& filename) override
+        Stream* open(const std::string& filename) override
         {
             const FileHeader* ptrHeader = m_folders.getHeader(filename);
-            if (!ptrHeader)
+            if (ptrHeader)
             {
-                MANGO_EXCEPTION("[mapper.zip] File \"%s\" not found.", filename.c_str());
+                const FileHeader& header = *ptrHeader;
+
+                if (m_parent_memory.address &&
+                    (header.compression == COMPRESSION_DEFLATE || header.compression == COMPRESSION_ZSTD ||
+                     header.compression == COMPRESSION_BZIP2) &&
+                    header.encryption == ENCRYPTION_NONE &&
+                    header.uncompressedSize >= zip_stream_threshold)
+                {
+                    LittleEndianConstPointer p = m_parent_memory.address + header.localOffset;
+
+                    LocalFileHeader localHeader(p);
+                    if (!localHeader.status())
+                    {
+                        MANGO_EXCEPTION("[mapper.zip] Invalid local header.");
+                    }
+
+                    u64 offset = header.localOffset + 30 + localHeader.filenameLen + localHeader.extraFieldLen;
+                    if (offset + header.compressedSize > m_parent_memory.size)
+                    {
+                        MANGO_EXCEPTION("[mapper.zip] File \"%s\" is truncated.", filename.c_str());
+                    }
+
+                    Memory compressed(m_parent_memory.address + offset, size_t(header.compressedSize));
+
+                    if (header.compression == COMPRESSION_ZSTD)
+                    {
+                        // the frames are the seek points
+                        return createZstdStream(compressed);
+                    }
+
+                    if (header.compression == COMPRESSION_BZIP2)
+                    {
+                        // the blocks are the seek points
+                        return createBzip2Stream(compressed, header.uncompressedSize);
+                    }
+
+                    return createInflateStream(compressed, header.uncompressedSize);
+                }
             }
 
-            const FileHeader& header = *ptrHeader;
-            return mmap(header, m_parent_memory.address, m_password);
+            return AbstractMapper::open(filename);
         }
     };
 
@@ -862,6 +1372,12 @@ namespace filesystem {
         return mapper;
     }
 
+    AbstractMapper* createStreamMapperZIP(Stream* parent, const std::string& password)
+    {
+        AbstractMapper* mapper = new MapperZIP(parent, password);
+        return mapper;
+    }
+
 } // namespace filesystem
 } // namespace mango
 
@@ -0,0 +1,96 @@
+/*
+    MANGO Multimedia Development Platform
+    Copyright (C) 2012-2019 Twilight Finland 3D Oy Ltd. All rights reserved.
+*/
+#pragma once
+
+#include <string>
+#include <mango/core/aes.hpp>
+#include <mango/core/hash.hpp>
+#include <mango/core/endian.hpp>
+
+namespace mango {
+namespace filesystem {
+
+    // -----------------------------------------------------------------
+    // MGX container format
+    // -----------------------------------------------------------------
+
+    /*
+        version 1: block = { offset, compressed, uncompressed, method }
+        version 2: block table starts with features, followed by
+                   { salt[16], key check (u64) } when ENCRYPTED;
+                   block = { offset, compressed, uncompressed, method, checksum }
+
+        The checksum is crc32c of the stored (compressed and encrypted) block
+        so that corrupted data is rejected before it is fed to decompressor.
+        The encryption is AES-256 in CTR mode; each block has it's own counter
+        range which starts from the block index. The key and the key check are
+        derived from the password with PBKDF2-HMAC-SHA1 (RFC 8018).
+
+        NOTE: The encryption provides confidentiality only. CTR mode is malleable
+        and crc32c over the ciphertext is not a message authentication code; anyone
+        can modify the encrypted data and recompute the checksums undetected.
+    */
+
+    constexpr u32 mgx_version = 2;
+    constexpr u32 mgx_salt_size = 16;
+    constexpr int mgx_kdf_iterations = 10000;
+
+    enum : u32
+    {
+        MGX_FEATURE_CHECKSUM = 0x0001,
+        MGX_FEATURE_ENCRYPTED = 0x0002,
+    };
+
+    struct BlockMGX
+    {
+        u64 offset;
+        u64 compressed;
+        u64 uncompressed;
+        u32 method;
+        u32 checksum;
+    };
+
+    // -----------------------------------------------------------------
+    // CipherMGX
+    // -----------------------------------------------------------------
+
+    class CipherMGX : protected NonCopyable
+    {
+    protected:
+        std::unique_ptr<AES> m_aes;
+        u64 m_check;
+
+    public:
+        CipherMGX(const std::string& password, const u8* salt)
+        {
+            // PBKDF2 generates the encryption key followed by the key check value
+            // which is used to detect incorrect password
+            u8 keys[32 + 8];
+
+            Memory password_memory(reinterpret_cast<const u8*>(password.data()), password.length());
+            pbkdf2_sha1(Memory(keys, sizeof(keys)), password_memory, Memory(salt, mgx_salt_size), mgx_kdf_iterations);
+
+            m_aes.reset(new AES(keys, 256));
+            m_check = uload64le(keys + 32);
+        }
+
+        u64 check() const
+        {
+            return m_check;
+        }
+
+        // encryption and decryption are the same operation in CTR mode; the block
+        // can be processed in parts which start at multiple of 16 bytes
+        void process(u8* dest, const u8* source, size_t size, u32 block, u64 offset = 0) const
+        {
+            u8 iv[16] = { 0 };
+            ustore32be(iv, block);
+            ustore64be(iv + 8, offset / 16);
+            m_aes->ctr_encrypt(dest, source, size, iv);
+        }
+    };
+
+} // namespace filesystem
+} // namespace mango
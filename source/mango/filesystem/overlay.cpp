@@ -0,0 +1,444 @@
+/*
+    MANGO Multimedia Development Platform
+    Copyright (C) 2012-2019 Twilight Finland 3D Oy Ltd. All rights reserved.
+*/
+#include <algorithm>
+#include <mango/core/exception.hpp>
+#include <mango/filesystem/overlay.hpp>
+#include "seekable.hpp"
+
+namespace
+{
+    using namespace mango;
+
+    std::string getFolderName(const std::string& pathname)
+    {
+        std::string folder = pathname;
+        if (!folder.empty() && folder.back() != '/')
+        {
+            folder += '/';
+        }
+        return folder;
+    }
+
+    std::string getParentFolder(const std::string& name)
+    {
+        // "a/b/c.txt" -> "a/b/", "a/b/" -> "a/"
+        const size_t end = name.size() > 1 ? name.size() - 2 : 0;
+        const size_t n = name.find_last_of('/', end);
+        return n != std::string::npos ? name.substr(0, n + 1) : std::string();
+    }
+
+    // The memory and the streams keep the layer alive; the layer owns the
+    // container they are mapped from.
+
+    class OverlayMemory : public VirtualMemory
+    {
+    protected:
+        std::shared_ptr<void> m_owner;
+        std::unique_ptr<VirtualMemory> m_source;
+
+    public:
+        OverlayMemory(std::shared_ptr<void> owner, VirtualMemory* source)
+            : m_owner(owner)
+            , m_source(source)
+        {
+            m_memory = *source;
+        }
+
+        void advise(MemoryAccess access, size_t offset, size_t size) override
+        {
+            m_source->advise(access, offset, size);
+        }
+    };
+
+    class OverlayStream : public Stream
+    {
+    protected:
+        std::shared_ptr<void> m_owner;
+        std::unique_ptr<Stream> m_source;
+
+    public:
+        OverlayStream(std::shared_ptr<void> owner, Stream* source)
+            : m_owner(owner)
+            , m_source(source)
+        {
+        }
+
+        u64 size() const override
+        {
+            return m_source->size();
+        }
+
+        u64 offset() const override
+        {
+            return m_source->offset();
+        }
+
+        void seek(u64 distance, SeekMode mode) override
+        {
+            m_source->seek(distance, mode);
+        }
+
+        void read(void* dest, size_t size) override
+        {
+            m_source->read(dest, size);
+        }
+
+        void write(const void* data, size_t size) override
+        {
+            m_source->write(data, size);
+        }
+
+        Memory map(u64 offset, size_t size) override
+        {
+            return m_source->map(offset, size);
+        }
+
+        VirtualMemory* mmap(u64 offset, size_t size) override
+        {
+            VirtualMemory* memory = m_source->mmap(offset, size);
+            return memory ? new OverlayMemory(m_owner, memory) : nullptr;
+        }
+    };
+
+} // namespace
+
+namespace mango {
+namespace filesystem {
+
+    // -----------------------------------------------------------------
+    // OverlayMapper::Layer
+    // -----------------------------------------------------------------
+
+    struct OverlayMapper::Layer
+    {
+        std::string pathname;
+        std::string password;
+        int priority;
+        u32 sequence;
+        std::shared_ptr<Mapper> mapper;
+        std::vector<FileInfo> files; // released when the layer is inserted
+        std::vector<const std::string*> names; // the inserted files in scan order
+
+        Layer(const std::string& pathname, int priority, const std::string& password)
+            : pathname(pathname)
+            , password(password)
+            , priority(priority)
+            , sequence(0)
+        {
+            mapper = std::make_shared<Mapper>(pathname, password);
+            scan("");
+        }
+
+        // the layer shadows the other layer
+        bool above(const Layer& layer) const
+        {
+            if (priority != layer.priority)
+            {
+                return priority > layer.priority;
+            }
+
+            return sequence > layer.sequence;
+        }
+
+        void scan(const std::string& folder)
+        {
+            AbstractMapper* abstract = *mapper;
+            if (!abstract)
+            {
+                return;
+            }
+
+            FileIndex index;
+            abstract->getIndex(index, mapper->basepath() + folder);
+
+            for (const FileInfo& node : index)
+            {
+                if (node.isContainer())
+                {
+                    // the container folders are added again when the index is requested
+                    continue;
+                }
+
+                const std::string name = folder + node.name;
+                files.emplace_back(name, node.size, node.flags);
+
+                if (node.isDirectory())
+                {
+                    scan(name);
+                }
+            }
+        }
+    };
+
+    // -----------------------------------------------------------------
+    // OverlayMapper
+    // -----------------------------------------------------------------
+
+    OverlayMapper::OverlayMapper()
+    {
+    }
+
+    OverlayMapper::~OverlayMapper()
+    {
+    }
+
+    OverlayMapper::Names* OverlayMapper::getChildren(const std::string& folder)
+    {
+        if (folder.empty())
+        {
+            return &m_root;
+        }
+
+        // the folders are scanned before their contents so the parent is always found
+        auto entry = m_entries.find(folder);
+        return entry != m_entries.end() ? &entry->second.children : nullptr;
+    }
+
+    void OverlayMapper::insert(const std::shared_ptr<Layer>& layer)
+    {
+        layer->names.reserve(layer->files.size());
+
+        for (const FileInfo& node : layer->files)
+        {
+            auto entry = m_entries.emplace(node.name, Entry()).first;
+            const std::string* name = &entry->first;
+            std::vector<Candidate>& candidates = entry->second.candidates;
+
+            if (candidates.empty())
+            {
+                // new name is visible in the parent folder
+                Names* children = getChildren(getParentFolder(node.name));
+                if (children)
+                {
+                    children->insert(name);
+                }
+            }
+
+            auto i = std::find_if(candidates.begin(), candidates.end(), [&] (const Candidate& candidate) {
+                return layer->above(*candidate.layer);
+            });
+
+            candidates.insert(i, Candidate { layer, node.size, node.flags });
+            layer->names.push_back(name);
+        }
+
+        // the names are now owned by the entries
+        std::vector<FileInfo>().swap(layer->files);
+    }
+
+    void OverlayMapper::remove(const std::shared_ptr<Layer>& layer)
+    {
+        // the contents of a folder are removed before the folder
+        for (auto i = layer->names.rbegin(); i != layer->names.rend(); ++i)
+        {
+            auto entry = m_entries.find(**i);
+            if (entry == m_entries.end())
+            {
+                continue;
+            }
+
+            std::vector<Candidate>& candidates = entry->second.candidates;
+            candidates.erase(std::remove_if(candidates.begin(), candidates.end(), [&] (const Candidate& candidate) {
+                return candidate.layer == layer;
+            }), candidates.end());
+
+            if (candidates.empty())
+            {
+                Names* children = getChildren(getParentFolder(entry->first));
+                if (children)
+                {
+                    children->erase(&entry->first);
+                }
+
+                m_entries.erase(entry);
+            }
+        }
+
+        layer->names.clear();
+    }
+
+    std::shared_ptr<OverlayMapper::Layer> OverlayMapper::resolve(const std::string& filename) const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto entry = m_entries.find(filename);
+        if (entry == m_entries.end())
+        {
+            return nullptr;
+        }
+
+        const Candidate& candidate = entry->second.candidates.front();
+        if (candidate.flags & FileInfo::DIRECTORY)
+        {
+            return nullptr;
+        }
+
+        return candidate.layer;
+    }
+
+    void OverlayMapper::mount(const std::string& pathname, int priority, const std::string& password)
+    {
+        // the layer is indexed without holding the lock
+        std::shared_ptr<Layer> layer = std::make_shared<Layer>(getFolderName(pathname), priority, password);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto i = std::find_if(m_layers.begin(), m_layers.end(), [&] (const std::shared_ptr<Layer>& node) {
+            return node->pathname == layer->pathname;
+        });
+
+        if (i != m_layers.end())
+        {
+            remove(*i);
+            m_layers.erase(i);
+        }
+
+        layer->sequence = ++m_sequence;
+        insert(layer);
+        m_layers.push_back(layer);
+    }
+
+    void OverlayMapper::unmount(const std::string& pathname)
+    {
+        const std::string folder = getFolderName(pathname);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto i = std::find_if(m_layers.begin(), m_layers.end(), [&] (const std::shared_ptr<Layer>& node) {
+            return node->pathname == folder;
+        });
+
+        if (i != m_layers.end())
+        {
+            remove(*i);
+            m_layers.erase(i);
+        }
+    }
+
+    void OverlayMapper::remount(const std::string& pathname)
+    {
+        const std::string folder = getFolderName(pathname);
+
+        std::shared_ptr<Layer> previous;
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            for (auto& node : m_layers)
+            {
+                if (node->pathname == folder)
+                {
+                    previous = node;
+                    break;
+                }
+            }
+        }
+
+        if (!previous)
+        {
+            MANGO_EXCEPTION("[mapper.overlay] \"%s\" is not mounted.", pathname.c_str());
+        }
+
+        // a replaced container does not match the cached one and is opened again
+        std::shared_ptr<Layer> layer = std::make_shared<Layer>(folder, previous->priority, previous->password);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto i = std::find(m_layers.begin(), m_layers.end(), previous);
+        if (i == m_layers.end())
+        {
+            // unmounted or mounted again while the layer was indexed
+            return;
+        }
+
+        // keep the position among the layers with the same priority
+        layer->sequence = previous->sequence;
+
+        remove(previous);
+        insert(layer);
+        *i = layer;
+    }
+
+    bool OverlayMapper::isMounted(const std::string& pathname) const
+    {
+        const std::string folder = getFolderName(pathname);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        for (auto& node : m_layers)
+        {
+            if (node->pathname == folder)
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    std::string OverlayMapper::getLayer(const std::string& filename) const
+    {
+        std::shared_ptr<Layer> layer = resolve(filename);
+        return layer ? layer->pathname : std::string();
+    }
+
+    bool OverlayMapper::isFile(const std::string& filename) const
+    {
+        return resolve(filename) != nullptr;
+    }
+
+    void OverlayMapper::getIndex(FileIndex& index, const std::string& pathname)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        const Names* children = getChildren(pathname);
+        if (!children)
+        {
+            return;
+        }
+
+        for (const std::string* name : *children)
+        {
+            const Candidate& candidate = m_entries.find(*name)->second.candidates.front();
+            index.emplace(name->substr(pathname.length()), candidate.size, candidate.flags);
+        }
+    }
+
+    VirtualMemory* OverlayMapper::mmap(const std::string& filename)
+    {
+        std::shared_ptr<Layer> layer = resolve(filename);
+        if (!layer)
+        {
+            MANGO_EXCEPTION("[mapper.overlay] File \"%s\" not found.", filename.c_str());
+        }
+
+        AbstractMapper* mapper = *layer->mapper;
+        VirtualMemory* memory = mapper->mmap(layer->mapper->basepath() + filename);
+        return new OverlayMemory(layer, memory);
+    }
+
+    Stream* OverlayMapper::open(const std::string& filename)
+    {
+        std::shared_ptr<Layer> layer = resolve(filename);
+        if (!layer)
+        {
+            MANGO_EXCEPTION("[mapper.overlay] File \"%s\" not found.", filename.c_str());
+        }
+
+        AbstractMapper* mapper = *layer->mapper;
+        Stream* stream = mapper->open(layer->mapper->basepath() + filename);
+
+        // keep the mapped streams recognizable so that nested containers can use the memory
+        VirtualMemory* memory = releaseVirtualMemory(stream);
+        if (memory)
+        {
+            return createVirtualMemoryStream(new OverlayMemory(layer, memory));
+        }
+
+        return new OverlayStream(layer, stream);
+    }
+
+} // namespace filesystem
+} // namespace mango
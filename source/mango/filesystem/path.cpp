@@ -4,6 +4,7 @@
 */
 #include <algorithm>
 #include <mango/filesystem/path.hpp>
+#include <mango/filesystem/file.hpp>
 
 namespace mango {
 namespace filesystem {
@@ -42,10 +43,38 @@ namespace filesystem {
         }
     }
 
+    Path::Path(std::shared_ptr<AbstractMapper> mapper, const std::string& pathname)
+        : m_mapper(std::make_shared<Mapper>(std::make_shared<Mapper>(mapper), pathname, ""))
+    {
+        AbstractMapper* abstract = *m_mapper;
+        if (abstract)
+        {
+            abstract->getIndex(m_files, m_mapper->basepath());
+        }
+    }
+
+    Path::Path(std::shared_ptr<Mapper> mapper)
+        : m_mapper(mapper)
+    {
+    }
+
     Path::~Path()
     {
     }
 
+    std::vector<std::future<std::unique_ptr<File>>> Path::prefetch(const std::vector<std::string>& filenames, u32 flags) const
+    {
+        std::vector<std::future<std::unique_ptr<File>>> files;
+        files.reserve(filenames.size());
+
+        for (const std::string& filename : filenames)
+        {
+            files.push_back(File::openAsync(*this, filename, flags));
+        }
+
+        return files;
+    }
+
     // -----------------------------------------------------------------
     // filename manipulation functions
     // -----------------------------------------------------------------
@@ -0,0 +1,1809 @@
+/*
+    MANGO Multimedia Development Platform
+    Copyright (C) 2012-2019 Twilight Finland 3D Oy Ltd. All rights reserved.
+*/
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <exception>
+#include <algorithm>
+#include <cstring>
+#include <mango/core/exception.hpp>
+#include <mango/core/buffer.hpp>
+#include <mango/core/pointer.hpp>
+#include <mango/core/thread.hpp>
+#include "seekable.hpp"
+
+#include "../../external/miniz/miniz.h"
+#include "../../external/zstd/zstd.h"
+#include "../../external/bzip2/bzlib.h"
+
+namespace
+{
+    using namespace mango;
+    using namespace mango::filesystem;
+
+    // window size is a multiple of the dictionary size so that the decoder
+    // output wraps to the start of the dictionary at every window boundary
+    constexpr size_t inflate_dict_size = TINFL_LZ_DICT_SIZE;
+    constexpr size_t inflate_window_size = 256 * 1024;
+    constexpr size_t inflate_max_windows = 4;
+
+    // A checkpoint is the decoder state with the dictionary (about 43 KB). The checkpoints
+    // are at least 1 MB apart so they take less than 5% of the decoded size, and the
+    // spacing grows with the stream so that there are at most 512 of them (22 MB).
+    constexpr u64 inflate_min_spacing = 1024 * 1024;
+    constexpr size_t inflate_max_checkpoints = 512;
+
+    // compression ratio used to choose the checkpoint spacing when the size is not known
+    constexpr u64 inflate_estimated_ratio = 4;
+
+    constexpr u64 unknown_size = ~u64(0);
+
+    struct InflateState
+    {
+        tinfl_decompressor decompressor;
+        u8 dictionary[inflate_dict_size];
+        u64 input;
+    };
+
+    // The stored checkpoints have the input position, the bit state and the dictionary.
+    // The decoding tables are rebuilt from the code lengths when the index is loaded.
+    constexpr u32 inflate_index_version = 2;
+    constexpr u32 inflate_state_size = 8 + 14 * 4 + 8 + 8 + 4 + TINFL_MAX_HUFF_TABLES * TINFL_MAX_HUFF_SYMBOLS_0 + inflate_dict_size;
+
+    void writeState(LittleEndianStream& s, const InflateState& state)
+    {
+        const tinfl_decompressor& r = state.decompressor;
+
+        s.write64(state.input);
+
+        const u32 values[] =
+        {
+            r.m_state, r.m_num_bits, r.m_zhdr0, r.m_zhdr1, r.m_z_adler32, r.m_final, r.m_type,
+            r.m_check_adler32, r.m_dist, r.m_counter, r.m_num_extra,
+            r.m_table_sizes[0], r.m_table_sizes[1], r.m_table_sizes[2]
+        };
+
+        for (u32 value : values)
+        {
+            s.write32(value);
+        }
+
+        s.write64(u64(r.m_bit_buf));
+        s.write64(u64(r.m_dist_from_out_buf_start));
+        s.write(r.m_raw_header, 4);
+
+        for (const tinfl_huff_table& table : r.m_tables)
+        {
+            s.write(table.m_code_size, TINFL_MAX_HUFF_SYMBOLS_0);
+        }
+
+        s.write(state.dictionary, inflate_dict_size);
+    }
+
+    // the same construction as in tinfl_decompress(); the code lengths come from the
+    // stored index so they are validated the same way before the tree is built
+    bool buildTable(tinfl_huff_table& table, u32 count)
+    {
+        u32 total_syms[16] = { 0 };
+        u32 next_code[17] = { 0 };
+
+        std::memset(table.m_look_up, 0, sizeof(table.m_look_up));
+        std::memset(table.m_tree, 0, sizeof(table.m_tree));
+
+        for (u32 i = 0; i < count; ++i)
+        {
+            total_syms[table.m_code_size[i]]++;
+        }
+
+        u32 used = 0;
+        u32 total = 0;
+        for (u32 i = 1; i <= 15; ++i)
+        {
+            used += total_syms[i];
+            total = (total + total_syms[i]) << 1;
+            next_code[i + 1] = total;
+        }
+
+        if (total != 65536 && used > 1)
+        {
+            // over-subscribed or incomplete code would overflow the tree
+            return false;
+        }
+
+        int tree_next = -1;
+
+        for (u32 symbol = 0; symbol < count; ++symbol)
+        {
+            const u32 code_size = table.m_code_size[symbol];
+            if (!code_size)
+            {
+                continue;
+            }
+
+            u32 code = next_code[code_size]++;
+            u32 rev_code = 0;
+
+            for (u32 i = code_size; i > 0; --i, code >>= 1)
+            {
+                rev_code = (rev_code << 1) | (code & 1);
+            }
+
+            if (code_size <= TINFL_FAST_LOOKUP_BITS)
+            {
+                const s16 k = s16((code_size << 9) | symbol);
+                for ( ; rev_code < TINFL_FAST_LOOKUP_SIZE; rev_code += (1 << code_size))
+                {
+                    table.m_look_up[rev_code] = k;
+                }
+                continue;
+            }
+
+            int tree_cur = table.m_look_up[rev_code & (TINFL_FAST_LOOKUP_SIZE - 1)];
+            if (!tree_cur)
+            {
+                table.m_look_up[rev_code & (TINFL_FAST_LOOKUP_SIZE - 1)] = s16(tree_next);
+                tree_cur = tree_next;
+                tree_next -= 2;
+            }
+
+            rev_code >>= (TINFL_FAST_LOOKUP_BITS - 1);
+
+            for (u32 j = code_size; j > (TINFL_FAST_LOOKUP_BITS + 1); --j)
+            {
+                tree_cur -= ((rev_code >>= 1) & 1);
+                if (!table.m_tree[-tree_cur - 1])
+                {
+                    table.m_tree[-tree_cur - 1] = s16(tree_next);
+                    tree_cur = tree_next;
+                    tree_next -= 2;
+                }
+                else
+                {
+                    tree_cur = table.m_tree[-tree_cur - 1];
+                }
+            }
+
+            tree_cur -= ((rev_code >>= 1) & 1);
+            table.m_tree[-tree_cur - 1] = s16(symbol);
+        }
+
+        return true;
+    }
+
+    // The checkpoints are taken when the output window is full so the decoder is
+    // suspended in one of the states which return TINFL_STATUS_HAS_MORE_OUTPUT, at the
+    // start of a member or at the end of one. The values which the state continues with
+    // are checked so that a stored index cannot resume the decoder out of its bounds.
+    bool isValidState(const tinfl_decompressor& r)
+    {
+        switch (r.m_state)
+        {
+            case 0:  // start of a member
+            case 34: // end of a member
+                return true;
+
+            case 9:  // stored block copy
+                return r.m_counter <= 0xffff;
+
+            case 52: // stored block byte from the bit buffer
+                return r.m_counter <= 0xffff && r.m_dist <= 0xff;
+
+            case 24: // literal
+                return r.m_counter < 256;
+
+            case 53: // match copy
+                return r.m_counter <= 258 && r.m_dist >= 1 && r.m_dist <= 32768;
+
+            default:
+                return false;
+        }
+    }
+
+    bool readState(LittleEndianConstPointer& p, InflateState& state)
+    {
+        tinfl_decompressor& r = state.decompressor;
+
+        state.input = p.read64();
+
+        u32* values[] =
+        {
+            &r.m_state, &r.m_num_bits, &r.m_zhdr0, &r.m_zhdr1, &r.m_z_adler32, &r.m_final, &r.m_type,
+            &r.m_check_adler32, &r.m_dist, &r.m_counter, &r.m_num_extra,
+            &r.m_table_sizes[0], &r.m_table_sizes[1], &r.m_table_sizes[2]
+        };
+
+        for (u32* value : values)
+        {
+            *value = p.read32();
+        }
+
+        const u64 bit_buf = p.read64();
+        const u64 dist_from_out_buf_start = p.read64();
+
+        std::memcpy(r.m_raw_header, p, 4);
+        p += 4;
+
+        for (tinfl_huff_table& table : r.m_tables)
+        {
+            std::memcpy(table.m_code_size, p, TINFL_MAX_HUFF_SYMBOLS_0);
+            p += TINFL_MAX_HUFF_SYMBOLS_0;
+        }
+
+        std::memcpy(state.dictionary, p, inflate_dict_size);
+        p += inflate_dict_size;
+
+        if (r.m_num_bits > TINFL_BITBUF_SIZE || dist_from_out_buf_start > inflate_dict_size ||
+            r.m_table_sizes[0] > TINFL_MAX_HUFF_SYMBOLS_0 ||
+            r.m_table_sizes[1] > TINFL_MAX_HUFF_SYMBOLS_1 ||
+            r.m_table_sizes[2] > TINFL_MAX_HUFF_SYMBOLS_2)
+        {
+            return false;
+        }
+
+        for (u32 i = 0; i < TINFL_MAX_HUFF_TABLES; ++i)
+        {
+            for (u32 j = 0; j < r.m_table_sizes[i]; ++j)
+            {
+                if (r.m_tables[i].m_code_size[j] > 15)
+                {
+                    return false;
+                }
+            }
+
+            if (!buildTable(r.m_tables[i], r.m_table_sizes[i]))
+            {
+                return false;
+            }
+        }
+
+        if (r.m_num_bits < 64 && (bit_buf >> r.m_num_bits))
+        {
+            // the bits above the buffered ones must be clear
+            return false;
+        }
+
+        if (!isValidState(r))
+        {
+            return false;
+        }
+
+        if ((r.m_state == 24 || r.m_state == 53) &&
+            (r.m_table_sizes[0] < 257 || r.m_table_sizes[1] < 1))
+        {
+            // the literal/length and distance tables are in use
+            return false;
+        }
+
+        r.m_bit_buf = tinfl_bit_buf_t(bit_buf);
+        r.m_dist_from_out_buf_start = size_t(dist_from_out_buf_start);
+
+        return true;
+    }
+
+    // returns the size of the gzip member header or zero when there is no header
+    size_t getGzipHeaderSize(const u8* data, size_t size)
+    {
+        if (size < 10 || data[0] != 0x1f || data[1] != 0x8b || data[2] != 8)
+        {
+            return 0;
+        }
+
+        const u8 flags = data[3];
+        size_t offset = 10;
+
+        if (flags & 0x04)
+        {
+            // FEXTRA
+            if (offset + 2 > size)
+                return 0;
+            offset += 2 + (data[offset] | (data[offset + 1] << 8));
+        }
+
+        for (u8 mask : { 0x08, 0x10 })
+        {
+            // FNAME, FCOMMENT: zero terminated strings
+            if (flags & mask)
+            {
+                while (offset < size && data[offset])
+                    ++offset;
+                ++offset;
+            }
+        }
+
+        if (flags & 0x02)
+        {
+            // FHCRC
+            offset += 2;
+        }
+
+        return offset <= size ? offset : 0;
+    }
+
+    // -----------------------------------------------------------------
+    // InflateStream
+    // -----------------------------------------------------------------
+
+    class InflateStream : public IndexedStream
+    {
+    protected:
+        struct Window
+        {
+            u64 index;
+            u64 stamp;
+            std::vector<u8> data;
+        };
+
+        Memory m_compressed;
+        u64 m_size; // unknown_size until the end of a gzip stream has been decoded
+        u64 m_offset;
+        size_t m_window_size;
+        u64 m_interval; // windows between the checkpoints
+        bool m_gzip;
+
+        // decoder state at the start of window m_state_window
+        std::unique_ptr<InflateState> m_state;
+        u64 m_state_window;
+
+        // checkpoints[i] is the decoder state at the start of window i * m_interval
+        std::vector<std::unique_ptr<InflateState>> m_checkpoints;
+
+        std::vector<Window> m_windows;
+        std::vector<u8> m_skip;
+        std::vector<u8> m_buffer;
+        u64 m_stamp;
+
+        u64 getWindowCount() const
+        {
+            if (m_size == unknown_size)
+            {
+                return unknown_size;
+            }
+
+            return (m_size + m_window_size - 1) / m_window_size;
+        }
+
+        size_t getWindowBytes(u64 index) const
+        {
+            const u64 start = index * m_window_size;
+            if (start >= m_size)
+            {
+                return 0;
+            }
+
+            return size_t(std::min(u64(m_window_size), m_size - start));
+        }
+
+        bool nextMember(InflateState& state)
+        {
+            // the member ends with crc32 and size; another member may follow
+            state.input = std::min(state.input + 8, u64(m_compressed.size));
+
+            const u8* data = m_compressed.address + state.input;
+            size_t header = getGzipHeaderSize(data, size_t(m_compressed.size - state.input));
+            if (!header)
+            {
+                return false;
+            }
+
+            state.input += header;
+            tinfl_init(&state.decompressor);
+            return true;
+        }
+
+        size_t decode(u8* dest)
+        {
+            const size_t bytes = getWindowBytes(m_state_window);
+            InflateState& state = *m_state;
+
+            size_t written = 0;
+            while (written < bytes)
+            {
+                // the output position is always a multiple of the dictionary size at window
+                // start so the decoder wraps exactly at the dictionary boundaries
+                const size_t dict_offset = written & (inflate_dict_size - 1);
+
+                size_t in_bytes = size_t(m_compressed.size - state.input);
+                size_t out_bytes = inflate_dict_size - dict_offset;
+
+                tinfl_status status = tinfl_decompress(&state.decompressor,
+                    m_compressed.address + state.input, &in_bytes,
+                    state.dictionary, state.dictionary + dict_offset, &out_bytes, 0);
+
+                state.input += in_bytes;
+
+                out_bytes = std::min(out_bytes, bytes - written);
+                std::memcpy(dest + written, state.dictionary + dict_offset, out_bytes);
+                written += out_bytes;
+
+                if (status < TINFL_STATUS_DONE)
+                {
+                    MANGO_EXCEPTION("[InflateStream] Corrupted compressed data.");
+                }
+
+                if (status == TINFL_STATUS_DONE && written < bytes)
+                {
+                    if (m_gzip && nextMember(state))
+                    {
+                        continue;
+                    }
+
+                    if (m_size == unknown_size)
+                    {
+                        // end of the stream
+                        m_size = m_state_window * m_window_size + written;
+                        break;
+                    }
+                }
+
+                if (written < bytes && (status == TINFL_STATUS_DONE || status == TINFL_STATUS_NEEDS_MORE_INPUT))
+                {
+                    MANGO_EXCEPTION("[InflateStream] Compressed data is truncated.");
+                }
+            }
+
+            ++m_state_window;
+
+            if (m_state_window == m_checkpoints.size() * m_interval && m_state_window < getWindowCount())
+            {
+                m_checkpoints.emplace_back(new InflateState(state));
+            }
+
+            return written;
+        }
+
+        size_t decode(u64 index, u8* dest)
+        {
+            // the live decoder is used when it is between the nearest checkpoint and the window
+            const u64 nearest = std::min(index / m_interval, u64(m_checkpoints.size() - 1));
+            if (m_state_window > index || m_state_window < nearest * m_interval)
+            {
+                *m_state = *m_checkpoints[size_t(nearest)];
+                m_state_window = nearest * m_interval;
+            }
+
+            while (m_state_window < index)
+            {
+                m_skip.resize(m_window_size);
+                if (!decode(m_skip.data()))
+                {
+                    // past the end of the stream
+                    return 0;
+                }
+            }
+
+            return decode(dest);
+        }
+
+        const Window& getWindow(u64 index)
+        {
+            Window* window = nullptr;
+
+            for (auto& w : m_windows)
+            {
+                if (w.index == index)
+                {
+                    w.stamp = ++m_stamp;
+                    return w;
+                }
+
+                if (!window || w.stamp < window->stamp)
+                {
+                    window = &w;
+                }
+            }
+
+            if (m_windows.size() < inflate_max_windows)
+            {
+                m_windows.emplace_back();
+                window = &m_windows.back();
+            }
+
+            // invalidate the window before decoding in case the decoder throws
+            window->index = ~u64(0);
+            window->data.resize(getWindowBytes(index));
+            window->data.resize(decode(index, window->data.data()));
+
+            window->index = index;
+            window->stamp = ++m_stamp;
+            return *window;
+        }
+
+        void copy(u8* dest, u64 offset, size_t bytes)
+        {
+            while (bytes > 0)
+            {
+                const u64 index = offset / m_window_size;
+                const size_t start = size_t(offset - index * m_window_size);
+
+                const Window& window = getWindow(index);
+                if (window.data.size() <= start)
+                {
+                    MANGO_EXCEPTION("[InflateStream] Reading past end of stream.");
+                }
+
+                const size_t count = std::min(bytes, window.data.size() - start);
+                std::memcpy(dest, window.data.data() + start, count);
+
+                dest += count;
+                offset += count;
+                bytes -= count;
+            }
+        }
+
+        void compact()
+        {
+            // The spacing was estimated when the size was not known; when there are
+            // too many checkpoints the spacing is doubled and every other one is dropped.
+            while (m_checkpoints.size() > inflate_max_checkpoints)
+            {
+                for (size_t i = 0; i * 2 < m_checkpoints.size(); ++i)
+                {
+                    m_checkpoints[i] = std::move(m_checkpoints[i * 2]);
+                }
+
+                m_checkpoints.resize((m_checkpoints.size() + 1) / 2);
+                m_interval *= 2;
+            }
+        }
+
+        u64 getSize()
+        {
+            while (m_size == unknown_size)
+            {
+                m_skip.resize(m_window_size);
+                decode(m_state_window, m_skip.data());
+                compact();
+            }
+
+            return m_size;
+        }
+
+    public:
+        InflateStream(Memory compressed, u64 size, bool gzip)
+            : m_compressed(compressed)
+            , m_size(size)
+            , m_offset(0)
+            , m_window_size(inflate_window_size)
+            , m_gzip(gzip)
+            , m_state(new InflateState())
+            , m_state_window(0)
+            , m_stamp(0)
+        {
+            tinfl_init(&m_state->decompressor);
+            m_state->input = 0;
+
+            if (gzip)
+            {
+                m_state->input = getGzipHeaderSize(compressed.address, compressed.size);
+                if (!m_state->input)
+                {
+                    MANGO_EXCEPTION("[InflateStream] Incorrect gzip header.");
+                }
+            }
+
+            // limit the number of checkpoints by growing the spacing with the stream size
+            u64 estimate = size == unknown_size ? compressed.size * inflate_estimated_ratio : size;
+            u64 spacing = std::max(inflate_min_spacing, estimate / inflate_max_checkpoints);
+            m_interval = (spacing + m_window_size - 1) / m_window_size;
+
+            m_checkpoints.emplace_back(new InflateState(*m_state));
+        }
+
+        ~InflateStream()
+        {
+        }
+
+        u64 size() const
+        {
+            // the end of the stream is found by decoding it
+            return const_cast<InflateStream*>(this)->getSize();
+        }
+
+        u64 offset() const
+        {
+            return m_offset;
+        }
+
+        void seek(u64 distance, SeekMode mode)
+        {
+            switch (mode)
+            {
+                case BEGIN:
+                    m_offset = std::min(m_size, distance);
+                    break;
+
+                case CURRENT:
+                    m_offset = std::min(m_size, m_offset + distance);
+                    break;
+
+                case END:
+                    m_offset = distance > size() ? 0 : m_size - distance;
+                    break;
+            }
+        }
+
+        void read(void* dest, size_t bytes)
+        {
+            if (m_size - m_offset < bytes)
+            {
+                MANGO_EXCEPTION("[InflateStream] Reading past end of stream.");
+            }
+
+            compact();
+            copy(reinterpret_cast<u8*>(dest), m_offset, bytes);
+            m_offset += bytes;
+        }
+
+        void write(const void* source, size_t bytes)
+        {
+            MANGO_UNREFERENCED(source);
+            MANGO_UNREFERENCED(bytes);
+            MANGO_EXCEPTION("[InflateStream] Stream is read-only.");
+        }
+
+        Memory map(u64 offset, size_t bytes)
+        {
+            if (offset > m_size)
+            {
+                return Memory();
+            }
+
+            compact();
+
+            bytes = size_t(std::min(u64(bytes), m_size - offset));
+
+            const u64 index = offset / m_window_size;
+            const size_t start = size_t(offset - index * m_window_size);
+
+            if (start + bytes <= getWindowBytes(index))
+            {
+                // range is inside one window; map the decoded window directly
+                const Window& window = getWindow(index);
+                if (start + bytes <= window.data.size())
+                {
+                    return Memory(window.data.data() + start, bytes);
+                }
+
+                // the stream ended inside the window
+                bytes = window.data.size() > start ? window.data.size() - start : 0;
+                return Memory(window.data.data() + start, bytes);
+            }
+
+            m_buffer.resize(bytes);
+            copy(m_buffer.data(), offset, bytes);
+            return Memory(m_buffer.data(), bytes);
+        }
+
+        void saveIndex(Buffer& buffer) const
+        {
+            MemoryStream stream;
+            LittleEndianStream s = stream;
+
+            s.write32(inflate_index_version);
+            s.write64(m_size);
+            s.write64(m_window_size);
+            s.write64(m_interval);
+            s.write32(u32(m_checkpoints.size()));
+
+            for (auto& checkpoint : m_checkpoints)
+            {
+                writeState(s, *checkpoint);
+            }
+
+            buffer.append(stream.data(), size_t(stream.size()));
+        }
+
+        bool loadIndex(Memory memory)
+        {
+            const size_t header = 32;
+            if (memory.size < header)
+            {
+                return false;
+            }
+
+            LittleEndianConstPointer p = memory.address;
+
+            u32 version = p.read32();
+            u64 size = p.read64();
+            u64 window_size = p.read64();
+            u64 interval = p.read64();
+            u32 count = p.read32();
+
+            if (version != inflate_index_version || !count || !interval || window_size != inflate_window_size ||
+                memory.size != header + u64(count) * inflate_state_size)
+            {
+                return false;
+            }
+
+            std::vector<std::unique_ptr<InflateState>> checkpoints;
+
+            for (u32 i = 0; i < count; ++i)
+            {
+                std::unique_ptr<InflateState> state(new InflateState());
+                if (!readState(p, *state) || state->input > m_compressed.size)
+                {
+                    return false;
+                }
+
+                checkpoints.push_back(std::move(state));
+            }
+
+            m_checkpoints = std::move(checkpoints);
+            m_size = size;
+            m_interval = interval;
+            m_windows.clear();
+
+            *m_state = *m_checkpoints[0];
+            m_state_window = 0;
+
+            return true;
+        }
+    };
+
+    // -----------------------------------------------------------------
+    // ZstdStream
+    // -----------------------------------------------------------------
+
+    // frames up to this size are decoded as a whole and cached; the larger
+    // frames are decoded with a streaming decoder which is moved forward
+    constexpr size_t zstd_max_window = 32 * 1024 * 1024;
+    constexpr size_t zstd_max_windows = 4;
+    constexpr size_t zstd_skip_size = 128 * 1024;
+
+    class ZstdStream : public IndexedStream
+    {
+    protected:
+        struct Frame
+        {
+            u64 input;
+            u64 input_size;
+            u64 output;
+            u64 output_size;
+        };
+
+        struct Window
+        {
+            size_t frame;
+            u64 stamp;
+            std::vector<u8> data;
+        };
+
+        Memory m_compressed;
+        std::vector<Frame> m_frames;
+        u64 m_size;
+        u64 m_offset;
+
+        std::vector<Window> m_windows;
+        u64 m_stamp;
+
+        // streaming decoder position in a large frame
+        ZSTD_DStream* m_dstream;
+        size_t m_cursor_frame;
+        size_t m_cursor_input;
+        u64 m_cursor_output;
+
+        std::vector<u8> m_skip;
+        std::vector<u8> m_buffer;
+
+        static constexpr size_t npos = ~size_t(0);
+
+        Memory getFrameMemory(const Frame& frame) const
+        {
+            return Memory(m_compressed.address + frame.input, size_t(frame.input_size));
+        }
+
+        static u64 measure(Memory memory)
+        {
+            // the frame header does not have the size; decode the frame to find it out
+            ZSTD_DStream* dstream = ZSTD_createDStream();
+            ZSTD_initDStream(dstream);
+
+            std::vector<u8> buffer(zstd_skip_size);
+            ZSTD_inBuffer input = { memory.address, memory.size, 0 };
+            u64 size = 0;
+
+            for (;;)
+            {
+                ZSTD_outBuffer output = { buffer.data(), buffer.size(), 0 };
+                size_t result = ZSTD_decompressStream(dstream, &output, &input);
+                if (ZSTD_isError(result))
+                {
+                    ZSTD_freeDStream(dstream);
+                    MANGO_EXCEPTION("[ZstdStream] %s", ZSTD_getErrorName(result));
+                }
+
+                size += output.pos;
+
+                if (!result)
+                {
+                    break;
+                }
+
+                if (!output.pos && input.pos == input.size)
+                {
+                    ZSTD_freeDStream(dstream);
+                    MANGO_EXCEPTION("[ZstdStream] Compressed data is truncated.");
+                }
+            }
+
+            ZSTD_freeDStream(dstream);
+            return size;
+        }
+
+        void parse()
+        {
+            u64 offset = 0;
+
+            while (offset < m_compressed.size)
+            {
+                const u8* data = m_compressed.address + offset;
+                const size_t available = size_t(m_compressed.size - offset);
+
+                size_t bytes = ZSTD_findFrameCompressedSize(data, available);
+                if (ZSTD_isError(bytes))
+                {
+                    MANGO_EXCEPTION("[ZstdStream] %s", ZSTD_getErrorName(bytes));
+                }
+
+                unsigned long long size = ZSTD_getFrameContentSize(data, bytes);
+                if (size == ZSTD_CONTENTSIZE_ERROR)
+                {
+                    // skippable frame
+                    size = 0;
+                }
+
+                m_frames.push_back({ offset, bytes, 0, u64(size) });
+                offset += bytes;
+            }
+
+            // the frames which do not store their size are measured in parallel
+            ConcurrentQueue q("zstd.measure", Priority::HIGH);
+
+            std::mutex error_mutex;
+            std::exception_ptr error;
+
+            for (Frame& frame : m_frames)
+            {
+                if (frame.output_size == ZSTD_CONTENTSIZE_UNKNOWN)
+                {
+                    Memory memory = getFrameMemory(frame);
+                    q.enqueue([&frame, memory, &error_mutex, &error] {
+                        try
+                        {
+                            frame.output_size = measure(memory);
+                        }
+                        catch (...)
+                        {
+                            std::lock_guard<std::mutex> lock(error_mutex);
+                            error = std::current_exception();
+                        }
+                    });
+                }
+            }
+
+            q.wait();
+
+            if (error)
+            {
+                std::rethrow_exception(error);
+            }
+
+            computeOutputOffsets();
+        }
+
+        void computeOutputOffsets()
+        {
+            m_size = 0;
+
+            for (Frame& frame : m_frames)
+            {
+                frame.output = m_size;
+                m_size += frame.output_size;
+            }
+        }
+
+        size_t getFrameIndex(u64 offset) const
+        {
+            auto i = std::upper_bound(m_frames.begin(), m_frames.end(), offset, [] (u64 value, const Frame& frame)
+            {
+                return value < frame.output;
+            });
+            return size_t(i - m_frames.begin()) - 1;
+        }
+
+        void decodeFrame(const Frame& frame, u8* dest) const
+        {
+            Memory memory = getFrameMemory(frame);
+            size_t result = ZSTD_decompress(dest, size_t(frame.output_size), memory.address, memory.size);
+            if (ZSTD_isError(result))
+            {
+                MANGO_EXCEPTION("[ZstdStream] %s", ZSTD_getErrorName(result));
+            }
+
+            if (result != frame.output_size)
+            {
+                MANGO_EXCEPTION("[ZstdStream] Incorrect frame size.");
+            }
+        }
+
+        const Window& getWindow(size_t index)
+        {
+            Window* window = nullptr;
+
+            for (auto& w : m_windows)
+            {
+                if (w.frame == index)
+                {
+                    w.stamp = ++m_stamp;
+                    return w;
+                }
+
+                if (!window || w.stamp < window->stamp)
+                {
+                    window = &w;
+                }
+            }
+
+            if (m_windows.size() < zstd_max_windows)
+            {
+                m_windows.emplace_back();
+                window = &m_windows.back();
+            }
+
+            // invalidate the window before decoding in case the decoder throws
+            const Frame& frame = m_frames[index];
+            window->frame = npos;
+            window->data.resize(size_t(frame.output_size));
+            decodeFrame(frame, window->data.data());
+
+            window->frame = index;
+            window->stamp = ++m_stamp;
+            return *window;
+        }
+
+        void stream(size_t index, u64 start, u8* dest, size_t bytes)
+        {
+            const Frame& frame = m_frames[index];
+
+            if (m_cursor_frame != index || m_cursor_output > start)
+            {
+                // the decoder can only move forward; restart at the beginning of the frame
+                ZSTD_initDStream(m_dstream);
+                m_cursor_frame = index;
+                m_cursor_input = 0;
+                m_cursor_output = 0;
+            }
+
+            Memory memory = getFrameMemory(frame);
+            ZSTD_inBuffer input = { memory.address, memory.size, m_cursor_input };
+
+            while (m_cursor_output < start + bytes)
+            {
+                ZSTD_outBuffer output;
+
+                if (m_cursor_output < start)
+                {
+                    m_skip.resize(zstd_skip_size);
+                    output = { m_skip.data(), size_t(std::min(u64(m_skip.size()), start - m_cursor_output)), 0 };
+                }
+                else
+                {
+                    output = { dest + size_t(m_cursor_output - start), size_t(start + bytes - m_cursor_output), 0 };
+                }
+
+                size_t result = ZSTD_decompressStream(m_dstream, &output, &input);
+                if (ZSTD_isError(result))
+                {
+                    m_cursor_frame = npos;
+                    MANGO_EXCEPTION("[ZstdStream] %s", ZSTD_getErrorName(result));
+                }
+
+                m_cursor_output += output.pos;
+                m_cursor_input = input.pos;
+
+                if (!output.pos && input.pos == input.size)
+                {
+                    m_cursor_frame = npos;
+                    MANGO_EXCEPTION("[ZstdStream] Compressed data is truncated.");
+                }
+            }
+        }
+
+        void copy(u8* dest, u64 offset, size_t bytes)
+        {
+            struct Task
+            {
+                const Frame* frame;
+                u8* dest;
+            };
+
+            std::vector<Task> tasks;
+
+            for (size_t index = getFrameIndex(offset); bytes > 0; ++index)
+            {
+                const Frame& frame = m_frames[index];
+                const u64 start = offset - frame.output;
+                const size_t count = size_t(std::min(u64(bytes), frame.output_size - start));
+
+                if (!count)
+                {
+                    // empty or skippable frame
+                    continue;
+                }
+
+                if (count == frame.output_size)
+                {
+                    // the whole frame is decoded directly into the destination
+                    tasks.push_back({ &frame, dest });
+                }
+                else if (frame.output_size <= zstd_max_window)
+                {
+                    const Window& window = getWindow(index);
+                    std::memcpy(dest, window.data.data() + start, count);
+                }
+                else
+                {
+                    stream(index, start, dest, count);
+                }
+
+                dest += count;
+                offset += count;
+                bytes -= count;
+            }
+
+            if (tasks.size() == 1)
+            {
+                decodeFrame(*tasks[0].frame, tasks[0].dest);
+            }
+            else if (tasks.size() > 1)
+            {
+                ConcurrentQueue q("zstd.decoder", Priority::HIGH);
+
+                std::mutex error_mutex;
+                std::exception_ptr error;
+
+                for (const Task& task : tasks)
+                {
+                    q.enqueue([this, task, &error_mutex, &error] {
+                        try
+                        {
+                            decodeFrame(*task.frame, task.dest);
+                        }
+                        catch (...)
+                        {
+                            std::lock_guard<std::mutex> lock(error_mutex);
+                            error = std::current_exception();
+                        }
+                    });
+                }
+
+                q.wait();
+
+                if (error)
+                {
+                    std::rethrow_exception(error);
+                }
+            }
+        }
+
+    public:
+        ZstdStream(Memory compressed, Memory index)
+            : m_compressed(compressed)
+            , m_size(0)
+            , m_offset(0)
+            , m_stamp(0)
+            , m_dstream(ZSTD_createDStream())
+            , m_cursor_frame(npos)
+            , m_cursor_input(0)
+            , m_cursor_output(0)
+        {
+            try
+            {
+                if (!index.size || !loadIndex(index))
+                {
+                    parse();
+                }
+            }
+            catch (...)
+            {
+                ZSTD_freeDStream(m_dstream);
+                throw;
+            }
+        }
+
+        ~ZstdStream()
+        {
+            ZSTD_freeDStream(m_dstream);
+        }
+
+        u64 size() const
+        {
+            return m_size;
+        }
+
+        u64 offset() const
+        {
+            return m_offset;
+        }
+
+        void seek(u64 distance, SeekMode mode)
+        {
+            switch (mode)
+            {
+                case BEGIN:
+                    m_offset = std::min(m_size, distance);
+                    break;
+
+                case CURRENT:
+                    m_offset = std::min(m_size, m_offset + distance);
+                    break;
+
+                case END:
+                    m_offset = distance > m_size ? 0 : m_size - distance;
+                    break;
+            }
+        }
+
+        void read(void* dest, size_t bytes)
+        {
+            if (m_size - m_offset < bytes)
+            {
+                MANGO_EXCEPTION("[ZstdStream] Reading past end of stream.");
+            }
+
+            copy(reinterpret_cast<u8*>(dest), m_offset, bytes);
+            m_offset += bytes;
+        }
+
+        void write(const void* source, size_t bytes)
+        {
+            MANGO_UNREFERENCED(source);
+            MANGO_UNREFERENCED(bytes);
+            MANGO_EXCEPTION("[ZstdStream] Stream is read-only.");
+        }
+
+        Memory map(u64 offset, size_t bytes)
+        {
+            if (offset > m_size)
+            {
+                return Memory();
+            }
+
+            bytes = size_t(std::min(u64(bytes), m_size - offset));
+
+            if (bytes > 0)
+            {
+                const size_t index = getFrameIndex(offset);
+                const Frame& frame = m_frames[index];
+                const u64 start = offset - frame.output;
+
+                if (start + bytes <= frame.output_size && frame.output_size <= zstd_max_window)
+                {
+                    // range is inside one frame; map the decoded frame directly
+                    const Window& window = getWindow(index);
+                    return Memory(window.data.data() + start, bytes);
+                }
+            }
+
+            m_buffer.resize(bytes);
+            copy(m_buffer.data(), offset, bytes);
+            return Memory(m_buffer.data(), bytes);
+        }
+
+        void saveIndex(Buffer& buffer) const
+        {
+            MemoryStream stream;
+            LittleEndianStream s = stream;
+
+            s.write32(u32(m_frames.size()));
+
+            for (const Frame& frame : m_frames)
+            {
+                s.write64(frame.input_size);
+                s.write64(frame.output_size);
+            }
+
+            buffer.append(stream.data(), size_t(stream.size()));
+        }
+
+        bool loadIndex(Memory memory)
+        {
+            if (memory.size < 4)
+            {
+                return false;
+            }
+
+            LittleEndianConstPointer p = memory.address;
+
+            u32 count = p.read32();
+            if (memory.size != 4 + u64(count) * 16)
+            {
+                return false;
+            }
+
+            std::vector<Frame> frames;
+            u64 input = 0;
+
+            for (u32 i = 0; i < count; ++i)
+            {
+                u64 input_size = p.read64();
+                u64 output_size = p.read64();
+                frames.push_back({ input, input_size, 0, output_size });
+                input += input_size;
+            }
+
+            if (input != m_compressed.size)
+            {
+                return false;
+            }
+
+            m_frames = std::move(frames);
+            m_windows.clear();
+            m_cursor_frame = npos;
+            computeOutputOffsets();
+
+            return true;
+        }
+    };
+
+    // -----------------------------------------------------------------
+    // Bzip2Stream
+    // -----------------------------------------------------------------
+
+    // The bzip2 blocks are compressed independently; only the combined checksum at the
+    // end of the stream depends on the previous blocks. The blocks start at any bit
+    // position with a 48 bit magic number so they are found by scanning the bits. A
+    // block is decoded alone by wrapping it into a stream of its own.
+    constexpr u64 bzip2_block_magic = 0x314159265359;
+    constexpr u64 bzip2_end_magic = 0x177245385090;
+    constexpr size_t bzip2_max_windows = 4;
+
+    class Bzip2Stream : public Stream
+    {
+    protected:
+        struct Block
+        {
+            u64 start;  // bit position of the block magic
+            u64 end;    // bit position of the next magic
+            u8 level;   // block size of the stream in 100 KB units
+            u64 output;
+            u64 output_size;
+        };
+
+        struct Window
+        {
+            size_t block;
+            u64 stamp;
+            std::vector<u8> data;
+        };
+
+        Memory m_compressed;
+        u64 m_size;
+        u64 m_offset;
+
+        // blocks[0..m_measured) have been decoded and have their output ranges
+        std::vector<Block> m_blocks;
+        size_t m_measured;
+
+        // the blocks are found when the stream is decoded forward
+        u64 m_scan;
+        u8 m_level;
+        bool m_scan_done;
+
+        std::vector<Window> m_windows;
+        u64 m_stamp;
+
+        std::vector<u8> m_buffer;
+
+        u64 getBits(u64 position, int count) const
+        {
+            // up to 48 bits from any bit position; the bits past the end are zero
+            if (!count)
+            {
+                return 0;
+            }
+
+            const size_t first = size_t(position >> 3);
+            u64 value = 0;
+
+            for (size_t i = 0; i < 8; ++i)
+            {
+                const size_t index = first + i;
+                value = (value << 8) | (index < m_compressed.size ? m_compressed.address[index] : 0);
+            }
+
+            return (value << (position & 7)) >> (64 - count);
+        }
+
+        bool readHeader(u64 position)
+        {
+            // "BZh" followed by the block size '1' .. '9'
+            const size_t offset = size_t(position >> 3);
+            if (offset + 4 > m_compressed.size)
+            {
+                return false;
+            }
+
+            const u8* p = m_compressed.address + offset;
+            if (p[0] != 'B' || p[1] != 'Z' || p[2] != 'h' || p[3] < '1' || p[3] > '9')
+            {
+                return false;
+            }
+
+            m_level = p[3] - '0';
+            m_scan = u64(offset + 4) * 8;
+            return true;
+        }
+
+        bool scan(u64& position, u64& magic)
+        {
+            // find the next block or end of stream magic at or after m_scan
+            const size_t total = m_compressed.size;
+            u64 window = 0;
+
+            for (size_t index = size_t(m_scan >> 3); index < total; ++index)
+            {
+                window = (window << 8) | m_compressed.address[index];
+
+                for (int shift = 7; shift >= 0; --shift)
+                {
+                    const u64 end = u64(index + 1) * 8 - shift;
+                    if (end < m_scan + 48)
+                    {
+                        continue;
+                    }
+
+                    const u64 value = (window >> shift) & 0xffffffffffff;
+                    if (value == bzip2_block_magic || value == bzip2_end_magic)
+                    {
+                        position = end - 48;
+                        magic = value;
+                        return true;
+                    }
+                }
+            }
+
+            return false;
+        }
+
+        bool discover()
+        {
+            // find the end of the last block; the next block is appended when there is one
+            while (!m_scan_done)
+            {
+                u64 position;
+                u64 magic;
+
+                if (!scan(position, magic))
+                {
+                    // the stream is truncated; the last block fails to decode
+                    if (!m_blocks.empty() && !m_blocks.back().end)
+                    {
+                        m_blocks.back().end = u64(m_compressed.size) * 8;
+                    }
+
+                    m_scan_done = true;
+                    return false;
+                }
+
+                if (!m_blocks.empty() && !m_blocks.back().end)
+                {
+                    m_blocks.back().end = position;
+                }
+
+                if (magic == bzip2_block_magic)
+                {
+                    m_blocks.push_back({ position, 0, m_level, 0, 0 });
+                    m_scan = position + 48;
+                    return true;
+                }
+
+                // end of stream with the combined checksum; another stream may follow
+                const u64 next = (position + 48 + 32 + 7) & ~u64(7);
+                if (!readHeader(next))
+                {
+                    m_scan_done = true;
+                }
+            }
+
+            return false;
+        }
+
+        void decode(const Block& block, std::vector<u8>& output)
+        {
+            // the block is wrapped into a stream of its own; the combined checksum of
+            // a stream with one block is the checksum of the block
+            const u32 crc = u32(getBits(block.start + 48, 32));
+            const u64 bits = block.end - block.start;
+
+            std::vector<u8> input;
+            input.reserve(size_t(bits / 8 + 20));
+
+            input.push_back('B');
+            input.push_back('Z');
+            input.push_back('h');
+            input.push_back('0' + block.level);
+
+            u64 position = block.start;
+            for (u64 count = bits / 8; count > 0; --count)
+            {
+                input.push_back(u8(getBits(position, 8)));
+                position += 8;
+            }
+
+            // remaining bits of the block, the end of stream magic and the checksum
+            const int remain = int(bits & 7);
+            u64 accumulator = getBits(position, remain);
+            accumulator = (accumulator << 48) | bzip2_end_magic;
+
+            int accumulated = remain + 48;
+            while (accumulated >= 8)
+            {
+                input.push_back(u8(accumulator >> (accumulated - 8)));
+                accumulated -= 8;
+            }
+
+            accumulator = (accumulator << 32) | crc;
+            accumulated += 32;
+            while (accumulated >= 8)
+            {
+                input.push_back(u8(accumulator >> (accumulated - 8)));
+                accumulated -= 8;
+            }
+
+            if (accumulated > 0)
+            {
+                input.push_back(u8(accumulator << (8 - accumulated)));
+            }
+
+            bz_stream strm;
+            std::memset(&strm, 0, sizeof(strm));
+
+            if (BZ2_bzDecompressInit(&strm, 0, 0) != BZ_OK)
+            {
+                MANGO_EXCEPTION("[Bzip2Stream] Decoder initialization failed.");
+            }
+
+            strm.next_in = reinterpret_cast<char*>(input.data());
+            strm.avail_in = unsigned(input.size());
+
+            output.resize(block.level * 100000 + 1024);
+            size_t written = 0;
+            int status;
+
+            for (;;)
+            {
+                strm.next_out = reinterpret_cast<char*>(output.data() + written);
+                strm.avail_out = unsigned(output.size() - written);
+
+                status = BZ2_bzDecompress(&strm);
+                written = output.size() - strm.avail_out;
+
+                if (status != BZ_OK || strm.avail_out)
+                {
+                    break;
+                }
+
+                // the run-length coding can expand the block beyond the block size
+                output.resize(output.size() * 2);
+            }
+
+            BZ2_bzDecompressEnd(&strm);
+
+            if (status != BZ_STREAM_END)
+            {
+                MANGO_EXCEPTION("[Bzip2Stream] Corrupted compressed data.");
+            }
+
+            output.resize(written);
+        }
+
+        bool measure()
+        {
+            // decode the next block in order to find where its output ends
+            if (m_measured == m_blocks.size() && !discover())
+            {
+                return false;
+            }
+
+            // the end of the block is the start of the next one
+            if (!m_blocks[m_measured].end)
+            {
+                discover();
+            }
+
+            m_blocks[m_measured].output = m_measured ?
+                m_blocks[m_measured - 1].output + m_blocks[m_measured - 1].output_size : 0;
+
+            for (;;)
+            {
+                try
+                {
+                    getWindow(m_measured, true);
+                    break;
+                }
+                catch (...)
+                {
+                    // a block magic can also appear in the compressed data by chance; it splits
+                    // the block which is then decoded together with the following segment
+                    if (m_measured + 1 >= m_blocks.size())
+                    {
+                        throw;
+                    }
+
+                    if (!m_blocks[m_measured + 1].end)
+                    {
+                        discover();
+                    }
+
+                    // the coded block is never much larger than the block size
+                    const Block& block = m_blocks[m_measured];
+                    const u64 limit = (block.level * 100000 + 1024) * 10;
+                    if (m_blocks[m_measured + 1].end - block.start > limit)
+                    {
+                        throw;
+                    }
+
+                    m_blocks[m_measured].end = m_blocks[m_measured + 1].end;
+                    m_blocks.erase(m_blocks.begin() + m_measured + 1);
+                }
+            }
+
+            ++m_measured;
+            return true;
+        }
+
+        size_t getBlockIndex(u64 offset)
+        {
+            while (!m_measured || offset >= m_blocks[m_measured - 1].output + m_blocks[m_measured - 1].output_size)
+            {
+                if (!measure())
+                {
+                    MANGO_EXCEPTION("[Bzip2Stream] Reading past end of stream.");
+                }
+            }
+
+            auto i = std::upper_bound(m_blocks.begin(), m_blocks.begin() + m_measured, offset,
+                [] (u64 value, const Block& block) {
+                    return value < block.output;
+                });
+
+            return size_t(i - m_blocks.begin() - 1);
+        }
+
+        Window& getWindow(size_t index, bool measuring = false)
+        {
+            Window* window = nullptr;
+
+            for (auto& w : m_windows)
+            {
+                if (w.block == index)
+                {
+                    w.stamp = ++m_stamp;
+                    return w;
+                }
+
+                if (!window || w.stamp < window->stamp)
+                {
+                    window = &w;
+                }
+            }
+
+            if (m_windows.size() < bzip2_max_windows)
+            {
+                m_windows.emplace_back();
+                window = &m_windows.back();
+            }
+
+            // invalidate the window before decoding in case the decoder throws
+            window->block = ~size_t(0);
+
+            Block& block = m_blocks[index];
+            decode(block, window->data);
+
+            if (measuring)
+            {
+                block.output_size = window->data.size();
+            }
+            else if (block.output_size != window->data.size())
+            {
+                MANGO_EXCEPTION("[Bzip2Stream] Corrupted compressed data.");
+            }
+
+            window->block = index;
+            window->stamp = ++m_stamp;
+            return *window;
+        }
+
+        void copy(u8* dest, u64 offset, size_t bytes)
+        {
+            while (bytes > 0)
+            {
+                const size_t index = getBlockIndex(offset);
+                const Block& block = m_blocks[index];
+                const Window& window = getWindow(index);
+
+                const size_t start = size_t(offset - block.output);
+                const size_t count = std::min(bytes, window.data.size() - start);
+                std::memcpy(dest, window.data.data() + start, count);
+
+                dest += count;
+                offset += count;
+                bytes -= count;
+            }
+        }
+
+    public:
+        Bzip2Stream(Memory compressed, u64 size)
+            : m_compressed(compressed)
+            , m_size(size)
+            , m_offset(0)
+            , m_measured(0)
+            , m_scan(0)
+            , m_level(0)
+            , m_scan_done(false)
+            , m_stamp(0)
+        {
+            if (!readHeader(0))
+            {
+                MANGO_EXCEPTION("[Bzip2Stream] Incorrect bzip2 header.");
+            }
+        }
+
+        ~Bzip2Stream()
+        {
+        }
+
+        u64 size() const
+        {
+            return m_size;
+        }
+
+        u64 offset() const
+        {
+            return m_offset;
+        }
+
+        void seek(u64 distance, SeekMode mode)
+        {
+            switch (mode)
+            {
+                case BEGIN:
+                    m_offset = std::min(m_size, distance);
+                    break;
+
+                case CURRENT:
+                    m_offset = std::min(m_size, m_offset + distance);
+                    break;
+
+                case END:
+                    m_offset = distance > m_size ? 0 : m_size - distance;
+                    break;
+            }
+        }
+
+        void read(void* dest, size_t bytes)
+        {
+            if (m_size - m_offset < bytes)
+            {
+                MANGO_EXCEPTION("[Bzip2Stream] Reading past end of stream.");
+            }
+
+            copy(reinterpret_cast<u8*>(dest), m_offset, bytes);
+            m_offset += bytes;
+        }
+
+        void write(const void* source, size_t bytes)
+        {
+            MANGO_UNREFERENCED(source);
+            MANGO_UNREFERENCED(bytes);
+            MANGO_EXCEPTION("[Bzip2Stream] Stream is read-only.");
+        }
+
+        Memory map(u64 offset, size_t bytes)
+        {
+            if (offset > m_size)
+            {
+                return Memory();
+            }
+
+            bytes = size_t(std::min(u64(bytes), m_size - offset));
+
+            if (bytes > 0)
+            {
+                const size_t index = getBlockIndex(offset);
+                const Block& block = m_blocks[index];
+                const u64 start = offset - block.output;
+
+                if (start + bytes <= block.output_size)
+                {
+                    // range is inside one block; map the decoded block directly
+                    const Window& window = getWindow(index);
+                    return Memory(window.data.data() + start, bytes);
+                }
+            }
+
+            m_buffer.resize(bytes);
+            copy(m_buffer.data(), offset, bytes);
+            return Memory(m_buffer.data(), bytes);
+        }
+    };
+
+    // -----------------------------------------------------------------
+    // VirtualMemoryStream
+    // -----------------------------------------------------------------
+
+    class VirtualMemoryStream : public ConstMemoryStream
+    {
+    protected:
+        std::unique_ptr<VirtualMemory> m_memory;
+
+    public:
+        VirtualMemoryStream(VirtualMemory* memory)
+            : ConstMemoryStream(*memory)
+            , m_memory(memory)
+        {
+        }
+
+        ~VirtualMemoryStream()
+        {
+        }
+
+        VirtualMemory* release()
+        {
+            return m_memory.release();
+        }
+    };
+
+} // namespace
+
+namespace mango {
+namespace filesystem {
+
+    Stream* createInflateStream(Memory compressed, u64 size)
+    {
+        return new InflateStream(compressed, size, false);
+    }
+
+    IndexedStream* createGzipStream(Memory compressed, Memory index)
+    {
+        InflateStream* stream = new InflateStream(compressed, unknown_size, true);
+        if (index.size)
+        {
+            stream->loadIndex(index);
+        }
+        return stream;
+    }
+
+    IndexedStream* createZstdStream(Memory compressed, Memory index)
+    {
+        return new ZstdStream(compressed, index);
+    }
+
+    Stream* createBzip2Stream(Memory compressed, u64 size)
+    {
+        return new Bzip2Stream(compressed, size);
+    }
+
+    Stream* createVirtualMemoryStream(VirtualMemory* memory)
+    {
+        return new VirtualMemoryStream(memory);
+    }
+
+    VirtualMemory* releaseVirtualMemory(Stream* stream)
+    {
+        VirtualMemoryStream* s = dynamic_cast<VirtualMemoryStream*>(stream);
+        if (!s)
+        {
+            return nullptr;
+        }
+
+        VirtualMemory* memory = s->release();
+        delete s;
+        return memory;
+    }
+
+} // namespace filesystem
+} // namespace mango
@@ -0,0 +1,56 @@
+/*
+    MANGO Multimedia Development Platform
+    Copyright (C) 2012-2019 Twilight Finland 3D Oy Ltd. All rights reserved.
+*/
+#pragma once
+
+#include <mango/core/configure.hpp>
+#include <mango/core/memory.hpp>
+#include <mango/core/buffer.hpp>
+#include <mango/core/stream.hpp>
+
+namespace mango {
+namespace filesystem {
+
+    // -----------------------------------------------------------------
+    // seekable decompression streams
+    // -----------------------------------------------------------------
+
+    // Random access stream to raw DEFLATE data. The data is decoded in windows
+    // when they are accessed; the decoder state is checkpointed at the window
+    // boundaries so that a seek only decodes from the nearest checkpoint.
+    // The compressed memory must stay valid for the lifetime of the stream.
+    Stream* createInflateStream(Memory compressed, u64 size);
+
+    // Stream with decoder checkpoints which can be stored and given back when the
+    // stream is created again so that the compressed data does not have to be
+    // decoded to rebuild them. An index which does not match is ignored.
+    class IndexedStream : public Stream
+    {
+    public:
+        virtual void saveIndex(Buffer& buffer) const = 0;
+    };
+
+    // Random access stream to gzip data with one or more members. The size is not
+    // known until the end of the stream has been decoded; size() decodes it when
+    // the index does not have it yet.
+    IndexedStream* createGzipStream(Memory compressed, Memory index = Memory());
+
+    // Random access stream to zstd data. The frames are the checkpoints; a seek
+    // decodes from the start of the frame and the frames which are completely
+    // covered by a read are decoded in parallel.
+    IndexedStream* createZstdStream(Memory compressed, Memory index = Memory());
+
+    // Random access stream to bzip2 data. The blocks are decoded independently so a
+    // seek decodes one block; the blocks are found when the stream is read forward.
+    Stream* createBzip2Stream(Memory compressed, u64 size);
+
+    // Stream which owns the mapped memory it reads from.
+    Stream* createVirtualMemoryStream(VirtualMemory* memory);
+
+    // Takes the mapped memory out of a stream created with createVirtualMemoryStream()
+    // and deletes the stream. Returns nullptr and leaves other streams untouched.
+    VirtualMemory* releaseVirtualMemory(Stream* stream);
+
+} // namespace filesystem
+} // namespace mango
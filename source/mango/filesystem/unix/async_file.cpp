@@ -0,0 +1,801 @@
+/*
+    MANGO Multimedia Development Platform
+    Copyright (C) 2012-2019 Twilight Finland 3D Oy Ltd. All rights reserved.
+*/
+#include <memory>
+#include <algorithm>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+#include <vector>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+
+#include <mango/core/exception.hpp>
+#include <mango/filesystem/file.hpp>
+
+#if defined(MANGO_PLATFORM_LINUX)
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define MANGO_ENABLE_IO_URING
+#endif
+#endif
+
+#ifndef O_DIRECT
+#define O_DIRECT 0
+#endif
+
+namespace mango {
+namespace filesystem {
+
+    struct AsyncFileHandle;
+
+} // namespace filesystem
+} // namespace mango
+
+namespace
+{
+    using namespace mango;
+    using namespace mango::filesystem;
+
+    struct Request
+    {
+        AsyncFileHandle* handle;
+        int fd;
+        bool write;
+        u64 offset;
+        Memory memory;
+        struct iovec iov;
+        ConcurrentQueue* queue;
+        AsyncFile::Callback callback;
+    };
+
+    void completeRequest(Request* request, ssize_t result);
+
+    // positional transfer which retries the partial transfers and interruptions
+    ssize_t transfer(int fd, bool write, u64 offset, u8* address, size_t size)
+    {
+        size_t total = 0;
+
+        while (total < size)
+        {
+            ssize_t n = write ? ::pwrite(fd, address + total, size - total, off_t(offset + total))
+                              : ::pread(fd, address + total, size - total, off_t(offset + total));
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return -1;
+            }
+
+            if (n == 0)
+            {
+                // end of file
+                break;
+            }
+
+            total += size_t(n);
+        }
+
+        return ssize_t(total);
+    }
+
+    // -----------------------------------------------------------------
+    // IOEngine
+    // -----------------------------------------------------------------
+
+    class IOEngine
+    {
+    public:
+        virtual ~IOEngine() = default;
+        virtual bool isAsync() const = 0;
+        virtual void push(Request* request) = 0;
+        virtual void submit() = 0;
+    };
+
+    // pread() / pwrite() in the ThreadPool
+    class ThreadEngine : public IOEngine
+    {
+    protected:
+        ConcurrentQueue m_queue;
+
+    public:
+        ThreadEngine()
+            : m_queue("filesystem.io", Priority::HIGH)
+        {
+        }
+
+        bool isAsync() const override
+        {
+            return false;
+        }
+
+        void push(Request* request) override
+        {
+            m_queue.enqueue([request] {
+                ssize_t result = transfer(request->fd, request->write, request->offset,
+                                          request->memory.address, request->memory.size);
+                completeRequest(request, result);
+            });
+        }
+
+        void submit() override
+        {
+            // the requests are executed when they are pushed
+        }
+    };
+
+#ifdef MANGO_ENABLE_IO_URING
+
+    // -----------------------------------------------------------------
+    // UringEngine
+    // -----------------------------------------------------------------
+
+    // One ring is shared by all files; the submissions are batched until submit()
+    // or the submission queue is full. A completion thread reaps the completion queue
+    // and enqueues the callbacks.
+
+    class UringEngine : public IOEngine
+    {
+    protected:
+        int m_ring { -1 };
+
+        u32* m_sq_head;
+        u32* m_sq_tail;
+        u32* m_sq_array;
+        u32 m_sq_mask;
+        u32 m_sq_entries;
+        io_uring_sqe* m_sqes;
+
+        u32* m_cq_head;
+        u32* m_cq_tail;
+        u32 m_cq_mask;
+        u32 m_cq_entries;
+        io_uring_cqe* m_cqes;
+
+        void* m_sq_memory { MAP_FAILED };
+        size_t m_sq_memory_size { 0 };
+        void* m_cq_memory { MAP_FAILED };
+        size_t m_cq_memory_size { 0 };
+        void* m_sqe_memory { MAP_FAILED };
+        size_t m_sqe_memory_size { 0 };
+
+        std::mutex m_mutex;
+        std::condition_variable m_condition;
+        u32 m_unsubmitted { 0 };
+        u32 m_inflight { 0 };
+        std::unique_ptr<ThreadEngine> m_fallback;
+        bool m_failed { false };
+        bool m_running { false };
+        bool m_waiting { true };
+        bool m_stopping { false };
+        std::thread m_thread;
+
+        static int enter(int ring, u32 submit, u32 complete, u32 flags)
+        {
+            return int(::syscall(__NR_io_uring_enter, ring, submit, complete, flags, nullptr, 0));
+        }
+
+        static bool isTransient(int error)
+        {
+            return error == EINTR || error == EAGAIN || error == EBUSY;
+        }
+
+        void fail()
+        {
+            // caller holds the mutex; the ring is not used for submission after this.
+            // The entries which the kernel did not consume are taken back from the
+            // submission queue and executed in the ThreadPool. The requests which were
+            // submitted already are owned by the kernel until they are reaped.
+            if (!m_fallback)
+            {
+                m_fallback.reset(new ThreadEngine());
+            }
+
+            m_failed = true;
+
+            u32 head = __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+            const u32 tail = *m_sq_tail;
+            u32 count = 0;
+
+            for ( ; head != tail; ++head)
+            {
+                const io_uring_sqe& sqe = m_sqes[m_sq_array[head & m_sq_mask]];
+                Request* request = reinterpret_cast<Request*>(sqe.user_data);
+                if (request)
+                {
+                    m_fallback->push(request);
+                }
+                ++count;
+            }
+
+            __atomic_store_n(m_sq_tail, tail - count, __ATOMIC_RELEASE);
+            m_unsubmitted = 0;
+            m_inflight -= std::min(count, m_inflight);
+            m_condition.notify_all();
+        }
+
+        void flush()
+        {
+            // caller holds the mutex
+            while (m_unsubmitted > 0 && !m_fallback)
+            {
+                int n = enter(m_ring, m_unsubmitted, 0, 0);
+                if (n < 0)
+                {
+                    if (isTransient(errno))
+                    {
+                        std::this_thread::yield();
+                        continue;
+                    }
+                    fail();
+                    break;
+                }
+                m_unsubmitted -= u32(n);
+            }
+        }
+
+        io_uring_sqe* getEntry()
+        {
+            // caller holds the mutex; the completion queue must not overflow
+            std::unique_lock<std::mutex> lock(m_mutex, std::adopt_lock);
+            while (m_inflight >= m_cq_entries && !m_fallback)
+            {
+                flush();
+                if (m_fallback)
+                    break;
+                m_condition.wait(lock);
+            }
+            lock.release();
+
+            if (m_fallback)
+            {
+                return nullptr;
+            }
+
+            const u32 tail = *m_sq_tail;
+            if (tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE) >= m_sq_entries)
+            {
+                flush();
+                if (m_fallback)
+                    return nullptr;
+            }
+
+            const u32 index = tail & m_sq_mask;
+            io_uring_sqe* sqe = &m_sqes[index];
+            std::memset(sqe, 0, sizeof(io_uring_sqe));
+            m_sq_array[index] = index;
+            return sqe;
+        }
+
+        void commit()
+        {
+            // caller holds the mutex
+            __atomic_store_n(m_sq_tail, *m_sq_tail + 1, __ATOMIC_RELEASE);
+            ++m_unsubmitted;
+            ++m_inflight;
+        }
+
+        void thread()
+        {
+            std::vector<std::pair<Request*, ssize_t>> completed;
+            bool polling = false;
+
+            for (;;)
+            {
+                if (polling)
+                {
+                    // the kernel still posts the completions into the ring
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+                else
+                {
+                    int n = enter(m_ring, 0, 1, IORING_ENTER_GETEVENTS);
+                    if (n < 0 && !isTransient(errno))
+                    {
+                        // the completions cannot be waited for; the submitted requests
+                        // are reaped by polling the ring so that none of them completes
+                        // while the kernel can still write into the buffer
+                        std::lock_guard<std::mutex> lock(m_mutex);
+                        fail();
+                        polling = true;
+                    }
+                }
+
+                u32 head = *m_cq_head;
+                const u32 tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+                u32 count = 0;
+                bool stop = false;
+
+                for ( ; head != tail; ++head)
+                {
+                    const io_uring_cqe& cqe = m_cqes[head & m_cq_mask];
+                    Request* request = reinterpret_cast<Request*>(cqe.user_data);
+                    if (request)
+                    {
+                        completed.emplace_back(request, ssize_t(cqe.res));
+                    }
+                    else
+                    {
+                        // shutdown
+                        stop = true;
+                    }
+                    ++count;
+                }
+
+                __atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+
+                for (auto& node : completed)
+                {
+                    ssize_t result = node.second;
+                    if (result < 0)
+                    {
+                        errno = int(-result);
+                        result = -1;
+                    }
+                    completeRequest(node.first, result);
+                }
+
+                completed.clear();
+
+                std::lock_guard<std::mutex> lock(m_mutex);
+
+                if (count)
+                {
+                    m_inflight -= std::min(count, m_inflight);
+                    m_condition.notify_all();
+                }
+
+                if (stop || (m_failed && (m_inflight == 0 || (polling && m_stopping))))
+                {
+                    m_running = false;
+                    break;
+                }
+
+                m_waiting = !polling;
+            }
+        }
+
+    public:
+        UringEngine()
+        {
+        }
+
+        ~UringEngine()
+        {
+            if (m_thread.joinable())
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_stopping = true;
+
+                if (m_running && !m_failed)
+                {
+                    // wake up the completion thread with a no-operation request
+                    io_uring_sqe* sqe = getEntry();
+                    if (sqe)
+                    {
+                        sqe->opcode = IORING_OP_NOP;
+                        sqe->user_data = 0;
+                        commit();
+                        flush();
+                    }
+                }
+
+                if (m_running && m_failed && m_waiting && m_inflight == 0)
+                {
+                    // the completion thread waits in the kernel for a completion which
+                    // does not arrive; the ring is left to it until the process exits
+                    lock.unlock();
+                    m_thread.detach();
+                    return;
+                }
+
+                lock.unlock();
+                m_thread.join();
+            }
+
+            if (m_sqe_memory != MAP_FAILED)
+                ::munmap(m_sqe_memory, m_sqe_memory_size);
+            if (m_cq_memory != MAP_FAILED && m_cq_memory != m_sq_memory)
+                ::munmap(m_cq_memory, m_cq_memory_size);
+            if (m_sq_memory != MAP_FAILED)
+                ::munmap(m_sq_memory, m_sq_memory_size);
+            if (m_ring != -1)
+                ::close(m_ring);
+        }
+
+        bool init(u32 entries)
+        {
+            io_uring_params params;
+            std::memset(&params, 0, sizeof(params));
+
+            m_ring = int(::syscall(__NR_io_uring_setup, entries, &params));
+            if (m_ring < 0)
+            {
+                // not supported by the kernel or disabled
+                m_ring = -1;
+                return false;
+            }
+
+            m_sq_memory_size = params.sq_off.array + params.sq_entries * sizeof(u32);
+            m_cq_memory_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+            const bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+            if (single)
+            {
+                m_sq_memory_size = std::max(m_sq_memory_size, m_cq_memory_size);
+            }
+
+            m_sq_memory = ::mmap(nullptr, m_sq_memory_size, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, m_ring, IORING_OFF_SQ_RING);
+            if (m_sq_memory == MAP_FAILED)
+                return false;
+
+            if (single)
+            {
+                m_cq_memory = m_sq_memory;
+            }
+            else
+            {
+                m_cq_memory = ::mmap(nullptr, m_cq_memory_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, m_ring, IORING_OFF_CQ_RING);
+                if (m_cq_memory == MAP_FAILED)
+                    return false;
+            }
+
+            m_sqe_memory_size = params.sq_entries * sizeof(io_uring_sqe);
+            m_sqe_memory = ::mmap(nullptr, m_sqe_memory_size, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, m_ring, IORING_OFF_SQES);
+            if (m_sqe_memory == MAP_FAILED)
+                return false;
+
+            u8* sq = reinterpret_cast<u8*>(m_sq_memory);
+            m_sq_head = reinterpret_cast<u32*>(sq + params.sq_off.head);
+            m_sq_tail = reinterpret_cast<u32*>(sq + params.sq_off.tail);
+            m_sq_array = reinterpret_cast<u32*>(sq + params.sq_off.array);
+            m_sq_mask = *reinterpret_cast<u32*>(sq + params.sq_off.ring_mask);
+            m_sq_entries = *reinterpret_cast<u32*>(sq + params.sq_off.ring_entries);
+            m_sqes = reinterpret_cast<io_uring_sqe*>(m_sqe_memory);
+
+            u8* cq = reinterpret_cast<u8*>(m_cq_memory);
+            m_cq_head = reinterpret_cast<u32*>(cq + params.cq_off.head);
+            m_cq_tail = reinterpret_cast<u32*>(cq + params.cq_off.tail);
+            m_cq_mask = *reinterpret_cast<u32*>(cq + params.cq_off.ring_mask);
+            m_cq_entries = *reinterpret_cast<u32*>(cq + params.cq_off.ring_entries);
+            m_cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+            m_running = true;
+            m_thread = std::thread([this] {
+                thread();
+            });
+
+            return true;
+        }
+
+        bool isAsync() const override
+        {
+            return true;
+        }
+
+        void push(Request* request) override
+        {
+            request->iov.iov_base = request->memory.address;
+            request->iov.iov_len = request->memory.size;
+
+            m_mutex.lock();
+
+            io_uring_sqe* sqe = getEntry();
+            if (!sqe)
+            {
+                m_mutex.unlock();
+                m_fallback->push(request);
+                return;
+            }
+
+            sqe->opcode = request->write ? IORING_OP_WRITEV : IORING_OP_READV;
+            sqe->fd = request->fd;
+            sqe->off = request->offset;
+            sqe->addr = reinterpret_cast<u64>(&request->iov);
+            sqe->len = 1;
+            sqe->user_data = reinterpret_cast<u64>(request);
+            commit();
+
+            m_mutex.unlock();
+        }
+
+        void submit() override
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            flush();
+        }
+    };
+
+#endif // MANGO_ENABLE_IO_URING
+
+    IOEngine& getEngine()
+    {
+        struct Instance
+        {
+            std::unique_ptr<IOEngine> engine;
+
+            Instance()
+            {
+                // the ring falls back to the ThreadPool, possibly when it is destroyed;
+                // the pool is created first so that it is destroyed after the engine
+                ThreadPool::getInstance();
+
+#ifdef MANGO_ENABLE_IO_URING
+                UringEngine* uring = new UringEngine();
+                if (uring->init(256))
+                {
+                    engine.reset(uring);
+                    return;
+                }
+                delete uring;
+#endif
+                engine.reset(new ThreadEngine());
+            }
+        };
+
+        static Instance instance;
+        return *instance.engine;
+    }
+
+} // namespace
+
+namespace mango {
+namespace filesystem {
+
+    // -----------------------------------------------------------------
+    // AsyncFileHandle
+    // -----------------------------------------------------------------
+
+    struct AsyncFileHandle
+    {
+        std::string m_filename;
+        u32 m_flags;
+        int m_fd;
+        size_t m_readahead { 0 };
+        std::atomic<u64> m_next_offset { 0 };
+
+        std::mutex m_mutex;
+        std::condition_variable m_condition;
+        size_t m_pending { 0 };
+
+        AsyncFileHandle(const std::string& filename, u32 flags)
+            : m_filename(filename)
+            , m_flags(flags)
+        {
+            int mode = 0;
+
+            switch (flags & (AsyncFile::READ | AsyncFile::WRITE))
+            {
+                case AsyncFile::READ:
+                    mode = O_RDONLY;
+                    break;
+                case AsyncFile::WRITE:
+                    mode = O_WRONLY | O_CREAT | O_TRUNC;
+                    break;
+                case AsyncFile::READ | AsyncFile::WRITE:
+                    mode = O_RDWR | O_CREAT;
+                    break;
+                default:
+                    MANGO_EXCEPTION("[AsyncFile] Incorrect flags.");
+            }
+
+            if (flags & AsyncFile::DIRECT)
+            {
+                mode |= O_DIRECT;
+            }
+
+            m_fd = ::open(filename.c_str(), mode | O_CLOEXEC, 0644);
+            if (m_fd == -1)
+            {
+                MANGO_EXCEPTION("[AsyncFile] Opening \"%s\" failed.", filename.c_str());
+            }
+        }
+
+        ~AsyncFileHandle()
+        {
+            wait();
+            ::close(m_fd);
+        }
+
+        void push(bool write, u64 offset, Memory memory, ConcurrentQueue& queue, AsyncFile::Callback callback)
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                ++m_pending;
+            }
+
+            Request* request = new Request();
+            request->handle = this;
+            request->fd = m_fd;
+            request->write = write;
+            request->offset = offset;
+            request->memory = memory;
+            request->queue = &queue;
+            request->callback = std::move(callback);
+
+            getEngine().push(request);
+        }
+
+        void complete()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (--m_pending == 0)
+            {
+                m_condition.notify_all();
+            }
+        }
+
+        void wait()
+        {
+            getEngine().submit();
+
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condition.wait(lock, [this] {
+                return m_pending == 0;
+            });
+        }
+
+        size_t read(u64 offset, void* dest, size_t size)
+        {
+            ssize_t result = transfer(m_fd, false, offset, reinterpret_cast<u8*>(dest), size);
+            if (result < 0)
+            {
+                MANGO_EXCEPTION("[AsyncFile] Reading \"%s\" failed.", m_filename.c_str());
+            }
+
+            const u64 next = offset + u64(result);
+
+            if (m_readahead && !(m_flags & AsyncFile::DIRECT))
+            {
+                // sequential access moves the read-ahead window forward
+                if (m_next_offset.exchange(next) == offset)
+                {
+#if defined(POSIX_FADV_WILLNEED)
+                    ::posix_fadvise(m_fd, off_t(next), off_t(m_readahead), POSIX_FADV_WILLNEED);
+#endif
+                }
+            }
+
+            return size_t(result);
+        }
+
+        size_t write(u64 offset, const void* data, size_t size)
+        {
+            u8* address = reinterpret_cast<u8*>(const_cast<void*>(data));
+            ssize_t result = transfer(m_fd, true, offset, address, size);
+            if (result < 0)
+            {
+                MANGO_EXCEPTION("[AsyncFile] Writing \"%s\" failed.", m_filename.c_str());
+            }
+            return size_t(result);
+        }
+    };
+
+} // namespace filesystem
+} // namespace mango
+
+namespace
+{
+
+    void completeRequest(Request* request, ssize_t result)
+    {
+        Memory memory = request->memory;
+        bool status = result >= 0;
+        memory.size = status ? size_t(result) : 0;
+
+        AsyncFile::Callback callback = std::move(request->callback);
+        request->queue->enqueue([callback, memory, status] {
+            callback(memory, status);
+        });
+
+        AsyncFileHandle* handle = request->handle;
+        delete request;
+
+        handle->complete();
+    }
+
+} // namespace
+
+namespace mango {
+namespace filesystem {
+
+    // -----------------------------------------------------------------
+    // AsyncFile
+    // -----------------------------------------------------------------
+
+    AsyncFile::AsyncFile(const std::string& filename, u32 flags)
+        : m_handle(new AsyncFileHandle(filename, flags))
+    {
+    }
+
+    AsyncFile::~AsyncFile()
+    {
+        delete m_handle;
+    }
+
+    const std::string& AsyncFile::filename() const
+    {
+        return m_handle->m_filename;
+    }
+
+    u64 AsyncFile::size() const
+    {
+        struct stat sb;
+        if (::fstat(m_handle->m_fd, &sb) == -1)
+        {
+            return 0;
+        }
+        return u64(sb.st_size);
+    }
+
+    void AsyncFile::resize(u64 size)
+    {
+        if (::ftruncate(m_handle->m_fd, off_t(size)) == -1)
+        {
+            MANGO_EXCEPTION("[AsyncFile] Resizing \"%s\" failed.", m_handle->m_filename.c_str());
+        }
+    }
+
+    void AsyncFile::setReadAhead(size_t bytes)
+    {
+        m_handle->m_readahead = bytes;
+
+#if defined(POSIX_FADV_SEQUENTIAL)
+        ::posix_fadvise(m_handle->m_fd, 0, 0, bytes ? POSIX_FADV_SEQUENTIAL : POSIX_FADV_NORMAL);
+#endif
+    }
+
+    size_t AsyncFile::read(u64 offset, void* dest, size_t size)
+    {
+        return m_handle->read(offset, dest, size);
+    }
+
+    size_t AsyncFile::write(u64 offset, const void* data, size_t size)
+    {
+        return m_handle->write(offset, data, size);
+    }
+
+    void AsyncFile::read(u64 offset, Memory dest, ConcurrentQueue& queue, Callback callback)
+    {
+        m_handle->push(false, offset, dest, queue, std::move(callback));
+    }
+
+    void AsyncFile::write(u64 offset, Memory source, ConcurrentQueue& queue, Callback callback)
+    {
+        m_handle->push(true, offset, source, queue, std::move(callback));
+    }
+
+    void AsyncFile::submit()
+    {
+        getEngine().submit();
+    }
+
+    void AsyncFile::wait()
+    {
+        m_handle->wait();
+    }
+
+    bool AsyncFile::isAsyncSupported()
+    {
+        return getEngine().isAsync();
+    }
+
+    size_t AsyncFile::getDirectAlignment()
+    {
+        return 4096;
+    }
+
+} // namespace filesystem
+} // namespace mango
@@ -16,9 +16,14 @@
 // -----------------------------------------------------------------
 
 #include <thread>
+#include <unordered_map>
+#include <cerrno>
+#include <poll.h>
 #include <sys/inotify.h>
+#include <sys/eventfd.h>
 #include <unistd.h>
 #include <limits.h>
+#include "../file_observer.hpp"
 
 namespace mango {
 namespace filesystem {
@@ -31,116 +36,242 @@ namespace filesystem {
 
 	struct FileObserverState
 	{
-        FileObserver* m_observer;
+        std::string m_root;
+        bool m_recursive;
 		int m_notify;
-		int m_watch;
+        int m_wakeup;
+        std::unordered_map<int, std::string> m_watches; // watch descriptor -> relative path
+        FileEventBatch m_batch;
         std::thread m_thread;
 
-        FileObserverState(FileObserver* observer, int notify, int watch)
-            : m_observer(observer)
-            , m_notify(notify)
-            , m_watch(watch)
+        FileObserverState(FileObserver* observer, const std::string& pathname, u32 options, u32 debounce,
+                          const std::function<void(std::function<void()>&&)>& dispatch)
+            : m_root(pathname)
+            , m_recursive((options & FileObserver::RECURSIVE) != 0)
+            , m_notify(-1)
+            , m_wakeup(-1)
+            , m_batch(observer, debounce, dispatch)
         {
+            if (!m_root.empty() && m_root.back() != '/')
+            {
+                m_root += '/';
+            }
+
+            m_notify = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+            if (m_notify < 0)
+            {
+                MANGO_EXCEPTION("[FileObserver] inotify_init() failed.");
+            }
+
+            m_wakeup = eventfd(0, EFD_CLOEXEC);
+            if (m_wakeup < 0)
+            {
+                close(m_notify);
+                MANGO_EXCEPTION("[FileObserver] eventfd() failed.");
+            }
+
+            if (addWatch("") < 0)
+            {
+                close(m_wakeup);
+                close(m_notify);
+                MANGO_EXCEPTION("[FileObserver] inotify_add_watch() failed.");
+            }
+
+            if (m_recursive)
+            {
+                scan("", false);
+            }
+
             // launch inotify handler in it's own thread
-            m_thread = std::thread([] (FileObserver* observer, int notify, int watch)
+            m_thread = std::thread([this]
             {
-                for (;;)
+                run();
+            });
+        }
+
+        ~FileObserverState()
+        {
+            u64 value = 1;
+            ssize_t bytes = write(m_wakeup, &value, sizeof(value));
+            MANGO_UNREFERENCED(bytes);
+
+            m_thread.join();
+            close(m_wakeup);
+            close(m_notify);
+        }
+
+        int addWatch(const std::string& relative)
+        {
+            const u32 mask = IN_CREATE | IN_DELETE | IN_MODIFY | IN_MOVED_FROM | IN_MOVED_TO;
+            int watch = inotify_add_watch(m_notify, (m_root + relative).c_str(), mask);
+            if (watch >= 0)
+            {
+                m_watches[watch] = relative;
+            }
+            return watch;
+        }
+
+        void removeWatches(const std::string& prefix)
+        {
+            for (auto i = m_watches.begin(); i != m_watches.end(); )
+            {
+                if (!i->second.compare(0, prefix.length(), prefix))
+                {
+                    inotify_rm_watch(m_notify, i->first);
+                    i = m_watches.erase(i);
+                }
+                else
                 {
-                    char buffer[BUFFER_SIZE];
+                    ++i;
+                }
+            }
+        }
 
-                    // read events (this call is blocking and the reason why the observer is threaded)
-                    int length = read(notify, buffer, BUFFER_SIZE);
-                    if (length < 0)
+        // watch the subdirectories; optionally report the contents as created since
+        // they may have been populated before the watch was added
+        void scan(const std::string& relative, bool report)
+        {
+            try
+            {
+                walk(m_root + relative, [&] (const FileInfo& info)
+                {
+                    std::string filename = relative + info.name;
+                    u32 flags = FileObserver::FILE;
+
+                    if (info.isDirectory())
                     {
-                        return;
+                        addWatch(filename);
+                        filename.pop_back();
+                        flags = FileObserver::DIRECTORY;
                     }
 
-                    char* ptr = buffer;
-                    char* end = buffer + length;
-
-                    while (ptr < end)
+                    if (report)
                     {
-                        // extract one event
-                        inotify_event* event = (inotify_event *)ptr;
-                        ptr += (EVENT_SIZE + event->len);
+                        m_batch.add(flags | FileObserver::CREATED, filename);
+                    }
+                }, "", 0);
+            }
+            catch (...)
+            {
+                // the directory was removed while scanning; the events will tell
+            }
+        }
+
+        // returns false when the observed directory is gone
+        bool process(const inotify_event* event)
+        {
+            if (event->mask & IN_Q_OVERFLOW)
+            {
+                // events were lost; the client has to rescan
+                m_batch.add(0, "");
+                return true;
+            }
+
+            auto i = m_watches.find(event->wd);
+
+            if (event->mask & IN_IGNORED)
+            {
+                // watch was deleted
+                if (i != m_watches.end())
+                {
+                    bool root = i->second.empty();
+                    m_watches.erase(i);
+                    return !root;
+                }
+                return true;
+            }
+
+            if (i == m_watches.end() || !event->len)
+            {
+                return true;
+            }
+
+            const std::string filename = i->second + event->name;
+            const bool directory = (event->mask & IN_ISDIR) != 0;
+            u32 flags = directory ? FileObserver::DIRECTORY : FileObserver::FILE;
+
+            if (event->mask & (IN_CREATE | IN_MOVED_TO))
+            {
+                m_batch.add(flags | FileObserver::CREATED, filename);
+
+                if (directory && m_recursive)
+                {
+                    addWatch(filename + "/");
+                    scan(filename + "/", true);
+                }
+            }
+            else if (event->mask & (IN_DELETE | IN_MOVED_FROM))
+            {
+                m_batch.add(flags | FileObserver::DELETED, filename);
 
-                        if (event->mask & IN_IGNORED)
+                if (directory && m_recursive && (event->mask & IN_MOVED_FROM))
+                {
+                    // the watches follow the moved directory; forget them
+                    removeWatches(filename + "/");
+                }
+            }
+            else if (event->mask & IN_MODIFY)
+            {
+                m_batch.add(flags | FileObserver::MODIFIED, filename);
+            }
+
+            return true;
+        }
+
+        void run()
+        {
+            alignas(inotify_event) char buffer[BUFFER_SIZE];
+
+            pollfd fds[2];
+            fds[0].fd = m_notify;
+            fds[0].events = POLLIN;
+            fds[1].fd = m_wakeup;
+            fds[1].events = POLLIN;
+
+            for (bool looping = true; looping; )
+            {
+                // sleep until there are events or the pending batch is due
+                int status = poll(fds, 2, m_batch.timeout());
+                if (status < 0)
+                {
+                    if (errno == EINTR)
+                        continue;
+                    break;
+                }
+
+                if (fds[1].revents)
+                {
+                    // stop() was called
+                    break;
+                }
+
+                if (fds[0].revents & POLLIN)
+                {
+                    for (;;)
+                    {
+                        ssize_t length = read(m_notify, buffer, BUFFER_SIZE);
+                        if (length <= 0)
                         {
-                            // watch was deleted
-                            return;
+                            break;
                         }
 
-                        // process event
-                        if (event->len)
+                        char* ptr = buffer;
+                        char* end = buffer + length;
+
+                        while (ptr < end)
                         {
-                            std::string filename = event->name;
-                            u32 flags = 0;
-
-                            if (event->mask & IN_ISDIR)
-                            {
-                                flags |= FileObserver::DIRECTORY;
-                            }
-                            else
-                            {
-                                flags |= FileObserver::FILE;
-                            }
-
-                            if (event->mask & IN_CREATE)
-                            {
-                                flags |= FileObserver::CREATED;
-                                observer->onEvent(flags, filename);
-                            }
-                            else if (event->mask & IN_DELETE)
-                            {
-                                flags |= FileObserver::DELETED;
-                                observer->onEvent(flags, filename);
-                            }
-                            else if (event->mask & IN_MOVED_FROM)
-                            {
-                                flags |= FileObserver::DELETED;
-                                observer->onEvent(flags, filename);
-                            }
-                            else if (event->mask & IN_MOVED_TO)
-                            {
-                                flags |= FileObserver::CREATED;
-                                observer->onEvent(flags, filename);
-                            }
-                            else if (event->mask & IN_MODIFY)
-                            {
-                                flags |= FileObserver::MODIFIED;
-                                observer->onEvent(flags, filename);
-                            }
-#if 0
-                            else if (event->mask & IN_OPEN)
-                            {
-                            }
-                            else if (event->mask & IN_CLOSE)
-                            {
-                            }
-                            else if (event->mask & IN_ACCESS)
-                            {
-                            }
-                            else if (event->mask & IN_ATTRIB)
-                            {
-                            }
-                            else if (event->mask & IN_DELETE_SELF)
-                            {
-                            }
-                            else if (event->mask & IN_MOVE_SELF)
-                            {
-                            }
-#endif
+                            // extract one event
+                            const inotify_event* event = reinterpret_cast<const inotify_event*>(ptr);
+                            ptr += (EVENT_SIZE + event->len);
+                            looping &= process(event);
                         }
                     }
                 }
-            }, m_observer, m_notify, m_watch);
-        }
 
-        ~FileObserverState()
-        {
-            inotify_rm_watch(m_notify, m_watch);
-            m_thread.join();
-            close(m_notify);
+                m_batch.update();
+            }
+
+            m_batch.update(true);
         }
 	};
 
@@ -148,33 +279,10 @@ namespace filesystem {
     // FileObserver
     // -----------------------------------------------------------------
 
-	FileObserver::FileObserver()
-        : m_state(nullptr)
-	{
-	}
-
-	FileObserver::~FileObserver()
-	{
-        stop();
-	}
-
-    void FileObserver::start(const std::string& pathname)
+    void FileObserver::start(const std::string& pathname, u32 options)
     {
         stop();
-
-        int notify = inotify_init();
-        if (notify < 0)
-        {
-            MANGO_EXCEPTION("[FileObserver] inotify_init() failed.");
-        }
-
-        int watch = inotify_add_watch(notify, pathname.c_str(), IN_ALL_EVENTS);
-        if (watch < 0)
-        {
-            MANGO_EXCEPTION("[FileObserver] inotify_init() failed.");
-        }
-
-        m_state = new FileObserverState(this, notify, watch);
+        m_state = new FileObserverState(this, pathname, options, m_debounce, m_dispatch);
     }
 
     void FileObserver::stop()
@@ -201,6 +309,7 @@ namespace filesystem {
 #include <fcntl.h>
 #include <sys/event.h>
 #include <unistd.h>
+#include "../file_observer.hpp"
 
 namespace mango {
 namespace filesystem {
@@ -208,55 +317,85 @@ namespace filesystem {
     struct FileObserverState
     {
         int m_kqueue;
+        int m_dirfd;
+        FileEventBatch m_batch;
         std::thread m_thread;
 
-        FileObserverState(const std::string& pathname, FileObserver* observer)
+        FileObserverState(FileObserver* observer, const std::string& pathname, u32 debounce,
+                          const std::function<void(std::function<void()>&&)>& dispatch)
             : m_kqueue(0)
+            , m_batch(observer, debounce, dispatch)
         {
             m_kqueue = kqueue();
-            int dirfd = open(pathname.c_str(), O_RDONLY);
+            m_dirfd = open(pathname.c_str(), O_RDONLY);
 
             struct kevent direvent;
-            EV_SET(&direvent, dirfd, EVFILT_VNODE, EV_ADD | EV_CLEAR | EV_ENABLE, NOTE_WRITE, 0, (void *)observer);
+            EV_SET(&direvent, m_dirfd, EVFILT_VNODE, EV_ADD | EV_CLEAR | EV_ENABLE, NOTE_WRITE, 0, (void *)observer);
 
             kevent(m_kqueue, &direvent, 1, NULL, 0, NULL);
 
-            struct kevent sigevent;
-            EV_SET (&sigevent, SIGINT, EVFILT_SIGNAL, EV_ADD | EV_ENABLE, 0, 0, NULL);
-            signal (SIGINT, SIG_IGN);
-            kevent(m_kqueue, &sigevent, 1, NULL, 0, NULL);
+            struct kevent userevent;
+            EV_SET(&userevent, 0, EVFILT_USER, EV_ADD | EV_CLEAR, 0, 0, NULL);
+            kevent(m_kqueue, &userevent, 1, NULL, 0, NULL);
 
             // launch kevent handler in it's own thread
-            m_thread = std::thread([] (FileObserver* observer, int kq)
+            m_thread = std::thread([this] (int kq)
             {
                 for (;;)
                 {
-                    // read kevent (this call is blocking and the reason why the observer is threaded)
+                    // sleep until there are events or the pending batch is due
+                    int timeout = m_batch.timeout();
+                    struct timespec ts;
+                    ts.tv_sec = timeout / 1000;
+                    ts.tv_nsec = (timeout % 1000) * 1000000;
+
                     struct kevent change;
-                    if (kevent(kq, NULL, 0, &change, 1, NULL) == -1)
+                    int count = kevent(kq, NULL, 0, &change, 1, timeout < 0 ? NULL : &ts);
+                    if (count == -1)
                     {
                         // kqueue was closed
-                        return 1;
+                        break;
                     }
 
-                    if (change.udata)
+                    if (count > 0)
                     {
-                        FileObserver* observer = reinterpret_cast<FileObserver*>(change.udata);
-                        observer->onEvent(0, "");
+                        if (change.filter == EVFILT_USER)
+                        {
+                            // stop() was called
+                            break;
+                        }
+
+                        if (change.udata)
+                        {
+                            // change notification; the directories are not tracked in detail
+                            m_batch.add(0, "");
+                        }
                     }
+
+                    m_batch.update();
                 }
 
-                return 0;
-            }, observer, m_kqueue);
+                m_batch.update(true);
+            }, m_kqueue);
         }
 
         ~FileObserverState()
         {
+            struct kevent userevent;
+            EV_SET(&userevent, 0, EVFILT_USER, 0, NOTE_TRIGGER, 0, NULL);
+            kevent(m_kqueue, &userevent, 1, NULL, 0, NULL);
+
+            m_thread.join();
+
             if (m_kqueue)
             {
                 close(m_kqueue);
             }
-            m_thread.join();
+
+            if (m_dirfd != -1)
+            {
+                close(m_dirfd);
+            }
         }
     };
 
@@ -264,20 +403,13 @@ namespace filesystem {
     // FileObserver
     // -----------------------------------------------------------------
 
-    FileObserver::FileObserver()
-        : m_state(nullptr)
+    void FileObserver::start(const std::string& pathname, u32 options)
     {
-    }
-
-    FileObserver::~FileObserver()
-    {
-        stop();
-    }
+        // kqueue only reports that the directory changed
+        MANGO_UNREFERENCED(options);
 
-    void FileObserver::start(const std::string& pathname)
-    {
         stop();
-        m_state = new FileObserverState(pathname, this);
+        m_state = new FileObserverState(this, pathname, m_debounce, m_dispatch);
     }
 
     void FileObserver::stop()
@@ -303,18 +435,10 @@ namespace filesystem {
 namespace mango {
 namespace filesystem {
 
-    FileObserver::FileObserver()
-        : m_state(nullptr)
-    {
-    }
-
-    FileObserver::~FileObserver()
-    {
-    }
-
-    void FileObserver::start(const std::string& pathname)
+    void FileObserver::start(const std::string& pathname, u32 options)
     {
         MANGO_UNREFERENCED(pathname);
+        MANGO_UNREFERENCED(options);
     }
 
     void FileObserver::stop()
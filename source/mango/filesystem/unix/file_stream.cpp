@@ -6,13 +6,43 @@
 #define _FILE_OFFSET_BITS 64 /* LFS: 64 bit off_t */
 #endif
 #include <cstdio>
+#include <climits>
+#include <algorithm>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
 
 #include <mango/core/string.hpp>
 #include <mango/core/exception.hpp>
 #include <mango/filesystem/file.hpp>
 
+namespace
+{
+    using namespace mango;
+
+    class FileMapping : public VirtualMemory
+    {
+    protected:
+        void* m_address;
+        size_t m_bytes;
+
+    public:
+        FileMapping(void* address, size_t bytes, size_t offset, size_t size)
+            : m_address(address)
+            , m_bytes(bytes)
+        {
+            m_memory = Memory(reinterpret_cast<u8*>(address) + offset, size);
+        }
+
+        ~FileMapping()
+        {
+            ::munmap(m_address, m_bytes);
+        }
+    };
+
+} // namespace
+
 namespace mango {
 namespace filesystem {
 
@@ -24,6 +54,7 @@ namespace filesystem {
 	{
 		FILE* m_file;
         std::string m_filename;
+        std::unique_ptr<VirtualMemory> m_mapping;
 
         FileHandle(const std::string& filename, const char* mode)
             : m_file(std::fopen(filename.c_str(), mode))
@@ -33,6 +64,7 @@ namespace filesystem {
 
 		~FileHandle()
 		{
+            m_mapping.reset();
             std::fclose(m_file);
 		}
 
@@ -71,6 +103,80 @@ namespace filesystem {
 	        size_t status = std::fwrite(data, 1, size, m_file);
 	        MANGO_UNREFERENCED(status);
 	    }
+
+	    void writev(const Memory* buffers, size_t count)
+	    {
+            // the stdio buffer must be drained before writing into the descriptor
+            std::fflush(m_file);
+            int fd = ::fileno(m_file);
+
+            std::vector<struct iovec> iov(count);
+            for (size_t i = 0; i < count; ++i)
+            {
+                iov[i].iov_base = buffers[i].address;
+                iov[i].iov_len = buffers[i].size;
+            }
+
+            struct iovec* next = iov.data();
+            struct iovec* end = next + count;
+
+            while (next < end)
+            {
+                const int n = int(std::min(end - next, std::ptrdiff_t(IOV_MAX)));
+                ssize_t written = ::writev(fd, next, n);
+                if (written < 0)
+                {
+                    MANGO_EXCEPTION("[FileStream] writev() failed.");
+                }
+
+                // skip fully written buffers and adjust the partially written one
+                for ( ; next < end && size_t(written) >= next->iov_len; ++next)
+                {
+                    written -= next->iov_len;
+                }
+
+                if (next < end)
+                {
+                    next->iov_base = reinterpret_cast<u8*>(next->iov_base) + written;
+                    next->iov_len -= written;
+                }
+            }
+
+            // synchronize the stdio position with the descriptor
+            fseeko(m_file, ::lseek(fd, 0, SEEK_CUR), SEEK_SET);
+	    }
+
+        VirtualMemory* mmap(u64 offset, size_t size)
+        {
+            const u64 total = this->size();
+            if (offset >= total || !size)
+            {
+                return nullptr;
+            }
+
+            size = size_t(std::min(u64(size), total - offset));
+
+            // the mapping must start at page boundary
+            const u64 page_size = u64(::sysconf(_SC_PAGESIZE));
+            const u64 page_offset = offset - offset % page_size;
+            const size_t bytes = size + size_t(offset - page_offset);
+
+            void* address = ::mmap(nullptr, bytes, PROT_READ, MAP_SHARED, ::fileno(m_file), off_t(page_offset));
+            if (address == MAP_FAILED)
+            {
+                // file is not readable (WRITE mode) or cannot be mapped
+                return nullptr;
+            }
+
+            return new FileMapping(address, bytes, size_t(offset - page_offset), size);
+        }
+
+        Memory map(u64 offset, size_t size)
+        {
+            // the previous mapping is released so that repeated mapping does not accumulate
+            m_mapping.reset(mmap(offset, size));
+            return m_mapping ? Memory(*m_mapping) : Memory();
+        }
 	};
 
     // -----------------------------------------------------------------
@@ -155,5 +261,20 @@ namespace filesystem {
 		m_handle->write(data, size);
     }
 
+    void FileStream::writev(const Memory* buffers, size_t count)
+    {
+		m_handle->writev(buffers, count);
+    }
+
+    Memory FileStream::map(u64 offset, size_t size)
+    {
+		return m_handle->map(offset, size);
+    }
+
+    VirtualMemory* FileStream::mmap(u64 offset, size_t size)
+    {
+		return m_handle->mmap(offset, size);
+    }
+
 } // namespace filesystem
 } // namespace mango
@@ -0,0 +1,279 @@
+/*
+    MANGO Multimedia Development Platform
+    Copyright (C) 2012-2019 Twilight Finland 3D Oy Ltd. All rights reserved.
+*/
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <mango/core/exception.hpp>
+#include <mango/filesystem/file.hpp>
+
+namespace mango {
+namespace filesystem {
+
+    // -----------------------------------------------------------------
+    // MappedFileHandle
+    // -----------------------------------------------------------------
+
+    struct MappedFileHandle
+    {
+        std::string m_filename;
+        int m_file;
+        u8* m_address;
+        u64 m_capacity;
+        u64 m_size;
+        u64 m_offset;
+
+        MappedFileHandle(const std::string& filename, u64 size)
+            : m_filename(filename)
+            , m_address(nullptr)
+            , m_capacity(0)
+            , m_size(0)
+            , m_offset(0)
+        {
+            m_file = ::open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (m_file == -1)
+            {
+                MANGO_EXCEPTION("[MappedFileStream] Opening \"%s\" failed.", filename.c_str());
+            }
+
+            if (size > 0)
+            {
+                resize(size);
+            }
+        }
+
+        ~MappedFileHandle()
+        {
+            finish();
+        }
+
+        void reserve(u64 capacity)
+        {
+            if (capacity <= m_capacity)
+            {
+                return;
+            }
+
+            if (m_file == -1)
+            {
+                MANGO_EXCEPTION("[MappedFileStream] \"%s\" is finished.", m_filename.c_str());
+            }
+
+#if defined(MANGO_PLATFORM_OSX) || defined(MANGO_PLATFORM_IOS)
+            int error = ::ftruncate(m_file, off_t(capacity)) == -1 ? errno : 0;
+#else
+            // the blocks are allocated up front; a sparse file which runs out of space
+            // would raise SIGBUS in the middle of a write into the mapping
+            int error = ::posix_fallocate(m_file, 0, off_t(capacity));
+            if (error == EOPNOTSUPP || error == EINVAL)
+            {
+                // the file system does not support allocation
+                error = ::ftruncate(m_file, off_t(capacity)) == -1 ? errno : 0;
+            }
+#endif
+
+            if (error)
+            {
+                MANGO_EXCEPTION("[MappedFileStream] Resizing \"%s\" failed.", m_filename.c_str());
+            }
+
+            void* address = MAP_FAILED;
+
+#if defined(MANGO_PLATFORM_LINUX) && defined(MREMAP_MAYMOVE)
+            if (m_address)
+            {
+                // the kernel moves the page tables instead of mapping everything again
+                address = ::mremap(m_address, size_t(m_capacity), size_t(capacity), MREMAP_MAYMOVE);
+                if (address != MAP_FAILED)
+                {
+                    m_address = nullptr;
+                }
+            }
+#endif
+
+            if (address == MAP_FAILED)
+            {
+                address = ::mmap(nullptr, size_t(capacity), PROT_READ | PROT_WRITE, MAP_SHARED, m_file, 0);
+                if (address == MAP_FAILED)
+                {
+                    MANGO_EXCEPTION("[MappedFileStream] Memory mapping \"%s\" failed.", m_filename.c_str());
+                }
+
+                if (m_address)
+                {
+                    ::munmap(m_address, size_t(m_capacity));
+                }
+            }
+
+            m_address = reinterpret_cast<u8*>(address);
+            m_capacity = capacity;
+        }
+
+        void resize(u64 size)
+        {
+            reserve(size);
+            m_size = size;
+        }
+
+        void flush()
+        {
+            if (m_address)
+            {
+                ::msync(m_address, size_t(m_size), MS_SYNC);
+            }
+        }
+
+        void finish()
+        {
+            if (m_file == -1)
+            {
+                return;
+            }
+
+            if (m_address)
+            {
+                ::munmap(m_address, size_t(m_capacity));
+                m_address = nullptr;
+            }
+
+            // drop the unused capacity
+            int status = ::ftruncate(m_file, off_t(m_size));
+            MANGO_UNREFERENCED(status);
+
+            ::close(m_file);
+            m_file = -1;
+            m_capacity = 0;
+        }
+
+        void read(void* dest, size_t size)
+        {
+            if (m_file == -1)
+            {
+                MANGO_EXCEPTION("[MappedFileStream] \"%s\" is finished.", m_filename.c_str());
+            }
+
+            if (!size)
+            {
+                return;
+            }
+
+            if (m_offset + size > m_size)
+            {
+                MANGO_EXCEPTION("[MappedFileStream] Reading past the end of \"%s\".", m_filename.c_str());
+            }
+
+            std::memcpy(dest, m_address + m_offset, size);
+            m_offset += size;
+        }
+
+        void write(const void* data, size_t size)
+        {
+            if (!size)
+            {
+                return;
+            }
+
+            const u64 end = m_offset + size;
+            if (end > m_capacity)
+            {
+                // geometric growth keeps the number of remaps logarithmic
+                reserve(std::max(end, std::max(m_capacity * 2, u64(64 * 1024))));
+            }
+
+            std::memcpy(m_address + m_offset, data, size);
+            m_offset = end;
+            m_size = std::max(m_size, end);
+        }
+    };
+
+    // -----------------------------------------------------------------
+    // MappedFileStream
+    // -----------------------------------------------------------------
+
+    MappedFileStream::MappedFileStream(const std::string& filename, u64 size)
+        : m_handle(new MappedFileHandle(filename, size))
+    {
+    }
+
+    MappedFileStream::~MappedFileStream()
+    {
+        delete m_handle;
+    }
+
+    const std::string& MappedFileStream::filename() const
+    {
+        return m_handle->m_filename;
+    }
+
+    Memory MappedFileStream::memory() const
+    {
+        // the contents are not available after finish()
+        u8* address = m_handle->m_address;
+        return Memory(address, address ? size_t(m_handle->m_size) : 0);
+    }
+
+    void MappedFileStream::reserve(u64 capacity)
+    {
+        m_handle->reserve(capacity);
+    }
+
+    void MappedFileStream::resize(u64 size)
+    {
+        m_handle->resize(size);
+    }
+
+    void MappedFileStream::flush()
+    {
+        m_handle->flush();
+    }
+
+    void MappedFileStream::finish()
+    {
+        m_handle->finish();
+    }
+
+    u64 MappedFileStream::size() const
+    {
+        return m_handle->m_size;
+    }
+
+    u64 MappedFileStream::offset() const
+    {
+        return m_handle->m_offset;
+    }
+
+    void MappedFileStream::seek(u64 distance, SeekMode mode)
+    {
+        switch (mode)
+        {
+            case BEGIN:
+                m_handle->m_offset = distance;
+                break;
+
+            case CURRENT:
+                m_handle->m_offset += distance;
+                break;
+
+            case END:
+                m_handle->m_offset = distance > m_handle->m_size ? 0 : m_handle->m_size - distance;
+                break;
+        }
+    }
+
+    void MappedFileStream::read(void* dest, size_t size)
+    {
+        m_handle->read(dest, size);
+    }
+
+    void MappedFileStream::write(const void* data, size_t size)
+    {
+        m_handle->write(data, size);
+    }
+
+} // namespace filesystem
+} // namespace mango
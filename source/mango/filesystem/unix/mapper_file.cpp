@@ -6,8 +6,9 @@
 #include <mango/core/string.hpp>
 #include <mango/filesystem/mapper.hpp>
 #include <mango/filesystem/path.hpp>
+#include "../cache.hpp"
+#include "../walker.hpp"
 
-#include <dirent.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/stat.h>
@@ -30,6 +31,68 @@ namespace
 		return x;
 	}
 
+    // -----------------------------------------------------------------
+    // advise_memory()
+    // -----------------------------------------------------------------
+
+    void advise_memory(u8* address, size_t size, MemoryAccess access)
+    {
+        // madvise() requires page aligned start address
+        const uintptr_t page_mask = uintptr_t(get_pagesize() - 1);
+        u8* start = reinterpret_cast<u8*>(uintptr_t(address) & ~page_mask);
+        size += size_t(address - start);
+
+        int advice = -1;
+
+        switch (access)
+        {
+            case MemoryAccess::NORMAL:
+                advice = MADV_NORMAL;
+                break;
+            case MemoryAccess::SEQUENTIAL:
+                advice = MADV_SEQUENTIAL;
+                break;
+            case MemoryAccess::RANDOM:
+                advice = MADV_RANDOM;
+                break;
+            case MemoryAccess::WILLNEED:
+                advice = MADV_WILLNEED;
+                break;
+            case MemoryAccess::DONTNEED:
+                advice = MADV_DONTNEED;
+                break;
+            case MemoryAccess::HUGEPAGE:
+#if defined(MADV_HUGEPAGE)
+                advice = MADV_HUGEPAGE;
+#endif
+                break;
+            case MemoryAccess::POPULATE:
+#if defined(MADV_POPULATE_READ)
+                advice = MADV_POPULATE_READ;
+#endif
+                break;
+        }
+
+        if (advice != -1 && ::madvise(start, size, advice) == 0)
+        {
+            return;
+        }
+
+        if (access == MemoryAccess::POPULATE)
+        {
+            // older kernels: schedule the read-ahead and touch every page
+            ::madvise(start, size, MADV_WILLNEED);
+
+            const size_t page_size = size_t(get_pagesize());
+            volatile u8 sink = 0;
+            for (size_t offset = 0; offset < size; offset += page_size)
+            {
+                sink ^= start[offset];
+            }
+            MANGO_UNREFERENCED(sink);
+        }
+    }
+
     // -----------------------------------------------------------------
     // FileMemory
     // -----------------------------------------------------------------
@@ -103,6 +166,18 @@ namespace
             }
         }
 
+        void advise(MemoryAccess access, size_t offset, size_t size) override
+        {
+            if (offset >= m_memory.size)
+            {
+                return;
+            }
+
+            size_t available = m_memory.size - offset;
+            size = size ? std::min(size, available) : available;
+            advise_memory(m_memory.address + offset, size, access);
+        }
+
         ~FileMemory()
         {
             if (m_address)
@@ -126,27 +201,6 @@ namespace
     protected:
         std::string m_basepath;
 
-        void emplace_helper(FileIndex& index, const std::string& pathname, std::string filename)
-        {
-            const std::string testname = pathname + filename;
-
-            struct stat s;
-            if (::stat(testname.c_str(), &s) != -1)
-            {
-                filename = removePrefix(filename, m_basepath);
-
-                if ((s.st_mode & S_IFDIR) == 0)
-                {
-                    size_t size = size_t(s.st_size);
-                    index.emplace(filename, size, 0);
-                }
-                else
-                {
-                    index.emplace(filename + "/", 0, FileInfo::DIRECTORY);
-                }
-            }
-        }
-
     public:
         FileMapper(const std::string& basepath)
             : m_basepath(basepath)
@@ -171,67 +225,13 @@ namespace
             return is;
         }
 
-#if defined(MANGO_PLATFORM_OSX) || defined(MANGO_PLATFORM_IOS) || defined(MANGO_PLATFORM_BSD)
-
-        void getIndex(FileIndex& index, const std::string& pathname) override
-        {
-            struct dirent** namelist = NULL;
-            std::string fullname = m_basepath + pathname;
-
-            const int n = ::scandir(fullname.c_str(), &namelist, [] (const struct dirent* e)
-            {
-                // filter out "." and ".."
-                if (!std::strcmp(e->d_name, ".") || !std::strcmp(e->d_name, ".."))
-                    return 0;
-                return 1;
-            }, 0);
-            if (n < 0)
-            {
-                // Unable to open directory.
-                ::free(namelist);
-                return;
-            }
-
-            for (int i = 0; i < n; ++i)
-            {
-                const std::string filename(namelist[i]->d_name);
-                ::free(namelist[i]);
-                emplace_helper(index, fullname, filename);
-            }
-
-            ::free(namelist);
-        }
-
-#else
-
         void getIndex(FileIndex& index, const std::string& pathname) override
         {
-            std::string fullname = m_basepath + pathname;
-            DIR* dirp = ::opendir(fullname.c_str());
-            if (!dirp)
-            {
-                // Unable to open directory.
-                return;
-            }
-
-            dirent* dp;
-
-            while ((dp = ::readdir(dirp)))
-            {
-                std::string filename(dp->d_name);
-
-                // skip "." and ".."
-                if (filename != "." && filename != "..")
-                {
-                    emplace_helper(index, fullname, filename);
-                }
-            }
-
-            ::closedir(dirp);
+            // the sizes are queried relative to the directory descriptor instead
+            // of looking up the full path of every entry
+            scanDirectory(index, m_basepath + pathname);
         }
 
-#endif
-
         VirtualMemory* mmap(const std::string& filename) override
         {
             VirtualMemory* memory = new FileMemory(m_basepath + filename, 0, 0);
@@ -244,6 +244,39 @@ namespace
 namespace mango {
 namespace filesystem {
 
+    // -----------------------------------------------------------------
+    // getContainerStatus()
+    // -----------------------------------------------------------------
+
+    bool getContainerStatus(const std::string& filename, std::string& canonical, u64& time, u64& size)
+    {
+        struct stat s;
+        if (::stat(filename.c_str(), &s) != 0)
+        {
+            return false;
+        }
+
+        char* path = ::realpath(filename.c_str(), nullptr);
+        if (!path)
+        {
+            return false;
+        }
+
+        canonical = path;
+        ::free(path);
+
+#if defined(MANGO_PLATFORM_LINUX) || defined(MANGO_PLATFORM_ANDROID)
+        time = u64(s.st_mtim.tv_sec) * 1000000000 + u64(s.st_mtim.tv_nsec);
+#elif defined(MANGO_PLATFORM_OSX) || defined(MANGO_PLATFORM_IOS)
+        time = u64(s.st_mtimespec.tv_sec) * 1000000000 + u64(s.st_mtimespec.tv_nsec);
+#else
+        time = u64(s.st_mtime) * 1000000000;
+#endif
+        size = u64(s.st_size);
+
+        return true;
+    }
+
     // -----------------------------------------------------------------
     // Mapper::createFileMapper()
     // -----------------------------------------------------------------
@@ -0,0 +1,240 @@
+/*
+    MANGO Multimedia Development Platform
+    Copyright (C) 2012-2019 Twilight Finland 3D Oy Ltd. All rights reserved.
+*/
+#include <cerrno>
+#include <cstring>
+#include <atomic>
+#include <mango/core/configure.hpp>
+#include "../walker.hpp"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#if defined(MANGO_PLATFORM_LINUX)
+#include <sys/syscall.h>
+#endif
+
+#if defined(MANGO_PLATFORM_LINUX) && defined(SYS_getdents64)
+#define MANGO_WALK_GETDENTS
+#endif
+
+namespace
+{
+    using namespace mango;
+    using namespace mango::filesystem;
+
+    enum EntryType
+    {
+        ENTRY_NONE,
+        ENTRY_FILE,
+        ENTRY_DIRECTORY,
+    };
+
+#if defined(STATX_TYPE) && defined(AT_STATX_DONT_SYNC)
+
+    // statx() is missing from older kernels and can be blocked by a seccomp filter
+    // in containers; after the first such failure fstatat() is used instead
+    std::atomic<bool> g_statx_supported { true };
+
+#endif
+
+    // Metadata of a directory entry relative to the directory file descriptor. The
+    // symbolic links are followed; the caller tells if the entry itself was a link.
+    EntryType statEntry(int fd, const char* name, u64& size)
+    {
+#if defined(STATX_TYPE) && defined(AT_STATX_DONT_SYNC)
+        if (g_statx_supported)
+        {
+            // request only the fields we need and let network filesystems answer from
+            // their attribute cache instead of a round-trip to the server
+            struct statx sx;
+            if (::statx(fd, name, AT_STATX_DONT_SYNC, STATX_TYPE | STATX_SIZE, &sx) == 0)
+            {
+                size = sx.stx_size;
+                return S_ISDIR(sx.stx_mode) ? ENTRY_DIRECTORY :
+                       S_ISREG(sx.stx_mode) ? ENTRY_FILE : ENTRY_NONE;
+            }
+
+            if (errno != ENOSYS && errno != EPERM)
+            {
+                // the entry was removed or is not accessible
+                return ENTRY_NONE;
+            }
+
+            g_statx_supported = false;
+        }
+#endif
+
+        struct stat s;
+        if (::fstatat(fd, name, &s, 0) == 0)
+        {
+            size = u64(s.st_size);
+            return S_ISDIR(s.st_mode) ? ENTRY_DIRECTORY :
+                   S_ISREG(s.st_mode) ? ENTRY_FILE : ENTRY_NONE;
+        }
+
+        return ENTRY_NONE;
+    }
+
+    void processEntry(WalkContext& context, std::vector<FileInfo>& batch, int fd,
+                      const std::string& relative, const char* name, unsigned char type)
+    {
+        if (name[0] == '.' && (!name[1] || (name[1] == '.' && !name[2])))
+        {
+            // skip "." and ".."
+            return;
+        }
+
+        const bool need_size = (context.flags & WALK_SIZE) != 0;
+
+        EntryType entry = ENTRY_NONE;
+        u64 size = 0;
+        bool recurse = true;
+
+        switch (type)
+        {
+            case DT_DIR:
+                entry = ENTRY_DIRECTORY;
+                break;
+
+            case DT_REG:
+                if (!context.filter.match(name))
+                {
+                    // the type is known so the filtered files are never stat'd
+                    return;
+                }
+
+                entry = ENTRY_FILE;
+                if (need_size)
+                {
+                    entry = statEntry(fd, name, size);
+                }
+                break;
+
+            case DT_LNK:
+                entry = statEntry(fd, name, size);
+                recurse = false;
+                break;
+
+            case DT_UNKNOWN:
+                // filesystem does not report the type
+                entry = statEntry(fd, name, size);
+                break;
+
+            default:
+                // devices, pipes and sockets
+                return;
+        }
+
+        switch (entry)
+        {
+            case ENTRY_FILE:
+                if (context.filter.match(name))
+                {
+                    batch.emplace_back(relative + name, size, 0);
+                }
+                break;
+
+            case ENTRY_DIRECTORY:
+            {
+                std::string pathname = relative + name + "/";
+                if (recurse && !(context.flags & WALK_NO_RECURSE))
+                {
+                    context.enqueue(pathname);
+                }
+                batch.emplace_back(pathname, 0, FileInfo::DIRECTORY);
+                break;
+            }
+
+            default:
+                break;
+        }
+    }
+
+#ifdef MANGO_WALK_GETDENTS
+
+    struct linux_dirent64
+    {
+        u64 d_ino;
+        s64 d_off;
+        unsigned short d_reclen;
+        unsigned char d_type;
+        char d_name[1];
+    };
+
+#endif
+
+} // namespace
+
+namespace mango {
+namespace filesystem {
+
+    void scanDirectory(WalkContext& context, const std::string& relative)
+    {
+        std::string pathname = context.root + relative;
+        if (pathname.empty())
+        {
+            pathname = ".";
+        }
+
+        int fd = ::open(pathname.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd == -1)
+        {
+            // unreadable directories are skipped
+            return;
+        }
+
+        std::vector<FileInfo> batch;
+
+#ifdef MANGO_WALK_GETDENTS
+
+        // read the entries in large batches; this reduces the number of round-trips
+        // to the server on network filesystems compared to readdir()
+        std::vector<char> buffer(256 * 1024);
+
+        for (;;)
+        {
+            long bytes = ::syscall(SYS_getdents64, fd, buffer.data(), buffer.size());
+            if (bytes <= 0)
+            {
+                break;
+            }
+
+            for (long offset = 0; offset < bytes; )
+            {
+                const linux_dirent64* e = reinterpret_cast<const linux_dirent64*>(buffer.data() + offset);
+                processEntry(context, batch, fd, relative, e->d_name, e->d_type);
+                offset += e->d_reclen;
+            }
+        }
+
+        ::close(fd);
+
+#else
+
+        DIR* dirp = ::fdopendir(fd);
+        if (!dirp)
+        {
+            ::close(fd);
+            return;
+        }
+
+        while (dirent* dp = ::readdir(dirp))
+        {
+            processEntry(context, batch, fd, relative, dp->d_name, dp->d_type);
+        }
+
+        // closes the file descriptor
+        ::closedir(dirp);
+
+#endif
+
+        context.deliver(batch);
+    }
+
+} // namespace filesystem
+} // namespace mango
@@ -0,0 +1,187 @@
+/*
+    MANGO Multimedia Development Platform
+    Copyright (C) 2012-2019 Twilight Finland 3D Oy Ltd. All rights reserved.
+*/
+#include <algorithm>
+#include "walker.hpp"
+
+namespace mango {
+namespace filesystem {
+
+    // -----------------------------------------------------------------
+    // WalkFilter
+    // -----------------------------------------------------------------
+
+    WalkFilter::WalkFilter(const std::string& filter)
+    {
+        size_t start = 0;
+        while (start <= filter.length())
+        {
+            size_t end = filter.find(';', start);
+            if (end == std::string::npos)
+            {
+                end = filter.length();
+            }
+
+            if (end > start)
+            {
+                m_patterns.push_back(filter.substr(start, end - start));
+            }
+
+            start = end + 1;
+        }
+    }
+
+    bool WalkFilter::match(const char* pattern, const char* name)
+    {
+        // iterative matching with backtracking to the last '*'
+        const char* star = nullptr;
+        const char* resume = nullptr;
+
+        while (*name)
+        {
+            if (*pattern == '*')
+            {
+                star = pattern++;
+                resume = name;
+            }
+            else if (*pattern == '?' || *pattern == *name)
+            {
+                ++pattern;
+                ++name;
+            }
+            else if (star)
+            {
+                pattern = star + 1;
+                name = ++resume;
+            }
+            else
+            {
+                return false;
+            }
+        }
+
+        while (*pattern == '*')
+        {
+            ++pattern;
+        }
+
+        return !*pattern;
+    }
+
+    bool WalkFilter::match(const char* name) const
+    {
+        if (m_patterns.empty())
+        {
+            return true;
+        }
+
+        for (const std::string& pattern : m_patterns)
+        {
+            if (match(pattern.c_str(), name))
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    // -----------------------------------------------------------------
+    // WalkContext
+    // -----------------------------------------------------------------
+
+    WalkContext::WalkContext(const std::string& root, WalkCallback callback, const std::string& filter, u32 flags)
+        : root(root)
+        , filter(filter)
+        , flags(flags)
+        , callback(callback)
+        , queue("filesystem.walk", Priority::HIGH)
+    {
+        if (!this->root.empty() && this->root.back() != '/')
+        {
+            this->root += '/';
+        }
+    }
+
+    void WalkContext::enqueue(const std::string& relative)
+    {
+        queue.enqueue([this, relative] {
+            if (cancelled)
+            {
+                return;
+            }
+
+            try
+            {
+                scanDirectory(*this, relative);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!exception)
+                {
+                    exception = std::current_exception();
+                }
+                cancelled = true;
+            }
+        });
+    }
+
+    void WalkContext::deliver(const std::vector<FileInfo>& batch)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (cancelled)
+        {
+            return;
+        }
+
+        for (const FileInfo& info : batch)
+        {
+            callback(info);
+        }
+    }
+
+    // -----------------------------------------------------------------
+    // walk()
+    // -----------------------------------------------------------------
+
+    void walk(const std::string& pathname, WalkCallback callback, const std::string& filter, u32 flags)
+    {
+        WalkContext context(pathname, callback, filter, flags);
+
+        context.enqueue("");
+        context.queue.wait();
+
+        if (context.exception)
+        {
+            std::rethrow_exception(context.exception);
+        }
+    }
+
+    void scanDirectory(FileIndex& index, const std::string& pathname)
+    {
+        WalkContext context(pathname, [&] (const FileInfo& info)
+        {
+            index.emplace(info.name, info.size, info.flags);
+        }, "", WALK_SIZE | WALK_NO_RECURSE);
+
+        scanDirectory(context, "");
+    }
+
+    void walk(FileIndex& index, const std::string& pathname, const std::string& filter, u32 flags)
+    {
+        walk(pathname, [&] (const FileInfo& info)
+        {
+            index.emplace(info.name, info.size, info.flags);
+        }, filter, flags);
+
+        std::sort(index.begin(), index.end(), [] (const FileInfo& a, const FileInfo& b)
+        {
+            return a.name < b.name;
+        });
+    }
+
+} // namespace filesystem
+} // namespace mango
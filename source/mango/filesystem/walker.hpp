@@ -0,0 +1,74 @@
+/*
+    MANGO Multimedia Development Platform
+    Copyright (C) 2012-2019 Twilight Finland 3D Oy Ltd. All rights reserved.
+*/
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <exception>
+#include <mango/core/thread.hpp>
+#include <mango/filesystem/path.hpp>
+
+namespace mango {
+namespace filesystem {
+
+    // -----------------------------------------------------------------
+    // WalkFilter
+    // -----------------------------------------------------------------
+
+    // Glob patterns separated with ';'. The '*' matches any sequence of
+    // characters and '?' matches any single character.
+
+    class WalkFilter
+    {
+    protected:
+        std::vector<std::string> m_patterns;
+
+        static bool match(const char* pattern, const char* name);
+
+    public:
+        WalkFilter(const std::string& filter);
+
+        bool match(const char* name) const;
+    };
+
+    // -----------------------------------------------------------------
+    // WalkContext
+    // -----------------------------------------------------------------
+
+    struct WalkContext
+    {
+        std::string root;
+        WalkFilter filter;
+        u32 flags;
+        WalkCallback callback;
+
+        ConcurrentQueue queue;
+        std::mutex mutex;
+        std::exception_ptr exception;
+        std::atomic<bool> cancelled { false };
+
+        WalkContext(const std::string& root, WalkCallback callback, const std::string& filter, u32 flags);
+
+        // scan the directory in the ThreadPool; relative is "" or ends with '/'
+        void enqueue(const std::string& relative);
+
+        // deliver the contents of a directory to the callback
+        void deliver(const std::vector<FileInfo>& batch);
+    };
+
+    // internal flag: the subdirectories are reported but not scanned
+    constexpr u32 WALK_NO_RECURSE = 0x80000000;
+
+    // Platform specific: read the directory (context.root + relative) into a batch,
+    // enqueue the subdirectories and deliver the batch.
+    void scanDirectory(WalkContext& context, const std::string& relative);
+
+    // read one directory in the calling thread; the names are relative to the pathname
+    void scanDirectory(FileIndex& index, const std::string& pathname);
+
+} // namespace filesystem
+} // namespace mango
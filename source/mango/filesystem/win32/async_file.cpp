@@ -0,0 +1,248 @@
+/*
+    MANGO Multimedia Development Platform
+    Copyright (C) 2012-2019 Twilight Finland 3D Oy Ltd. All rights reserved.
+*/
+#include <algorithm>
+#include <mutex>
+#include <condition_variable>
+#include <mango/core/string.hpp>
+#include <mango/core/exception.hpp>
+#include <mango/filesystem/file.hpp>
+
+namespace
+{
+    using namespace mango;
+
+    // positional transfer; the file pointer of the handle is not used
+    bool transfer(HANDLE handle, bool write, u64 offset, u8* address, size_t size, size_t& total)
+    {
+        total = 0;
+
+        while (total < size)
+        {
+            const u64 position = offset + total;
+            const DWORD bytes = DWORD(std::min(size - total, size_t(0x40000000)));
+
+            OVERLAPPED overlapped = { 0 };
+            overlapped.Offset = DWORD(position);
+            overlapped.OffsetHigh = DWORD(position >> 32);
+
+            DWORD n = 0;
+            BOOL status = write ? ::WriteFile(handle, address + total, bytes, &n, &overlapped)
+                                : ::ReadFile(handle, address + total, bytes, &n, &overlapped);
+            if (!status)
+            {
+                return ::GetLastError() == ERROR_HANDLE_EOF;
+            }
+
+            if (n == 0)
+            {
+                // end of file
+                break;
+            }
+
+            total += n;
+        }
+
+        return true;
+    }
+
+    ConcurrentQueue& getQueue()
+    {
+        static ConcurrentQueue queue("filesystem.io", Priority::HIGH);
+        return queue;
+    }
+
+} // namespace
+
+namespace mango {
+namespace filesystem {
+
+    // -----------------------------------------------------------------
+    // AsyncFileHandle
+    // -----------------------------------------------------------------
+
+    // The requests are executed in the ThreadPool; overlapped completion ports
+    // are not used so that the handle can serve the blocking calls as well.
+
+    struct AsyncFileHandle
+    {
+        std::string m_filename;
+        HANDLE m_handle;
+
+        std::mutex m_mutex;
+        std::condition_variable m_condition;
+        size_t m_pending { 0 };
+
+        AsyncFileHandle(const std::string& filename, u32 flags)
+            : m_filename(filename)
+        {
+            DWORD access = 0;
+            DWORD disposition = 0;
+
+            switch (flags & (AsyncFile::READ | AsyncFile::WRITE))
+            {
+                case AsyncFile::READ:
+                    access = GENERIC_READ;
+                    disposition = OPEN_EXISTING;
+                    break;
+                case AsyncFile::WRITE:
+                    access = GENERIC_WRITE;
+                    disposition = CREATE_ALWAYS;
+                    break;
+                case AsyncFile::READ | AsyncFile::WRITE:
+                    access = GENERIC_READ | GENERIC_WRITE;
+                    disposition = OPEN_ALWAYS;
+                    break;
+                default:
+                    MANGO_EXCEPTION("[AsyncFile] Incorrect flags.");
+            }
+
+            DWORD attributes = FILE_ATTRIBUTE_NORMAL;
+            if (flags & AsyncFile::DIRECT)
+            {
+                attributes |= FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH;
+            }
+
+            m_handle = ::CreateFileW(u16_fromBytes(filename).c_str(), access, FILE_SHARE_READ,
+                NULL, disposition, attributes, NULL);
+            if (m_handle == INVALID_HANDLE_VALUE)
+            {
+                MANGO_EXCEPTION("[AsyncFile] Opening \"%s\" failed.", filename.c_str());
+            }
+        }
+
+        ~AsyncFileHandle()
+        {
+            wait();
+            ::CloseHandle(m_handle);
+        }
+
+        void push(bool write, u64 offset, Memory memory, ConcurrentQueue& queue, AsyncFile::Callback callback)
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                ++m_pending;
+            }
+
+            getQueue().enqueue([this, write, offset, memory, &queue, callback] {
+                size_t bytes = 0;
+                bool status = transfer(m_handle, write, offset, memory.address, memory.size, bytes);
+
+                Memory result(memory.address, status ? bytes : 0);
+                queue.enqueue([callback, result, status] {
+                    callback(result, status);
+                });
+
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (--m_pending == 0)
+                {
+                    m_condition.notify_all();
+                }
+            });
+        }
+
+        void wait()
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condition.wait(lock, [this] {
+                return m_pending == 0;
+            });
+        }
+    };
+
+    // -----------------------------------------------------------------
+    // AsyncFile
+    // -----------------------------------------------------------------
+
+    AsyncFile::AsyncFile(const std::string& filename, u32 flags)
+        : m_handle(new AsyncFileHandle(filename, flags))
+    {
+    }
+
+    AsyncFile::~AsyncFile()
+    {
+        delete m_handle;
+    }
+
+    const std::string& AsyncFile::filename() const
+    {
+        return m_handle->m_filename;
+    }
+
+    u64 AsyncFile::size() const
+    {
+        LARGE_INTEGER integer;
+        BOOL status = ::GetFileSizeEx(m_handle->m_handle, &integer);
+        return status ? u64(integer.QuadPart) : 0;
+    }
+
+    void AsyncFile::resize(u64 size)
+    {
+        FILE_END_OF_FILE_INFO info;
+        info.EndOfFile.QuadPart = size;
+        if (!::SetFileInformationByHandle(m_handle->m_handle, FileEndOfFileInfo, &info, sizeof(info)))
+        {
+            MANGO_EXCEPTION("[AsyncFile] Resizing \"%s\" failed.", m_handle->m_filename.c_str());
+        }
+    }
+
+    void AsyncFile::setReadAhead(size_t bytes)
+    {
+        // the cache manager does read-ahead on its own
+        MANGO_UNREFERENCED(bytes);
+    }
+
+    size_t AsyncFile::read(u64 offset, void* dest, size_t size)
+    {
+        size_t bytes = 0;
+        if (!transfer(m_handle->m_handle, false, offset, reinterpret_cast<u8*>(dest), size, bytes))
+        {
+            MANGO_EXCEPTION("[AsyncFile] Reading \"%s\" failed.", m_handle->m_filename.c_str());
+        }
+        return bytes;
+    }
+
+    size_t AsyncFile::write(u64 offset, const void* data, size_t size)
+    {
+        size_t bytes = 0;
+        u8* address = reinterpret_cast<u8*>(const_cast<void*>(data));
+        if (!transfer(m_handle->m_handle, true, offset, address, size, bytes))
+        {
+            MANGO_EXCEPTION("[AsyncFile] Writing \"%s\" failed.", m_handle->m_filename.c_str());
+        }
+        return bytes;
+    }
+
+    void AsyncFile::read(u64 offset, Memory dest, ConcurrentQueue& queue, Callback callback)
+    {
+        m_handle->push(false, offset, dest, queue, std::move(callback));
+    }
+
+    void AsyncFile::write(u64 offset, Memory source, ConcurrentQueue& queue, Callback callback)
+    {
+        m_handle->push(true, offset, source, queue, std::move(callback));
+    }
+
+    void AsyncFile::submit()
+    {
+        // the requests are executed when they are pushed
+    }
+
+    void AsyncFile::wait()
+    {
+        m_handle->wait();
+    }
+
+    bool AsyncFile::isAsyncSupported()
+    {
+        return false;
+    }
+
+    size_t AsyncFile::getDirectAlignment()
+    {
+        return 4096;
+    }
+
+} // namespace filesystem
+} // namespace mango
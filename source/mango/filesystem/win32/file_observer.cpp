@@ -8,6 +8,8 @@
 #include <mango/filesystem/fileobserver.hpp>
 
 #include <thread>
+#include <algorithm>
+#include "../file_observer.hpp"
 
 namespace mango {
 namespace filesystem {
@@ -18,7 +20,7 @@ namespace filesystem {
         BUFFER_BYTES = sizeof(DWORD) * BUFFER_SIZE
     };
 
-    static void processNotify(FileObserver* observer, BYTE* buffer, DWORD bytes, u32 flags0)
+    static void processNotify(FileEventBatch& batch, BYTE* buffer, DWORD bytes, u32 flags0)
     {
         for (; buffer;)
         {
@@ -50,10 +52,13 @@ namespace filesystem {
             {
                 // Extract and convert the filename to UTF-8
                 const std::wstring u16filename(notify->FileName, notify->FileNameLength / 2);
-                const std::string filename = u16_toBytes(u16filename);
+                std::string filename = u16_toBytes(u16filename);
 
-                // Generate event
-                observer->onEvent(flags | flags0, filename);
+                // Subtree notifications use backslash as separator
+                std::replace(filename.begin(), filename.end(), '\\', '/');
+
+                // Coalesce event
+                batch.add(flags | flags0, filename);
             }
         }
     }
@@ -62,6 +67,7 @@ namespace filesystem {
     {
         HANDLE m_directory[2];
         HANDLE m_handle[3];
+        FileEventBatch m_batch;
         std::thread m_thread;
         bool m_started;
 
@@ -100,8 +106,10 @@ namespace filesystem {
                 CloseHandle(m_handle[2]);
         }
 
-        FileObserverState(FileObserver* observer, const std::string& u8pathname)
-            : m_started(false)
+        FileObserverState(FileObserver* observer, const std::string& u8pathname, u32 options, u32 debounce,
+                          const std::function<void(std::function<void()>&&)>& dispatch)
+            : m_batch(observer, debounce, dispatch)
+            , m_started(false)
         {
             m_directory[0] = INVALID_HANDLE_VALUE;
             m_directory[1] = INVALID_HANDLE_VALUE;
@@ -136,12 +144,14 @@ namespace filesystem {
             // Mark the thread started
             m_started = true;
 
+            const BOOL subtree = (options & FileObserver::RECURSIVE) ? TRUE : FALSE;
+
             // Create file observer thread
             m_thread = std::thread([=]
             {
                 const DWORD filter[] =
                 {
-                    FILE_NOTIFY_CHANGE_FILE_NAME,
+                    FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE,
                     FILE_NOTIFY_CHANGE_DIR_NAME
                 };
 
@@ -158,19 +168,21 @@ namespace filesystem {
                 DWORD buffer[BUFFER_SIZE * 2];
                 DWORD bytes;
 
-                if (!ReadDirectoryChangesW(m_directory[0], buffer + 0 * BUFFER_SIZE, BUFFER_BYTES, FALSE, filter[0], &bytes, &overlapped[0], NULL))
+                if (!ReadDirectoryChangesW(m_directory[0], buffer + 0 * BUFFER_SIZE, BUFFER_BYTES, subtree, filter[0], &bytes, &overlapped[0], NULL))
                 {
                     return;
                 }
 
-                if (!ReadDirectoryChangesW(m_directory[1], buffer + 1 * BUFFER_SIZE, BUFFER_BYTES, FALSE, filter[1], &bytes, &overlapped[1], NULL))
+                if (!ReadDirectoryChangesW(m_directory[1], buffer + 1 * BUFFER_SIZE, BUFFER_BYTES, subtree, filter[1], &bytes, &overlapped[1], NULL))
                 {
                     return;
                 }
 
                 for (bool looping = true; looping;)
                 {
-                    DWORD status = WaitForMultipleObjects(3, m_handle, FALSE, INFINITE);
+                    // Sleep until there are events or the pending batch is due
+                    const int timeout = m_batch.timeout();
+                    DWORD status = WaitForMultipleObjects(3, m_handle, FALSE, timeout < 0 ? INFINITE : DWORD(timeout));
                     switch (status)
                     {
                         case WAIT_OBJECT_0 + 0:
@@ -182,11 +194,16 @@ namespace filesystem {
                             {
                                 if (bytes > 0)
                                 {
-                                    processNotify(observer, (BYTE*)(buffer + index * BUFFER_SIZE), bytes, flags[index]);
+                                    processNotify(m_batch, (BYTE*)(buffer + index * BUFFER_SIZE), bytes, flags[index]);
+                                }
+                                else
+                                {
+                                    // The buffer overflowed; the client has to rescan
+                                    m_batch.add(0, "");
                                 }
 
                                 // Restart the read directory
-                                if (!ReadDirectoryChangesW(m_directory[index], buffer + index * BUFFER_SIZE, BUFFER_BYTES, FALSE, filter[index], &bytes, &overlapped[index], NULL))
+                                if (!ReadDirectoryChangesW(m_directory[index], buffer + index * BUFFER_SIZE, BUFFER_BYTES, subtree, filter[index], &bytes, &overlapped[index], NULL))
                                 {
                                     looping = false;
                                 }
@@ -201,7 +218,11 @@ namespace filesystem {
                             break;
                         }
                     }
+
+                    m_batch.update();
                 }
+
+                m_batch.update(true);
             });
         }
 
@@ -225,20 +246,10 @@ namespace filesystem {
     // FileObserver
     // -----------------------------------------------------------------
 
-	FileObserver::FileObserver()
-        : m_state(nullptr)
-	{
-	}
-
-	FileObserver::~FileObserver()
-	{
-        stop();
-    }
-
-    void FileObserver::start(const std::string& pathname)
+    void FileObserver::start(const std::string& pathname, u32 options)
     {
         stop();
-        m_state = new FileObserverState(this, pathname);
+        m_state = new FileObserverState(this, pathname, options, m_debounce, m_dispatch);
     }
 
     void FileObserver::stop()
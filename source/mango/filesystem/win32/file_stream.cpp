@@ -167,5 +167,29 @@ namespace filesystem {
 		m_handle->write(data, size);
     }
 
+    void FileStream::writev(const Memory* buffers, size_t count)
+    {
+        // NOTE: WriteFileGather() requires unbuffered, page aligned I/O
+        for (size_t i = 0; i < count; ++i)
+        {
+		    m_handle->write(buffers[i].address, buffers[i].size);
+        }
+    }
+
+    Memory FileStream::map(u64 offset, size_t size)
+    {
+        // not supported; StreamView will read the data instead
+        MANGO_UNREFERENCED(offset);
+        MANGO_UNREFERENCED(size);
+        return Memory();
+    }
+
+    VirtualMemory* FileStream::mmap(u64 offset, size_t size)
+    {
+        MANGO_UNREFERENCED(offset);
+        MANGO_UNREFERENCED(size);
+        return nullptr;
+    }
+
 } // namespace filesystem
 } // namespace mango
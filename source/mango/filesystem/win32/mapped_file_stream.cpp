@@ -0,0 +1,261 @@
+/*
+    MANGO Multimedia Development Platform
+    Copyright (C) 2012-2019 Twilight Finland 3D Oy Ltd. All rights reserved.
+*/
+#include <algorithm>
+#include <cstring>
+
+#include <mango/core/string.hpp>
+#include <mango/core/exception.hpp>
+#include <mango/filesystem/file.hpp>
+
+namespace mango {
+namespace filesystem {
+
+    // -----------------------------------------------------------------
+    // MappedFileHandle
+    // -----------------------------------------------------------------
+
+    struct MappedFileHandle
+    {
+        std::string m_filename;
+        HANDLE m_file;
+        HANDLE m_map;
+        u8* m_address;
+        u64 m_capacity;
+        u64 m_size;
+        u64 m_offset;
+
+        MappedFileHandle(const std::string& filename, u64 size)
+            : m_filename(filename)
+            , m_map(NULL)
+            , m_address(nullptr)
+            , m_capacity(0)
+            , m_size(0)
+            , m_offset(0)
+        {
+            m_file = ::CreateFileW(u16_fromBytes(filename).c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ,
+                NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+            if (m_file == INVALID_HANDLE_VALUE)
+            {
+                MANGO_EXCEPTION("[MappedFileStream] Opening \"%s\" failed.", filename.c_str());
+            }
+
+            if (size > 0)
+            {
+                resize(size);
+            }
+        }
+
+        ~MappedFileHandle()
+        {
+            finish();
+        }
+
+        void unmap()
+        {
+            if (m_address)
+            {
+                ::UnmapViewOfFile(m_address);
+                m_address = nullptr;
+            }
+
+            if (m_map)
+            {
+                ::CloseHandle(m_map);
+                m_map = NULL;
+            }
+        }
+
+        void reserve(u64 capacity)
+        {
+            if (capacity <= m_capacity)
+            {
+                return;
+            }
+
+            if (m_file == INVALID_HANDLE_VALUE)
+            {
+                MANGO_EXCEPTION("[MappedFileStream] \"%s\" is finished.", m_filename.c_str());
+            }
+
+            // the mapping object cannot grow; the file is extended by a larger mapping
+            unmap();
+
+            m_map = ::CreateFileMappingW(m_file, NULL, PAGE_READWRITE, DWORD(capacity >> 32), DWORD(capacity), NULL);
+            if (!m_map)
+            {
+                MANGO_EXCEPTION("[MappedFileStream] Resizing \"%s\" failed.", m_filename.c_str());
+            }
+
+            m_address = reinterpret_cast<u8*>(::MapViewOfFile(m_map, FILE_MAP_WRITE, 0, 0, SIZE_T(capacity)));
+            if (!m_address)
+            {
+                MANGO_EXCEPTION("[MappedFileStream] Memory mapping \"%s\" failed.", m_filename.c_str());
+            }
+
+            m_capacity = capacity;
+        }
+
+        void resize(u64 size)
+        {
+            reserve(size);
+            m_size = size;
+        }
+
+        void flush()
+        {
+            if (m_address)
+            {
+                ::FlushViewOfFile(m_address, SIZE_T(m_size));
+                ::FlushFileBuffers(m_file);
+            }
+        }
+
+        void finish()
+        {
+            if (m_file == INVALID_HANDLE_VALUE)
+            {
+                return;
+            }
+
+            unmap();
+
+            // drop the unused capacity
+            LARGE_INTEGER position;
+            position.QuadPart = LONGLONG(m_size);
+            ::SetFilePointerEx(m_file, position, NULL, FILE_BEGIN);
+            ::SetEndOfFile(m_file);
+
+            ::CloseHandle(m_file);
+            m_file = INVALID_HANDLE_VALUE;
+            m_capacity = 0;
+        }
+
+        void read(void* dest, size_t size)
+        {
+            if (m_file == INVALID_HANDLE_VALUE)
+            {
+                MANGO_EXCEPTION("[MappedFileStream] \"%s\" is finished.", m_filename.c_str());
+            }
+
+            if (!size)
+            {
+                return;
+            }
+
+            if (m_offset + size > m_size)
+            {
+                MANGO_EXCEPTION("[MappedFileStream] Reading past the end of \"%s\".", m_filename.c_str());
+            }
+
+            std::memcpy(dest, m_address + m_offset, size);
+            m_offset += size;
+        }
+
+        void write(const void* data, size_t size)
+        {
+            if (!size)
+            {
+                return;
+            }
+
+            const u64 end = m_offset + size;
+            if (end > m_capacity)
+            {
+                // geometric growth keeps the number of remaps logarithmic
+                reserve(std::max(end, std::max(m_capacity * 2, u64(64 * 1024))));
+            }
+
+            std::memcpy(m_address + m_offset, data, size);
+            m_offset = end;
+            m_size = std::max(m_size, end);
+        }
+    };
+
+    // -----------------------------------------------------------------
+    // MappedFileStream
+    // -----------------------------------------------------------------
+
+    MappedFileStream::MappedFileStream(const std::string& filename, u64 size)
+        : m_handle(new MappedFileHandle(filename, size))
+    {
+    }
+
+    MappedFileStream::~MappedFileStream()
+    {
+        delete m_handle;
+    }
+
+    const std::string& MappedFileStream::filename() const
+    {
+        return m_handle->m_filename;
+    }
+
+    Memory MappedFileStream::memory() const
+    {
+        // the contents are not available after finish()
+        u8* address = m_handle->m_address;
+        return Memory(address, address ? size_t(m_handle->m_size) : 0);
+    }
+
+    void MappedFileStream::reserve(u64 capacity)
+    {
+        m_handle->reserve(capacity);
+    }
+
+    void MappedFileStream::resize(u64 size)
+    {
+        m_handle->resize(size);
+    }
+
+    void MappedFileStream::flush()
+    {
+        m_handle->flush();
+    }
+
+    void MappedFileStream::finish()
+    {
+        m_handle->finish();
+    }
+
+    u64 MappedFileStream::size() const
+    {
+        return m_handle->m_size;
+    }
+
+    u64 MappedFileStream::offset() const
+    {
+        return m_handle->m_offset;
+    }
+
+    void MappedFileStream::seek(u64 distance, SeekMode mode)
+    {
+        switch (mode)
+        {
+            case BEGIN:
+                m_handle->m_offset = distance;
+                break;
+
+            case CURRENT:
+                m_handle->m_offset += distance;
+                break;
+
+            case END:
+                m_handle->m_offset = distance > m_handle->m_size ? 0 : m_handle->m_size - distance;
+                break;
+        }
+    }
+
+    void MappedFileStream::read(void* dest, size_t size)
+    {
+        m_handle->read(dest, size);
+    }
+
+    void MappedFileStream::write(const void* data, size_t size)
+    {
+        m_handle->write(data, size);
+    }
+
+} // namespace filesystem
+} // namespace mango
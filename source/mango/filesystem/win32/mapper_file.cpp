@@ -6,7 +6,9 @@
 #include <mango/core/string.hpp>
 #include <mango/filesystem/mapper.hpp>
 #include <mango/filesystem/path.hpp>
+#include "../cache.hpp"
 
+#include <algorithm>
 #include <io.h>
 #include <fcntl.h>
 #include <sys/stat.h>
@@ -100,6 +102,51 @@ namespace
             }
         }
 
+        void advise(MemoryAccess access, size_t offset, size_t size) override
+        {
+            if (offset >= m_memory.size)
+            {
+                return;
+            }
+
+            size_t available = m_memory.size - offset;
+            size = size ? std::min(size, available) : available;
+            u8* address = m_memory.address + offset;
+
+            switch (access)
+            {
+                case MemoryAccess::WILLNEED:
+                case MemoryAccess::SEQUENTIAL:
+                {
+#if _WIN32_WINNT >= 0x0602
+                    // asynchronous read of the range into the working set
+                    WIN32_MEMORY_RANGE_ENTRY range;
+                    range.VirtualAddress = address;
+                    range.NumberOfBytes = size;
+                    ::PrefetchVirtualMemory(::GetCurrentProcess(), 1, &range, 0);
+#endif
+                    break;
+                }
+
+                case MemoryAccess::POPULATE:
+                {
+                    SYSTEM_INFO info;
+                    ::GetSystemInfo(&info);
+                    volatile u8 sink = 0;
+                    for (size_t i = 0; i < size; i += info.dwPageSize)
+                    {
+                        sink ^= address[i];
+                    }
+                    MANGO_UNREFERENCED(sink);
+                    break;
+                }
+
+                default:
+                    // the other hints are not supported for file mappings
+                    break;
+            }
+        }
+
         ~FileMemory()
         {
             if (m_address)
@@ -204,6 +251,36 @@ namespace
 namespace mango {
 namespace filesystem {
 
+    // -----------------------------------------------------------------
+    // getContainerStatus()
+    // -----------------------------------------------------------------
+
+    bool getContainerStatus(const std::string& filename, std::string& canonical, u64& time, u64& size)
+    {
+        const std::wstring wfilename = u16_fromBytes(filename);
+
+        WIN32_FILE_ATTRIBUTE_DATA data;
+        if (!::GetFileAttributesExW(wfilename.c_str(), GetFileExInfoStandard, &data))
+        {
+            return false;
+        }
+
+        wchar_t path[MAX_PATH * 4];
+        DWORD length = ::GetFullPathNameW(wfilename.c_str(), MAX_PATH * 4, path, NULL);
+        if (!length || length >= MAX_PATH * 4)
+        {
+            return false;
+        }
+
+        canonical = u16_toBytes(std::wstring(path, length));
+        std::replace(canonical.begin(), canonical.end(), '\\', '/');
+
+        time = (u64(data.ftLastWriteTime.dwHighDateTime) << 32) | data.ftLastWriteTime.dwLowDateTime;
+        size = (u64(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+
+        return true;
+    }
+
     // -----------------------------------------------------------------
     // Mapper::createFileMapper()
     // -----------------------------------------------------------------
@@ -0,0 +1,62 @@
+/*
+    MANGO Multimedia Development Platform
+    Copyright (C) 2012-2019 Twilight Finland 3D Oy Ltd. All rights reserved.
+*/
+#include <mango/core/string.hpp>
+#include "../walker.hpp"
+
+namespace mango {
+namespace filesystem {
+
+    void scanDirectory(WalkContext& context, const std::string& relative)
+    {
+        std::wstring filespec = u16_fromBytes(context.root + relative + "*");
+
+        // the find data has the attributes and sizes so the files are never stat'd
+        WIN32_FIND_DATAW data;
+        HANDLE handle = ::FindFirstFileExW(filespec.c_str(), FindExInfoBasic, &data,
+            FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+        if (handle == INVALID_HANDLE_VALUE)
+        {
+            // unreadable directories are skipped
+            return;
+        }
+
+        std::vector<FileInfo> batch;
+
+        do
+        {
+            const std::string name = u16_toBytes(data.cFileName);
+
+            // skip "." and ".."
+            if (name == "." || name == "..")
+            {
+                continue;
+            }
+
+            if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+            {
+                std::string pathname = relative + name + "/";
+
+                // junctions and symbolic links are reported but not followed
+                if ((data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) == 0 && !(context.flags & WALK_NO_RECURSE))
+                {
+                    context.enqueue(pathname);
+                }
+
+                batch.emplace_back(pathname, 0, FileInfo::DIRECTORY);
+            }
+            else if (context.filter.match(name.c_str()))
+            {
+                u64 size = (u64(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+                batch.emplace_back(relative + name, size, 0);
+            }
+        } while (::FindNextFileW(handle, &data));
+
+        ::FindClose(handle);
+
+        context.deliver(batch);
+    }
+
+} // namespace filesystem
+} // namespace mango
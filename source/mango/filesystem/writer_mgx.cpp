@@ -0,0 +1,568 @@
+/*
+    MANGO Multimedia Development Platform
+    Copyright (C) 2012-2019 Twilight Finland 3D Oy Ltd. All rights reserved.
+*/
+#include <set>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <random>
+#include <mango/core/core.hpp>
+#include <mango/filesystem/filesystem.hpp>
+#include <mango/image/fourcc.hpp>
+#include "mgx.hpp"
+
+#ifdef MANGO_ENABLE_ARCHIVE_MGX
+
+namespace
+{
+    using namespace mango;
+    using namespace mango::filesystem;
+
+    constexpr u64 mgx_page_size = 4096;
+
+    using Block = BlockMGX;
+
+    struct Segment
+    {
+        u32 block;
+        u32 offset;
+        u32 size;
+        u32 checksum; // crc32c of the segment; combined into file checksum
+    };
+
+    struct FileEntry
+    {
+        std::string filename;
+        u64 size;
+        std::vector<Segment> segments;
+    };
+
+} // namespace
+
+namespace mango {
+namespace filesystem {
+
+    // -----------------------------------------------------------------
+    // ContextMGX
+    // -----------------------------------------------------------------
+
+    struct ContextMGX
+    {
+        std::unique_ptr<FileStream> m_file;
+        Stream& m_stream;
+
+        Compressor m_compressor;
+        int m_level;
+        size_t m_block_size { 4 * 1024 * 1024 };
+        size_t m_max_pending;
+
+        ConcurrentQueue m_queue;
+        std::mutex m_mutex;
+
+        std::mutex m_pending_mutex;
+        std::condition_variable m_pending_condition;
+        size_t m_pending { 0 };
+        bool m_finished { false };
+
+        // first error from the compressor threads; reported by finish()
+        std::exception_ptr m_exception;
+
+        u32 m_features { MGX_FEATURE_CHECKSUM };
+        u8 m_salt[mgx_salt_size];
+        std::unique_ptr<CipherMGX> m_cipher;
+
+        // the deques keep references valid for the tasks while entries are added
+        std::deque<Block> m_blocks;
+        std::deque<FileEntry> m_files;
+        std::set<std::string> m_filenames;
+        std::set<std::string> m_folders;
+
+        // small files are collected into shared pack block
+        std::shared_ptr<Buffer> m_pack;
+        std::vector<Segment*> m_pack_segments;
+        u32 m_pack_block { 0 };
+
+        ContextMGX(FileStream* file, Stream& stream, Compressor::Method method, int level)
+            : m_file(file)
+            , m_stream(stream)
+            , m_compressor(getCompressor(method))
+            , m_level(level)
+            , m_queue("mgx.compressor")
+        {
+            // limit the amount of data in flight
+            m_max_pending = size_t(std::max(16, ThreadPool::getInstanceSize() * 4)) * m_block_size;
+
+            LittleEndianStream s = m_stream;
+            s.write32(u32_mask('m', 'g', 'x', '0'));
+        }
+
+        ~ContextMGX()
+        {
+        }
+
+        void addFolders(const std::string& filename)
+        {
+            for (size_t n = filename.find('/'); n != std::string::npos; n = filename.find('/', n + 1))
+            {
+                m_folders.insert(filename.substr(0, n + 1));
+            }
+        }
+
+        FileEntry& addEntry(const std::string& filename, u64 size)
+        {
+            if (m_finished)
+            {
+                MANGO_EXCEPTION("[WriterMGX] Container is already finished.");
+            }
+
+            if (filename.empty() || filename.back() == '/')
+            {
+                MANGO_EXCEPTION("[WriterMGX] Incorrect filename \"%s\".", filename.c_str());
+            }
+
+            if (!m_filenames.insert(filename).second)
+            {
+                MANGO_EXCEPTION("[WriterMGX] File \"%s\" already exists.", filename.c_str());
+            }
+
+            addFolders(filename);
+
+            m_files.push_back({ filename, size, std::vector<Segment>() });
+            return m_files.back();
+        }
+
+        u32 addBlock()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_blocks.push_back({ 0, 0, 0, 0, 0 });
+            return u32(m_blocks.size() - 1);
+        }
+
+        void throttle(size_t bytes)
+        {
+            // wait until enough of the queued blocks have been written
+            std::unique_lock<std::mutex> lock(m_pending_mutex);
+            m_pending_condition.wait(lock, [&] {
+                return !m_pending || m_pending + bytes <= m_max_pending;
+            });
+            m_pending += bytes;
+        }
+
+        void release(size_t bytes)
+        {
+            std::lock_guard<std::mutex> lock(m_pending_mutex);
+            m_pending -= bytes;
+            m_pending_condition.notify_all();
+        }
+
+        void writeBlock(u32 index, Memory source, Memory data, u32 method)
+        {
+            // checksum of the stored data
+            const u32 checksum = (m_features & MGX_FEATURE_CHECKSUM) ? crc32c(0, data) : 0;
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            if (!method && !m_cipher)
+            {
+                // stored blocks are page-aligned so that they can be mapped directly
+                static const u8 zeros[mgx_page_size] = { 0 };
+                const u64 padding = (0 - m_stream.offset()) & (mgx_page_size - 1);
+                m_stream.write(zeros, size_t(padding));
+            }
+
+            Block& block = m_blocks[index];
+            block.offset = m_stream.offset();
+            block.compressed = data.size;
+            block.uncompressed = source.size;
+            block.method = method;
+            block.checksum = checksum;
+
+            m_stream.write(data.address, data.size);
+        }
+
+        void encodeBlock(u32 index, Memory source, const std::vector<Segment*>& segments)
+        {
+            // file checksums are computed while the data is hot in the cache
+            for (Segment* segment : segments)
+            {
+                segment->checksum = crc32c(0, Memory(source.address + segment->offset, segment->size));
+            }
+
+            u32 method = m_compressor.method;
+
+            Buffer buffer;
+            Memory data = source;
+
+            if (method && source.size)
+            {
+                buffer.resize(m_compressor.bound(source.size));
+                size_t bytes = 0;
+
+                try
+                {
+                    bytes = m_compressor.compress(buffer, source, m_level);
+                }
+                catch (Exception&)
+                {
+                    // the data is stored uncompressed
+                    bytes = 0;
+                }
+
+                if (bytes > 0 && bytes < source.size)
+                {
+                    data = Memory(buffer.data(), bytes);
+                }
+                else
+                {
+                    method = 0;
+                }
+            }
+            else
+            {
+                method = 0;
+            }
+
+            if (m_cipher)
+            {
+                if (data.address == source.address)
+                {
+                    // the source is read-only
+                    buffer.resize(source.size);
+                    data = buffer;
+                }
+
+                m_cipher->process(data.address, method ? data.address : source.address, data.size, index);
+            }
+
+            writeBlock(index, source, data, method);
+        }
+
+        void compressBlock(u32 index, Memory source, const std::vector<Segment*>& segments)
+        {
+            try
+            {
+                encodeBlock(index, source, segments);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (!m_exception)
+                {
+                    m_exception = std::current_exception();
+                }
+            }
+
+            release(source.size);
+        }
+
+        void flushPack()
+        {
+            if (m_pack_segments.empty())
+            {
+                return;
+            }
+
+            std::shared_ptr<Buffer> pack = m_pack;
+            std::vector<Segment*> segments = m_pack_segments;
+            const u32 index = m_pack_block;
+
+            throttle(pack->size());
+
+            m_queue.enqueue([this, pack, segments, index] {
+                compressBlock(index, *pack, segments);
+            });
+
+            m_pack.reset();
+            m_pack_segments.clear();
+        }
+
+        void addSmallFile(FileEntry& entry, Memory memory)
+        {
+            if (m_pack && m_pack->size() + memory.size > m_block_size)
+            {
+                flushPack();
+            }
+
+            if (!m_pack)
+            {
+                m_pack = std::make_shared<Buffer>();
+                m_pack->reserve(m_block_size);
+                m_pack_block = addBlock();
+            }
+
+            entry.segments.push_back({ m_pack_block, u32(m_pack->size()), u32(memory.size), 0 });
+            m_pack_segments.push_back(&entry.segments.back());
+            m_pack->append(memory.address, memory.size);
+        }
+
+        void addLargeFile(FileEntry& entry, Memory memory, std::shared_ptr<File> file)
+        {
+            // reserve the segments first so that the tasks can keep pointers to them
+            const size_t count = (memory.size + m_block_size - 1) / m_block_size;
+            entry.segments.resize(count);
+
+            for (size_t i = 0; i < count; ++i)
+            {
+                const size_t offset = i * m_block_size;
+                const size_t size = std::min(m_block_size, memory.size - offset);
+                const u32 index = addBlock();
+
+                Segment* segment = &entry.segments[i];
+                *segment = { index, 0, u32(size), 0 };
+
+                throttle(size);
+
+                Memory source(memory.address + offset, size);
+
+                m_queue.enqueue([this, file, source, segment, index] {
+                    compressBlock(index, source, std::vector<Segment*>(1, segment));
+                });
+            }
+        }
+
+        void addFile(const std::string& filename, Memory memory, std::shared_ptr<File> file)
+        {
+            FileEntry& entry = addEntry(filename, memory.size);
+
+            // files smaller than half a block are packed with other small files
+            if (memory.size < m_block_size / 2)
+            {
+                addSmallFile(entry, memory);
+            }
+            else
+            {
+                addLargeFile(entry, memory, file);
+            }
+        }
+
+        u32 getChecksum(const FileEntry& entry) const
+        {
+            u32 checksum = 0;
+            for (const Segment& segment : entry.segments)
+            {
+                checksum = crc32c_combine(checksum, segment.checksum, segment.size);
+            }
+            return checksum;
+        }
+
+        void writeHeader(LittleEndianStream& s, const std::string& filename, u64 size, u32 checksum, const std::vector<Segment>& segments)
+        {
+            s.write32(u32(filename.length()));
+            s.write(filename.data(), filename.length());
+            s.write64(size);
+            s.write32(checksum);
+            s.write32(u32(segments.size()));
+
+            for (const Segment& segment : segments)
+            {
+                s.write32(segment.block);
+                s.write32(segment.offset);
+                s.write32(segment.size);
+            }
+        }
+
+        void finish()
+        {
+            if (m_finished)
+            {
+                return;
+            }
+
+            flushPack();
+            m_queue.wait();
+            m_finished = true;
+
+            if (m_exception)
+            {
+                // a block could not be written in the compressor thread
+                std::rethrow_exception(m_exception);
+            }
+
+            LittleEndianStream s = m_stream;
+
+            // block table
+            const u64 block_offset = s.offset();
+
+            s.write32(u32_mask('m', 'g', 'x', '1'));
+            s.write32(u32(m_blocks.size()));
+            s.write32(m_features);
+
+            if (m_cipher)
+            {
+                s.write(m_salt, mgx_salt_size);
+                s.write64(m_cipher->check());
+            }
+
+            for (const Block& block : m_blocks)
+            {
+                s.write64(block.offset);
+                s.write64(block.compressed);
+                s.write64(block.uncompressed);
+                s.write32(block.method);
+                s.write32(block.checksum);
+            }
+
+            s.write32(u32_mask('m', 'g', 'x', '2'));
+
+            // file table
+            const u64 file_offset = s.offset();
+
+            s.write32(u32_mask('m', 'g', 'x', '2'));
+            s.write32(u32(m_folders.size() + m_files.size()));
+
+            for (const std::string& folder : m_folders)
+            {
+                writeHeader(s, folder, 0, 0, std::vector<Segment>());
+            }
+
+            for (const FileEntry& entry : m_files)
+            {
+                writeHeader(s, entry.filename, entry.size, getChecksum(entry), entry.segments);
+            }
+
+            s.write32(u32_mask('m', 'g', 'x', '3'));
+
+            // header
+            s.write32(u32_mask('m', 'g', 'x', '3'));
+            s.write32(mgx_version);
+            s.write64(block_offset);
+            s.write64(file_offset);
+        }
+    };
+
+    // -----------------------------------------------------------------
+    // WriterMGX
+    // -----------------------------------------------------------------
+
+    WriterMGX::WriterMGX(const std::string& filename, Compressor::Method method, int level)
+    {
+        FileStream* file = new FileStream(filename, Stream::WRITE);
+        m_context.reset(new ContextMGX(file, *file, method, level));
+    }
+
+    WriterMGX::WriterMGX(Stream& stream, Compressor::Method method, int level)
+    {
+        m_context.reset(new ContextMGX(nullptr, stream, method, level));
+    }
+
+    WriterMGX::~WriterMGX()
+    {
+        try
+        {
+            m_context->finish();
+        }
+        catch (...)
+        {
+            // the destructor cannot report errors; see finish()
+        }
+    }
+
+    void WriterMGX::setBlockSize(size_t bytes)
+    {
+        if (!m_context->m_files.empty())
+        {
+            MANGO_EXCEPTION("[WriterMGX] Block size must be set before adding files.");
+        }
+
+        // the segment offsets and sizes are stored as 32 bit values
+        m_context->m_block_size = std::min(std::max(bytes, size_t(4096)), size_t(0x7fffffff));
+        m_context->m_max_pending = size_t(std::max(16, ThreadPool::getInstanceSize() * 4)) * m_context->m_block_size;
+    }
+
+    void WriterMGX::setChecksum(bool enable)
+    {
+        if (!m_context->m_files.empty())
+        {
+            MANGO_EXCEPTION("[WriterMGX] Checksum must be configured before adding files.");
+        }
+
+        if (enable)
+            m_context->m_features |= MGX_FEATURE_CHECKSUM;
+        else
+            m_context->m_features &= ~MGX_FEATURE_CHECKSUM;
+    }
+
+    void WriterMGX::setPassword(const std::string& password)
+    {
+        if (!m_context->m_files.empty())
+        {
+            MANGO_EXCEPTION("[WriterMGX] Password must be set before adding files.");
+        }
+
+        if (password.empty())
+        {
+            m_context->m_features &= ~MGX_FEATURE_ENCRYPTED;
+            m_context->m_cipher.reset();
+            return;
+        }
+
+        std::random_device random;
+        for (u32 i = 0; i < mgx_salt_size; ++i)
+        {
+            m_context->m_salt[i] = u8(random());
+        }
+
+        m_context->m_features |= MGX_FEATURE_ENCRYPTED;
+        m_context->m_cipher.reset(new CipherMGX(password, m_context->m_salt));
+    }
+
+    void WriterMGX::addFile(const std::string& filename, Memory memory)
+    {
+        m_context->addFile(filename, memory, nullptr);
+    }
+
+    void WriterMGX::addFile(const std::string& filename, const std::string& source)
+    {
+        std::shared_ptr<File> file = std::make_shared<File>(source);
+        m_context->addFile(filename, *file, file);
+    }
+
+    void WriterMGX::addDirectory(const std::string& pathname, const std::string& source)
+    {
+        std::string prefix = pathname;
+        if (!prefix.empty() && prefix.back() != '/')
+        {
+            prefix += '/';
+        }
+
+        std::string folder = source;
+        if (!folder.empty() && folder.back() != '/')
+        {
+            folder += '/';
+        }
+
+        if (!prefix.empty())
+        {
+            m_context->addFolders(prefix);
+        }
+
+        Path path(folder);
+
+        for (const FileInfo& info : path)
+        {
+            if (info.isDirectory())
+            {
+                // containers are stored as files
+                if (!info.isContainer())
+                {
+                    addDirectory(prefix + info.name, folder + info.name);
+                }
+            }
+            else
+            {
+                addFile(prefix + info.name, folder + info.name);
+            }
+        }
+    }
+
+    void WriterMGX::finish()
+    {
+        m_context->finish();
+    }
+
+} // namespace filesystem
+} // namespace mango
+
+#endif // MANGO_ENABLE_ARCHIVE_MGX
@@ -0,0 +1,753 @@
+/*
+    MANGO Multimedia Development Platform
+    Copyright (C) 2012-2019 Twilight Finland 3D Oy Ltd. All rights reserved.
+*/
+#include <set>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <ctime>
+#include <mango/core/core.hpp>
+#include <mango/filesystem/filesystem.hpp>
+#include <mango/math/math.hpp>
+
+#define MINIZ_NO_ZLIB_COMPATIBLE_NAMES
+#include "../../external/miniz/miniz.h"
+#include "../../external/lzma/7zCrc.h"
+#include "../../external/lzma/Alloc.h"
+#include "../../external/lzma/XzEnc.h"
+
+#ifdef MANGO_ENABLE_ARCHIVE_ZIP
+
+namespace
+{
+    using namespace mango;
+    using namespace mango::filesystem;
+
+    constexpr u64 zip_page_size = 4096;
+    constexpr size_t zip_chunk_size = 1024 * 1024;
+    constexpr u64 zip_max32 = 0xffffffff;
+    constexpr u64 zip_max16 = 0xffff;
+
+    enum : u16
+    {
+        EXTRA_ZIP64 = 0x0001,
+        EXTRA_ALIGNMENT = 0xd935, // same as the Android zipalign uses
+    };
+
+    // -----------------------------------------------------------------
+    // compression
+    // -----------------------------------------------------------------
+
+    // Raw DEFLATE stream for one chunk; the chunks which are not last end with
+    // sync flush so that they can be concatenated into single stream.
+    void deflate_chunk(Buffer& buffer, Memory source, int level, bool last)
+    {
+        struct Output
+        {
+            static mz_bool put(const void* data, int length, void* user)
+            {
+                reinterpret_cast<Buffer*>(user)->append(data, size_t(length));
+                return MZ_TRUE;
+            }
+        };
+
+        std::unique_ptr<tdefl_compressor> compressor(new tdefl_compressor);
+
+        const mz_uint flags = tdefl_create_comp_flags_from_zip_params(clamp(level, 0, 10), -MZ_DEFAULT_WINDOW_BITS, MZ_DEFAULT_STRATEGY);
+        tdefl_init(compressor.get(), Output::put, &buffer, int(flags));
+
+        buffer.reserve(source.size / 2);
+
+        tdefl_status status = tdefl_compress_buffer(compressor.get(), source.address, source.size,
+            last ? TDEFL_FINISH : TDEFL_SYNC_FLUSH);
+
+        if (status != (last ? TDEFL_STATUS_DONE : TDEFL_STATUS_OKAY))
+        {
+            MANGO_EXCEPTION("[WriterZIP] DEFLATE compression failed.");
+        }
+    }
+
+#ifdef MANGO_ENABLE_LICENSE_BSD
+
+    // zstd frames can be concatenated so the chunks are compressed into separate frames
+    void zstd_chunk(Buffer& buffer, Memory source, int level)
+    {
+        buffer.resize(zstd::bound(source.size));
+        size_t bytes = zstd::compress(buffer, source, level);
+        buffer.resize(bytes);
+    }
+
+#endif
+
+    void xz_compress(Buffer& buffer, Memory source, int level)
+    {
+        struct InputStream : ISeqInStream
+        {
+            Memory memory;
+
+            InputStream(Memory memory)
+                : memory(memory)
+            {
+                Read = read;
+            }
+
+            static SRes read(const ISeqInStream* p, void* buf, size_t* size)
+            {
+                InputStream* stream = (InputStream*) p;
+                size_t bytes = std::min(*size, stream->memory.size);
+                std::memcpy(buf, stream->memory.address, bytes);
+                stream->memory.address += bytes;
+                stream->memory.size -= bytes;
+                *size = bytes;
+                return SZ_OK;
+            }
+        };
+
+        struct OutputStream : ISeqOutStream
+        {
+            Buffer& buffer;
+
+            OutputStream(Buffer& buffer)
+                : buffer(buffer)
+            {
+                Write = write;
+            }
+
+            static size_t write(const ISeqOutStream* p, const void* buf, size_t size)
+            {
+                OutputStream* stream = (OutputStream*) p;
+                stream->buffer.append(buf, size);
+                return size;
+            }
+        };
+
+        // the xz block headers have crc32 checksum
+        static const bool table = (CrcGenerateTable(), true);
+        MANGO_UNREFERENCED(table);
+
+        CXzProps props;
+        XzProps_Init(&props);
+        props.lzma2Props.lzmaProps.level = clamp(level, 0, 9);
+        props.reduceSize = source.size;
+
+        InputStream input(source);
+        OutputStream output(buffer);
+
+        buffer.reserve(source.size / 2);
+
+        SRes result = Xz_Encode(&output, &input, &props, nullptr);
+        if (result != SZ_OK)
+        {
+            MANGO_EXCEPTION("[WriterZIP] XZ compression failed (%d).", int(result));
+        }
+    }
+
+    // -----------------------------------------------------------------
+    // entries
+    // -----------------------------------------------------------------
+
+    struct FileEntry
+    {
+        std::string filename;
+        u16 method;
+        u32 crc;
+        u64 compressed;
+        u64 size;
+        u64 offset;
+    };
+
+    struct Chunk
+    {
+        Memory source;
+        Buffer buffer;
+        u32 crc;
+    };
+
+    struct Job
+    {
+        FileEntry* entry;
+        int level;
+        std::shared_ptr<File> file;
+        std::deque<Chunk> chunks;
+        std::atomic<size_t> remaining;
+        std::atomic<bool> failed { false };
+    };
+
+    u16 getVersionNeeded(u16 method, bool zip64)
+    {
+        u16 version = 10;
+        switch (method)
+        {
+            case WriterZIP::DEFLATE:
+                version = 20;
+                break;
+            case WriterZIP::ZSTD:
+            case WriterZIP::XZ:
+                version = 63;
+                break;
+        }
+        return zip64 ? std::max(version, u16(45)) : version;
+    }
+
+    u16 getFlags(const std::string& filename)
+    {
+        // bit 11: filename is encoded in UTF-8
+        for (char c : filename)
+        {
+            if (u8(c) >= 0x80)
+                return 0x0800;
+        }
+        return 0;
+    }
+
+} // namespace
+
+namespace mango {
+namespace filesystem {
+
+    // -----------------------------------------------------------------
+    // ContextZIP
+    // -----------------------------------------------------------------
+
+    struct ContextZIP
+    {
+        std::unique_ptr<FileStream> m_file;
+        Stream& m_stream;
+
+        u16 m_method;
+        int m_level;
+        size_t m_max_pending;
+
+        ConcurrentQueue m_queue;
+        std::mutex m_mutex;
+
+        std::mutex m_pending_mutex;
+        std::condition_variable m_pending_condition;
+        size_t m_pending { 0 };
+        bool m_finished { false };
+
+        // first error from the compressor threads; reported by finish()
+        std::exception_ptr m_exception;
+
+        u16 m_time;
+        u16 m_date;
+
+        // the deques keep references valid for the tasks while entries are added
+        std::deque<FileEntry> m_files;
+        std::set<std::string> m_filenames;
+        std::set<std::string> m_folders;
+
+        ContextZIP(FileStream* file, Stream& stream, WriterZIP::Method method, int level)
+            : m_file(file)
+            , m_stream(stream)
+            , m_queue("zip.compressor")
+        {
+            setMethod(method, level);
+
+            // limit the amount of data in flight; the compressed chunks of an entry are
+            // retained until the entry is written
+            m_max_pending = size_t(std::max(16, ThreadPool::getInstanceSize() * 4)) * zip_chunk_size * 4;
+
+            // all entries get the archive creation time in MS-DOS format
+            std::time_t now = std::time(nullptr);
+            std::tm* t = std::localtime(&now);
+            m_time = u16((t->tm_hour << 11) | (t->tm_min << 5) | (t->tm_sec >> 1));
+            m_date = u16((std::max(t->tm_year - 80, 0) << 9) | ((t->tm_mon + 1) << 5) | t->tm_mday);
+        }
+
+        ~ContextZIP()
+        {
+        }
+
+        void setMethod(WriterZIP::Method method, int level)
+        {
+            switch (method)
+            {
+                case WriterZIP::STORE:
+                case WriterZIP::DEFLATE:
+                case WriterZIP::XZ:
+                    break;
+
+                case WriterZIP::ZSTD:
+#ifndef MANGO_ENABLE_LICENSE_BSD
+                    MANGO_EXCEPTION("[WriterZIP] zstd compression is not enabled.");
+#endif
+                    break;
+
+                default:
+                    MANGO_EXCEPTION("[WriterZIP] Incorrect compression method (%d).", int(method));
+            }
+
+            m_method = u16(method);
+            m_level = level;
+        }
+
+        void addFolders(const std::string& filename)
+        {
+            for (size_t n = filename.find('/'); n != std::string::npos; n = filename.find('/', n + 1))
+            {
+                m_folders.insert(filename.substr(0, n + 1));
+            }
+        }
+
+        FileEntry& addEntry(const std::string& filename, u64 size)
+        {
+            if (m_finished)
+            {
+                MANGO_EXCEPTION("[WriterZIP] Archive is already finished.");
+            }
+
+            if (filename.empty() || filename.back() == '/' || filename.length() > zip_max16)
+            {
+                MANGO_EXCEPTION("[WriterZIP] Incorrect filename \"%s\".", filename.c_str());
+            }
+
+            if (!m_filenames.insert(filename).second)
+            {
+                MANGO_EXCEPTION("[WriterZIP] File \"%s\" already exists.", filename.c_str());
+            }
+
+            addFolders(filename);
+
+            m_files.push_back({ filename, m_method, 0, 0, size, 0 });
+            return m_files.back();
+        }
+
+        void throttle(size_t bytes)
+        {
+            // wait until enough of the queued entries have been written; the
+            // queue keeps running so the compressor threads do not go idle
+            std::unique_lock<std::mutex> lock(m_pending_mutex);
+            m_pending_condition.wait(lock, [&] {
+                return !m_pending || m_pending + bytes <= m_max_pending;
+            });
+            m_pending += bytes;
+        }
+
+        void release(size_t bytes)
+        {
+            std::lock_guard<std::mutex> lock(m_pending_mutex);
+            m_pending -= bytes;
+            m_pending_condition.notify_all();
+        }
+
+        void writeLocalHeader(const FileEntry& entry)
+        {
+            const bool zip64 = entry.size >= zip_max32 || entry.compressed >= zip_max32;
+
+            u64 offset = m_stream.offset();
+            u64 extra = zip64 ? 20 : 0;
+            u64 padding = 0;
+
+            if (entry.method == WriterZIP::STORE && entry.size >= zip_page_size)
+            {
+                // stored data is page-aligned so that it can be mapped directly; the padding
+                // is an extra field with 16 bit alignment followed by zeros. Files smaller
+                // than a page are not aligned as the padding would dominate the archive size.
+                padding = (0 - (offset + 30 + entry.filename.length() + extra)) & (zip_page_size - 1);
+                if (padding && padding < 6)
+                {
+                    padding += zip_page_size;
+                }
+            }
+
+            LittleEndianStream s = m_stream;
+
+            s.write32(0x04034b50);
+            s.write16(getVersionNeeded(entry.method, zip64));
+            s.write16(getFlags(entry.filename));
+            s.write16(entry.method);
+            s.write16(m_time);
+            s.write16(m_date);
+            s.write32(entry.crc);
+            s.write32(u32(zip64 ? zip_max32 : entry.compressed));
+            s.write32(u32(zip64 ? zip_max32 : entry.size));
+            s.write16(u16(entry.filename.length()));
+            s.write16(u16(extra + padding));
+            s.write(entry.filename.data(), entry.filename.length());
+
+            if (zip64)
+            {
+                s.write16(EXTRA_ZIP64);
+                s.write16(16);
+                s.write64(entry.size);
+                s.write64(entry.compressed);
+            }
+
+            if (padding)
+            {
+                static const u8 zeros[zip_page_size + 6] = { 0 };
+                s.write16(EXTRA_ALIGNMENT);
+                s.write16(u16(padding - 4));
+                s.write16(u16(zip_page_size));
+                s.write(zeros, size_t(padding - 6));
+            }
+        }
+
+        void writeEntry(Job& job)
+        {
+            FileEntry& entry = *job.entry;
+
+            u32 crc = 0;
+            u64 compressed = 0;
+
+            for (const Chunk& chunk : job.chunks)
+            {
+                crc = crc32_combine(crc, chunk.crc, chunk.source.size);
+                compressed += chunk.buffer.size();
+            }
+
+            std::vector<Memory> buffers;
+
+            if (entry.method == WriterZIP::STORE || job.failed || compressed >= entry.size)
+            {
+                // the data did not compress; it is stored and the memory is written as-is
+                entry.method = WriterZIP::STORE;
+                compressed = entry.size;
+
+                for (const Chunk& chunk : job.chunks)
+                {
+                    buffers.push_back(chunk.source);
+                }
+            }
+            else
+            {
+                for (const Chunk& chunk : job.chunks)
+                {
+                    buffers.push_back(chunk.buffer);
+                }
+            }
+
+            entry.crc = crc;
+            entry.compressed = compressed;
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            entry.offset = m_stream.offset();
+            writeLocalHeader(entry);
+            m_stream.writev(buffers);
+        }
+
+        void compressChunk(Job& job, size_t index)
+        {
+            Chunk& chunk = job.chunks[index];
+            const bool last = index == job.chunks.size() - 1;
+
+            // checksum is computed while the data is hot in the cache
+            chunk.crc = crc32(0, chunk.source);
+
+            try
+            {
+                compress(job, chunk, index == 0, last);
+            }
+            catch (...)
+            {
+                // the file is stored uncompressed
+                job.failed = true;
+            }
+        }
+
+        void compress(Job& job, Chunk& chunk, bool first, bool last)
+        {
+            switch (job.entry->method)
+            {
+                case WriterZIP::DEFLATE:
+                    deflate_chunk(chunk.buffer, chunk.source, job.level, last);
+                    break;
+
+#ifdef MANGO_ENABLE_LICENSE_BSD
+                case WriterZIP::ZSTD:
+                    zstd_chunk(chunk.buffer, chunk.source, job.level);
+                    break;
+#endif
+
+                case WriterZIP::XZ:
+                    // the whole file is compressed into one xz stream; only the
+                    // checksums are computed in chunks
+                    if (first)
+                    {
+                        xz_compress(chunk.buffer, Memory(chunk.source.address, size_t(job.entry->size)), job.level);
+                    }
+                    break;
+
+                default:
+                    break;
+            }
+        }
+
+        void addFile(const std::string& filename, Memory memory, std::shared_ptr<File> file)
+        {
+            FileEntry& entry = addEntry(filename, memory.size);
+
+            std::shared_ptr<Job> job = std::make_shared<Job>();
+            job->entry = &entry;
+            job->level = m_level;
+            job->file = file;
+
+            if (!memory.size)
+            {
+                entry.method = WriterZIP::STORE;
+                writeEntry(*job);
+                return;
+            }
+
+            const size_t count = (memory.size + zip_chunk_size - 1) / zip_chunk_size;
+            job->chunks.resize(count);
+            job->remaining = count;
+
+            for (size_t i = 0; i < count; ++i)
+            {
+                const size_t offset = i * zip_chunk_size;
+                const size_t size = std::min(zip_chunk_size, memory.size - offset);
+                job->chunks[i].source = Memory(memory.address + offset, size);
+            }
+
+            throttle(memory.size);
+
+            for (size_t i = 0; i < count; ++i)
+            {
+                m_queue.enqueue([this, job, i] {
+                    compressChunk(*job, i);
+
+                    // the last completed chunk writes the entry
+                    if (--job->remaining == 0)
+                    {
+                        try
+                        {
+                            writeEntry(*job);
+                        }
+                        catch (...)
+                        {
+                            std::lock_guard<std::mutex> lock(m_mutex);
+                            if (!m_exception)
+                            {
+                                m_exception = std::current_exception();
+                            }
+                        }
+
+                        release(size_t(job->entry->size));
+                    }
+                });
+            }
+        }
+
+        void writeCentralHeader(LittleEndianStream& s, const FileEntry& entry)
+        {
+            const bool zip64_size = entry.size >= zip_max32 || entry.compressed >= zip_max32;
+            const bool zip64_offset = entry.offset >= zip_max32;
+
+            // fields are present in the ZIP64 extra field only if they overflow
+            u16 extra = 0;
+            extra += zip64_size ? 16 : 0;
+            extra += zip64_offset ? 8 : 0;
+
+            s.write32(0x02014b50);
+            s.write16(63); // version made by: MS-DOS, 6.3
+            s.write16(getVersionNeeded(entry.method, extra > 0));
+            s.write16(getFlags(entry.filename));
+            s.write16(entry.method);
+            s.write16(m_time);
+            s.write16(m_date);
+            s.write32(entry.crc);
+            s.write32(u32(zip64_size ? zip_max32 : entry.compressed));
+            s.write32(u32(zip64_size ? zip_max32 : entry.size));
+            s.write16(u16(entry.filename.length()));
+            s.write16(extra ? extra + 4 : 0);
+            s.write16(0); // comment
+            s.write16(0); // disk start
+            s.write16(0); // internal attributes
+            s.write32(entry.filename.back() == '/' ? 0x10 : 0); // external attributes: MS-DOS directory
+            s.write32(u32(zip64_offset ? zip_max32 : entry.offset));
+            s.write(entry.filename.data(), entry.filename.length());
+
+            if (extra)
+            {
+                s.write16(EXTRA_ZIP64);
+                s.write16(extra);
+
+                if (zip64_size)
+                {
+                    s.write64(entry.size);
+                    s.write64(entry.compressed);
+                }
+
+                if (zip64_offset)
+                {
+                    s.write64(entry.offset);
+                }
+            }
+        }
+
+        void finish()
+        {
+            if (m_finished)
+            {
+                return;
+            }
+
+            m_queue.wait();
+            m_finished = true;
+
+            if (m_exception)
+            {
+                // an entry could not be written in the compressor thread
+                std::rethrow_exception(m_exception);
+            }
+
+            // folders are written as empty entries
+            std::vector<FileEntry> folders;
+
+            for (const std::string& folder : m_folders)
+            {
+                FileEntry entry = { folder, WriterZIP::STORE, 0, 0, 0, m_stream.offset() };
+                writeLocalHeader(entry);
+                folders.push_back(entry);
+            }
+
+            LittleEndianStream s = m_stream;
+
+            // central directory
+            const u64 directory_offset = s.offset();
+
+            for (const FileEntry& entry : folders)
+            {
+                writeCentralHeader(s, entry);
+            }
+
+            for (const FileEntry& entry : m_files)
+            {
+                writeCentralHeader(s, entry);
+            }
+
+            const u64 directory_size = s.offset() - directory_offset;
+            const u64 count = folders.size() + m_files.size();
+
+            const bool zip64 = count >= zip_max16 || directory_size >= zip_max32 || directory_offset >= zip_max32;
+
+            if (zip64)
+            {
+                // ZIP64 end of central directory record
+                const u64 record_offset = s.offset();
+
+                s.write32(0x06064b50);
+                s.write64(44); // size of the remaining record
+                s.write16(45); // version made by
+                s.write16(45); // version needed
+                s.write32(0); // this disk
+                s.write32(0); // disk where central directory starts
+                s.write64(count);
+                s.write64(count);
+                s.write64(directory_size);
+                s.write64(directory_offset);
+
+                // ZIP64 end of central directory locator
+                s.write32(0x07064b50);
+                s.write32(0); // disk where the record is
+                s.write64(record_offset);
+                s.write32(1); // number of disks
+            }
+
+            // end of central directory record
+            s.write32(0x06054b50);
+            s.write16(0); // this disk
+            s.write16(0); // disk where central directory starts
+            s.write16(u16(zip64 ? zip_max16 : count));
+            s.write16(u16(zip64 ? zip_max16 : count));
+            s.write32(u32(zip64 ? zip_max32 : directory_size));
+            s.write32(u32(zip64 ? zip_max32 : directory_offset));
+            s.write16(0); // comment
+        }
+    };
+
+    // -----------------------------------------------------------------
+    // WriterZIP
+    // -----------------------------------------------------------------
+
+    WriterZIP::WriterZIP(const std::string& filename, Method method, int level)
+    {
+        FileStream* file = new FileStream(filename, Stream::WRITE);
+        m_context.reset(new ContextZIP(file, *file, method, level));
+    }
+
+    WriterZIP::WriterZIP(Stream& stream, Method method, int level)
+    {
+        m_context.reset(new ContextZIP(nullptr, stream, method, level));
+    }
+
+    WriterZIP::~WriterZIP()
+    {
+        try
+        {
+            m_context->finish();
+        }
+        catch (...)
+        {
+            // the destructor cannot report errors; see finish()
+        }
+    }
+
+    void WriterZIP::setMethod(Method method, int level)
+    {
+        m_context->setMethod(method, level);
+    }
+
+    void WriterZIP::addFile(const std::string& filename, Memory memory)
+    {
+        m_context->addFile(filename, memory, nullptr);
+    }
+
+    void WriterZIP::addFile(const std::string& filename, const std::string& source)
+    {
+        std::shared_ptr<File> file = std::make_shared<File>(source);
+        m_context->addFile(filename, *file, file);
+    }
+
+    void WriterZIP::addDirectory(const std::string& pathname, const std::string& source)
+    {
+        std::string prefix = pathname;
+        if (!prefix.empty() && prefix.back() != '/')
+        {
+            prefix += '/';
+        }
+
+        std::string folder = source;
+        if (!folder.empty() && folder.back() != '/')
+        {
+            folder += '/';
+        }
+
+        if (!prefix.empty())
+        {
+            m_context->addFolders(prefix);
+        }
+
+        Path path(folder);
+
+        for (const FileInfo& info : path)
+        {
+            if (info.isDirectory())
+            {
+                // containers are stored as files
+                if (!info.isContainer())
+                {
+                    addDirectory(prefix + info.name, folder + info.name);
+                }
+            }
+            else
+            {
+                addFile(prefix + info.name, folder + info.name);
+            }
+        }
+    }
+
+    void WriterZIP::finish()
+    {
+        m_context->finish();
+    }
+
+} // namespace filesystem
+} // namespace mango
+
+#endif // MANGO_ENABLE_ARCHIVE_ZIP
@@ -4,6 +4,7 @@
 */
 #include <map>
 #include <mango/core/string.hpp>
+#include <mango/core/buffer.hpp>
 #include <mango/core/timer.hpp>
 #include <mango/image/image.hpp>
 
@@ -237,6 +238,18 @@ namespace mango
         }
     }
 
+    ImageDecoder::ImageDecoder(Stream& stream, const std::string& filename)
+    {
+        ImageDecoder::CreateDecoderFunc create_decoder_func = g_imageServer.getImageDecoder(filename);
+        if (create_decoder_func)
+        {
+            // the decoder references the memory; m_view is declared first so it outlives the interface
+            m_view.reset(new StreamView(stream));
+            ImageDecoderInterface* x = create_decoder_func(*m_view);
+            m_interface.reset(x);
+        }
+    }
+
     ImageDecoder::~ImageDecoder()
     {
     }
@@ -272,6 +285,7 @@ namespace mango
         }
         else
         {
+            ScopedTimer timer(options.histogram);
             status = m_interface->decode(dest, options.palette, level, depth, face);
         }
 
@@ -330,6 +344,7 @@ namespace mango
         }
         else
         {
+            ScopedTimer timer(options.histogram);
             status = m_encode_func(output, source, options);
         }
 
@@ -1876,17 +1876,25 @@ namespace
 
     void writeChunk(Stream& stream, u32 chunkid, Memory memory)
     {
-        BigEndianStream s(stream);
+        u8 header[8];
+        ustore32be(header + 0, u32(memory.size));
+        ustore32be(header + 4, chunkid);
 
-        u8 temp[4];
-        ustore32be(temp, chunkid);
-        u32 crc = crc32(0, Memory(temp, 4));
+        u32 crc = crc32(0, Memory(header + 4, 4));
         crc = crc32(crc, memory);
 
-        s.write32(u32(memory.size));
-        s.write32(chunkid);
-        s.write(memory);
-        s.write32(crc);
+        u8 footer[4];
+        ustore32be(footer, crc);
+
+        // write the chunk without concatenating the payload
+        const Memory buffers[] =
+        {
+            Memory(header, 8),
+            memory,
+            Memory(footer, 4)
+        };
+
+        stream.writev(buffers, 3);
     }
 
     void write_IHDR(Stream& stream, const Surface& surface, u8 color_bits, ColorType color_type)
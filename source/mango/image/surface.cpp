@@ -9,6 +9,7 @@
 #include <mango/core/string.hpp>
 #include <mango/core/bits.hpp>
 #include <mango/core/half.hpp>
+#include <mango/core/buffer.hpp>
 #include <mango/simd/simd.hpp>
 #include <mango/image/image.hpp>
 
@@ -201,7 +202,10 @@ namespace
 
     Surface load_surface(const std::string& filename, const Format* format)
     {
-        filesystem::File file(filename);
+        // the decoders consume the input from start to end; read it ahead instead of
+        // faulting in one page at a time
+        filesystem::File file(filename, filesystem::File::SEQUENTIAL);
+        file.advise(MemoryAccess::WILLNEED);
         Surface surface = load_surface(file, filesystem::getExtension(filename), format);
         return surface;
     }
@@ -241,11 +245,26 @@ namespace
 
     Surface load_palette_surface(const std::string& filename, Palette& palette)
     {
-        filesystem::File file(filename);
+        filesystem::File file(filename, filesystem::File::SEQUENTIAL);
+        file.advise(MemoryAccess::WILLNEED);
         Surface surface = load_palette_surface(file, filesystem::getExtension(filename), palette);
         return surface;
     }
 
+    Surface load_surface(Stream& stream, const std::string& extension, const Format* format)
+    {
+        StreamView view(stream);
+        Surface surface = load_surface(view, extension, format);
+        return surface;
+    }
+
+    Surface load_palette_surface(Stream& stream, const std::string& extension, Palette& palette)
+    {
+        StreamView view(stream);
+        Surface surface = load_palette_surface(view, extension, palette);
+        return surface;
+    }
+
 } // namespace
 
 namespace mango
@@ -298,11 +317,22 @@ namespace mango
         ImageEncoder encoder(filename);
         if (encoder.isEncoder())
         {
+            // the output can be a pipe or a device; mapped output is written with
+            // save(Stream&) and a MappedFileStream
             filesystem::FileStream file(filename, Stream::WRITE);
             encoder.encode(file, *this, options);
         }
     }
 
+    void Surface::save(Stream& stream, const std::string& extension, const ImageEncodeOptions& options) const
+    {
+        ImageEncoder encoder(extension);
+        if (encoder.isEncoder())
+        {
+            encoder.encode(stream, *this, options);
+        }
+    }
+
     void Surface::clear(float red, float green, float blue, float alpha) const
     {
         switch (format.type)
@@ -567,6 +597,21 @@ namespace mango
     {
     }
 
+    Bitmap::Bitmap(Stream& stream, const std::string& extension)
+        : Surface(load_surface(stream, extension, nullptr))
+    {
+    }
+
+    Bitmap::Bitmap(Stream& stream, const std::string& extension, const Format& format)
+        : Surface(load_surface(stream, extension, &format))
+    {
+    }
+
+    Bitmap::Bitmap(Stream& stream, const std::string& extension, Palette& palette)
+        : Surface(load_palette_surface(stream, extension, palette))
+    {
+    }
+
     Bitmap::Bitmap(Bitmap&& bitmap)
         : Surface(bitmap)
     {
@@ -1958,6 +1958,10 @@ namespace
                 ptr = huffman.flush(ptr);
                 buffer.append(huff_temp, ptr - huff_temp);
 
+                // append restart marker so that the buffers can be written as-is
+                const u8 marker[] = { 0xff, u8(0xd0 + (y & 7)) };
+                buffer.append(marker, 2);
+
                 // mark buffer ready for writing
                 buffer.ready = true;
             });
@@ -1970,6 +1974,11 @@ namespace
         // writing marker data
         jp.write_markers(s, sample, surface.width, surface.height);
 
+        // EOI marker
+        static const u8 eoi_marker[] = { 0xff, 0xd9 };
+
+        std::vector<Memory> bitstream;
+
         for (int y = 0; y < jp.vertical_mcus; ++y)
         {
             EncodeBuffer& buffer = buffers[y];
@@ -1980,16 +1989,14 @@ namespace
                 queue.steal();
             }
 
-            // write huffman bitstream
-            s.write(buffer, size_t(buffer.size()));
-
-            // write restart marker
-            int index = y & 7;
-            s.write16(0xffd0 + index);
+            // huffman bitstream + restart marker
+            bitstream.push_back(buffer);
         }
 
-        // EOI marker
-        s.write16(0xffd9);
+        bitstream.emplace_back(eoi_marker, 2);
+
+        // write the buffers without concatenating them
+        s.writev(bitstream);
 
         status.info = jp.info;
     }